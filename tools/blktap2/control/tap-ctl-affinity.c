@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "tap-ctl.h"
+
+int
+tap_ctl_node_cpus(const int node, char *cpus, size_t size)
+{
+	int err;
+	FILE *f;
+	char path[64];
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/node/node%d/cpulist", node);
+
+	f = fopen(path, "r");
+	if (!f) {
+		err = errno;
+		EPRINTF("failed to open %s: %d\n", path, err);
+		return err;
+	}
+
+	err = 0;
+	if (!fgets(cpus, size, f))
+		err = EIO;
+	else
+		cpus[strcspn(cpus, "\n")] = '\0';
+
+	fclose(f);
+	return err;
+}
+
+int
+tap_ctl_affinity(const int id, const char *cpus)
+{
+	int err;
+	tapdisk_message_t message;
+
+	if (strnlen(cpus, TAPDISK_MESSAGE_STRING_LENGTH) >=
+	    TAPDISK_MESSAGE_STRING_LENGTH)
+		return ENAMETOOLONG;
+
+	memset(&message, 0, sizeof(message));
+	message.type = TAPDISK_MESSAGE_AFFINITY;
+	strcpy(message.u.string.text, cpus);
+
+	err = tap_ctl_connect_send_and_receive(id, &message, 5);
+	if (err)
+		return err;
+
+	if (message.type == TAPDISK_MESSAGE_AFFINITY_RSP)
+		err = message.u.response.error;
+	else {
+		err = EINVAL;
+		EPRINTF("got unexpected result '%s' from %d\n",
+			tapdisk_message_name(message.type), id);
+	}
+
+	return err;
+}
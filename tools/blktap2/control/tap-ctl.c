@@ -582,6 +582,147 @@ usage:
 	return EINVAL;
 }
 
+static void
+tap_cli_affinity_usage(FILE *stream)
+{
+	fprintf(stream, "usage: affinity <-p pid> <-c cpus | -n node>\n");
+}
+
+static int
+tap_cli_affinity(int argc, char **argv)
+{
+	const char *cpus;
+	char node_cpus[TAPDISK_MESSAGE_STRING_LENGTH];
+	int c, pid, node, err;
+
+	pid  = -1;
+	node = -1;
+	cpus = NULL;
+
+	optind = 0;
+	while ((c = getopt(argc, argv, "p:c:n:h")) != -1) {
+		switch (c) {
+		case 'p':
+			pid = atoi(optarg);
+			break;
+		case 'c':
+			cpus = optarg;
+			break;
+		case 'n':
+			node = atoi(optarg);
+			break;
+		case '?':
+			goto usage;
+		case 'h':
+			tap_cli_affinity_usage(stdout);
+			return 0;
+		}
+	}
+
+	if (pid == -1 || (cpus && node != -1) || (!cpus && node == -1))
+		goto usage;
+
+	if (node != -1) {
+		err = tap_ctl_node_cpus(node, node_cpus, sizeof(node_cpus));
+		if (err)
+			return err;
+		cpus = node_cpus;
+	}
+
+	return tap_ctl_affinity(pid, cpus);
+
+usage:
+	tap_cli_affinity_usage(stderr);
+	return EINVAL;
+}
+
+static void
+tap_cli_stats_usage(FILE *stream)
+{
+	fprintf(stream, "usage: stats <-p pid> <-m minor> [-i interval]\n");
+}
+
+static int
+tap_cli_stats(int argc, char **argv)
+{
+	tapdisk_message_stats_t prev, stats;
+	int c, i, pid, minor, interval, err;
+
+	pid      = -1;
+	minor    = -1;
+	interval = 0;
+
+	optind = 0;
+	while ((c = getopt(argc, argv, "p:m:i:h")) != -1) {
+		switch (c) {
+		case 'p':
+			pid = atoi(optarg);
+			break;
+		case 'm':
+			minor = atoi(optarg);
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case '?':
+			goto usage;
+		case 'h':
+			tap_cli_stats_usage(stdout);
+			return 0;
+		}
+	}
+
+	if (pid == -1 || minor == -1 || interval < 0)
+		goto usage;
+
+	err = tap_ctl_stats(pid, minor, &stats);
+	if (err)
+		return err;
+
+	if (interval) {
+		prev = stats;
+		sleep(interval);
+
+		err = tap_ctl_stats(pid, minor, &stats);
+		if (err)
+			return err;
+
+		stats.requests -= prev.requests;
+		stats.sectors  -= prev.sectors;
+		stats.errors   -= prev.errors;
+		stats.cache_hits      -= prev.cache_hits;
+		stats.cache_misses    -= prev.cache_misses;
+		stats.cache_evictions -= prev.cache_evictions;
+		stats.cache_readahead -= prev.cache_readahead;
+		for (i = 0; i < TAPDISK_MESSAGE_LATENCY_BUCKETS; i++)
+			stats.latency[i] -= prev.latency[i];
+
+		printf("iops=%"PRIu64" kbps=%"PRIu64" ",
+		       stats.requests / interval,
+		       stats.sectors / 2 / interval);
+	}
+
+	printf("requests=%"PRIu64" sectors=%"PRIu64" errors=%"PRIu64"\n",
+	       stats.requests, stats.sectors, stats.errors);
+
+	if (stats.cache_hits || stats.cache_misses)
+		printf("cache: hits=%"PRIu64" misses=%"PRIu64" "
+		       "evictions=%"PRIu64" readahead=%"PRIu64"\n",
+		       stats.cache_hits, stats.cache_misses,
+		       stats.cache_evictions, stats.cache_readahead);
+
+	for (i = 0; i < TAPDISK_MESSAGE_LATENCY_BUCKETS; i++)
+		if (stats.latency[i])
+			printf("%10lluus %u\n",
+			       i ? 1ULL << (i - 1) : 0ULL, stats.latency[i]);
+
+	return 0;
+
+usage:
+	tap_cli_stats_usage(stderr);
+	return EINVAL;
+}
+
 static void
 tap_cli_major_usage(FILE *stream)
 {
@@ -715,6 +856,8 @@ struct command commands[] = {
 	{ .name = "close",        .func = tap_cli_close         },
 	{ .name = "pause",        .func = tap_cli_pause         },
 	{ .name = "unpause",      .func = tap_cli_unpause       },
+	{ .name = "affinity",     .func = tap_cli_affinity      },
+	{ .name = "stats",        .func = tap_cli_stats         },
 	{ .name = "major",        .func = tap_cli_major         },
 	{ .name = "check",        .func = tap_cli_check         },
 };
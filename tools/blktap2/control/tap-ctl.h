@@ -96,6 +96,11 @@ int tap_ctl_close(const int id, const int minor, const int force);
 int tap_ctl_pause(const int id, const int minor);
 int tap_ctl_unpause(const int id, const int minor, const char *params);
 
+int tap_ctl_node_cpus(const int node, char *cpus, size_t size);
+int tap_ctl_affinity(const int id, const char *cpus);
+int tap_ctl_stats(const int id, const int minor,
+		  tapdisk_message_stats_t *stats);
+
 int tap_ctl_blk_major(void);
 
 #endif
@@ -31,6 +31,7 @@
 #include <stdlib.h>
 #include <sys/mman.h>
 
+#include "list.h"
 #include "tapdisk.h"
 #include "tapdisk-utils.h"
 #include "tapdisk-driver.h"
@@ -54,10 +55,17 @@
 
 #define BLOCK_CACHE_NODES_PER_PAGE      (1 << (RADIX_TREE_PAGE_SHIFT - RADIX_TREE_NODE_SHIFT))
 
-#define BLOCK_CACHE_MAX_SIZE            (10 << 20) /* 100MB cache */
+#define BLOCK_CACHE_MAX_SIZE            (100 << 20) /* 100MB cache */
 #define BLOCK_CACHE_REQUESTS            (TAPDISK_DATA_REQUESTS << 3)
 #define BLOCK_CACHE_PAGE_IDLETIME       60
 
+/*
+ * a miss that continues a run of BLOCK_CACHE_READAHEAD_TRIGGER sequential
+ * reads is extended by BLOCK_CACHE_READAHEAD_SECS sectors.
+ */
+#define BLOCK_CACHE_READAHEAD_TRIGGER   2
+#define BLOCK_CACHE_READAHEAD_SECS      256
+
 typedef struct radix_tree               radix_tree_t;
 typedef struct radix_tree_node          radix_tree_node_t;
 typedef struct radix_tree_link          radix_tree_link_t;
@@ -73,6 +81,9 @@ struct radix_tree_page {
 	size_t                          size;
 	uint64_t                        sec;
 	radix_tree_link_t              *owners[BLOCK_CACHE_NODES_PER_PAGE];
+
+	int                             referenced;
+	struct list_head                clock;
 };
 
 struct radix_tree_leaf {
@@ -99,6 +110,10 @@ struct radix_tree {
 	uint32_t                        nodes;
 	radix_tree_node_t              *root;
 
+	/* pages in CLOCK order; the hand is the head of the list */
+	struct list_head                pages;
+	uint64_t                        evicted;
+
 	block_cache_t                  *cache;
 };
 
@@ -106,6 +121,7 @@ struct block_cache_request {
 	int                             err;
 	char                           *buf;
 	uint64_t                        secs;
+	uint64_t                        ra_secs;
 	td_request_t                    treq;
 	block_cache_t                  *cache;
 };
@@ -115,6 +131,8 @@ struct block_cache_stats {
 	uint64_t                        hits;
 	uint64_t                        misses;
 	uint64_t                        prunes;
+	uint64_t                        evictions;
+	uint64_t                        readahead;
 };
 
 struct block_cache {
@@ -122,6 +140,11 @@ struct block_cache {
 	char                           *name;
 
 	uint64_t                        sectors;
+	uint64_t                        max_size;
+
+	/* sequential stream detection */
+	uint64_t                        seq_next;
+	int                             seq_count;
 
 	block_cache_request_t           requests[BLOCK_CACHE_REQUESTS];
 	block_cache_request_t          *request_free_list[BLOCK_CACHE_REQUESTS];
@@ -233,6 +256,8 @@ radix_tree_allocate_page(radix_tree_t *tree,
 	page->size  = size;
 	tree->size += size;
 
+	list_add_tail(&page->clock, &tree->pages);
+
 	return page;
 }
 
@@ -247,6 +272,7 @@ radix_tree_free_page(radix_tree_t *tree, radix_tree_page_t *page)
 
 	tree->cache->stats.prunes += (page->size >> RADIX_TREE_NODE_SHIFT);
 	tree->size -= page->size;
+	list_del(&page->clock);
 	free(page->buf);
 	free(page);
 }
@@ -306,8 +332,11 @@ radix_tree_find_leaf(radix_tree_t *tree, uint64_t sector)
 		link       = node->links + idx;
 		link->time = now.tv_sec;
 
-		if (radix_tree_node_contains_leaves(tree, node))
+		if (radix_tree_node_contains_leaves(tree, node)) {
+			if (link->u.leaf.page)
+				link->u.leaf.page->referenced = 1;
 			return link->u.leaf.buf;
+		}
 
 		if (!link->u.next)
 			return NULL;
@@ -375,6 +404,89 @@ fail:
 	return -ENOMEM;
 }
 
+/*
+ * returns 1 if @node no longer holds any pages; empty nodes below it
+ * are freed.
+ */
+static int
+radix_tree_reap_branch(radix_tree_t *tree, radix_tree_node_t *node)
+{
+	int i, empty;
+	radix_tree_link_t *link;
+
+	empty = 1;
+
+	for (i = 0; i < RADIX_TREE_NODE_SIZE; i++) {
+		link = node->links + i;
+
+		if (radix_tree_node_contains_leaves(tree, node)) {
+			if (link->u.leaf.page)
+				empty = 0;
+			continue;
+		}
+
+		if (!link->u.next)
+			continue;
+
+		if (radix_tree_reap_branch(tree, link->u.next))
+			radix_tree_clear_link(link);
+		else
+			empty = 0;
+	}
+
+	if (empty && !radix_tree_node_is_root(tree, node))
+		radix_tree_free_node(tree, node);
+
+	return empty;
+}
+
+/*
+ * CLOCK: sweep the hand over the pages, giving referenced pages a second
+ * chance, until @size more bytes of data, and the nodes to hold them,
+ * fit under the cache limit.  Eviction leaves empty nodes behind; once
+ * they take up half the cache and enough pages have gone since the last
+ * pass, reap them here rather than wait for the idle prune.
+ * returns 0 if enough space was freed.
+ */
+static int
+radix_tree_evict(radix_tree_t *tree, uint64_t size)
+{
+	block_cache_t *cache = tree->cache;
+	radix_tree_page_t *page;
+	uint64_t scanned, pages;
+
+	if (tree->nodes * sizeof(radix_tree_node_t) > cache->max_size >> 1 &&
+	    tree->evicted > tree->nodes) {
+		radix_tree_reap_branch(tree, tree->root);
+		tree->evicted = 0;
+	}
+
+	/* inserting the leaves may take a new node at every level */
+	size   += tree->height * sizeof(radix_tree_node_t);
+	scanned = 0;
+	pages   = tree->size >> RADIX_TREE_NODE_SHIFT;
+
+	while (radix_tree_size(tree) + size >= cache->max_size) {
+		if (list_empty(&tree->pages) || scanned++ > pages << 1)
+			return -ENOSPC;
+
+		page = list_entry(tree->pages.next, radix_tree_page_t, clock);
+
+		if (page->referenced) {
+			page->referenced = 0;
+			list_del(&page->clock);
+			list_add_tail(&page->clock, &tree->pages);
+			continue;
+		}
+
+		cache->stats.evictions += page->size >> RADIX_TREE_NODE_SHIFT;
+		radix_tree_remove_page(tree, page);
+		tree->evicted++;
+	}
+
+	return 0;
+}
+
 static void
 radix_tree_delete_branch(radix_tree_t *tree, radix_tree_node_t *node)
 {
@@ -474,6 +586,7 @@ radix_tree_prune(radix_tree_t *tree)
 static inline int
 radix_tree_initialize(radix_tree_t *tree, uint64_t sectors)
 {
+	INIT_LIST_HEAD(&tree->pages);
 	tree->height = radix_tree_calculate_height(sectors);
 	tree->root   = radix_tree_allocate_node(tree, tree->height);
 	if (!tree->root)
@@ -516,6 +629,29 @@ block_cache_put_request(block_cache_t *cache, block_cache_request_t *breq)
 	cache->request_free_list[cache->requests_free++] = breq;
 }
 
+/*
+ * TAPDISK2_CACHE_SIZE (in MB) overrides the default cache size.
+ */
+static uint64_t
+block_cache_max_size(void)
+{
+	const char *size;
+	unsigned long mb;
+	char *end;
+
+	size = getenv("TAPDISK2_CACHE_SIZE");
+	if (!size)
+		return BLOCK_CACHE_MAX_SIZE;
+
+	mb = strtoul(size, &end, 0);
+	if (end == size || *end || !mb) {
+		EPRINTF("invalid TAPDISK2_CACHE_SIZE '%s'\n", size);
+		return BLOCK_CACHE_MAX_SIZE;
+	}
+
+	return (uint64_t)mb << 20;
+}
+
 static int
 block_cache_open(td_driver_t *driver, const char *name, td_flag_t flags)
 {
@@ -534,7 +670,8 @@ block_cache_open(td_driver_t *driver, const char *name, td_flag_t flags)
 	if (err)
 		return -ENOMEM;
 
-	cache->sectors = driver->info.size;
+	cache->sectors  = driver->info.size;
+	cache->max_size = block_cache_max_size();
 
 	tree = &cache->tree;
 	err  = radix_tree_initialize(tree, cache->sectors);
@@ -555,8 +692,9 @@ block_cache_open(td_driver_t *driver, const char *name, td_flag_t flags)
 		goto fail;
 
 	DPRINTF("opening cache for %s, sectors: %"PRIu64", "
-		"tree: %p, height: %d\n",
-		cache->name, cache->sectors, tree, tree->height);
+		"tree: %p, height: %d, size: %"PRIu64"\n",
+		cache->name, cache->sectors, tree, tree->height,
+		cache->max_size);
 
 	if (mlockall(MCL_CURRENT | MCL_FUTURE))
 		DPRINTF("mlockall failed: %d\n", -errno);
@@ -624,10 +762,49 @@ block_cache_hit(block_cache_t *cache, td_request_t treq, char *iov[])
 	td_complete_request(treq, 0);
 }
 
+/*
+ * a page holds at most BLOCK_CACHE_NODES_PER_PAGE sectors and owns its
+ * buffer, so readahead data is copied out into page sized buffers.
+ */
+static void
+block_cache_add_readahead(block_cache_t *cache, block_cache_request_t *breq)
+{
+	char *buf;
+	uint64_t sec, secs, done;
+	radix_tree_t *tree = &cache->tree;
+
+	for (done = 0; done < breq->ra_secs; done += secs) {
+		sec  = breq->treq.sec + breq->treq.secs + done;
+		secs = breq->ra_secs - done;
+		if (secs > BLOCK_CACHE_NODES_PER_PAGE)
+			secs = BLOCK_CACHE_NODES_PER_PAGE;
+
+		if (radix_tree_evict(tree, secs << RADIX_TREE_NODE_SHIFT))
+			break;
+
+		if (posix_memalign((void **)&buf, RADIX_TREE_NODE_SIZE,
+				   secs << RADIX_TREE_NODE_SHIFT))
+			break;
+
+		memcpy(buf, breq->buf + ((sec - breq->treq.sec) <<
+					 RADIX_TREE_NODE_SHIFT),
+		       secs << RADIX_TREE_NODE_SHIFT);
+
+		if (radix_tree_add_leaves(tree, buf, sec, secs)) {
+			free(buf);
+			break;
+		}
+
+		cache->stats.readahead += secs;
+	}
+}
+
 static void
 block_cache_populate_cache(td_request_t clone, int err)
 {
 	int i;
+	char *buf;
+	size_t size;
 	radix_tree_t *tree;
 	block_cache_t *cache;
 	block_cache_request_t *breq;
@@ -654,33 +831,77 @@ block_cache_populate_cache(td_request_t clone, int err)
 		       breq->buf + off, RADIX_TREE_NODE_SIZE);
 	}
 
-	if (radix_tree_add_leaves(tree, breq->buf,
-				  breq->treq.sec, breq->treq.secs))
+	buf = breq->buf;
+
+	/*
+	 * the readahead tail gets leaves of its own; keep only the
+	 * requested sectors in the page we insert, so that the tree
+	 * accounts for every byte it pins.
+	 */
+	if (breq->ra_secs) {
+		block_cache_add_readahead(cache, breq);
+
+		size = breq->treq.secs << RADIX_TREE_NODE_SHIFT;
+		if (posix_memalign((void **)&buf, RADIX_TREE_NODE_SIZE, size))
+			buf = NULL;
+		else
+			memcpy(buf, breq->buf, size);
+
 		free(breq->buf);
+		if (!buf)
+			goto out;
+	}
+
+	if (radix_tree_evict(tree, breq->treq.secs << RADIX_TREE_NODE_SHIFT) ||
+	    radix_tree_add_leaves(tree, buf, breq->treq.sec, breq->treq.secs))
+		free(buf);
 
 out:
 	td_complete_request(breq->treq, breq->err);
 	block_cache_put_request(cache, breq);
 }
 
+/*
+ * extend a miss that continues a sequential stream so that the next
+ * reads of the stream hit.  the readahead must stay within the image.
+ */
+static uint64_t
+block_cache_readahead(block_cache_t *cache, td_request_t treq)
+{
+	uint64_t end, secs;
+
+	if (cache->seq_count < BLOCK_CACHE_READAHEAD_TRIGGER)
+		return 0;
+
+	end = treq.sec + treq.secs;
+	if (end >= cache->sectors)
+		return 0;
+
+	secs = cache->sectors - end;
+	if (secs > BLOCK_CACHE_READAHEAD_SECS)
+		secs = BLOCK_CACHE_READAHEAD_SECS;
+
+	return secs;
+}
+
 static void
 block_cache_miss(block_cache_t *cache, td_request_t treq)
 {
 	char *buf;
 	size_t size;
+	uint64_t ra_secs;
 	td_request_t clone;
-	radix_tree_t *tree;
 	block_cache_request_t *breq;
 
 	DBG("%s: block cache miss: sec 0x%08llx\n", cache->name, treq.sec);
 
-	clone = treq;
-	tree  = &cache->tree;
-	size  = treq.secs << RADIX_TREE_NODE_SHIFT;
+	clone   = treq;
+	ra_secs = block_cache_readahead(cache, treq);
+	size    = (treq.secs + ra_secs) << RADIX_TREE_NODE_SHIFT;
 
 	cache->stats.misses += treq.secs;
 
-	if (radix_tree_size(tree) + size >= BLOCK_CACHE_MAX_SIZE)
+	if (treq.secs << RADIX_TREE_NODE_SHIFT >= cache->max_size)
 		goto out;
 
 	breq = block_cache_get_request(cache);
@@ -693,12 +914,14 @@ block_cache_miss(block_cache_t *cache, td_request_t treq)
 	}
 
 	breq->treq    = treq;
-	breq->secs    = treq.secs;
+	breq->secs    = treq.secs + ra_secs;
+	breq->ra_secs = ra_secs;
 	breq->err     = 0;
 	breq->buf     = buf;
 	breq->cache   = cache;
 
 	clone.buf     = buf;
+	clone.secs    = treq.secs + ra_secs;
 	clone.cb      = block_cache_populate_cache;
 	clone.cb_data = breq;
 
@@ -719,6 +942,12 @@ block_cache_queue_read(td_driver_t *driver, td_request_t treq)
 
 	cache->stats.reads += treq.secs;
 
+	if (treq.sec == cache->seq_next)
+		cache->seq_count++;
+	else
+		cache->seq_count = 0;
+	cache->seq_next = treq.sec + treq.secs;
+
 	if (treq.secs > BLOCK_CACHE_NODES_PER_PAGE)
 		return td_forward_request(treq);
 
@@ -771,6 +1000,22 @@ block_cache_debug(td_driver_t *driver)
 	WARN("BLOCK CACHE %s\n", cache->name);
 	WARN("reads: %"PRIu64", hits: %"PRIu64", misses: %"PRIu64", prunes: %"PRIu64"\n",
 	     stats->reads, stats->hits, stats->misses, stats->prunes);
+	WARN("evictions: %"PRIu64", readahead: %"PRIu64", size: %"PRIu64
+	     "/%"PRIu64"\n", stats->evictions, stats->readahead,
+	     radix_tree_size(&cache->tree), cache->max_size);
+}
+
+static void
+block_cache_stats(td_driver_t *driver, td_cache_stats_t *stats)
+{
+	block_cache_t *cache = (block_cache_t *)driver->data;
+
+	stats->reads     = cache->stats.reads;
+	stats->hits      = cache->stats.hits;
+	stats->misses    = cache->stats.misses;
+	stats->evictions = cache->stats.evictions;
+	stats->readahead = cache->stats.readahead;
+	stats->size      = radix_tree_size(&cache->tree);
 }
 
 struct tap_disk tapdisk_block_cache = {
@@ -784,4 +1029,5 @@ struct tap_disk tapdisk_block_cache = {
 	.td_get_parent_id           = block_cache_get_parent_id,
 	.td_validate_parent         = block_cache_validate_parent,
 	.td_debug                   = block_cache_debug,
+	.td_cache_stats             = block_cache_stats,
 };
@@ -110,6 +110,8 @@ unsigned int SPB;
 
 /******VHD DEFINES******/
 #define VHD_CACHE_SIZE               32
+#define VHD_PREALLOC_BLOCKS          16
+#define VHD_BAT_BATCH                16 /* new blocks awaiting bat flush */
 
 #define VHD_REQS_DATA                TAPDISK_DATA_REQUESTS
 #define VHD_REQS_META                (VHD_CACHE_SIZE + 2)
@@ -121,6 +123,7 @@ unsigned int SPB;
 #define VHD_OP_BITMAP_READ           3
 #define VHD_OP_BITMAP_WRITE          4
 #define VHD_OP_ZERO_BM_WRITE         5
+#define VHD_OP_BAT_FLUSH             6
 
 #define VHD_BM_BAT_LOCKED            0
 #define VHD_BM_BAT_CLEAR             1
@@ -138,6 +141,11 @@ unsigned int SPB;
 
 #define VHD_FLAG_BAT_LOCKED          1
 #define VHD_FLAG_BAT_WRITE_STARTED   2
+#define VHD_FLAG_BAT_FLUSHING        4
+
+#define VHD_FLAG_ALLOC_PENDING       1
+#define VHD_FLAG_ALLOC_DIRTY         2
+#define VHD_FLAG_ALLOC_FLUSHING      4
 
 #define VHD_FLAG_BM_UPDATE_BAT       1
 #define VHD_FLAG_BM_WRITE_PENDING    2
@@ -182,6 +190,18 @@ struct vhd_request {
 	struct vhd_transaction   *tx;
 };
 
+/*
+ * a block allocated with preallocation whose bat entry is not on disk
+ * yet.  req stands in for the bat write in the block's transaction, so
+ * the bitmap is not written before the entry.
+ */
+struct vhd_bat_alloc {
+	uint32_t                  blk;
+	uint64_t                  offset;      /* sector of the new block */
+	vhd_flag_t                status;
+	struct vhd_request        req;
+};
+
 struct vhd_bat_state {
 	vhd_bat_t                 bat;
 	vhd_batmap_t              batmap;
@@ -191,6 +211,12 @@ struct vhd_bat_state {
 	struct vhd_request        req;         /* for writing bat table */
 	struct vhd_request        zero_req;    /* for initializing bitmaps */
 	char                     *bat_buf;
+
+	/* write-back bat cache, used with preallocation */
+	struct vhd_bat_alloc      alloc[VHD_BAT_BATCH];
+	struct vhd_request        flush_req[VHD_BAT_BATCH];
+	int                       flush_runs;    /* flush_req in use */
+	int                       flush_pending; /* flush_req in flight */
 };
 
 struct vhd_bitmap {
@@ -224,6 +250,8 @@ struct vhd_state {
         u32                       spb;         /* sectors per block */
         u64                       next_db;     /* pointer to the next 
 						* (unallocated) datablock */
+	u64                       prealloc_end; /* end of zeroed space
+						 * reserved past next_db */
 
 	struct vhd_bat_state      bat;
 
@@ -258,6 +286,7 @@ struct vhd_state {
 
 static void vhd_complete(void *, struct tiocb *, int);
 static void finish_data_transaction(struct vhd_state *, struct vhd_bitmap *);
+static void vhd_release_preallocated(struct vhd_state *);
 
 static struct vhd_state  *_vhd_master;
 static unsigned long      _vhd_zsize;
@@ -383,6 +412,7 @@ find_next_free_block(struct vhd_state *s)
 			s->next_db = entry + s->spb + s->bm_secs;
 	}
 
+	s->prealloc_end = s->next_db;
 	return 0;
 }
 
@@ -436,8 +466,8 @@ vhd_initialize_bat(struct vhd_state *s)
 					s->vhd.file);
 	}
 
-	err = posix_memalign((void **)&s->bat.bat_buf,
-			     VHD_SECTOR_SIZE, VHD_SECTOR_SIZE);
+	err = posix_memalign((void **)&s->bat.bat_buf, VHD_SECTOR_SIZE,
+			     VHD_SECTOR_SIZE * VHD_BAT_BATCH);
 	if (err) {
 		s->bat.bat_buf = NULL;
 		goto fail;
@@ -743,6 +773,8 @@ _vhd_close(td_driver_t *driver)
 	if (test_vhd_flag(s->flags, VHD_FLAG_OPEN_STRICT) || s->writes) {
 		memcpy(&s->vhd.bat, &s->bat.bat, sizeof(vhd_bat_t));
 		err = vhd_write_footer(&s->vhd, &s->vhd.footer);
+		if (!err)
+			vhd_release_preallocated(s);
 		memset(&s->vhd.bat, 0, sizeof(vhd_bat_t));
 
 		if (err)
@@ -954,6 +986,35 @@ bat_locked(struct vhd_state *s)
 	return test_vhd_flag(s->bat.status, VHD_FLAG_BAT_LOCKED);
 }
 
+static inline struct vhd_bat_alloc *
+get_bat_alloc(struct vhd_state *s, uint32_t blk)
+{
+	int i;
+	struct vhd_bat_alloc *a;
+
+	for (i = 0; i < VHD_BAT_BATCH; i++) {
+		a = s->bat.alloc + i;
+		if (test_vhd_flag(a->status, VHD_FLAG_ALLOC_PENDING) &&
+		    a->blk == blk)
+			return a;
+	}
+
+	return NULL;
+}
+
+static inline struct vhd_bat_alloc *
+get_free_bat_alloc(struct vhd_state *s)
+{
+	int i;
+
+	for (i = 0; i < VHD_BAT_BATCH; i++)
+		if (!test_vhd_flag(s->bat.alloc[i].status,
+				   VHD_FLAG_ALLOC_PENDING))
+			return s->bat.alloc + i;
+
+	return NULL;
+}
+
 static inline void
 init_vhd_bitmap(struct vhd_state *s, struct vhd_bitmap *bm)
 {
@@ -1054,6 +1115,43 @@ remove_lru_bitmap(struct vhd_state *s)
 	return  lru;
 }
 
+/* would alloc_vhd_bitmap() fail? */
+static inline int
+bitmap_cache_full(struct vhd_state *s)
+{
+	int i;
+	struct vhd_bitmap *bm;
+
+	if (s->bm_free_count > 0)
+		return 0;
+
+	for (i = 0; i < VHD_CACHE_SIZE; i++) {
+		bm = s->bitmap[i];
+		if (bm && bm->seqno < s->bm_lru && !bitmap_locked(bm))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * must a write to unallocated @blk wait?  without preallocation, one
+ * block is allocated at a time; with it, up to VHD_BAT_BATCH, as long
+ * as their bitmaps fit in the cache.
+ */
+static inline int
+bat_blocked(struct vhd_state *s, uint32_t blk)
+{
+	if (!test_vhd_flag(s->flags, VHD_FLAG_OPEN_PREALLOCATE))
+		return bat_locked(s) && s->bat.pbw_blk != blk;
+
+	if (get_bat_alloc(s, blk))
+		return 0;
+
+	return (!get_free_bat_alloc(s) ||
+		(!get_bitmap(s, blk) && bitmap_cache_full(s)));
+}
+
 static int
 alloc_vhd_bitmap(struct vhd_state *s, struct vhd_bitmap **bitmap, uint32_t blk)
 {
@@ -1155,8 +1253,7 @@ read_bitmap_cache(struct vhd_state *s, uint64_t sector, uint8_t op)
 	}
 
 	if (bat_entry(s, blk) == DD_BLK_UNUSED) {
-		if (op == VHD_OP_DATA_WRITE &&
-		    s->bat.pbw_blk != blk && bat_locked(s))
+		if (op == VHD_OP_DATA_WRITE && bat_blocked(s, blk))
 			return VHD_BM_BAT_LOCKED;
 
 		return VHD_BM_BAT_CLEAR;
@@ -1378,49 +1475,241 @@ update_bat(struct vhd_state *s, uint32_t blk)
 }
 
 static int
-allocate_block(struct vhd_state *s, uint32_t blk)
+vhd_write_zeros(struct vhd_state *s, uint64_t offset, uint64_t size)
+{
+	ssize_t ret;
+	size_t len;
+
+	while (size) {
+		len = MIN(size, _vhd_zsize);
+		ret = pwrite(s->vhd.fd, vhd_zeros(len), len, offset);
+		if (ret != len)
+			return (ret == -1 ? -errno : -EIO);
+
+		offset += len;
+		size   -= len;
+	}
+
+	return 0;
+}
+
+/*
+ * make sure everything from next_db up to @end (in sectors) is allocated
+ * and reads back as zeroes.  on regular files, space is reserved
+ * VHD_PREALLOC_BLOCKS blocks at a time with fallocate, so new blocks no
+ * longer cost a synchronous write of a whole block of zeroes.  whatever
+ * already lies past the last block (the old footer, or leftovers of an
+ * unclean shutdown) is explicitly zeroed first.
+ */
+static int
+vhd_preallocate(struct vhd_state *s, uint64_t end)
+{
+	int err;
+	off_t eof;
+	uint64_t start, target, size;
+
+	if (end <= s->prealloc_end)
+		return 0;
+
+	target = end;
+	if (!s->vhd.is_block)
+		target = MAX(end, s->next_db +
+			     VHD_PREALLOC_BLOCKS * (s->spb + s->bm_secs));
+
+	start  = vhd_sectors_to_bytes(s->prealloc_end);
+	target = vhd_sectors_to_bytes(target);
+
+	eof = lseek(s->vhd.fd, 0, SEEK_END);
+	if (eof == (off_t)-1)
+		return -errno;
+
+	if (start < eof) {
+		size = MIN(target, eof) - start;
+		err  = vhd_write_zeros(s, start, size);
+		if (err)
+			goto fail;
+		start += size;
+	}
+
+	if (start < target) {
+		err = fallocate(s->vhd.fd, 0, start, target - start);
+		if (err == -1) {
+			err = -errno;
+			if (err != -EOPNOTSUPP && err != -ENOSYS)
+				goto fail;
+
+			/* no fallocate here: zero just what was asked for */
+			target = MAX(start, vhd_sectors_to_bytes(end));
+			err    = vhd_write_zeros(s, start, target - start);
+			if (err)
+				goto fail;
+		}
+	}
+
+	DBG(TLOG_DBG, "preallocated 0x%08"PRIx64" to 0x%08"PRIx64"\n",
+	    s->prealloc_end, target >> VHD_SECTOR_SHIFT);
+
+	s->prealloc_end = target >> VHD_SECTOR_SHIFT;
+	return 0;
+
+ fail:
+	ERR(err, "preallocating 0x%08"PRIx64" to 0x%08"PRIx64" failed\n",
+	    s->prealloc_end, target >> VHD_SECTOR_SHIFT);
+	return err;
+}
+
+/*
+ * drop preallocated space that never got used, so that the footer
+ * written at the end of data is also the last thing in the file.
+ */
+static void
+vhd_release_preallocated(struct vhd_state *s)
+{
+	int err;
+	off_t end;
+
+	if (s->vhd.is_block || s->prealloc_end <= s->next_db)
+		return;
+
+	err = vhd_end_of_data(&s->vhd, &end);
+	if (err)
+		goto fail;
+
+	if (ftruncate(s->vhd.fd, end + sizeof(vhd_footer_t)) == -1) {
+		err = -errno;
+		goto fail;
+	}
+
+	s->prealloc_end = s->next_db;
+	return;
+
+ fail:
+	EPRINTF("releasing %s preallocation: %d\n", s->vhd.file, err);
+}
+
+/*
+ * write the bat entries of new blocks.  one flush is in flight at a
+ * time, and blocks allocated meanwhile wait for the next one, so under
+ * load many entries share a flush.  the dirty bat sectors go out in
+ * ascending order, runs of adjacent sectors as one write.
+ */
+static void
+schedule_bat_flush(struct vhd_state *s)
+{
+	int i, j, n;
+	u32 *entries, secs[VHD_BAT_BATCH];
+	struct vhd_bat_alloc *a;
+	struct vhd_request *req;
+	char *buf;
+
+	if (test_vhd_flag(s->bat.status, VHD_FLAG_BAT_FLUSHING))
+		return;
+
+	/* sorted, distinct bat sectors of the dirty entries */
+	n = 0;
+	for (i = 0; i < VHD_BAT_BATCH; i++) {
+		a = s->bat.alloc + i;
+		if (!test_vhd_flag(a->status, VHD_FLAG_ALLOC_DIRTY))
+			continue;
+
+		clear_vhd_flag(a->status, VHD_FLAG_ALLOC_DIRTY);
+		set_vhd_flag(a->status, VHD_FLAG_ALLOC_FLUSHING);
+
+		for (j = n; j > 0 && secs[j - 1] > a->blk / 128; j--)
+			;
+		if (j > 0 && secs[j - 1] == a->blk / 128)
+			continue;
+
+		memmove(secs + j + 1, secs + j, (n - j) * sizeof(u32));
+		secs[j] = a->blk / 128;
+		n++;
+	}
+
+	if (!n)
+		return;
+
+	buf = s->bat.bat_buf;
+	for (i = 0; i < n; i++)
+		memcpy(buf + i * VHD_SECTOR_SIZE,
+		       &bat_entry(s, secs[i] * 128), VHD_SECTOR_SIZE);
+
+	for (i = 0; i < VHD_BAT_BATCH; i++) {
+		a = s->bat.alloc + i;
+		if (!test_vhd_flag(a->status, VHD_FLAG_ALLOC_FLUSHING))
+			continue;
+
+		for (j = 0; secs[j] != a->blk / 128; j++)
+			;
+		entries = (u32 *)(buf + j * VHD_SECTOR_SIZE);
+		entries[a->blk % 128] = a->offset;
+	}
+
+	for (i = 0; i < n * 128; i++)
+		BE32_OUT(&((u32 *)buf)[i]);
+
+	s->bat.flush_runs = 0;
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && secs[j] == secs[j - 1] + 1; j++)
+			;
+
+		req = s->bat.flush_req + s->bat.flush_runs++;
+		init_vhd_request(s, req);
+
+		/* treq.sec is the first bat sector of the run */
+		req->treq.sec  = secs[i];
+		req->treq.secs = j - i;
+		req->treq.buf  = buf + i * VHD_SECTOR_SIZE;
+		req->op        = VHD_OP_BAT_FLUSH;
+		req->next      = NULL;
+
+		aio_write(s, req, s->vhd.header.table_offset +
+			  vhd_sectors_to_bytes(secs[i]));
+
+		DBG(TLOG_DBG, "bat sectors 0x%x-0x%x\n", secs[i], secs[j - 1]);
+	}
+
+	s->bat.flush_pending = s->bat.flush_runs;
+	set_vhd_flag(s->bat.status, VHD_FLAG_BAT_FLUSHING);
+}
+
+/*
+ * reserve space for new block @blk, or find the reservation made by an
+ * earlier write to it, and return its sector in @offset.  the bat entry
+ * goes out with the next bat flush.
+ */
+static int
+allocate_block(struct vhd_state *s, uint32_t blk, uint64_t *offset)
 {
-	char *zeros;
 	int err, gap;
-	uint64_t offset, size;
+	uint64_t end;
 	struct vhd_bitmap *bm;
+	struct vhd_bat_alloc *a;
 
 	ASSERT(bat_entry(s, blk) == DD_BLK_UNUSED);
 
-	if (bat_locked(s)) {
-		ASSERT(s->bat.pbw_blk == blk);
-		if (s->bat.req.error)
+	a = get_bat_alloc(s, blk);
+	if (a) {
+		if (a->req.error)
 			return -EBUSY;
+
+		*offset = a->offset;
 		return 0;
 	}
 
-	gap            = 0;
-	s->bat.pbw_blk = blk;
-	offset         = vhd_sectors_to_bytes(s->next_db);
+	a = get_free_bat_alloc(s);
+	if (!a)
+		return -EBUSY;
+
+	gap = 0;
 
 	/* data region of segment should begin on page boundary */
-	if ((s->next_db + s->bm_secs) % s->spp) {
+	if ((s->next_db + s->bm_secs) % s->spp)
 		gap = (s->spp - ((s->next_db + s->bm_secs) % s->spp));
-		s->next_db += gap;
-	}
 
-	s->bat.pbw_offset = s->next_db;
-
-	DBG(TLOG_DBG, "blk: 0x%04x, pbwo: 0x%08"PRIx64"\n",
-	    blk, s->bat.pbw_offset);
-
-	if (lseek(s->vhd.fd, offset, SEEK_SET) == (off_t)-1) {
-		ERR(errno, "lseek failed\n");
-		return -errno;
-	}
-
-	size = vhd_sectors_to_bytes(s->spb + s->bm_secs + gap);
-	err  = write(s->vhd.fd, vhd_zeros(size), size);
-	if (err != size) {
-		err = (err == -1 ? -errno : -EIO);
-		ERR(err, "write failed");
+	end = s->next_db + gap + s->bm_secs + s->spb;
+	err = vhd_preallocate(s, end);
+	if (err)
 		return err;
-	}
 
 	/* empty bitmap could already be in
 	 * cache if earlier bat update failed */
@@ -1434,11 +1723,21 @@ allocate_block(struct vhd_state *s, uint32_t blk)
 		install_bitmap(s, bm);
 	}
 
-	lock_bat(s);
+	init_vhd_request(s, &a->req);
+	a->blk            = blk;
+	a->offset         = s->next_db + gap;
+	a->status         = VHD_FLAG_ALLOC_PENDING | VHD_FLAG_ALLOC_DIRTY;
+	a->req.op         = VHD_OP_BAT_FLUSH;
+	a->req.treq.sec   = blk * s->spb;
+	s->next_db        = end;
+
+	DBG(TLOG_DBG, "blk: 0x%04x, offset: 0x%08"PRIx64"\n", blk, a->offset);
+
 	lock_bitmap(bm);
-	schedule_bat_write(s);
-	add_to_transaction(&bm->tx, &s->bat.req);
+	add_to_transaction(&bm->tx, &a->req);
+	schedule_bat_flush(s);
 
+	*offset = a->offset;
 	return 0;
 }
 
@@ -1506,14 +1805,14 @@ schedule_data_write(struct vhd_state *s, td_request_t treq, vhd_flag_t flags)
 
 	if (test_vhd_flag(flags, VHD_FLAG_REQ_UPDATE_BAT)) {
 		if (test_vhd_flag(s->flags, VHD_FLAG_OPEN_PREALLOCATE))
-			err = allocate_block(s, blk);
-		else
-			err = update_bat(s, blk);
+			err = allocate_block(s, blk, &offset);
+		else {
+			err    = update_bat(s, blk);
+			offset = s->bat.pbw_offset;
+		}
 
 		if (err)
 			return err;
-
-		offset = s->bat.pbw_offset;
 	}
 
 	offset += s->bm_secs + sec;
@@ -1899,11 +2198,38 @@ start_new_bitmap_transaction(struct vhd_state *s, struct vhd_bitmap *bm)
 		finish_data_transaction(s, bm);
 }
 
+static void
+finish_bat_alloc_transaction(struct vhd_state *s, struct vhd_bitmap *bm)
+{
+	struct vhd_bat_alloc *a;
+	struct vhd_transaction *tx = &bm->tx;
+
+	a = get_bat_alloc(s, bm->blk);
+	if (!a)
+		return;
+
+	if (test_vhd_flag(a->status,
+			  VHD_FLAG_ALLOC_DIRTY | VHD_FLAG_ALLOC_FLUSHING))
+		return;
+
+	/* as below: hold a failed block until its writes have drained */
+	if (a->req.error && test_vhd_flag(tx->status, VHD_FLAG_TX_LIVE)) {
+		tx->closed = 1;
+		return;
+	}
+
+	DBG(TLOG_DBG, "blk: 0x%04x\n", bm->blk);
+	a->status = 0;
+}
+
 static void
 finish_bat_transaction(struct vhd_state *s, struct vhd_bitmap *bm)
 {
 	struct vhd_transaction *tx = &bm->tx;
 
+	if (test_vhd_flag(s->flags, VHD_FLAG_OPEN_PREALLOCATE))
+		return finish_bat_alloc_transaction(s, bm);
+
 	if (!bat_locked(s))
 		return;
 
@@ -2010,20 +2336,88 @@ finish_bat_write(struct vhd_request *req)
 	} else
 		tx->error = req->error;
 
-	if (test_vhd_flag(s->flags, VHD_FLAG_OPEN_PREALLOCATE)) {
-		tx->finished++;
-		remove_from_req_list(&tx->requests, req);
-		if (transaction_completed(tx))
-			finish_data_transaction(s, bm);
-	} else {
-		clear_vhd_flag(tx->status, VHD_FLAG_TX_UPDATE_BAT);
-		if (s->bat.req.tx)
-			finish_bitmap_transaction(s, bm, req->error);
-	}
+	clear_vhd_flag(tx->status, VHD_FLAG_TX_UPDATE_BAT);
+	if (s->bat.req.tx)
+		finish_bitmap_transaction(s, bm, req->error);
+
+	finish_bat_transaction(s, bm);
+}
+
+static void
+finish_bat_alloc(struct vhd_state *s, struct vhd_bat_alloc *a)
+{
+	struct vhd_bitmap *bm;
+	struct vhd_transaction *tx;
+
+	bm = get_bitmap(s, a->blk);
+
+	DBG(TLOG_DBG, "blk 0x%04x, offset: 0x%08"PRIx64", err %d\n",
+	    a->blk, a->offset, a->req.error);
+	ASSERT(bm && bitmap_valid(bm));
+
+	tx = &bm->tx;
+	ASSERT(test_vhd_flag(tx->status, VHD_FLAG_TX_LIVE));
+
+	if (!a->req.error)
+		bat_entry(s, a->blk) = a->offset;
+	else
+		tx->error = a->req.error;
+
+	tx->finished++;
+	remove_from_req_list(&tx->requests, &a->req);
+	if (transaction_completed(tx))
+		finish_data_transaction(s, bm);
 
 	finish_bat_transaction(s, bm);
 }
 
+static void
+finish_bat_flush(struct vhd_request *req)
+{
+	int i, j, n;
+	struct vhd_request *r;
+	struct vhd_bat_alloc *a, *done[VHD_BAT_BATCH];
+	struct vhd_state *s = req->state;
+
+	s->returned++;
+	TRACE(s);
+
+	ASSERT(test_vhd_flag(s->bat.status, VHD_FLAG_BAT_FLUSHING));
+	if (--s->bat.flush_pending)
+		return;
+
+	/*
+	 * the whole flush is back.  collect its blocks before settling
+	 * them: completing their requests may allocate more blocks and
+	 * start the next flush.
+	 */
+	n = 0;
+	for (i = 0; i < VHD_BAT_BATCH; i++) {
+		a = s->bat.alloc + i;
+		if (!test_vhd_flag(a->status, VHD_FLAG_ALLOC_FLUSHING))
+			continue;
+
+		for (j = 0; j < s->bat.flush_runs; j++) {
+			r = s->bat.flush_req + j;
+			if (a->blk / 128 >= r->treq.sec &&
+			    a->blk / 128 < r->treq.sec + r->treq.secs)
+				break;
+		}
+
+		ASSERT(j < s->bat.flush_runs);
+		a->req.error = s->bat.flush_req[j].error;
+		clear_vhd_flag(a->status, VHD_FLAG_ALLOC_FLUSHING);
+		done[n++] = a;
+	}
+
+	clear_vhd_flag(s->bat.status, VHD_FLAG_BAT_FLUSHING);
+
+	for (i = 0; i < n; i++)
+		finish_bat_alloc(s, done[i]);
+
+	schedule_bat_flush(s);
+}
+
 static void
 finish_zero_bm_write(struct vhd_request *req)
 {
@@ -2230,6 +2624,10 @@ vhd_complete(void *arg, struct tiocb *tiocb, int err)
 		finish_bat_write(req);
 		break;
 
+	case VHD_OP_BAT_FLUSH:
+		finish_bat_flush(req);
+		break;
+
 	default:
 		ASSERT(0);
 		break;
@@ -2302,6 +2700,17 @@ vhd_debug(td_driver_t *driver)
 	    "pbw_off: 0x%08"PRIx64", tx: %p\n", s->bat.status, s->bat.pbw_blk,
 	    s->bat.pbw_offset, s->bat.req.tx);
 
+	DBG(TLOG_WARN, "BAT FLUSH: runs: %d, pending: %d\n",
+	    s->bat.flush_runs, s->bat.flush_pending);
+	for (i = 0; i < VHD_BAT_BATCH; i++) {
+		struct vhd_bat_alloc *a = &s->bat.alloc[i];
+
+		if (a->status)
+			DBG(TLOG_WARN, "%d: blk: 0x%04x, off: 0x%08"PRIx64", "
+			    "status: 0x%02x, err: %d\n", i, a->blk,
+			    a->offset, a->status, a->req.error);
+	}
+
 /*
 	for (i = 0; i < s->hdr.max_bat_size; i++)
 		DPRINTF("%d: %u\n", i, s->bat.bat[i]);
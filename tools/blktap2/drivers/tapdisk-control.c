@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <sched.h>
 #include <sys/un.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -46,6 +47,7 @@
 #include "tapdisk-utils.h"
 #include "tapdisk-server.h"
 #include "tapdisk-message.h"
+#include "tapdisk-interface.h"
 #include "tapdisk-disktype.h"
 
 struct tapdisk_control {
@@ -627,6 +629,132 @@ out:
 	tapdisk_control_close_connection(connection);
 }
 
+/*
+ * Parse a cpu list of the form "0-3,8,10-11", as found in
+ * /sys/devices/system/node/node<N>/cpulist.
+ */
+static int
+tapdisk_control_parse_cpus(const char *list, cpu_set_t *cpus)
+{
+	unsigned long first, last;
+	char *end;
+
+	CPU_ZERO(cpus);
+
+	while (*list) {
+		first = last = strtoul(list, &end, 10);
+		if (end == list)
+			return -EINVAL;
+
+		if (*end == '-') {
+			list = end + 1;
+			last = strtoul(list, &end, 10);
+			if (end == list || last < first)
+				return -EINVAL;
+		}
+
+		if (last >= CPU_SETSIZE)
+			return -ERANGE;
+
+		for (; first <= last; first++)
+			CPU_SET(first, cpus);
+
+		if (*end == ',')
+			end++;
+		else if (*end && *end != '\n')
+			return -EINVAL;
+		else
+			break;
+
+		list = end;
+	}
+
+	return CPU_COUNT(cpus) ? 0 : -EINVAL;
+}
+
+/*
+ * Each tapdisk runs its VBDs in a single event loop, so placing the
+ * process places the VBDs with it.  Issuing this again moves a running
+ * tapdisk to another node without pausing its VBDs.
+ */
+static void
+tapdisk_control_set_affinity(struct tapdisk_control_connection *connection,
+			     tapdisk_message_t *request)
+{
+	int err;
+	cpu_set_t cpus;
+	tapdisk_message_t response;
+
+	memset(&response, 0, sizeof(response));
+
+	response.type = TAPDISK_MESSAGE_AFFINITY_RSP;
+
+	request->u.string.text[TAPDISK_MESSAGE_STRING_LENGTH - 1] = '\0';
+
+	err = tapdisk_control_parse_cpus(request->u.string.text, &cpus);
+	if (err)
+		goto out;
+
+	err = sched_setaffinity(0, sizeof(cpus), &cpus);
+	if (err) {
+		err = -errno;
+		goto out;
+	}
+
+	DPRINTF("running on cpus %s\n", request->u.string.text);
+
+out:
+	response.cookie = request->cookie;
+	response.u.response.error = -err;
+	tapdisk_control_write_message(connection->socket, &response, 2);
+	tapdisk_control_close_connection(connection);
+}
+
+static void
+tapdisk_control_get_stats(struct tapdisk_control_connection *connection,
+			  tapdisk_message_t *request)
+{
+	int i;
+	td_vbd_t *vbd;
+	td_image_t *image, *tmp;
+	td_cache_stats_t cache;
+	tapdisk_message_t response;
+
+	memset(&response, 0, sizeof(response));
+
+	response.type = TAPDISK_MESSAGE_STATS_RSP;
+	response.cookie = request->cookie;
+
+	vbd = tapdisk_server_get_vbd(request->cookie);
+	if (!vbd) {
+		response.type = TAPDISK_MESSAGE_ERROR;
+		response.u.response.error = EINVAL;
+		goto out;
+	}
+
+	response.u.stats.requests = vbd->returned;
+	response.u.stats.sectors  = vbd->secs_returned;
+	response.u.stats.errors   = vbd->errors;
+
+	for (i = 0; i < TD_VBD_LATENCY_BUCKETS &&
+		     i < TAPDISK_MESSAGE_LATENCY_BUCKETS; i++)
+		response.u.stats.latency[i] = vbd->latency[i];
+
+	tapdisk_vbd_for_each_image(vbd, image, tmp) {
+		if (td_get_cache_stats(image, &cache))
+			continue;
+
+		response.u.stats.cache_hits      += cache.hits;
+		response.u.stats.cache_misses    += cache.misses;
+		response.u.stats.cache_evictions += cache.evictions;
+		response.u.stats.cache_readahead += cache.readahead;
+	}
+
+out:
+	tapdisk_control_write_message(connection->socket, &response, 2);
+	tapdisk_control_close_connection(connection);
+}
+
 static void
 tapdisk_control_handle_request(event_id_t id, char mode, void *private)
 {
@@ -664,6 +792,10 @@ tapdisk_control_handle_request(event_id_t id, char mode, void *private)
 		return tapdisk_control_resume_vbd(connection, &message);
 	case TAPDISK_MESSAGE_CLOSE:
 		return tapdisk_control_close_image(connection, &message);
+	case TAPDISK_MESSAGE_AFFINITY:
+		return tapdisk_control_set_affinity(connection, &message);
+	case TAPDISK_MESSAGE_STATS:
+		return tapdisk_control_get_stats(connection, &message);
 	default: {
 		tapdisk_message_t response;
 	fail:
@@ -245,6 +245,22 @@ td_prep_write(struct tiocb *tiocb, int fd, char *buf, size_t bytes,
 	tapdisk_prep_tiocb(tiocb, fd, 1, buf, bytes, offset, cb, arg);
 }
 
+int
+td_get_cache_stats(td_image_t *image, td_cache_stats_t *stats)
+{
+	td_driver_t *driver;
+
+	driver = image->driver;
+	if (!driver || !td_flag_test(driver->state, TD_DRIVER_OPEN))
+		return -ENODEV;
+
+	if (!driver->ops->td_cache_stats)
+		return -ENOSYS;
+
+	driver->ops->td_cache_stats(driver, stats);
+	return 0;
+}
+
 void
 td_debug(td_image_t *image)
 {
@@ -28,6 +28,7 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <libaio.h>
 #ifdef __linux__
@@ -55,6 +56,8 @@
  */
 #define REQUEST_ASYNC_FD ((io_context_t)1)
 
+#define NR_TIOS (sizeof(tapdisk_tios) / sizeof(tapdisk_tios[0]))
+
 static inline void
 queue_tiocb(struct tqueue *queue, struct tiocb *tiocb)
 {
@@ -262,9 +265,9 @@ tapdisk_rwio_submit(struct tqueue *queue)
 
 static const struct tio td_tio_rwio = {
 	.name        = "rwio",
-	.data_size   = 0,
-	.tio_setup   = NULL,
-	.tio_destroy = NULL,
+	.data_size   = sizeof(struct rwio),
+	.tio_setup   = tapdisk_rwio_setup,
+	.tio_destroy = tapdisk_rwio_destroy,
 	.tio_submit  = tapdisk_rwio_submit
 };
 
@@ -272,6 +275,26 @@ static const struct tio td_tio_rwio = {
  * libaio
  */
 
+/*
+ * Layout of the completion ring the kernel maps at the address returned
+ * by io_setup (see fs/aio.c).  Only the head is written from user space.
+ */
+struct lio_ring {
+	unsigned         id;
+	unsigned         nr;
+	unsigned         head;
+	unsigned         tail;
+
+	unsigned         magic;
+	unsigned         compat_features;
+	unsigned         incompat_features;
+	unsigned         header_length;
+
+	struct io_event  io_events[0];
+};
+
+#define LIO_RING_MAGIC          0xa10a10a1
+
 struct lio {
 	io_context_t     aio_ctx;
 	struct io_event *aio_events;
@@ -283,6 +306,7 @@ struct lio {
 };
 
 #define LIO_FLAG_EVENTFD        (1<<0)
+#define LIO_FLAG_RING           (1<<1)
 
 static int
 tapdisk_lio_check_resfd(void)
@@ -438,6 +462,35 @@ tapdisk_lio_ack_event(struct tqueue *queue)
 		read_exact(lio->event_fd, &val, sizeof(val));
 }
 
+/*
+ * Copy completed events straight out of the mapped completion ring,
+ * saving the io_getevents call.  We are the only consumer of the ring,
+ * so publishing the new head is all the kernel needs to reuse the slots.
+ */
+static int
+tapdisk_lio_reap_ring(struct tqueue *queue)
+{
+	struct lio *lio = queue->tio_data;
+	struct lio_ring *ring = (struct lio_ring *)lio->aio_ctx;
+	unsigned head, tail;
+	int n = 0;
+
+	head = ring->head;
+	tail = ring->tail;
+	__sync_synchronize();
+
+	while (head != tail && n < queue->size) {
+		lio->aio_events[n++] = ring->io_events[head];
+		if (++head == ring->nr)
+			head = 0;
+	}
+
+	__sync_synchronize();
+	ring->head = head;
+
+	return n;
+}
+
 static void
 tapdisk_lio_event(event_id_t id, char mode, void *private)
 {
@@ -451,8 +504,11 @@ tapdisk_lio_event(event_id_t id, char mode, void *private)
 	tapdisk_lio_ack_event(queue);
 
 	lio   = queue->tio_data;
-	ret   = io_getevents(lio->aio_ctx, 0,
-			     queue->size, lio->aio_events, NULL);
+	if (lio->flags & LIO_FLAG_RING)
+		ret = tapdisk_lio_reap_ring(queue);
+	else
+		ret = io_getevents(lio->aio_ctx, 0,
+				   queue->size, lio->aio_events, NULL);
 	split = io_split(&queue->opioctx, lio->aio_events, ret);
 	tapdisk_filter_events(queue->filter, lio->aio_events, split);
 
@@ -547,6 +603,62 @@ static const struct tio td_tio_lio = {
 	.tio_submit  = tapdisk_lio_submit,
 };
 
+/*
+ * lio-ring: libaio submission, completions reaped from the mapped ring.
+ * Needs the eventfd notification path, as the aio-poll patch context is
+ * not a ring address we can rely on.
+ */
+static int
+tapdisk_lio_ring_setup(struct tqueue *queue, int qlen)
+{
+	struct lio *lio = queue->tio_data;
+	struct lio_ring *ring;
+	int err;
+
+	err = tapdisk_lio_setup(queue, qlen);
+	if (err)
+		return err;
+
+	ring = (struct lio_ring *)lio->aio_ctx;
+
+	if (!(lio->flags & LIO_FLAG_EVENTFD) ||
+	    ring->magic != LIO_RING_MAGIC || ring->incompat_features) {
+		DPRINTF("AIO completion ring not usable, "
+			"falling back to io_getevents\n");
+		return 0;
+	}
+
+	lio->flags |= LIO_FLAG_RING;
+
+	return 0;
+}
+
+static const struct tio td_tio_lio_ring = {
+	.name        = "lio-ring",
+	.data_size   = sizeof(struct lio),
+	.tio_setup   = tapdisk_lio_ring_setup,
+	.tio_destroy = tapdisk_lio_destroy,
+	.tio_submit  = tapdisk_lio_submit,
+};
+
+static const struct tio *tapdisk_tios[] = {
+	[TIO_DRV_LIO]      = &td_tio_lio,
+	[TIO_DRV_RWIO]     = &td_tio_rwio,
+	[TIO_DRV_LIO_RING] = &td_tio_lio_ring,
+};
+
+int
+tapdisk_queue_tio_drv(const char *name)
+{
+	int drv;
+
+	for (drv = 0; drv < NR_TIOS; drv++)
+		if (tapdisk_tios[drv] && !strcmp(tapdisk_tios[drv]->name, name))
+			return drv;
+
+	return -EINVAL;
+}
+
 static void
 tapdisk_queue_free_io(struct tqueue *queue)
 {
@@ -568,18 +680,13 @@ tapdisk_queue_init_io(struct tqueue *queue, int drv)
 	const struct tio *tio;
 	int err;
 
-	switch (drv) {
-	case TIO_DRV_LIO:
-		tio = &td_tio_lio;
-		break;
-	case TIO_DRV_RWIO:
-		tio = &td_tio_rwio;
-		break;
-	default:
+	if (drv < 0 || drv >= NR_TIOS || !tapdisk_tios[drv]) {
 		err = -EINVAL;
 		goto fail;
 	}
 
+	tio = tapdisk_tios[drv];
+
 	queue->tio_data = calloc(1, tio->data_size);
 	if (!queue->tio_data) {
 		PERROR("malloc(%zu)", tio->data_size);
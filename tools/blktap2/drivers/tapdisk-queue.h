@@ -94,8 +94,9 @@ struct tio {
 };
 
 enum {
-	TIO_DRV_LIO     = 1,
-	TIO_DRV_RWIO    = 2,
+	TIO_DRV_LIO      = 1,
+	TIO_DRV_RWIO     = 2,
+	TIO_DRV_LIO_RING = 3,
 };
 
 /*
@@ -111,6 +112,7 @@ enum {
 #define tapdisk_queue_empty(q) ((q)->queued == 0)
 #define tapdisk_queue_full(q)  \
 	(((q)->tiocbs_pending + (q)->queued) >= (q)->size)
+int tapdisk_queue_tio_drv(const char *name);
 int tapdisk_init_queue(struct tqueue *, int size, int drv, struct tfilter *);
 void tapdisk_free_queue(struct tqueue *);
 void tapdisk_debug_queue(struct tqueue *);
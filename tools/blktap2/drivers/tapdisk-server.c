@@ -171,7 +171,7 @@ tapdisk_server_check_progress(void)
 		tapdisk_vbd_check_progress(vbd);
 }
 
-static void
+void
 tapdisk_server_submit_tiocbs(void)
 {
 	tapdisk_submit_all_tiocbs(&server.aio_queue);
@@ -205,11 +205,34 @@ tapdisk_server_stop_vbds(void)
 		tapdisk_vbd_kill_queue(vbd);
 }
 
+/*
+ * tap-ctl spawns one tapdisk per VBD, so TAPDISK2_TIO in its environment
+ * selects the I/O queue driver for that VBD.
+ */
+static int
+tapdisk_server_tio_drv(void)
+{
+	const char *name;
+	int drv;
+
+	name = getenv("TAPDISK2_TIO");
+	if (!name)
+		return TIO_DRV_LIO;
+
+	drv = tapdisk_queue_tio_drv(name);
+	if (drv < 0) {
+		EPRINTF("unknown I/O queue driver '%s', using lio\n", name);
+		return TIO_DRV_LIO;
+	}
+
+	return drv;
+}
+
 static int
 tapdisk_server_init_aio(void)
 {
 	return tapdisk_init_queue(&server.aio_queue, TAPDISK_TIOCBS,
-				  TIO_DRV_LIO, NULL);
+				  tapdisk_server_tio_drv(), NULL);
 }
 
 static void
@@ -42,6 +42,7 @@ void tapdisk_server_add_vbd(td_vbd_t *);
 void tapdisk_server_remove_vbd(td_vbd_t *);
 
 void tapdisk_server_queue_tiocb(struct tiocb *);
+void tapdisk_server_submit_tiocbs(void);
 
 void tapdisk_server_check_state(void);
 
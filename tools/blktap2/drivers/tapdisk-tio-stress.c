@@ -0,0 +1,187 @@
+/*
+ * tapdisk-tio-stress.c
+ *
+ * Stress the tapdisk I/O queue with random O_DIRECT reads or writes and
+ * report IOPS and CPU time per I/O for the selected queue driver.  Point
+ * it at a RAM-backed block device (e.g. /dev/ram0 from brd) so that the
+ * numbers reflect tapdisk's submit and reap overhead, not the media.
+ *
+ * Usage: tapdisk-tio-stress [-t tio] [-n ios] [-q depth] [-b bytes] [-w] dev
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "tapdisk.h"
+#include "tapdisk-queue.h"
+#include "tapdisk-server.h"
+
+#define DEFAULT_IOS        1000000
+#define DEFAULT_DEPTH      TAPDISK_TIOCBS
+#define DEFAULT_BYTES      4096
+
+struct stress_io {
+	struct tiocb       tiocb;
+	char              *buf;
+};
+
+static int       fd;
+static int       rw;
+static size_t    bytes;
+static uint64_t  nr_blocks;
+
+static uint64_t  issued;
+static uint64_t  completed;
+static uint64_t  total;
+static int       errors;
+
+static double
+now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static double
+cpu_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec * 1e6 + ru.ru_utime.tv_usec +
+		ru.ru_stime.tv_sec * 1e6 + ru.ru_stime.tv_usec;
+}
+
+static void stress_complete(void *arg, struct tiocb *tiocb, int err);
+
+static void
+stress_issue(struct stress_io *io)
+{
+	long long offset = (long long)(random() % nr_blocks) * bytes;
+
+	tapdisk_prep_tiocb(&io->tiocb, fd, rw, io->buf, bytes, offset,
+			   stress_complete, io);
+	tapdisk_server_queue_tiocb(&io->tiocb);
+	issued++;
+}
+
+static void
+stress_complete(void *arg, struct tiocb *tiocb, int err)
+{
+	completed++;
+	if (err)
+		errors++;
+
+	if (issued < total)
+		stress_issue(arg);
+}
+
+static void
+usage(const char *app, int err)
+{
+	fprintf(stderr, "usage: %s [-t tio] [-n ios] [-q depth] [-b bytes] "
+		"[-w] <dev>\n", app);
+	exit(err);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct stress_io *ios;
+	int c, i, depth, err;
+	double wall, cpu;
+	off_t size;
+
+	total = DEFAULT_IOS;
+	depth = DEFAULT_DEPTH;
+	bytes = DEFAULT_BYTES;
+	rw    = 0;
+
+	while ((c = getopt(argc, argv, "t:n:q:b:wh")) != -1) {
+		switch (c) {
+		case 't':
+			setenv("TAPDISK2_TIO", optarg, 1);
+			break;
+		case 'n':
+			total = strtoull(optarg, NULL, 0);
+			break;
+		case 'q':
+			depth = atoi(optarg);
+			break;
+		case 'b':
+			bytes = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			rw = 1;
+			break;
+		case 'h':
+			usage(argv[0], 0);
+			break;
+		default:
+			usage(argv[0], EINVAL);
+		}
+	}
+
+	if (optind != argc - 1 || !total || depth <= 0 ||
+	    depth > TAPDISK_TIOCBS || !bytes || bytes % 512)
+		usage(argv[0], EINVAL);
+
+	fd = open(argv[optind], (rw ? O_RDWR : O_RDONLY) | O_DIRECT);
+	if (fd == -1) {
+		perror(argv[optind]);
+		return errno;
+	}
+
+	size = lseek(fd, 0, SEEK_END);
+	nr_blocks = size > 0 ? size / bytes : 0;
+	if (!nr_blocks) {
+		fprintf(stderr, "%s: too small\n", argv[optind]);
+		return EINVAL;
+	}
+
+	ios = calloc(depth, sizeof(*ios));
+	if (!ios)
+		return ENOMEM;
+
+	for (i = 0; i < depth; i++) {
+		err = posix_memalign((void **)&ios[i].buf, 4096, bytes);
+		if (err)
+			return err;
+		memset(ios[i].buf, i, bytes);
+	}
+
+	err = tapdisk_server_initialize();
+	if (err) {
+		fprintf(stderr, "failed to initialize server: %d\n", err);
+		return -err;
+	}
+
+	wall = now_us();
+	cpu  = cpu_us();
+
+	for (i = 0; i < depth && issued < total; i++)
+		stress_issue(&ios[i]);
+	tapdisk_server_submit_tiocbs();
+
+	while (completed < total)
+		tapdisk_server_iterate();
+
+	wall = now_us() - wall;
+	cpu  = cpu_us() - cpu;
+
+	printf("%s: %"PRIu64" %s of %zu bytes, depth %d: %.0f IOPS, "
+	       "%.2f us CPU/IO, %d errors\n",
+	       getenv("TAPDISK2_TIO") ? : "lio", total,
+	       rw ? "writes" : "reads", bytes, depth,
+	       total * 1e6 / wall, cpu / total, errors);
+
+	return errors ? EIO : 0;
+}
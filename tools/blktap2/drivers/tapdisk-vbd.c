@@ -1052,12 +1052,34 @@ tapdisk_vbd_callback(void *arg, blkif_response_t *rsp)
 	tapdisk_vbd_write_response_to_ring(vbd, rsp);
 }
 
+static void
+tapdisk_vbd_account_response(td_vbd_t *vbd, td_vbd_request_t *vreq)
+{
+	struct timeval now;
+	uint64_t usecs;
+	int i, bucket;
+
+	gettimeofday(&now, NULL);
+	usecs = (now.tv_sec - vreq->arrival.tv_sec) * 1000000ULL +
+		now.tv_usec - vreq->arrival.tv_usec;
+
+	for (bucket = 0; usecs && bucket < TD_VBD_LATENCY_BUCKETS - 1; bucket++)
+		usecs >>= 1;
+	vbd->latency[bucket]++;
+
+	for (i = 0; i < vreq->req.nr_segments; i++)
+		vbd->secs_returned += vreq->req.seg[i].last_sect -
+			vreq->req.seg[i].first_sect + 1;
+}
+
 static void
 tapdisk_vbd_make_response(td_vbd_t *vbd, td_vbd_request_t *vreq)
 {
 	blkif_request_t tmp;
 	blkif_response_t *rsp;
 
+	tapdisk_vbd_account_response(vbd, vreq);
+
 	tmp = vreq->req;
 	rsp = (blkif_response_t *)&vreq->req;
 
@@ -1318,18 +1340,16 @@ tapdisk_vbd_forward_request(td_request_t treq)
 {
 	td_vbd_t *vbd;
 	td_image_t *image;
-	td_vbd_request_t *vreq;
 
 	image = treq.image;
 	vbd   = (td_vbd_t *)image->private;
-	vreq  = (td_vbd_request_t *)treq.private;
 
 	gettimeofday(&vbd->ts, NULL);
 
 	if (tapdisk_vbd_queue_ready(vbd))
 		__tapdisk_vbd_reissue_td_request(vbd, image, treq);
 	else
-		__tapdisk_vbd_complete_td_request(vbd, vreq, treq, -EIO);
+		td_complete_request(treq, -EIO);
 }
 
 static void
@@ -1578,6 +1598,7 @@ tapdisk_vbd_pull_ring_requests(td_vbd_t *vbd)
 		memcpy(&vreq->req, req, sizeof(blkif_request_t));
 		vbd->received++;
 		vreq->vbd = vbd;
+		gettimeofday(&vreq->arrival, NULL);
 
 		tapdisk_vbd_move_request(vreq, &vbd->new_requests);
 
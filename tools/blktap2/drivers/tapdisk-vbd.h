@@ -38,6 +38,7 @@
 
 #define TD_VBD_MAX_RETRIES          100
 #define TD_VBD_RETRY_INTERVAL       1
+#define TD_VBD_LATENCY_BUCKETS      24
 
 #define TD_VBD_DEAD                 0x0001
 #define TD_VBD_CLOSED               0x0002
@@ -74,6 +75,7 @@ struct td_vbd_request {
 	int                         secs_pending;
 	int                         num_retries;
 	struct timeval              last_try;
+	struct timeval              arrival;
 
 	td_vbd_t                   *vbd;
 	struct list_head            next;
@@ -125,6 +127,8 @@ struct td_vbd_handle {
 	uint64_t                    secs_pending;
 	uint64_t                    retries;
 	uint64_t                    errors;
+	uint64_t                    secs_returned;
+	uint32_t                    latency[TD_VBD_LATENCY_BUCKETS];
 };
 
 #define tapdisk_vbd_for_each_request(vreq, tmp, list)	                \
@@ -0,0 +1,262 @@
+/*
+ * tapdisk-vhd-stress.c
+ *
+ * Random-write benchmark for the VHD driver.  Aligned writes of a fixed
+ * size are scattered over a dynamic VHD through the same driver code
+ * tapdisk2 runs, so on a freshly created image nearly every write has to
+ * allocate a block first.  Reports IOPS, CPU time per write and how much
+ * the image grew.
+ *
+ * Usage: tapdisk-vhd-stress [-n ios] [-q depth] [-b bytes] [-l] image
+ *
+ * -l opens the image as LVM storage, i.e. without preallocation, to
+ * compare against the zero-bitmap allocation path.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "libvhd.h"
+#include "tapdisk.h"
+#include "tapdisk-image.h"
+#include "tapdisk-server.h"
+#include "tapdisk-disktype.h"
+#include "tapdisk-interface.h"
+
+#define DEFAULT_IOS        10000
+#define DEFAULT_DEPTH      32
+#define DEFAULT_BYTES      4096
+
+struct stress_write {
+	char              *buf;
+	int                secs;       /* sectors still outstanding */
+	int                blocked;
+	td_request_t       retry;      /* clone the driver bounced */
+};
+
+static td_image_t *image;
+static size_t      bytes;
+static uint64_t    nr_chunks;
+
+static uint64_t    issued;
+static uint64_t    completed;
+static uint64_t    total;
+static uint64_t    retries;
+static int         errors;
+
+static double
+now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static double
+cpu_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec * 1e6 + ru.ru_utime.tv_usec +
+		ru.ru_stime.tv_sec * 1e6 + ru.ru_stime.tv_usec;
+}
+
+static off_t
+image_size(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st))
+		return 0;
+
+	return st.st_blocks << VHD_SECTOR_SHIFT;
+}
+
+static void stress_complete(td_request_t treq, int err);
+
+static void
+stress_issue(struct stress_write *w)
+{
+	td_request_t treq;
+
+	memset(&treq, 0, sizeof(treq));
+	treq.op      = TD_OP_WRITE;
+	treq.buf     = w->buf;
+	treq.sec     = (random() % nr_chunks) * (bytes >> VHD_SECTOR_SHIFT);
+	treq.secs    = bytes >> VHD_SECTOR_SHIFT;
+	treq.image   = image;
+	treq.cb      = stress_complete;
+	treq.cb_data = w;
+
+	w->secs = treq.secs;
+	issued++;
+
+	td_queue_write(image, treq);
+}
+
+static void
+stress_complete(td_request_t treq, int err)
+{
+	struct stress_write *w = treq.cb_data;
+
+	/*
+	 * like the vbd, retry -EBUSY: the driver is waiting for room for
+	 * another new block, or for a free bitmap or request
+	 */
+	if (err == -EBUSY) {
+		w->retry   = treq;
+		w->blocked = 1;
+		retries++;
+		return;
+	}
+
+	if (err)
+		errors++;
+
+	w->secs -= treq.secs;
+	if (w->secs)
+		return;
+
+	completed++;
+	if (issued < total && !errors)
+		stress_issue(w);
+}
+
+static void
+stress_kick(struct stress_write *ws, int depth)
+{
+	int i;
+
+	for (i = 0; i < depth; i++) {
+		if (!ws[i].blocked)
+			continue;
+
+		ws[i].blocked = 0;
+		td_queue_write(image, ws[i].retry);
+	}
+}
+
+static void
+usage(const char *app, int err)
+{
+	fprintf(stderr, "usage: %s [-n ios] [-q depth] [-b bytes] [-l] "
+		"<image>\n", app);
+	exit(err);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct stress_write *ws;
+	int c, i, depth, storage, err;
+	double wall, cpu;
+	off_t before, after;
+	const char *path;
+
+	total   = DEFAULT_IOS;
+	depth   = DEFAULT_DEPTH;
+	bytes   = DEFAULT_BYTES;
+	storage = TAPDISK_STORAGE_TYPE_DEFAULT;
+
+	while ((c = getopt(argc, argv, "n:q:b:lh")) != -1) {
+		switch (c) {
+		case 'n':
+			total = strtoull(optarg, NULL, 0);
+			break;
+		case 'q':
+			depth = atoi(optarg);
+			break;
+		case 'b':
+			bytes = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			storage = TAPDISK_STORAGE_TYPE_LVM;
+			break;
+		case 'h':
+			usage(argv[0], 0);
+			break;
+		default:
+			usage(argv[0], EINVAL);
+		}
+	}
+
+	if (optind != argc - 1 || !total || depth <= 0 ||
+	    depth > TAPDISK_DATA_REQUESTS || !bytes ||
+	    bytes % VHD_SECTOR_SIZE || VHD_BLOCK_SIZE % bytes)
+		usage(argv[0], EINVAL);
+
+	path = argv[optind];
+
+	err = tapdisk_server_initialize();
+	if (err) {
+		fprintf(stderr, "failed to initialize server: %d\n", err);
+		return -err;
+	}
+
+	image = tapdisk_image_allocate(path, DISK_TYPE_VHD, storage, 0, NULL);
+	if (!image)
+		return ENOMEM;
+
+	err = td_open(image);
+	if (err) {
+		fprintf(stderr, "failed to open %s: %d\n", path, err);
+		return -err;
+	}
+
+	nr_chunks = (image->info.size << VHD_SECTOR_SHIFT) / bytes;
+	if (!nr_chunks) {
+		fprintf(stderr, "%s: too small\n", path);
+		return EINVAL;
+	}
+
+	ws = calloc(depth, sizeof(*ws));
+	if (!ws)
+		return ENOMEM;
+
+	for (i = 0; i < depth; i++) {
+		err = posix_memalign((void **)&ws[i].buf, 4096, bytes);
+		if (err)
+			return err;
+		memset(ws[i].buf, i + 1, bytes);
+	}
+
+	before = image_size(path);
+	wall   = now_us();
+	cpu    = cpu_us();
+
+	for (i = 0; i < depth && issued < total; i++)
+		stress_issue(&ws[i]);
+	tapdisk_server_submit_tiocbs();
+
+	while (completed < issued) {
+		tapdisk_server_iterate();
+		stress_kick(ws, depth);
+		tapdisk_server_submit_tiocbs();
+	}
+
+	wall = now_us() - wall;
+	cpu  = cpu_us() - cpu;
+
+	td_close(image);
+	tapdisk_image_free(image);
+	after = image_size(path);
+
+	printf("%s: %"PRIu64" random writes of %zu bytes, depth %d: "
+	       "%.0f IOPS, %.2f us CPU/IO, %"PRIu64" retries, %d errors, "
+	       "image grew by %"PRIu64" MB\n",
+	       storage == TAPDISK_STORAGE_TYPE_LVM ? "zero-bitmap" : "prealloc",
+	       completed, bytes, depth, completed * 1e6 / wall,
+	       cpu / completed, retries, errors,
+	       (uint64_t)(after - before) >> 20);
+
+	return errors ? EIO : 0;
+}
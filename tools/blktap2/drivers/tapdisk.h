@@ -110,6 +110,7 @@ typedef struct td_disk_info          td_disk_info_t;
 typedef struct td_request            td_request_t;
 typedef struct td_driver_handle      td_driver_t;
 typedef struct td_image_handle       td_image_t;
+typedef struct td_cache_stats        td_cache_stats_t;
 
 struct td_disk_id {
 	char                        *name;
@@ -153,6 +154,16 @@ typedef void (*td_callback_t)(td_request_t, int);
  * Structure describing the interface to a virtual disk implementation.
  * See note at the top of this file describing this interface.
  */
+/* counts in sectors, size in bytes */
+struct td_cache_stats {
+	uint64_t                     reads;
+	uint64_t                     hits;
+	uint64_t                     misses;
+	uint64_t                     evictions;
+	uint64_t                     readahead;
+	uint64_t                     size;
+};
+
 struct tap_disk {
 	const char                  *disk_type;
 	td_flag_t                    flags;
@@ -164,6 +175,7 @@ struct tap_disk {
 	void (*td_queue_read)        (td_driver_t *, td_request_t);
 	void (*td_queue_write)       (td_driver_t *, td_request_t);
 	void (*td_debug)             (td_driver_t *);
+	void (*td_cache_stats)       (td_driver_t *, td_cache_stats_t *);
 };
 
 #endif
@@ -36,6 +36,9 @@
 #define TAPDISK_MESSAGE_MAX_MINORS \
 	((TAPDISK_MESSAGE_MAX_PATH_LENGTH / sizeof(int)) - 1)
 
+/* latency bucket i counts requests completed in [2^(i-1), 2^i) usecs */
+#define TAPDISK_MESSAGE_LATENCY_BUCKETS  24
+
 #define TAPDISK_MESSAGE_FLAG_SHARED      0x01
 #define TAPDISK_MESSAGE_FLAG_RDONLY      0x02
 #define TAPDISK_MESSAGE_FLAG_ADD_CACHE   0x04
@@ -50,6 +53,7 @@ typedef struct tapdisk_message_string    tapdisk_message_string_t;
 typedef struct tapdisk_message_response  tapdisk_message_response_t;
 typedef struct tapdisk_message_minors    tapdisk_message_minors_t;
 typedef struct tapdisk_message_list      tapdisk_message_list_t;
+typedef struct tapdisk_message_stats     tapdisk_message_stats_t;
 
 struct tapdisk_message_params {
 	tapdisk_message_flag_t           flags;
@@ -88,6 +92,19 @@ struct tapdisk_message_list {
 	char                             path[TAPDISK_MESSAGE_MAX_PATH_LENGTH];
 };
 
+struct tapdisk_message_stats {
+	uint64_t                         requests;
+	uint64_t                         sectors;
+	uint64_t                         errors;
+	uint32_t                         latency[TAPDISK_MESSAGE_LATENCY_BUCKETS];
+
+	/* block cache, in sectors; all zero if the vbd has no cache */
+	uint64_t                         cache_hits;
+	uint64_t                         cache_misses;
+	uint64_t                         cache_evictions;
+	uint64_t                         cache_readahead;
+};
+
 struct tapdisk_message {
 	uint16_t                         type;
 	uint16_t                         cookie;
@@ -100,6 +117,7 @@ struct tapdisk_message {
 		tapdisk_message_minors_t minors;
 		tapdisk_message_response_t response;
 		tapdisk_message_list_t   list;
+		tapdisk_message_stats_t  stats;
 	} u;
 };
 
@@ -126,6 +144,10 @@ enum tapdisk_message_id {
 	TAPDISK_MESSAGE_LIST_RSP,
 	TAPDISK_MESSAGE_FORCE_SHUTDOWN,
 	TAPDISK_MESSAGE_EXIT,
+	TAPDISK_MESSAGE_AFFINITY,
+	TAPDISK_MESSAGE_AFFINITY_RSP,
+	TAPDISK_MESSAGE_STATS,
+	TAPDISK_MESSAGE_STATS_RSP,
 };
 
 static inline char *
@@ -195,6 +217,18 @@ tapdisk_message_name(enum tapdisk_message_id id)
 	case TAPDISK_MESSAGE_EXIT:
 		return "exit";
 
+	case TAPDISK_MESSAGE_AFFINITY:
+		return "affinity";
+
+	case TAPDISK_MESSAGE_AFFINITY_RSP:
+		return "affinity response";
+
+	case TAPDISK_MESSAGE_STATS:
+		return "stats";
+
+	case TAPDISK_MESSAGE_STATS_RSP:
+		return "stats response";
+
 	default:
 		return "unknown";
 	}
@@ -28,191 +28,773 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 
 #include "libvhd.h"
 
+/*
+ * Coalescing is done in two halves.  The calling thread walks the BAT
+ * block by block, reads the bitmaps of every image in the chain and
+ * resolves, for each sector, which image holds its newest copy.  Runs of
+ * sectors coming from the same image are merged into extents, across
+ * block boundaries where the source and destination are both
+ * contiguous, and handed to a pool of workers that copy them with large
+ * O_DIRECT reads and writes.
+ *
+ * When the target is a VHD, its bitmaps and BAT are only updated once
+ * all data of a batch of blocks is on disk: data, then bitmaps, then
+ * BAT, so an interrupted coalesce never exposes sectors that were not
+ * copied.  Running it again simply redoes the copy.
+ */
+
+#define COALESCE_DEFAULT_DEPTH     8
+#define COALESCE_MAX_DEPTH         64
+#define COALESCE_MAX_CHAIN         64
+#define COALESCE_BATCH             1024      /* blocks per metadata update */
+#define COALESCE_NO_OWNER          0xff
+
+struct coalesce_extent {
+	int                        fd;       /* image to copy from */
+	uint64_t                   src;      /* in sectors */
+	uint64_t                   dst;
+	uint32_t                   secs;
+};
+
+struct coalesce_bitmap {
+	uint32_t                   blk;
+	char                      *map;
+};
+
+struct coalesce_ctx {
+	int                        nr_chain;
+	vhd_context_t              chain[COALESCE_MAX_CHAIN];
+
+	int                        target_fd;
+	int                        target_raw;
+	vhd_context_t              target;
+	uint64_t                   target_end;  /* next free sector */
+	uint64_t                   disk_secs;
+
+	int                        bat_dirty;
+	int                        batmap_dirty;
+	int                        nr_bitmaps;
+	struct coalesce_bitmap     bitmaps[COALESCE_BATCH];
+
+	struct coalesce_extent     pending;     /* still being merged */
+
+	pthread_mutex_t            lock;
+	pthread_cond_t             more;        /* work queued, or done */
+	pthread_cond_t             less;        /* room, or a worker idle */
+	int                        depth;
+	int                        started;
+	pthread_t                  workers[COALESCE_MAX_DEPTH];
+	char                      *bufs[COALESCE_MAX_DEPTH];
+	struct coalesce_extent     queue[2 * COALESCE_MAX_DEPTH];
+	int                        head;
+	int                        count;
+	int                        busy;
+	int                        done;
+	int                        err;
+
+	int                        progress;
+	uint64_t                   copied;      /* in sectors */
+	double                     start;
+	double                     report;
+};
+
+static double
+coalesce_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
 static int
-__raw_io_write(int fd, char* buf, uint64_t sec, uint32_t secs)
+coalesce_copy(struct coalesce_ctx *c, struct coalesce_extent *ext, char *buf)
 {
-	off_t off;
-	size_t ret;
+	ssize_t ret;
+	size_t size;
 
-	errno = 0;
-	off = lseek(fd, vhd_sectors_to_bytes(sec), SEEK_SET);
-	if (off == (off_t)-1) {
-		printf("raw parent: seek(0x%08"PRIx64") failed: %d\n",
-		       vhd_sectors_to_bytes(sec), -errno);
-		return -errno;
+	size = vhd_sectors_to_bytes(ext->secs);
+
+	ret = pread(ext->fd, buf, size, vhd_sectors_to_bytes(ext->src));
+	if (ret != size) {
+		printf("read of 0x%zx at 0x%08"PRIx64" returned %zd, "
+		       "errno: %d\n", size, ext->src, ret, -errno);
+		return (ret == -1 ? -errno : -EIO);
+	}
+
+	ret = pwrite(c->target_fd, buf, size, vhd_sectors_to_bytes(ext->dst));
+	if (ret != size) {
+		printf("write of 0x%zx at 0x%08"PRIx64" returned %zd, "
+		       "errno: %d\n", size, ext->dst, ret, -errno);
+		return (ret == -1 ? -errno : -EIO);
+	}
+
+	return 0;
+}
+
+static void *
+coalesce_worker(void *arg)
+{
+	int err;
+	char *buf;
+	struct coalesce_extent ext;
+	struct coalesce_ctx *c = arg;
+
+	pthread_mutex_lock(&c->lock);
+	buf = c->bufs[c->started++];
+
+	for (;;) {
+		while (!c->count && !c->done)
+			pthread_cond_wait(&c->more, &c->lock);
+
+		if (!c->count)
+			break;
+
+		ext      = c->queue[c->head];
+		c->head  = (c->head + 1) % (2 * c->depth);
+		c->count--;
+		c->busy++;
+		pthread_cond_broadcast(&c->less);
+
+		/* after a failure, just empty the queue */
+		if (c->err)
+			err = 0;
+		else {
+			pthread_mutex_unlock(&c->lock);
+			err = coalesce_copy(c, &ext, buf);
+			pthread_mutex_lock(&c->lock);
+		}
+
+		if (err && !c->err)
+			c->err = err;
+		if (!err)
+			c->copied += ext.secs;
+
+		c->busy--;
+		pthread_cond_broadcast(&c->less);
+	}
+
+	pthread_mutex_unlock(&c->lock);
+	return NULL;
+}
+
+static int
+coalesce_start_workers(struct coalesce_ctx *c)
+{
+	int i, err;
+	size_t size;
+
+	size = vhd_sectors_to_bytes(c->chain[0].spb);
+
+	for (i = 0; i < c->depth; i++) {
+		err = posix_memalign((void **)&c->bufs[i], 4096, size);
+		if (err) {
+			c->bufs[i] = NULL;
+			return -err;
+		}
 	}
 
-	ret = write(fd, buf, vhd_sectors_to_bytes(secs));
-	if (ret == vhd_sectors_to_bytes(secs))
+	for (i = 0; i < c->depth; i++) {
+		err = pthread_create(&c->workers[i], NULL, coalesce_worker, c);
+		if (err) {
+			c->depth = i;
+			return -err;
+		}
+	}
+
+	return 0;
+}
+
+static void
+coalesce_stop_workers(struct coalesce_ctx *c)
+{
+	int i;
+
+	pthread_mutex_lock(&c->lock);
+	c->done = 1;
+	pthread_cond_broadcast(&c->more);
+	pthread_mutex_unlock(&c->lock);
+
+	for (i = 0; i < c->depth; i++)
+		pthread_join(c->workers[i], NULL);
+
+	for (i = 0; i < COALESCE_MAX_DEPTH; i++)
+		free(c->bufs[i]);
+}
+
+static int
+coalesce_queue_extent(struct coalesce_ctx *c, struct coalesce_extent *ext)
+{
+	int err;
+
+	pthread_mutex_lock(&c->lock);
+
+	while (c->count == 2 * c->depth && !c->err)
+		pthread_cond_wait(&c->less, &c->lock);
+
+	err = c->err;
+	if (!err) {
+		c->queue[(c->head + c->count) % (2 * c->depth)] = *ext;
+		c->count++;
+		pthread_cond_signal(&c->more);
+	}
+
+	pthread_mutex_unlock(&c->lock);
+	return err;
+}
+
+/* wait until every queued extent has been copied */
+static int
+coalesce_drain(struct coalesce_ctx *c)
+{
+	int err;
+
+	pthread_mutex_lock(&c->lock);
+	while ((c->count || c->busy) && !c->err)
+		pthread_cond_wait(&c->less, &c->lock);
+	err = c->err;
+	pthread_mutex_unlock(&c->lock);
+
+	return err;
+}
+
+static int
+coalesce_flush_extent(struct coalesce_ctx *c)
+{
+	int err;
+
+	if (!c->pending.secs)
 		return 0;
 
-	printf("raw parent: write of 0x%"PRIx64" returned %zd, errno: %d\n",
-	       vhd_sectors_to_bytes(secs), ret, -errno);
-	return (errno ? -errno : -EIO);
+	err = coalesce_queue_extent(c, &c->pending);
+	c->pending.secs = 0;
+
+	return err;
+}
+
+static int
+coalesce_add_extent(struct coalesce_ctx *c, int fd,
+		    uint64_t src, uint64_t dst, uint32_t secs)
+{
+	int err;
+	struct coalesce_extent *p = &c->pending;
+
+	if (p->secs && p->fd == fd &&
+	    p->src + p->secs == src && p->dst + p->secs == dst &&
+	    p->secs + secs <= c->chain[0].spb) {
+		p->secs += secs;
+		return 0;
+	}
+
+	err = coalesce_flush_extent(c);
+	if (err)
+		return err;
+
+	p->fd   = fd;
+	p->src  = src;
+	p->dst  = dst;
+	p->secs = secs;
+
+	return 0;
 }
 
 /*
- * Use 'parent' if the parent is VHD, and 'parent_fd' if the parent is raw
+ * find (or allocate) @blk in a VHD target and fold the sectors about to
+ * be copied into its bitmap.  new blocks are placed after the last one,
+ * with the data region page aligned as libvhd and tapdisk do.
  */
 static int
-vhd_util_coalesce_block(vhd_context_t *vhd, vhd_context_t *parent,
-		int parent_fd, uint64_t block)
+coalesce_target_block(struct coalesce_ctx *c, uint32_t blk,
+		      uint8_t *owner, uint32_t secs, uint64_t *base)
 {
-	int i, err;
-	char *buf, *map;
-	uint64_t sec, secs;
+	int err, spp, gap;
+	uint32_t i;
+	char *map;
+	vhd_context_t *t = &c->target;
+
+	if (blk >= t->bat.entries) {
+		printf("block %u beyond end of %s\n", blk, t->file);
+		return -ERANGE;
+	}
 
-	buf = NULL;
 	map = NULL;
-	sec = block * vhd->spb;
 
-	if (vhd->bat.bat[block] == DD_BLK_UNUSED)
-		return 0;
+	if (t->bat.bat[blk] == DD_BLK_UNUSED) {
+		spp = getpagesize() >> VHD_SECTOR_SHIFT;
+		gap = (c->target_end + t->bm_secs) % spp;
+		if (gap)
+			c->target_end += spp - gap;
 
-	err = posix_memalign((void **)&buf, 4096, vhd->header.block_size);
-	if (err)
-		return -err;
+		t->bat.bat[blk]  = c->target_end;
+		c->target_end   += t->bm_secs + t->spb;
+		c->bat_dirty     = 1;
 
-	err = vhd_io_read(vhd, buf, sec, vhd->spb);
-	if (err)
-		goto done;
+		err = posix_memalign((void **)&map, VHD_SECTOR_SIZE,
+				     vhd_sectors_to_bytes(t->bm_secs));
+		if (err)
+			return -err;
+		memset(map, 0, vhd_sectors_to_bytes(t->bm_secs));
 
-	if (vhd_has_batmap(vhd) && vhd_batmap_test(vhd, &vhd->batmap, block)) {
-		if (parent->file)
-			err = vhd_io_write(parent, buf, sec, vhd->spb);
-		else
-			err = __raw_io_write(parent_fd, buf, sec, vhd->spb);
-		goto done;
+	} else if (!vhd_has_batmap(t) ||
+		   !vhd_batmap_test(t, &t->batmap, blk)) {
+		err = vhd_read_bitmap(t, blk, &map);
+		if (err)
+			return err;
 	}
 
-	err = vhd_read_bitmap(vhd, block, &map);
-	if (err)
-		goto done;
+	if (map) {
+		for (i = 0; i < secs; i++)
+			if (owner[i] != COALESCE_NO_OWNER)
+				vhd_bitmap_set(t, map, i);
 
-	for (i = 0; i < vhd->spb; i++) {
-		if (!vhd_bitmap_test(vhd, map, i))
+		c->bitmaps[c->nr_bitmaps].blk = blk;
+		c->bitmaps[c->nr_bitmaps].map = map;
+		c->nr_bitmaps++;
+	}
+
+	*base = t->bat.bat[blk] + t->bm_secs;
+	return 0;
+}
+
+static int
+coalesce_scan_block(struct coalesce_ctx *c, uint32_t blk, uint8_t *owner)
+{
+	int i, err, full;
+	char *map;
+	uint64_t base;
+	uint32_t sec, end, secs, claimed;
+	vhd_context_t *vhd;
+
+	secs    = MIN(c->chain[0].spb,
+		      c->disk_secs - (uint64_t)blk * c->chain[0].spb);
+	claimed = 0;
+	memset(owner, COALESCE_NO_OWNER, secs);
+
+	for (i = 0; i < c->nr_chain && claimed < secs; i++) {
+		vhd = &c->chain[i];
+
+		if (blk >= vhd->bat.entries ||
+		    vhd->bat.bat[blk] == DD_BLK_UNUSED)
 			continue;
 
-		for (secs = 0; i + secs < vhd->spb; secs++)
-			if (!vhd_bitmap_test(vhd, map, i + secs))
-				break;
+		map  = NULL;
+		full = (vhd_has_batmap(vhd) &&
+			vhd_batmap_test(vhd, &vhd->batmap, blk));
+
+		if (!full) {
+			err = vhd_read_bitmap(vhd, blk, &map);
+			if (err) {
+				printf("error reading %s bitmap %u: %d\n",
+				       vhd->file, blk, err);
+				return err;
+			}
+		}
 
-		if (parent->file)
-			err = vhd_io_write(parent,
-					   buf + vhd_sectors_to_bytes(i),
-					   sec + i, secs);
-		else
-			err = __raw_io_write(parent_fd,
-					     buf + vhd_sectors_to_bytes(i),
-					     sec + i, secs);
-		if (err)
-			goto done;
+		for (sec = 0; sec < secs; sec++)
+			if (owner[sec] == COALESCE_NO_OWNER &&
+			    (full || vhd_bitmap_test(vhd, map, sec))) {
+				owner[sec] = i;
+				claimed++;
+			}
 
-		i += secs;
+		free(map);
 	}
 
-	err = 0;
+	if (!claimed)
+		return 0;
 
-done:
-	free(buf);
-	free(map);
-	return err;
+	if (c->target_raw)
+		base = (uint64_t)blk * c->chain[0].spb;
+	else {
+		err = coalesce_target_block(c, blk, owner, secs, &base);
+		if (err)
+			return err;
+	}
+
+	for (sec = 0; sec < secs; sec = end) {
+		if (owner[sec] == COALESCE_NO_OWNER) {
+			end = sec + 1;
+			continue;
+		}
+
+		for (end = sec + 1; end < secs; end++)
+			if (owner[end] != owner[sec])
+				break;
+
+		vhd = &c->chain[owner[sec]];
+		err = coalesce_add_extent(c, vhd->fd,
+					  vhd->bat.bat[blk] + vhd->bm_secs + sec,
+					  base + sec, end - sec);
+		if (err)
+			return err;
+	}
+
+	return 0;
 }
 
-int
-vhd_util_coalesce(int argc, char **argv)
+static void
+coalesce_free_bitmaps(struct coalesce_ctx *c)
 {
-	int err, c;
-	uint64_t i;
-	char *name, *pname;
-	vhd_context_t vhd, parent;
-	int parent_fd = -1;
+	int i;
 
-	name  = NULL;
-	pname = NULL;
-	parent.file = NULL;
+	for (i = 0; i < c->nr_bitmaps; i++)
+		free(c->bitmaps[i].map);
 
-	if (!argc || !argv)
-		goto usage;
+	c->nr_bitmaps = 0;
+}
 
-	optind = 0;
-	while ((c = getopt(argc, argv, "n:h")) != -1) {
-		switch (c) {
-		case 'n':
-			name = optarg;
+/* data first, then bitmaps, then the BAT entries pointing at them */
+static int
+coalesce_commit(struct coalesce_ctx *c)
+{
+	int i, err;
+	vhd_context_t *t = &c->target;
+	struct coalesce_bitmap *bm;
+
+	err = coalesce_flush_extent(c);
+	if (!err)
+		err = coalesce_drain(c);
+
+	for (i = 0; i < c->nr_bitmaps && !err; i++) {
+		bm  = c->bitmaps + i;
+		err = vhd_write_bitmap(t, bm->blk, bm->map);
+		if (err) {
+			printf("error writing %s bitmap %u: %d\n",
+			       t->file, bm->blk, err);
 			break;
-		case 'h':
-		default:
-			goto usage;
+		}
+
+		if (vhd_has_batmap(t)) {
+			uint32_t sec;
+
+			for (sec = 0; sec < t->spb; sec++)
+				if (!vhd_bitmap_test(t, bm->map, sec))
+					break;
+
+			if (sec == t->spb) {
+				vhd_batmap_set(t, &t->batmap, bm->blk);
+				c->batmap_dirty = 1;
+			}
 		}
 	}
 
-	if (!name || optind != argc)
-		goto usage;
+	coalesce_free_bitmaps(c);
+
+	if (!err && c->bat_dirty) {
+		err = vhd_write_bat(t, &t->bat);
+		if (err)
+			printf("error writing %s bat: %d\n", t->file, err);
+		c->bat_dirty = 0;
+	}
+
+	return err;
+}
+
+static void
+coalesce_report(struct coalesce_ctx *c, uint32_t blk, int final)
+{
+	double now, mb;
+
+	if (!c->progress)
+		return;
+
+	now = coalesce_now();
+	if (!final && now - c->report < 1)
+		return;
+
+	pthread_mutex_lock(&c->lock);
+	mb = vhd_sectors_to_bytes(c->copied) / (double)(1 << 20);
+	pthread_mutex_unlock(&c->lock);
+
+	c->report = now;
+	now      -= c->start;
+
+	if (final)
+		printf("coalesced %.0f MB from %d image%s in %.1f s "
+		       "(%.1f MB/s)\n", mb, c->nr_chain,
+		       c->nr_chain > 1 ? "s" : "", now, now ? mb / now : 0);
+	else
+		printf("%u/%u blocks, %.0f MB, %.1f MB/s\n",
+		       blk, c->chain[0].bat.entries, mb, now ? mb / now : 0);
+	fflush(stdout);
+}
+
+static int
+coalesce_same_file(const char *a, const char *b)
+{
+	struct stat sa, sb;
+
+	if (stat(a, &sa) || stat(b, &sb))
+		return 0;
+
+	return (sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino);
+}
+
+static int
+coalesce_open_image(vhd_context_t *vhd, const char *name, int flags)
+{
+	int err;
 
-	err = vhd_open(&vhd, name, VHD_OPEN_RDONLY);
+	err = vhd_open(vhd, name, flags);
 	if (err) {
 		printf("error opening %s: %d\n", name, err);
 		return err;
 	}
 
-	err = vhd_parent_locator_get(&vhd, &pname);
+	err = vhd_get_bat(vhd);
+	if (!err && vhd_has_batmap(vhd))
+		err = vhd_get_batmap(vhd);
 	if (err) {
-		printf("error finding %s parent: %d\n", name, err);
-		vhd_close(&vhd);
-		return err;
+		printf("error reading %s metadata: %d\n", name, err);
+		vhd_close(vhd);
 	}
 
-	if (vhd_parent_raw(&vhd)) {
-		parent_fd = open(pname, O_RDWR | O_DIRECT | O_LARGEFILE, 0644);
-		if (parent_fd == -1) {
+	return err;
+}
+
+/*
+ * open @name and its ancestors, up to but excluding @ancestor (or just
+ * @name when no ancestor is given), then the image they coalesce into.
+ */
+static int
+coalesce_open_chain(struct coalesce_ctx *c, const char *name,
+		    const char *ancestor)
+{
+	int err;
+	char *path, *pname;
+	vhd_context_t *vhd;
+
+	if (ancestor && access(ancestor, F_OK)) {
+		printf("error opening %s: %d\n", ancestor, -errno);
+		return -errno;
+	}
+
+	path  = strdup(name);
+	pname = NULL;
+	if (!path)
+		return -ENOMEM;
+
+	for (;;) {
+		if (c->nr_chain == COALESCE_MAX_CHAIN) {
+			printf("chain of %s is too long\n", name);
+			err = -E2BIG;
+			goto out;
+		}
+
+		vhd = &c->chain[c->nr_chain];
+		err = coalesce_open_image(vhd, path, VHD_OPEN_RDONLY);
+		if (err)
+			goto out;
+		c->nr_chain++;
+
+		if (vhd->spb != c->chain[0].spb) {
+			printf("%s: block size differs from %s\n", path, name);
+			err = -EINVAL;
+			goto out;
+		}
+
+		err = vhd_parent_locator_get(vhd, &pname);
+		if (err) {
+			printf("error finding %s parent: %d\n", path, err);
+			goto out;
+		}
+
+		if (!ancestor || coalesce_same_file(pname, ancestor))
+			break;
+
+		if (vhd_parent_raw(vhd)) {
+			printf("%s is not an ancestor of %s\n", ancestor, name);
+			err = -EINVAL;
+			goto out;
+		}
+
+		free(path);
+		path  = pname;
+		pname = NULL;
+	}
+
+	if (vhd_parent_raw(vhd)) {
+		c->target_raw = 1;
+		c->target_fd  = open(pname, O_RDWR | O_DIRECT | O_LARGEFILE, 0644);
+		if (c->target_fd == -1) {
 			err = -errno;
 			printf("failed to open parent %s: %d\n", pname, err);
-			vhd_close(&vhd);
-			return err;
+			goto out;
 		}
 	} else {
-		err = vhd_open(&parent, pname, VHD_OPEN_RDWR);
-		if (err) {
-			printf("error opening %s: %d\n", pname, err);
-			free(pname);
-			vhd_close(&vhd);
-			return err;
+		err = coalesce_open_image(&c->target, pname, VHD_OPEN_RDWR);
+		if (err)
+			goto out;
+
+		if (c->target.spb != c->chain[0].spb) {
+			printf("%s: block size differs from %s\n", pname, name);
+			err = -EINVAL;
+			goto out;
 		}
+
+		c->target_fd = c->target.fd;
 	}
 
-	err = vhd_get_bat(&vhd);
+	err = 0;
+
+ out:
+	free(path);
+	free(pname);
+	return err;
+}
+
+static void
+coalesce_close_chain(struct coalesce_ctx *c)
+{
+	int i;
+
+	for (i = 0; i < c->nr_chain; i++)
+		vhd_close(&c->chain[i]);
+
+	if (c->target.file)
+		vhd_close(&c->target);
+	else if (c->target_fd != -1)
+		close(c->target_fd);
+}
+
+static int
+coalesce_run(struct coalesce_ctx *c)
+{
+	int err;
+	off_t end;
+	uint32_t blk;
+	uint8_t *owner;
+
+	c->disk_secs = c->chain[0].footer.curr_size >> VHD_SECTOR_SHIFT;
+
+	if (!c->target_raw) {
+		err = vhd_end_of_data(&c->target, &end);
+		if (err)
+			return err;
+		c->target_end = end >> VHD_SECTOR_SHIFT;
+	}
+
+	owner = malloc(c->chain[0].spb);
+	if (!owner)
+		return -ENOMEM;
+
+	err = coalesce_start_workers(c);
 	if (err)
-		goto done;
+		goto out;
+
+	c->start = c->report = coalesce_now();
+
+	for (blk = 0; blk < c->chain[0].bat.entries; blk++) {
+		if ((uint64_t)blk * c->chain[0].spb >= c->disk_secs)
+			break;
 
-	if (vhd_has_batmap(&vhd)) {
-		err = vhd_get_batmap(&vhd);
+		err = coalesce_scan_block(c, blk, owner);
 		if (err)
-			goto done;
+			goto out;
+
+		if (c->nr_bitmaps == COALESCE_BATCH) {
+			err = coalesce_commit(c);
+			if (err)
+				goto out;
+		}
+
+		coalesce_report(c, blk, 0);
 	}
 
-	for (i = 0; i < vhd.bat.entries; i++) {
-		err = vhd_util_coalesce_block(&vhd, &parent, parent_fd, i);
+	err = coalesce_commit(c);
+	if (err)
+		goto out;
+
+	if (!c->target_raw) {
+		if (c->batmap_dirty) {
+			err = vhd_write_batmap(&c->target, &c->target.batmap);
+			if (err)
+				goto out;
+		}
+
+		err = vhd_write_footer(&c->target, &c->target.footer);
 		if (err)
-			goto done;
+			goto out;
 	}
 
-	err = 0;
+	coalesce_report(c, blk, 1);
 
- done:
-	free(pname);
-	vhd_close(&vhd);
-	if (parent.file)
-		vhd_close(&parent);
-	else
-		close(parent_fd);
+ out:
+	coalesce_stop_workers(c);
+	coalesce_free_bitmaps(c);
+	free(owner);
+	return err;
+}
+
+int
+vhd_util_coalesce(int argc, char **argv)
+{
+	int err, c;
+	char *name, *ancestor;
+	struct coalesce_ctx *ctx;
+
+	name     = NULL;
+	ancestor = NULL;
+
+	if (!argc || !argv)
+		goto usage;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -ENOMEM;
+
+	ctx->target_fd = -1;
+	ctx->depth     = COALESCE_DEFAULT_DEPTH;
+
+	optind = 0;
+	while ((c = getopt(argc, argv, "n:a:q:ph")) != -1) {
+		switch (c) {
+		case 'n':
+			name = optarg;
+			break;
+		case 'a':
+			ancestor = optarg;
+			break;
+		case 'q':
+			ctx->depth = strtol(optarg, NULL, 10);
+			break;
+		case 'p':
+			ctx->progress = 1;
+			break;
+		case 'h':
+		default:
+			goto usage_free;
+		}
+	}
+
+	if (!name || optind != argc ||
+	    ctx->depth < 1 || ctx->depth > COALESCE_MAX_DEPTH)
+		goto usage_free;
+
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_cond_init(&ctx->more, NULL);
+	pthread_cond_init(&ctx->less, NULL);
+
+	err = coalesce_open_chain(ctx, name, ancestor);
+	if (!err)
+		err = coalesce_run(ctx);
+
+	coalesce_close_chain(ctx);
+	free(ctx);
 	return err;
 
+usage_free:
+	free(ctx);
 usage:
-	printf("options: <-n name> [-h help]\n");
+	printf("options: <-n name> [-a ancestor] [-q queue depth (1-%d)] "
+	       "[-p print progress] [-h help]\n", COALESCE_MAX_DEPTH);
 	return -EINVAL;
 }
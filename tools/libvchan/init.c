@@ -62,20 +62,49 @@
 #define MAX_LARGE_RING (1 << LARGE_RING_SHIFT)
 #define LARGE_RING_OFFSET 2048
 
-// if you go over this size, you'll have too many grants to fit in the shared page.
-#define MAX_RING_SHIFT 20
+// the largest ring whose grant list still fits in the shared page next to
+// a one-page ring on the other side; ring_grants_fit() has the exact rule.
+#define MAX_RING_SHIFT 21
 #define MAX_RING_SIZE (1 << MAX_RING_SHIFT)
 
 #ifndef offsetof
 #define offsetof(TYPE, MEMBER) ((size_t) &((TYPE *)0)->MEMBER)
 #endif
 
+static int ring_grants(int order)
+{
+	return order >= PAGE_SHIFT ? 1 << (order - PAGE_SHIFT) : 0;
+}
+
+static size_t ring_offset(int order)
+{
+	switch (order) {
+	case SMALL_RING_SHIFT:
+		return SMALL_RING_OFFSET;
+	case LARGE_RING_SHIFT:
+		return LARGE_RING_OFFSET;
+	default:
+		return PAGE_SIZE;
+	}
+}
+
+/*
+ * The grant list of both rings has to fit in the shared page, and must not
+ * run into a ring that lives in that page.
+ */
+static int ring_grants_fit(int left_order, int right_order)
+{
+	size_t end = offsetof(struct vchan_interface, grants) +
+		(ring_grants(left_order) + ring_grants(right_order)) * sizeof(uint32_t);
+	return end <= ring_offset(left_order) && end <= ring_offset(right_order);
+}
+
 #define max(a,b) ((a > b) ? a : b)
 
 static int init_gnt_srv(struct libxenvchan *ctrl, int domain)
 {
-	int pages_left = ctrl->read.order >= PAGE_SHIFT ? 1 << (ctrl->read.order - PAGE_SHIFT) : 0;
-	int pages_right = ctrl->write.order >= PAGE_SHIFT ? 1 << (ctrl->write.order - PAGE_SHIFT) : 0;
+	int pages_left = ring_grants(ctrl->read.order);
+	int pages_right = ring_grants(ctrl->write.order);
 	uint32_t ring_ref = -1;
 	void *ring;
 
@@ -160,6 +189,8 @@ static int init_gnt_cli(struct libxenvchan *ctrl, int domain, uint32_t ring_ref)
 		goto out_unmap_ring;
 	if (ctrl->read.order == ctrl->write.order && ctrl->read.order < PAGE_SHIFT)
 		goto out_unmap_ring;
+	if (!ring_grants_fit(ctrl->write.order, ctrl->read.order))
+		goto out_unmap_ring;
 
 	grants = ctrl->ring->grants;
 
@@ -297,10 +328,34 @@ static int min_order(size_t siz)
 struct libxenvchan *libxenvchan_server_init(xentoollog_logger *logger, int domain, const char* xs_path, size_t left_min, size_t right_min)
 {
 	struct libxenvchan *ctrl;
-	int ring_ref;
+	int ring_ref, read_order, write_order;
 	if (left_min > MAX_RING_SIZE || right_min > MAX_RING_SIZE)
 		return 0;
 
+	read_order = min_order(left_min);
+	write_order = min_order(right_min);
+
+	// if we can avoid allocating extra pages by using in-page rings, do so
+	if (left_min <= MAX_SMALL_RING && right_min <= MAX_LARGE_RING) {
+		read_order = SMALL_RING_SHIFT;
+		write_order = LARGE_RING_SHIFT;
+	} else if (left_min <= MAX_LARGE_RING && right_min <= MAX_SMALL_RING) {
+		read_order = LARGE_RING_SHIFT;
+		write_order = SMALL_RING_SHIFT;
+	} else if (left_min <= MAX_LARGE_RING) {
+		read_order = LARGE_RING_SHIFT;
+	} else if (right_min <= MAX_LARGE_RING) {
+		write_order = LARGE_RING_SHIFT;
+	}
+
+	// a big ring's grant list may not leave room for the other one in-page
+	if (!ring_grants_fit(read_order, write_order)) {
+		read_order = max(read_order, PAGE_SHIFT);
+		write_order = max(write_order, PAGE_SHIFT);
+	}
+	if (!ring_grants_fit(read_order, write_order))
+		return 0;
+
 	ctrl = malloc(sizeof(*ctrl));
 	if (!ctrl)
 		return 0;
@@ -309,22 +364,10 @@ struct libxenvchan *libxenvchan_server_init(xentoollog_logger *logger, int domai
 	ctrl->event = NULL;
 	ctrl->is_server = 1;
 	ctrl->server_persist = 0;
+	ctrl->spin = ctrl->spin_max = 0;
 
-	ctrl->read.order = min_order(left_min);
-	ctrl->write.order = min_order(right_min);
-
-	// if we can avoid allocating extra pages by using in-page rings, do so
-	if (left_min <= MAX_SMALL_RING && right_min <= MAX_LARGE_RING) {
-		ctrl->read.order = SMALL_RING_SHIFT;
-		ctrl->write.order = LARGE_RING_SHIFT;
-	} else if (left_min <= MAX_LARGE_RING && right_min <= MAX_SMALL_RING) {
-		ctrl->read.order = LARGE_RING_SHIFT;
-		ctrl->write.order = SMALL_RING_SHIFT;
-	} else if (left_min <= MAX_LARGE_RING) {
-		ctrl->read.order = LARGE_RING_SHIFT;
-	} else if (right_min <= MAX_LARGE_RING) {
-		ctrl->write.order = LARGE_RING_SHIFT;
-	}
+	ctrl->read.order = read_order;
+	ctrl->write.order = write_order;
 
 	ctrl->gntshr = xc_gntshr_open(logger, 0);
 	if (!ctrl->gntshr)
@@ -389,6 +432,7 @@ struct libxenvchan *libxenvchan_client_init(xentoollog_logger *logger, int domai
 	ctrl->gnttab = NULL;
 	ctrl->write.order = ctrl->read.order = 0;
 	ctrl->is_server = 0;
+	ctrl->spin = ctrl->spin_max = 0;
 
 	xs = xs_daemon_open();
 	if (!xs)
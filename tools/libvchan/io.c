@@ -49,6 +49,15 @@
 #define PAGE_SIZE 4096
 #endif
 
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() asm volatile ( "rep; nop" ::: "memory" )
+#else
+#define cpu_relax() xen_mb()
+#endif
+
+/* a spinning waiter never backs off below this many polls */
+#define SPIN_MIN 64
+
 
 static inline uint32_t rd_prod(struct libxenvchan *ctrl)
 {
@@ -202,6 +211,67 @@ int libxenvchan_wait(struct libxenvchan *ctrl)
 	return 0;
 }
 
+/*
+ * Poll avail() without asking the peer for notifications, so that a peer
+ * which keeps the ring moving never has to kick us. A spin that succeeds
+ * doubles the budget for next time and one that runs out halves it.
+ */
+static int spin_wait(struct libxenvchan *ctrl, int (*avail)(struct libxenvchan *),
+		size_t request)
+{
+	unsigned int i;
+
+	if (!ctrl->spin_max)
+		return 0;
+	if (ctrl->spin > ctrl->spin_max)
+		ctrl->spin = ctrl->spin_max;
+	if (ctrl->spin < SPIN_MIN)
+		ctrl->spin = SPIN_MIN;
+
+	for (i = 0; i < ctrl->spin; i++) {
+		if (avail(ctrl) >= request) {
+			ctrl->spin *= 2;
+			return 1;
+		}
+		if (!libxenvchan_is_open(ctrl))
+			return 0;
+		cpu_relax();
+	}
+	ctrl->spin /= 2;
+	return 0;
+}
+
+/*
+ * Wait until avail() reports at least request bytes: spin first, then ask
+ * for the $bit notification and block on the event channel.
+ *
+ * Returns the amount available, 0 if nonblocking, or -1 on error.
+ */
+static int wait_avail(struct libxenvchan *ctrl, int (*avail)(struct libxenvchan *),
+		uint8_t bit, size_t request)
+{
+	int ready;
+
+	while (1) {
+		ready = avail(ctrl);
+		if (ready >= request)
+			return ready;
+		if (!libxenvchan_is_open(ctrl))
+			return -1;
+		if (ctrl->blocking && spin_wait(ctrl, avail, request))
+			continue;
+		request_notify(ctrl, bit);
+		/* the peer may have moved its index before seeing the request */
+		ready = avail(ctrl);
+		if (ready >= request)
+			return ready;
+		if (!ctrl->blocking)
+			return 0;
+		if (libxenvchan_wait(ctrl))
+			return -1;
+	}
+}
+
 /**
  * returns -1 on error, or size on success
  *
@@ -341,6 +411,69 @@ int libxenvchan_read(struct libxenvchan *ctrl, void *data, size_t size)
 	}
 }
 
+static void ring_iov(void *ring, uint32_t idx, uint32_t ring_size,
+		struct iovec iov[2], size_t size)
+{
+	uint32_t real_idx = idx & (ring_size - 1);
+	size_t avail_contig = ring_size - real_idx;
+	if (avail_contig > size)
+		avail_contig = size;
+	iov[0].iov_base = ring + real_idx;
+	iov[0].iov_len = avail_contig;
+	iov[1].iov_base = ring;
+	iov[1].iov_len = size - avail_contig;
+}
+
+int libxenvchan_write_reserve(struct libxenvchan *ctrl, struct iovec iov[2], size_t size)
+{
+	int avail;
+	if (!libxenvchan_is_open(ctrl))
+		return -1;
+	if (size > wr_ring_size(ctrl))
+		return -1;
+	avail = wait_avail(ctrl, raw_get_buffer_space, VCHAN_NOTIFY_READ, size);
+	if (avail <= 0)
+		return avail;
+	xen_mb(); /* read indexes /then/ write data */
+	ring_iov(wr_ring(ctrl), wr_prod(ctrl), wr_ring_size(ctrl), iov, avail);
+	return avail;
+}
+
+int libxenvchan_write_commit(struct libxenvchan *ctrl, size_t size)
+{
+	if (size > raw_get_buffer_space(ctrl))
+		return -1;
+	xen_wmb(); /* write data /then/ notify */
+	wr_prod(ctrl) += size;
+	if (send_notify(ctrl, VCHAN_NOTIFY_WRITE))
+		return -1;
+	return 0;
+}
+
+int libxenvchan_read_peek(struct libxenvchan *ctrl, struct iovec iov[2], size_t size)
+{
+	int avail;
+	if (size > rd_ring_size(ctrl))
+		return -1;
+	avail = wait_avail(ctrl, raw_get_data_ready, VCHAN_NOTIFY_WRITE, size ? : 1);
+	if (avail <= 0)
+		return avail;
+	xen_rmb(); /* data read must happen /after/ rd_prod read */
+	ring_iov((void *)rd_ring(ctrl), rd_cons(ctrl), rd_ring_size(ctrl), iov, avail);
+	return avail;
+}
+
+int libxenvchan_read_consume(struct libxenvchan *ctrl, size_t size)
+{
+	if (size > raw_get_data_ready(ctrl))
+		return -1;
+	xen_mb(); /* consume /then/ notify */
+	rd_cons(ctrl) += size;
+	if (send_notify(ctrl, VCHAN_NOTIFY_READ))
+		return -1;
+	return 0;
+}
+
 int libxenvchan_is_open(struct libxenvchan* ctrl)
 {
 	if (ctrl->is_server)
@@ -43,6 +43,7 @@
  *  compile time, so the macros in ring.h cannot be used to access the rings.
  */
 
+#include <sys/uio.h>
 #include <xen/io/libxenvchan.h>
 #include <xen/sys/evtchn.h>
 #include <xenctrl.h>
@@ -82,6 +83,12 @@ struct libxenvchan {
 	int blocking:1;
 	/* communication rings */
 	struct libxenvchan_ring read, write;
+	/**
+	 * Blocking zero-copy calls poll the shared indexes up to $spin times
+	 * before asking the peer for an event; the budget adapts between a
+	 * small floor and spin_max. Zero (the default) never spins.
+	 */
+	unsigned int spin, spin_max;
 };
 
 /**
@@ -146,6 +153,38 @@ int libxenvchan_send(struct libxenvchan *ctrl, const void *data, size_t size);
  *         the vchan is nonblocking)
  */
 int libxenvchan_write(struct libxenvchan *ctrl, const void *data, size_t size);
+/**
+ * Zero-copy send: expose free ring space for the caller to fill in place.
+ * Nothing is visible to the peer until libxenvchan_write_commit().
+ * @param ctrl The vchan control structure
+ * @param iov Set to the free space; iov[1] is empty unless it wraps
+ * @param size The minimum amount of space needed
+ * @return -1 on error, 0 if nonblocking and less than $size is free, or the
+ *         total amount of free space described by iov (at least $size)
+ */
+int libxenvchan_write_reserve(struct libxenvchan *ctrl, struct iovec iov[2], size_t size);
+/**
+ * Publish the first $size bytes of reserved space and notify the peer if it
+ * asked to be told. Filling several records before committing them together
+ * costs a single notification.
+ * @return -1 on error, or 0
+ */
+int libxenvchan_write_commit(struct libxenvchan *ctrl, size_t size);
+/**
+ * Zero-copy receive: expose pending data in the ring without copying it.
+ * The data remains in the ring until libxenvchan_read_consume().
+ * @param ctrl The vchan control structure
+ * @param iov Set to the pending data; iov[1] is empty unless it wraps
+ * @param size The minimum amount of data wanted
+ * @return -1 on error, 0 if nonblocking and less than $size is ready, or the
+ *         total amount of data described by iov (at least $size)
+ */
+int libxenvchan_read_peek(struct libxenvchan *ctrl, struct iovec iov[2], size_t size);
+/**
+ * Release the first $size bytes of peeked data back to the writer.
+ * @return -1 on error, or 0
+ */
+int libxenvchan_read_consume(struct libxenvchan *ctrl, size_t size);
 /**
  * Waits for reads or writes to unblock, or for a close
  */
@@ -0,0 +1,358 @@
+/**
+ * @file
+ * @section LICENSE
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ * @section DESCRIPTION
+ *
+ * Throughput and latency benchmark for the libxenvchan ring code.  The two
+ * ends are a parent and a child process sharing an anonymous mapping laid
+ * out like a vchan, and io.o is linked against the stand-ins below, which
+ * carry event channel notifications over a pipe.  No hypervisor is needed,
+ * so this measures the copies, index updates and notifications only.
+ *
+ * usage: vchan-bench [-n records] [-b bytes] [-o order] [-s spins] [-z] [-l]
+ *
+ *  -z  use write_reserve/commit and read_peek/consume instead of send/recv
+ *  -l  ping-pong a single record and report the round trip time
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <libxenvchan.h>
+
+#define DEFAULT_RECORDS 1000000
+#define DEFAULT_BYTES 64
+#define DEFAULT_ORDER 16
+
+/* Each end of the "event channel" is a pipe towards the other process. */
+struct xc_interface_core {
+	int rd, wr;
+	unsigned long kicks, waits;
+};
+
+int xc_evtchn_notify(xc_evtchn *xce, evtchn_port_t port)
+{
+	char c = 0;
+	xce->kicks++;
+	return write(xce->wr, &c, 1) == 1 ? 0 : -1;
+}
+
+evtchn_port_or_error_t xc_evtchn_pending(xc_evtchn *xce)
+{
+	char c;
+	xce->waits++;
+	return read(xce->rd, &c, 1) == 1 ? 0 : -1;
+}
+
+int xc_evtchn_unmask(xc_evtchn *xce, evtchn_port_t port)
+{
+	return 0;
+}
+
+int xc_evtchn_fd(xc_evtchn *xce)
+{
+	return xce->rd;
+}
+
+int xc_evtchn_close(xc_evtchn *xce)
+{
+	return 0;
+}
+
+/* Never called: the benchmark does not use libxenvchan_close(). */
+int xc_gntshr_munmap(xc_gntshr *xcg, void *start_address, uint32_t count)
+{
+	return 0;
+}
+
+int xc_gnttab_munmap(xc_gnttab *xcg, void *start_address, uint32_t count)
+{
+	return 0;
+}
+
+int xc_gntshr_close(xc_gntshr *xcg)
+{
+	return 0;
+}
+
+int xc_gnttab_close(xc_gnttab *xcg)
+{
+	return 0;
+}
+
+static unsigned long records = DEFAULT_RECORDS;
+static size_t bytes = DEFAULT_BYTES;
+static int zerocopy;
+
+static double now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+/*
+ * Records never straddle the end of the ring (bytes divides the ring size),
+ * so a record is always contiguous within one of the two iovecs.
+ */
+static void *iov_at(struct iovec iov[2], size_t off)
+{
+	if (off < iov[0].iov_len)
+		return iov[0].iov_base + off;
+	return iov[1].iov_base + (off - iov[0].iov_len);
+}
+
+/* Send records [seq, seq + nr); returns how many went. */
+static unsigned long put_records(struct libxenvchan *ctrl, unsigned long seq,
+		unsigned long nr)
+{
+	static char *buf;
+	struct iovec iov[2];
+	unsigned long i;
+	int avail;
+
+	if (!zerocopy) {
+		if (!buf && !(buf = malloc(bytes)))
+			die("malloc");
+		memset(buf, seq, bytes);
+		memcpy(buf, &seq, sizeof(seq));
+		if (libxenvchan_send(ctrl, buf, bytes) != bytes)
+			die("libxenvchan_send");
+		return 1;
+	}
+
+	avail = libxenvchan_write_reserve(ctrl, iov, bytes);
+	if (avail <= 0)
+		die("libxenvchan_write_reserve");
+	if (nr > avail / bytes)
+		nr = avail / bytes;
+	for (i = 0; i < nr; i++) {
+		char *rec = iov_at(iov, i * bytes);
+		unsigned long s = seq + i;
+		memset(rec, s, bytes);
+		memcpy(rec, &s, sizeof(s));
+	}
+	if (libxenvchan_write_commit(ctrl, nr * bytes))
+		die("libxenvchan_write_commit");
+	return nr;
+}
+
+/* Receive and check records starting at seq; returns how many arrived. */
+static unsigned long get_records(struct libxenvchan *ctrl, unsigned long seq,
+		unsigned long nr)
+{
+	static char *buf;
+	struct iovec iov[2];
+	unsigned long i, s;
+	int avail;
+
+	if (!zerocopy) {
+		if (!buf && !(buf = malloc(bytes)))
+			die("malloc");
+		if (libxenvchan_recv(ctrl, buf, bytes) != bytes)
+			die("libxenvchan_recv");
+		memcpy(&s, buf, sizeof(s));
+		if (s != seq) {
+			fprintf(stderr, "expected record %lu, got %lu\n", seq, s);
+			exit(1);
+		}
+		return 1;
+	}
+
+	avail = libxenvchan_read_peek(ctrl, iov, bytes);
+	if (avail <= 0)
+		die("libxenvchan_read_peek");
+	if (nr > avail / bytes)
+		nr = avail / bytes;
+	for (i = 0; i < nr; i++) {
+		memcpy(&s, iov_at(iov, i * bytes), sizeof(s));
+		if (s != seq + i) {
+			fprintf(stderr, "expected record %lu, got %lu\n", seq + i, s);
+			exit(1);
+		}
+	}
+	if (libxenvchan_read_consume(ctrl, nr * bytes))
+		die("libxenvchan_read_consume");
+	return nr;
+}
+
+static void report(const char *who, struct libxenvchan *ctrl)
+{
+	printf("%s: %lu kicks sent, %lu blocking waits\n", who,
+	       ctrl->event->kicks, ctrl->event->waits);
+}
+
+/* Server side: left is what it reads, right is what it writes. */
+static struct libxenvchan *setup(struct vchan_interface *ring, void *left,
+		void *right, int order, int is_server, int rd, int wr,
+		unsigned int spins)
+{
+	struct libxenvchan *ctrl = calloc(1, sizeof(*ctrl));
+	xc_evtchn *event = calloc(1, sizeof(*event));
+
+	if (!ctrl || !event)
+		die("calloc");
+
+	event->rd = rd;
+	event->wr = wr;
+	ctrl->event = event;
+	ctrl->ring = ring;
+	ctrl->is_server = is_server;
+	ctrl->blocking = 1;
+	ctrl->spin_max = spins;
+	ctrl->read.order = ctrl->write.order = order;
+	if (is_server) {
+		ctrl->read.shr = &ring->left;
+		ctrl->read.buffer = left;
+		ctrl->write.shr = &ring->right;
+		ctrl->write.buffer = right;
+	} else {
+		ctrl->write.shr = &ring->left;
+		ctrl->write.buffer = left;
+		ctrl->read.shr = &ring->right;
+		ctrl->read.buffer = right;
+	}
+	return ctrl;
+}
+
+static void usage(char **argv)
+{
+	fprintf(stderr, "usage: %s [-n records] [-b bytes] [-o order] "
+		"[-s spins] [-z] [-l]\n", argv[0]);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct libxenvchan *ctrl;
+	struct vchan_interface *ring;
+	int order = DEFAULT_ORDER, latency = 0, to_child[2], to_parent[2];
+	unsigned int spins = 0;
+	unsigned long done, i;
+	char *shared, ack = 0;
+	double start, us;
+	pid_t pid;
+	int c, status;
+
+	while ((c = getopt(argc, argv, "n:b:o:s:zl")) != -1) {
+		switch (c) {
+		case 'n':
+			records = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bytes = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			order = atoi(optarg);
+			break;
+		case 's':
+			spins = strtoul(optarg, NULL, 0);
+			break;
+		case 'z':
+			zerocopy = 1;
+			break;
+		case 'l':
+			latency = 1;
+			break;
+		default:
+			usage(argv);
+		}
+	}
+
+	if (!records || order < 12 || order > 24 || bytes < sizeof(long) ||
+	    (bytes & (bytes - 1)) || bytes > (1 << order))
+		usage(argv);
+
+	shared = mmap(NULL, 4096 + (2 << order), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED)
+		die("mmap");
+	ring = (struct vchan_interface *)shared;
+	ring->left_order = ring->right_order = order;
+	ring->cli_live = ring->srv_live = 1;
+
+	if (pipe(to_child) || pipe(to_parent))
+		die("pipe");
+
+	pid = fork();
+	if (pid < 0)
+		die("fork");
+
+	if (pid == 0) {
+		/* client: receives the stream, echoes in latency mode */
+		ctrl = setup(ring, shared + 4096, shared + 4096 + (1 << order),
+			     order, 0, to_child[0], to_parent[1], spins);
+		for (done = 0; done < records; ) {
+			i = get_records(ctrl, done, records - done);
+			if (latency && put_records(ctrl, done, 1) != 1)
+				die("echo");
+			done += i;
+		}
+		report("client", ctrl);
+		fflush(stdout);
+		if (!latency && libxenvchan_write(ctrl, &ack, 1) != 1)
+			die("ack");
+		exit(0);
+	}
+
+	/* server: produces the stream */
+	ctrl = setup(ring, shared + 4096, shared + 4096 + (1 << order),
+		     order, 1, to_parent[0], to_child[1], spins);
+
+	start = now_us();
+	if (latency) {
+		for (done = 0; done < records; done++) {
+			put_records(ctrl, done, 1);
+			get_records(ctrl, done, 1);
+		}
+	} else {
+		for (done = 0; done < records; )
+			done += put_records(ctrl, done, records - done);
+		if (libxenvchan_read(ctrl, &ack, 1) != 1)
+			die("ack");
+	}
+	us = now_us() - start;
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		return 1;
+
+	report("server", ctrl);
+	if (latency)
+		printf("%s: %lu round trips of %zu bytes, %.2f us each\n",
+		       zerocopy ? "zero-copy" : "copy", records, bytes,
+		       us / records);
+	else
+		printf("%s: %lu records of %zu bytes, %.0f records/s, %.1f MB/s\n",
+		       zerocopy ? "zero-copy" : "copy", records, bytes,
+		       records * 1e6 / us, records * bytes / us);
+	return 0;
+}
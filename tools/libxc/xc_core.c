@@ -59,6 +59,31 @@
  *  |.shstrtab: section header string table                  |
  *  +--------------------------------------------------------+
  *
+ * Pages which could not be mapped are dumped as zeroes, and their
+ * .xen_p2m/.xen_pfn entries are XC_CORE_INVALID_PFN.  When writing to a
+ * seekable file, all-zero pages are left as holes (XC_DUMPCORE_SPARSE);
+ * the layout above is unchanged and readers see the zeroes.
+ *
+ * Compressed dumps are a separate format (version 0.2), written only when
+ * the caller asks for XC_DUMPCORE_FORMAT_LZ4: tools which know just
+ * .xen_pages cannot read them.  They replace .xen_pages with two sections,
+ * placed where .xen_pages would be:
+ *
+ *  +--------------------------------------------------------+
+ *  |.xen_pages_lz4                                          |
+ *  |    the pages, one after another, as described by       |
+ *  |    .xen_pages_lz4_sizes; padded to 8 bytes             |
+ *  +--------------------------------------------------------+
+ *  |.xen_pages_lz4_sizes: uint32_t[nr_pages]                |
+ *  |    0:         all-zero page, nothing stored            |
+ *  |    PAGE_SIZE: page stored uncompressed                 |
+ *  |    otherwise: length of the page as an LZ4 block       |
+ *  +--------------------------------------------------------+
+ *
+ * The page at index i starts at the sum of the sizes before it, and
+ * corresponds to entry i of .xen_p2m/.xen_pfn exactly as in .xen_pages.
+ * Such a dump is written with its section headers patched at the end, so
+ * it needs a seekable file.
  */
 
 #include "xg_private.h"
@@ -66,10 +91,31 @@
 #include "xc_dom.h"
 #include <stdlib.h>
 #include <unistd.h>
+#ifndef __MINIOS__
+#include <pthread.h>
+#endif
 
 /* number of pages to write at a time */
 #define DUMP_INCREMENT (4 * 1024)
 
+/* number of pages mapped by a worker in one go */
+#define DUMP_BATCH 1024
+
+/* default and maximum number of page workers */
+#define DUMP_THREADS_DEFAULT 8
+#define DUMP_THREADS_MAX 64
+
+/* where the dump goes */
+struct xc_core_output {
+    void           *args;
+    dumpcore_rtn_t *dump_rtn;
+    /* optional: advance over length bytes of zeroes without writing */
+    int           (*skip)(xc_interface *xch, void *args, uint64_t length);
+    /* optional: overwrite earlier output at offset */
+    int           (*rewrite)(xc_interface *xch, void *args, uint64_t offset,
+                             char *buffer, unsigned int length);
+};
+
 /* string table */
 struct xc_core_strtab {
     char       *strings;
@@ -313,9 +359,9 @@ elfnote_fill_xen_version(xc_interface *xch,
 
 static void
 elfnote_fill_format_version(struct xen_dumpcore_elfnote_format_version_desc
-                            *format_version)
+                            *format_version, uint64_t version)
 {
-    format_version->version = XEN_DUMPCORE_FORMAT_VERSION_CURRENT;
+    format_version->version = version;
 }
 
 static void
@@ -399,7 +445,8 @@ elfnote_dump_xen_version(xc_interface *xch, void *args,
 
 static int
 elfnote_dump_format_version(xc_interface *xch,
-                            void *args, dumpcore_rtn_t dump_rtn)
+                            void *args, dumpcore_rtn_t dump_rtn,
+                            uint64_t version)
 {
     int sts;
     struct elfnote elfnote;
@@ -410,26 +457,399 @@ elfnote_dump_format_version(xc_interface *xch,
     
     elfnote.descsz = sizeof(format_version);
     elfnote.type = XEN_ELFNOTE_DUMPCORE_FORMAT_VERSION;
-    elfnote_fill_format_version(&format_version);
+    elfnote_fill_format_version(&format_version, version);
     sts = dump_rtn(xch, args, (char*)&elfnote, sizeof(elfnote));
     if ( sts != 0 )
         return sts;
     return dump_rtn(xch, args, (char*)&format_version, sizeof(format_version));
 }
 
-int
-xc_domain_dumpcore_via_callback(xc_interface *xch,
-                                uint32_t domid,
-                                void *args,
-                                dumpcore_rtn_t dump_rtn)
+/*
+ * Page dumping is split between worker threads, which map batches of guest
+ * pages (and compress them for LZ4 dumps), and the calling thread, which
+ * writes the batches out strictly in order.  Batch n is only handed to a
+ * worker once slot n % nr_slots has been written out and freed.
+ */
+enum {
+    BATCH_FREE,
+    BATCH_BUSY,
+    BATCH_DONE,
+};
+
+struct dump_batch {
+    int             state;
+    unsigned int    nr;         /* pages in this batch */
+    void           *vaddr;      /* mapping, until written out */
+    char           *buf;        /* LZ4: compressed pages */
+    unsigned long   len;        /* LZ4: bytes used in buf */
+    uint8_t        *zero;       /* per page: unmapped or all zeroes */
+    int            *err;        /* per page: mapping error */
+};
+
+struct dump_pipeline {
+    xc_interface               *xch;
+    uint32_t                    domid;
+    unsigned int                flags;
+    const xen_pfn_t            *gmfns;
+    unsigned long               nr;
+    struct xen_dumpcore_p2m    *p2m_array;
+    uint64_t                   *pfn_array;
+    uint32_t                   *lz4_sizes;
+
+    unsigned long               nr_batches;
+    unsigned long               next;
+    unsigned int                nr_slots;
+    struct dump_batch          *slots;
+    unsigned int                nr_threads;
+    int                         stop;
+#ifndef __MINIOS__
+    pthread_mutex_t             lock;
+    pthread_cond_t              cond;
+    pthread_t                  *threads;
+#endif
+};
+
+static int page_is_zero(const void *page)
+{
+    const unsigned long *p = page;
+    unsigned int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); i++ )
+        if ( p[i] )
+            return 0;
+    return 1;
+}
+
+static void dump_invalidate(struct dump_pipeline *dp, unsigned long j)
+{
+    if ( dp->p2m_array )
+    {
+        dp->p2m_array[j].pfn = XC_CORE_INVALID_PFN;
+        dp->p2m_array[j].gmfn = XC_CORE_INVALID_GMFN;
+    }
+    else
+        dp->pfn_array[j] = XC_CORE_INVALID_PFN;
+}
+
+static void dump_fill_batch(struct dump_pipeline *dp, struct dump_batch *b,
+                            unsigned long idx)
+{
+    unsigned long start = idx * DUMP_BATCH;
+    unsigned int i, nr = min_t(unsigned long, DUMP_BATCH, dp->nr - start);
+    char *page;
+
+    b->nr = nr;
+    b->len = 0;
+    b->vaddr = xc_map_foreign_bulk(dp->xch, dp->domid, PROT_READ,
+                                   &dp->gmfns[start], b->err, nr);
+
+    for ( i = 0; i < nr; i++ )
+    {
+        page = (char *)b->vaddr + (unsigned long)i * PAGE_SIZE;
+        b->zero[i] = !b->vaddr || b->err[i];
+        if ( b->zero[i] )
+            dump_invalidate(dp, start + i);
+        else if ( dp->flags & (XC_DUMPCORE_SPARSE | XC_DUMPCORE_FORMAT_LZ4) )
+            b->zero[i] = page_is_zero(page);
+
+        if ( !(dp->flags & XC_DUMPCORE_FORMAT_LZ4) )
+            continue;
+
+        if ( b->zero[i] )
+            dp->lz4_sizes[start + i] = 0;
+        else
+        {
+            unsigned int len = xc_core_lz4_compress(page, PAGE_SIZE,
+                                                    b->buf + b->len,
+                                                    PAGE_SIZE - 1);
+            if ( len == 0 )
+            {
+                memcpy(b->buf + b->len, page, PAGE_SIZE);
+                len = PAGE_SIZE;
+            }
+            dp->lz4_sizes[start + i] = len;
+            b->len += len;
+        }
+    }
+
+    if ( (dp->flags & XC_DUMPCORE_FORMAT_LZ4) && b->vaddr )
+    {
+        munmap(b->vaddr, (unsigned long)nr * PAGE_SIZE);
+        b->vaddr = NULL;
+    }
+}
+
+#ifndef __MINIOS__
+static void *dump_worker(void *arg)
+{
+    struct dump_pipeline *dp = arg;
+    struct dump_batch *b;
+    unsigned long idx;
+
+    pthread_mutex_lock(&dp->lock);
+    while ( !dp->stop && dp->next < dp->nr_batches )
+    {
+        b = &dp->slots[dp->next % dp->nr_slots];
+        if ( b->state != BATCH_FREE )
+        {
+            pthread_cond_wait(&dp->cond, &dp->lock);
+            continue;
+        }
+        idx = dp->next++;
+        b->state = BATCH_BUSY;
+        pthread_mutex_unlock(&dp->lock);
+
+        dump_fill_batch(dp, b, idx);
+
+        pthread_mutex_lock(&dp->lock);
+        b->state = BATCH_DONE;
+        pthread_cond_broadcast(&dp->cond);
+    }
+    pthread_mutex_unlock(&dp->lock);
+
+    return NULL;
+}
+#endif
+
+/* Wait for batch idx, filling it here if there are no workers. */
+static struct dump_batch *dump_get_batch(struct dump_pipeline *dp,
+                                         unsigned long idx)
+{
+    struct dump_batch *b = &dp->slots[idx % dp->nr_slots];
+
+    if ( dp->nr_threads == 0 )
+    {
+        dump_fill_batch(dp, b, idx);
+        return b;
+    }
+
+#ifndef __MINIOS__
+    pthread_mutex_lock(&dp->lock);
+    while ( b->state != BATCH_DONE )
+        pthread_cond_wait(&dp->cond, &dp->lock);
+    pthread_mutex_unlock(&dp->lock);
+#endif
+    return b;
+}
+
+static void dump_put_batch(struct dump_pipeline *dp, struct dump_batch *b)
+{
+    if ( b->vaddr )
+        munmap(b->vaddr, (unsigned long)b->nr * PAGE_SIZE);
+    b->vaddr = NULL;
+
+#ifndef __MINIOS__
+    if ( dp->nr_threads )
+    {
+        pthread_mutex_lock(&dp->lock);
+        b->state = BATCH_FREE;
+        pthread_cond_broadcast(&dp->cond);
+        pthread_mutex_unlock(&dp->lock);
+    }
+#endif
+}
+
+/* Write out the uncompressed pages of a batch, leaving holes if we can. */
+static int dump_write_batch(xc_interface *xch, struct dump_pipeline *dp,
+                            const struct xc_core_output *out,
+                            struct dump_batch *b, char *zero_page)
+{
+    unsigned int i, run, nr = b->nr;
+    int sparse = (dp->flags & XC_DUMPCORE_SPARSE) && out->skip;
+    int sts;
+
+    for ( i = 0; i < nr; i += run )
+    {
+        if ( !b->zero[i] )
+        {
+            for ( run = 1; i + run < nr && !b->zero[i + run]; run++ )
+                ;
+            sts = out->dump_rtn(xch, out->args,
+                                (char *)b->vaddr + (unsigned long)i * PAGE_SIZE,
+                                run * PAGE_SIZE);
+        }
+        else if ( sparse )
+        {
+            for ( run = 1; i + run < nr && b->zero[i + run]; run++ )
+                ;
+            sts = out->skip(xch, out->args, (uint64_t)run * PAGE_SIZE);
+        }
+        else if ( b->vaddr && !b->err[i] )
+        {
+            /* mapped but all zeroes, and no way to skip it */
+            run = 1;
+            sts = out->dump_rtn(xch, out->args,
+                                (char *)b->vaddr + (unsigned long)i * PAGE_SIZE,
+                                PAGE_SIZE);
+        }
+        else
+        {
+            run = 1;
+            sts = out->dump_rtn(xch, out->args, zero_page, PAGE_SIZE);
+        }
+        if ( sts != 0 )
+            return sts;
+    }
+
+    return 0;
+}
+
+static void dump_pipeline_free(struct dump_pipeline *dp)
+{
+    unsigned int i;
+
+    if ( dp->slots == NULL )
+        return;
+    for ( i = 0; i < dp->nr_slots; i++ )
+    {
+        free(dp->slots[i].buf);
+        free(dp->slots[i].zero);
+        free(dp->slots[i].err);
+    }
+    free(dp->slots);
+    dp->slots = NULL;
+}
+
+/*
+ * Dump gmfns[0..nr) as the .xen_pages (or .xen_pages_lz4) section contents.
+ * For LZ4 dumps *lz4_len is set to the number of bytes written.
+ */
+static int dump_pages(xc_interface *xch, uint32_t domid,
+                      const struct xc_core_output *out, unsigned int flags,
+                      unsigned int nr_threads, const xen_pfn_t *gmfns,
+                      unsigned long nr, struct xen_dumpcore_p2m *p2m_array,
+                      uint64_t *pfn_array, uint32_t *lz4_sizes,
+                      uint64_t *lz4_len, char *zero_page)
+{
+    struct dump_pipeline _dp = {}, *dp = &_dp;
+    struct dump_batch *b;
+    unsigned long idx;
+    unsigned int i;
+#ifndef __MINIOS__
+    unsigned int started = 0;
+#endif
+    int sts = -1;
+
+    if ( nr == 0 )
+        return 0;
+
+#ifdef __MINIOS__
+    nr_threads = 0;
+#endif
+    /* the workers map pages through xch while this thread writes */
+    if ( xch->flags & XC_OPENFLAG_NON_REENTRANT )
+        nr_threads = 0;
+
+    dp->xch = xch;
+    dp->domid = domid;
+    dp->flags = flags;
+    dp->gmfns = gmfns;
+    dp->nr = nr;
+    dp->p2m_array = p2m_array;
+    dp->pfn_array = pfn_array;
+    dp->lz4_sizes = lz4_sizes;
+    dp->nr_batches = (nr + DUMP_BATCH - 1) / DUMP_BATCH;
+    dp->nr_threads = min_t(unsigned long, nr_threads, dp->nr_batches);
+    dp->nr_slots = dp->nr_threads ? 2 * dp->nr_threads : 1;
+
+    dp->slots = calloc(dp->nr_slots, sizeof(*dp->slots));
+    if ( dp->slots == NULL )
+    {
+        PERROR("Could not allocate dump batches");
+        return -1;
+    }
+    for ( i = 0; i < dp->nr_slots; i++ )
+    {
+        b = &dp->slots[i];
+        b->zero = malloc(DUMP_BATCH * sizeof(*b->zero));
+        b->err = malloc(DUMP_BATCH * sizeof(*b->err));
+        if ( flags & XC_DUMPCORE_FORMAT_LZ4 )
+            b->buf = malloc(DUMP_BATCH * PAGE_SIZE);
+        if ( !b->zero || !b->err ||
+             ((flags & XC_DUMPCORE_FORMAT_LZ4) && !b->buf) )
+        {
+            PERROR("Could not allocate dump batches");
+            goto out;
+        }
+    }
+
+#ifndef __MINIOS__
+    if ( dp->nr_threads )
+    {
+        pthread_mutex_init(&dp->lock, NULL);
+        pthread_cond_init(&dp->cond, NULL);
+        dp->threads = calloc(dp->nr_threads, sizeof(*dp->threads));
+        if ( dp->threads == NULL )
+        {
+            PERROR("Could not allocate dump threads");
+            goto out_sync;
+        }
+        for ( ; started < dp->nr_threads; started++ )
+            if ( pthread_create(&dp->threads[started], NULL,
+                                dump_worker, dp) )
+            {
+                PERROR("Could not start dump thread");
+                goto out_join;
+            }
+    }
+#endif
+
+    *lz4_len = 0;
+    for ( idx = 0; idx < dp->nr_batches; idx++ )
+    {
+        b = dump_get_batch(dp, idx);
+        if ( flags & XC_DUMPCORE_FORMAT_LZ4 )
+        {
+            sts = b->len ? out->dump_rtn(xch, out->args, b->buf, b->len) : 0;
+            *lz4_len += b->len;
+        }
+        else
+            sts = dump_write_batch(xch, dp, out, b, zero_page);
+        dump_put_batch(dp, b);
+        if ( sts != 0 )
+            break;
+    }
+
+#ifndef __MINIOS__
+ out_join:
+    if ( dp->nr_threads )
+    {
+        pthread_mutex_lock(&dp->lock);
+        dp->stop = 1;
+        pthread_cond_broadcast(&dp->cond);
+        pthread_mutex_unlock(&dp->lock);
+        for ( i = 0; i < started; i++ )
+            pthread_join(dp->threads[i], NULL);
+        /* batches mapped but never written out */
+        for ( i = 0; i < dp->nr_slots; i++ )
+            dump_put_batch(dp, &dp->slots[i]);
+    }
+ out_sync:
+    if ( dp->nr_threads )
+    {
+        free(dp->threads);
+        pthread_cond_destroy(&dp->cond);
+        pthread_mutex_destroy(&dp->lock);
+    }
+#endif
+ out:
+    dump_pipeline_free(dp);
+    return sts;
+}
+
+static int
+xc_core_dump(xc_interface *xch, uint32_t domid,
+             const struct xc_core_output *out, unsigned int flags,
+             unsigned int nr_threads)
 {
+    void *args = out->args;
+    dumpcore_rtn_t *dump_rtn = out->dump_rtn;
     xc_dominfo_t info;
     shared_info_any_t *live_shinfo = NULL;
     struct domain_info_context _dinfo = {};
     struct domain_info_context *dinfo = &_dinfo;
 
     int nr_vcpus = 0;
-    char *dump_mem, *dump_mem_start = NULL;
     vcpu_guest_context_any_t *ctxt = NULL;
     struct xc_core_arch_context arch_ctxt;
     char dummy[PAGE_SIZE];
@@ -450,6 +870,10 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
 
     uint64_t *pfn_array = NULL;
 
+    xen_pfn_t *gmfns = NULL;
+    uint32_t *lz4_sizes = NULL;
+    uint64_t lz4_len = 0;
+
     Elf64_Ehdr ehdr;
     uint64_t filesz;
     uint64_t offset;
@@ -458,8 +882,16 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
     struct xc_core_strtab *strtab = NULL;
     uint16_t strtab_idx;
     struct xc_core_section_headers *sheaders = NULL;
+    uint16_t pages_idx, sizes_idx = 0, p2m_idx;
     Elf64_Shdr *shdr;
- 
+
+    if ( (flags & XC_DUMPCORE_FORMAT_LZ4) && out->rewrite == NULL )
+    {
+        ERROR("Compressed dumps need a seekable output");
+        errno = EINVAL;
+        return sts;
+    }
+
     if ( xc_domain_get_guest_width(xch, domid, &dinfo->guest_width) != 0 )
     {
         PERROR("Could not get address size for domain");
@@ -467,11 +899,6 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
     }
 
     xc_core_arch_context_init(&arch_ctxt);
-    if ( (dump_mem_start = malloc(DUMP_INCREMENT*PAGE_SIZE)) == NULL )
-    {
-        PERROR("Could not allocate dump_mem");
-        goto out;
-    }
 
     if ( xc_domain_getinfo(xch, domid, 1, &info) != 1 )
     {
@@ -535,6 +962,22 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
      */
     nr_pages = info.nr_pages;
 
+    gmfns = malloc(nr_pages * sizeof(gmfns[0]));
+    if ( gmfns == NULL )
+    {
+        PERROR("Could not allocate gmfn array");
+        goto out;
+    }
+    if ( flags & XC_DUMPCORE_FORMAT_LZ4 )
+    {
+        lz4_sizes = calloc(nr_pages, sizeof(lz4_sizes[0]));
+        if ( lz4_sizes == NULL )
+        {
+            PERROR("Could not allocate page size array");
+            goto out;
+        }
+    }
+
     if ( !auto_translated_physmap )
     {
         /* obtain p2m table */
@@ -662,9 +1105,11 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
     /*
      * pages and p2m/pfn are the last section to allocate section headers
      * so that we know the number of section headers here.
-     * 2 = pages section and p2m/pfn table section
+     * 2 = pages section and p2m/pfn table section, plus the page sizes
+     * section of a compressed dump
      */
-    fixup = (sheaders->num + 2) * sizeof(*shdr);
+    fixup = (sheaders->num + 2 + !!(flags & XC_DUMPCORE_FORMAT_LZ4)) *
+            sizeof(*shdr);
     /* zeroth section should have zero offset */
     for ( i = 1; i < sheaders->num; i++ )
         sheaders->shdrs[i].sh_offset += fixup;
@@ -679,9 +1124,35 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
         PERROR("could not get section headers for .xen_pages");
         goto out;
     }
-    filesz = (uint64_t)nr_pages * PAGE_SIZE;
-    sts = xc_core_shdr_set(xch, shdr, strtab, XEN_DUMPCORE_SEC_PAGES, SHT_PROGBITS,
-                           offset, filesz, PAGE_SIZE, PAGE_SIZE);
+    pages_idx = shdr - sheaders->shdrs;
+    if ( !(flags & XC_DUMPCORE_FORMAT_LZ4) )
+    {
+        filesz = (uint64_t)nr_pages * PAGE_SIZE;
+        sts = xc_core_shdr_set(xch, shdr, strtab, XEN_DUMPCORE_SEC_PAGES,
+                               SHT_PROGBITS, offset, filesz,
+                               PAGE_SIZE, PAGE_SIZE);
+    }
+    else
+    {
+        /* the compressed size and what follows are fixed up at the end */
+        filesz = 0;
+        sts = xc_core_shdr_set(xch, shdr, strtab, XEN_DUMPCORE_SEC_PAGES_LZ4,
+                               SHT_PROGBITS, offset, filesz, PAGE_SIZE, 0);
+        if ( sts != 0 )
+            goto out;
+
+        shdr = xc_core_shdr_get(xch,sheaders);
+        if ( shdr == NULL )
+        {
+            PERROR("could not get section headers for .xen_pages_lz4_sizes");
+            goto out;
+        }
+        sizes_idx = shdr - sheaders->shdrs;
+        sts = xc_core_shdr_set(xch, shdr, strtab,
+                               XEN_DUMPCORE_SEC_PAGES_LZ4_SIZES, SHT_PROGBITS,
+                               offset, (uint64_t)nr_pages * sizeof(lz4_sizes[0]),
+                               __alignof__(lz4_sizes[0]), sizeof(lz4_sizes[0]));
+    }
     if ( sts != 0 )
         goto out;
     offset += filesz;
@@ -693,6 +1164,7 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
         PERROR("Could not get section header for .xen_{p2m, pfn} table");
         goto out;
     }
+    p2m_idx = shdr - sheaders->shdrs;
     if ( !auto_translated_physmap )
     {
         filesz = (uint64_t)nr_pages * sizeof(p2m_array[0]);
@@ -748,7 +1220,10 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
         goto out;
 
     /* elf note section: format version */
-    sts = elfnote_dump_format_version(xch, args, dump_rtn);
+    sts = elfnote_dump_format_version(xch, args, dump_rtn,
+                                      (flags & XC_DUMPCORE_FORMAT_LZ4) ?
+                                      XEN_DUMPCORE_FORMAT_VERSION_LZ4 :
+                                      XEN_DUMPCORE_FORMAT_VERSION_CURRENT);
     if ( sts != 0 )
         goto out;
 
@@ -776,9 +1251,8 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
     if ( sts != 0 )
         goto out;
 
-    /* dump pages: .xen_pages */
+    /* gather the frames to dump and fill in the p2m/pfn table */
     j = 0;
-    dump_mem = dump_mem_start;
     for ( map_idx = 0; map_idx < nr_memory_map; map_idx++ )
     {
         uint64_t pfn_start;
@@ -789,8 +1263,7 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
         for ( i = pfn_start; i < pfn_end; i++ )
         {
             uint64_t gmfn;
-            void *vaddr;
-            
+
             if ( j >= nr_pages )
             {
                 /*
@@ -798,7 +1271,7 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
                  * guest domain may increase memory.
                  */
                 IPRINTF("exceeded nr_pages (%ld) losing pages", nr_pages);
-                goto copy_done;
+                goto gather_done;
             }
 
             if ( !auto_translated_physmap )
@@ -831,28 +1304,15 @@ xc_domain_dumpcore_via_callback(xc_interface *xch,
                 pfn_array[j] = i;
             }
 
-            vaddr = xc_map_foreign_range(
-                xch, domid, PAGE_SIZE, PROT_READ, gmfn);
-            if ( vaddr == NULL )
-                continue;
-            memcpy(dump_mem, vaddr, PAGE_SIZE);
-            munmap(vaddr, PAGE_SIZE);
-            dump_mem += PAGE_SIZE;
-            if ( (j + 1) % DUMP_INCREMENT == 0 )
-            {
-                sts = dump_rtn(
-                    xch, args, dump_mem_start, dump_mem - dump_mem_start);
-                if ( sts != 0 )
-                    goto out;
-                dump_mem = dump_mem_start;
-            }
-
+            gmfns[j] = gmfn;
             j++;
         }
     }
 
-copy_done:
-    sts = dump_rtn(xch, args, dump_mem_start, dump_mem - dump_mem_start);
+gather_done:
+    /* dump pages: .xen_pages or .xen_pages_lz4 */
+    sts = dump_pages(xch, domid, out, flags, nr_threads, gmfns, j,
+                     p2m_array, pfn_array, lz4_sizes, &lz4_len, dummy);
     if ( sts != 0 )
         goto out;
     if ( j < nr_pages )
@@ -861,9 +1321,13 @@ copy_done:
          * guest domain may reduce memory. pad with zero pages.
          */
         IPRINTF("j (%ld) != nr_pages (%ld)", j, nr_pages);
-        memset(dump_mem_start, 0, PAGE_SIZE);
         for (; j < nr_pages; j++) {
-            sts = dump_rtn(xch, args, dump_mem_start, PAGE_SIZE);
+            if ( flags & XC_DUMPCORE_FORMAT_LZ4 )
+                sts = 0; /* size stays 0 */
+            else if ( (flags & XC_DUMPCORE_SPARSE) && out->skip )
+                sts = out->skip(xch, args, PAGE_SIZE);
+            else
+                sts = dump_rtn(xch, args, dummy, PAGE_SIZE);
             if ( sts != 0 )
                 goto out;
             if ( !auto_translated_physmap )
@@ -876,6 +1340,27 @@ copy_done:
         }
     }
 
+    if ( flags & XC_DUMPCORE_FORMAT_LZ4 )
+    {
+        /* now that the compressed size is known, move what follows it */
+        sheaders->shdrs[pages_idx].sh_size = lz4_len;
+        offset = sheaders->shdrs[pages_idx].sh_offset + ROUNDUP(lz4_len, 3);
+        sts = dump_rtn(xch, args, dummy, ROUNDUP(lz4_len, 3) - lz4_len);
+        if ( sts != 0 )
+            goto out;
+
+        sheaders->shdrs[sizes_idx].sh_offset = offset;
+        offset += sheaders->shdrs[sizes_idx].sh_size;
+        sheaders->shdrs[p2m_idx].sh_offset = offset;
+        offset += sheaders->shdrs[p2m_idx].sh_size;
+        sheaders->shdrs[strtab_idx].sh_offset = offset;
+
+        sts = dump_rtn(xch, args, (char *)lz4_sizes,
+                       sizeof(lz4_sizes[0]) * nr_pages);
+        if ( sts != 0 )
+            goto out;
+    }
+
     /* p2m/pfn table: .xen_p2m/.xen_pfn */
     if ( !auto_translated_physmap )
         sts = dump_rtn(
@@ -891,6 +1376,15 @@ copy_done:
     if ( sts != 0 )
         goto out;
 
+    if ( flags & XC_DUMPCORE_FORMAT_LZ4 )
+    {
+        /* section headers, with the offsets fixed up above */
+        sts = out->rewrite(xch, args, sizeof(ehdr), (char *)sheaders->shdrs,
+                           sheaders->num * sizeof(sheaders->shdrs[0]));
+        if ( sts != 0 )
+            goto out;
+    }
+
     sts = 0;
 
 out:
@@ -908,8 +1402,8 @@ out:
         xc_core_strtab_free(strtab);
     if ( ctxt != NULL )
         free(ctxt);
-    if ( dump_mem_start != NULL )
-        free(dump_mem_start);
+    free(gmfns);
+    free(lz4_sizes);
     if ( live_shinfo != NULL )
         munmap(live_shinfo, PAGE_SIZE);
     xc_core_arch_context_free(&arch_ctxt);
@@ -917,9 +1411,24 @@ out:
     return sts;
 }
 
+int
+xc_domain_dumpcore_via_callback(xc_interface *xch,
+                                uint32_t domid,
+                                void *args,
+                                dumpcore_rtn_t dump_rtn)
+{
+    struct xc_core_output out = {
+        .args = args,
+        .dump_rtn = dump_rtn,
+    };
+
+    return xc_core_dump(xch, domid, &out, 0, DUMP_THREADS_DEFAULT);
+}
+
 /* Callback args for writing to a local dump file. */
 struct dump_args {
-    int     fd;
+    int         fd;
+    uint64_t    unflushed;      /* bytes written since the last discard */
 };
 
 /* Callback routine for writing to a local dump file. */
@@ -934,32 +1443,78 @@ static int local_file_dump(xc_interface *xch,
         return -errno;
     }
 
-    if ( length >= (DUMP_INCREMENT * PAGE_SIZE) )
+    da->unflushed += length;
+    if ( da->unflushed >= (DUMP_INCREMENT * PAGE_SIZE) )
     {
         // Now dumping pages -- make sure we discard clean pages from
         // the cache after each write
         discard_file_cache(xch, da->fd, 0 /* no flush */);
+        da->unflushed = 0;
+    }
+
+    return 0;
+}
+
+/* Leave a hole in a local dump file. */
+static int local_file_skip(xc_interface *xch, void *args, uint64_t length)
+{
+    struct dump_args *da = args;
+
+    if ( lseek(da->fd, length, SEEK_CUR) == (off_t)-1 )
+    {
+        PERROR("Failed to seek dump file");
+        return -errno;
+    }
+
+    return 0;
+}
+
+/* Overwrite part of a local dump file. */
+static int local_file_rewrite(xc_interface *xch, void *args, uint64_t offset,
+                              char *buffer, unsigned int length)
+{
+    struct dump_args *da = args;
+
+    if ( pwrite(da->fd, buffer, length, offset) != length )
+    {
+        PERROR("Failed to rewrite dump file");
+        return errno ? -errno : -EIO;
     }
 
     return 0;
 }
 
 int
-xc_domain_dumpcore(xc_interface *xch,
-                   uint32_t domid,
-                   const char *corename)
+xc_domain_dumpcore_flags(xc_interface *xch,
+                         uint32_t domid,
+                         const char *corename,
+                         unsigned int flags,
+                         unsigned int nr_threads)
 {
-    struct dump_args da;
+    struct dump_args da = {};
+    struct xc_core_output out = {
+        .args = &da,
+        .dump_rtn = local_file_dump,
+    };
     int sts;
 
+    if ( nr_threads > DUMP_THREADS_MAX )
+        nr_threads = DUMP_THREADS_MAX;
+
     if ( (da.fd = open(corename, O_CREAT|O_RDWR|O_TRUNC, S_IWUSR|S_IRUSR)) < 0 )
     {
         PERROR("Could not open corefile %s", corename);
         return -errno;
     }
 
-    sts = xc_domain_dumpcore_via_callback(
-        xch, domid, &da, &local_file_dump);
+    /* holes and header fix-ups need a real file; a pipe just gets data */
+    if ( lseek(da.fd, 0, SEEK_CUR) != (off_t)-1 )
+    {
+        out.skip = local_file_skip;
+        out.rewrite = local_file_rewrite;
+    }
+
+    sts = xc_core_dump(xch, domid, &out, flags, nr_threads);
 
     /* flush and discard any remaining portion of the file from cache */
     discard_file_cache(xch, da.fd, 1/* flush first*/);
@@ -969,6 +1524,15 @@ xc_domain_dumpcore(xc_interface *xch,
     return sts;
 }
 
+int
+xc_domain_dumpcore(xc_interface *xch,
+                   uint32_t domid,
+                   const char *corename)
+{
+    return xc_domain_dumpcore_flags(xch, domid, corename,
+                                    XC_DUMPCORE_SPARSE, DUMP_THREADS_DEFAULT);
+}
+
 /*
  * Local variables:
  * mode: C
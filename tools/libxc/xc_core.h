@@ -32,6 +32,8 @@
 #define XEN_DUMPCORE_SEC_P2M                    ".xen_p2m"
 #define XEN_DUMPCORE_SEC_PFN                    ".xen_pfn"
 #define XEN_DUMPCORE_SEC_PAGES                  ".xen_pages"
+#define XEN_DUMPCORE_SEC_PAGES_LZ4              ".xen_pages_lz4"
+#define XEN_DUMPCORE_SEC_PAGES_LZ4_SIZES        ".xen_pages_lz4_sizes"
 
 /* elf note name */
 #define XEN_DUMPCORE_ELFNOTE_NAME               "Xen"
@@ -80,6 +82,12 @@ struct xen_dumpcore_elfnote_xen_version_desc {
     XEN_DUMPCORE_FORMAT_VERSION(XEN_DUMPCORE_FORMAT_MAJOR_CURRENT,  \
                                 XEN_DUMPCORE_FORMAT_MINOR_CURRENT)
 
+/* dumps with .xen_pages_lz4 instead of .xen_pages, see xc_core.c */
+#define XEN_DUMPCORE_FORMAT_MINOR_LZ4           ((uint64_t)2)
+#define XEN_DUMPCORE_FORMAT_VERSION_LZ4                             \
+    XEN_DUMPCORE_FORMAT_VERSION(XEN_DUMPCORE_FORMAT_MAJOR_CURRENT,  \
+                                XEN_DUMPCORE_FORMAT_MINOR_LZ4)
+
 struct xen_dumpcore_elfnote_format_version_desc {
     uint64_t    version;
 };
@@ -143,6 +151,13 @@ int xc_core_arch_map_p2m(xc_interface *xch, unsigned int guest_width,
                          xc_dominfo_t *info, shared_info_any_t *live_shinfo,
                          xen_pfn_t **live_p2m, unsigned long *pfnp);
 
+/*
+ * LZ4-compress len (< 64k) bytes at src into at most max bytes at dst.
+ * Returns the compressed length, or 0 if it does not fit.
+ */
+unsigned int xc_core_lz4_compress(const void *src, unsigned int len,
+                                  void *dst, unsigned int max);
+
 int xc_core_arch_map_p2m_writable(xc_interface *xch, unsigned int guest_width,
                                   xc_dominfo_t *info,
                                   shared_info_any_t *live_shinfo,
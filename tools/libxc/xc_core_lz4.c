@@ -0,0 +1,163 @@
+/*
+ * LZ4 block compression of guest pages for compressed dump-core files.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * A small greedy compressor producing standard LZ4 blocks, so that any LZ4
+ * block decoder (including xen/common/lz4/decompress.c) can read the pages
+ * back.  It only needs to handle inputs below 64k, which keeps every match
+ * offset within one hash table slot of 16 bits.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "xc_core.h"
+
+#define LZ4_MINMATCH            4
+#define LZ4_LASTLITERALS        5   /* block must end with this many literals */
+#define LZ4_MFLIMIT             12  /* no match may start closer to the end */
+#define LZ4_HASH_LOG            12
+#define LZ4_RUN_MASK            15
+
+static inline uint32_t lz4_read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline unsigned int lz4_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+static uint8_t *lz4_put_length(uint8_t *op, unsigned int len)
+{
+    for ( ; len >= 255; len -= 255 )
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+/* Worst-case size of a sequence carrying @lit literals and a match. */
+static inline unsigned int lz4_seq_bound(unsigned int lit, unsigned int mlen)
+{
+    return 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1;
+}
+
+static uint8_t *lz4_put_sequence(uint8_t *op, const uint8_t *lit,
+                                 unsigned int nr_lit)
+{
+    uint8_t *token = op++;
+
+    if ( nr_lit >= LZ4_RUN_MASK )
+    {
+        *token = LZ4_RUN_MASK << 4;
+        op = lz4_put_length(op, nr_lit - LZ4_RUN_MASK);
+    }
+    else
+        *token = nr_lit << 4;
+    memcpy(op, lit, nr_lit);
+    return op + nr_lit;
+}
+
+unsigned int xc_core_lz4_compress(const void *src, unsigned int len,
+                                  void *dst, unsigned int max)
+{
+    uint16_t table[1 << LZ4_HASH_LOG];
+    const uint8_t *base = src, *ip = base, *anchor = base;
+    const uint8_t *iend = base + len;
+    const uint8_t *mflimit = iend - LZ4_MFLIMIT;
+    const uint8_t *matchlimit = iend - LZ4_LASTLITERALS;
+    uint8_t *op = dst, *oend = op + max;
+    unsigned int nr_lit;
+
+    if ( len > 0xffff )
+        return 0;
+
+    memset(table, 0, sizeof(table));
+
+    if ( len > LZ4_MFLIMIT )
+    {
+        for ( ip++; ip < mflimit; )
+        {
+            uint32_t seq = lz4_read32(ip);
+            unsigned int h = lz4_hash(seq);
+            const uint8_t *ref = base + table[h];
+            const uint8_t *mp, *rp;
+            unsigned int mlen, off;
+            uint8_t *token;
+
+            table[h] = ip - base;
+            if ( ref >= ip || lz4_read32(ref) != seq )
+            {
+                ip++;
+                continue;
+            }
+
+            while ( ip > anchor && ref > base && ip[-1] == ref[-1] )
+            {
+                ip--;
+                ref--;
+            }
+            for ( mp = ip + LZ4_MINMATCH, rp = ref + LZ4_MINMATCH;
+                  mp < matchlimit && *mp == *rp; mp++, rp++ )
+                ;
+
+            nr_lit = ip - anchor;
+            mlen = mp - ip - LZ4_MINMATCH;
+            if ( lz4_seq_bound(nr_lit, mlen) > oend - op )
+                return 0;
+
+            token = op;
+            op = lz4_put_sequence(op, anchor, nr_lit);
+            off = ip - ref;
+            *op++ = off;
+            *op++ = off >> 8;
+            if ( mlen >= LZ4_RUN_MASK )
+            {
+                *token |= LZ4_RUN_MASK;
+                op = lz4_put_length(op, mlen - LZ4_RUN_MASK);
+            }
+            else
+                *token |= mlen;
+
+            anchor = ip = mp;
+            if ( ip < mflimit )
+                table[lz4_hash(lz4_read32(ip - 2))] = ip - 2 - base;
+        }
+    }
+
+    nr_lit = iend - anchor;
+    if ( 1 + nr_lit / 255 + 1 + nr_lit > oend - op )
+        return 0;
+    op = lz4_put_sequence(op, anchor, nr_lit);
+
+    return op - (uint8_t *)dst;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
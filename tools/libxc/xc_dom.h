@@ -71,10 +71,11 @@ struct xc_dom_image {
     /* If ramdisk_seg.vstart is non zero then the ramdisk will be
      * loaded at that address, otherwise it will automatically placed.
      *
-     * If automatic placement is used and the ramdisk is gzip
-     * compressed then it will be decompressed as it is loaded. If the
-     * ramdisk has been explicitly placed then it is loaded as is
-     * otherwise decompressing risks undoing the manual placement.
+     * If automatic placement is used and the ramdisk is gzip or
+     * legacy LZ4 compressed then it will be decompressed as it is
+     * loaded. If the ramdisk has been explicitly placed then it is
+     * loaded as is otherwise decompressing risks undoing the manual
+     * placement.
      */
     struct xc_dom_seg ramdisk_seg;
     struct xc_dom_seg p2m_seg;
@@ -242,6 +243,10 @@ int xc_dom_do_gunzip(xc_interface *xch,
                      void *src, size_t srclen, void *dst, size_t dstlen);
 int xc_dom_try_gunzip(struct xc_dom_image *dom, void **blob, size_t * size);
 
+size_t xc_dom_check_lz4(xc_interface *xch, void *blob, size_t size);
+int xc_dom_do_lz4(xc_interface *xch,
+                  void *src, size_t srclen, void *dst, size_t dstlen);
+
 int xc_dom_kernel_file(struct xc_dom_image *dom, const char *filename);
 int xc_dom_ramdisk_file(struct xc_dom_image *dom, const char *filename);
 int xc_dom_kernel_mem(struct xc_dom_image *dom, const void *mem,
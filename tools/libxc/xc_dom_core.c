@@ -952,7 +952,7 @@ int xc_dom_build_image(struct xc_dom_image *dom)
     /* load ramdisk */
     if ( dom->ramdisk_blob )
     {
-        size_t unziplen, ramdisklen;
+        size_t unziplen = 0, unlz4len = 0, ramdisklen;
         void *ramdiskmap;
 
         if ( !dom->ramdisk_seg.vstart )
@@ -961,9 +961,16 @@ int xc_dom_build_image(struct xc_dom_image *dom)
                                          dom->ramdisk_blob, dom->ramdisk_size);
             if ( xc_dom_ramdisk_check_size(dom, unziplen) != 0 )
                 unziplen = 0;
+            if ( !unziplen )
+            {
+                /* Decoded in parallel, directly into the segment. */
+                unlz4len = xc_dom_check_lz4(dom->xch, dom->ramdisk_blob,
+                                            dom->ramdisk_size);
+                if ( xc_dom_ramdisk_check_size(dom, unlz4len) != 0 )
+                    unlz4len = 0;
+                unziplen = unlz4len;
+            }
         }
-        else
-            unziplen = 0;
 
         ramdisklen = unziplen ? unziplen : dom->ramdisk_size;
 
@@ -978,7 +985,14 @@ int xc_dom_build_image(struct xc_dom_image *dom)
                       __FUNCTION__);
             goto err;
         }
-        if ( unziplen )
+        if ( unlz4len )
+        {
+            if ( xc_dom_do_lz4(dom->xch,
+                               dom->ramdisk_blob, dom->ramdisk_size,
+                               ramdiskmap, ramdisklen) == -1 )
+                goto err;
+        }
+        else if ( unziplen )
         {
             if ( xc_dom_do_gunzip(dom->xch,
                                   dom->ramdisk_blob, dom->ramdisk_size,
@@ -33,94 +33,340 @@ static inline uint_fast32_t le32_to_cpup(const unsigned char *buf)
 
 #include "../../xen/common/lz4/decompress.c"
 
+#include <pthread.h>
+#include <unistd.h>
+
 #define ARCHIVE_MAGICNUMBER 0x184C2102
 
+/*
+ * Legacy-format LZ4 (lz4 -l, as used for Linux kernels and initramfs) is a
+ * series of independently compressed chunks.  As lz4 writes a single
+ * stream, each decodes to exactly LZ4_CHUNK_SIZE bytes except for the
+ * last.  The output offset of every chunk is then known up front, which
+ * lets the chunks of large images be decoded in parallel, straight into
+ * their final location.  Nothing in the format guarantees this layout,
+ * though: concatenated streams have a short chunk at the end of each.
+ * Such images are decoded serially, and such ramdisks are loaded as is.
+ */
+#define LZ4_CHUNK_SIZE          (8 << 20)
+#define LZ4_MAX_THREADS         8
+
+struct lz4_chunk {
+    const unsigned char *src;
+    size_t len;
+};
+
+struct lz4_job {
+    const struct lz4_chunk *chunks;
+    unsigned int nr;
+    unsigned int next;
+    unsigned char *out;
+    size_t out_len;
+    int failed;
+};
+
+/*
+ * Find the chunks in a legacy-format stream.  A kernel payload carries the
+ * decompressed size as a 32-bit trailer; exactly four bytes left over at a
+ * chunk boundary are taken to be that.  Returns the number of chunks, or -1
+ * if the data is not a well-formed legacy LZ4 stream.
+ */
+static int lz4_scan(const unsigned char *inp, size_t size,
+                    struct lz4_chunk **pchunks)
+{
+    struct lz4_chunk *chunks = NULL, *tmp;
+    unsigned int nr = 0, max = 0;
+    size_t chunksize;
+
+    if ( size < 8 || get_unaligned_le32(inp) != ARCHIVE_MAGICNUMBER )
+        return -1;
+
+    while ( size > 4 )
+    {
+        chunksize = get_unaligned_le32(inp);
+        inp += 4;
+        size -= 4;
+        if ( chunksize == ARCHIVE_MAGICNUMBER )
+            continue;
+        if ( chunksize > size )
+            goto err;
+
+        if ( nr == max )
+        {
+            max = max ? max * 2 : 16;
+            tmp = realloc(chunks, max * sizeof(*chunks));
+            if ( !tmp )
+                goto err;
+            chunks = tmp;
+        }
+        chunks[nr].src = inp;
+        chunks[nr].len = chunksize;
+        nr++;
+
+        inp += chunksize;
+        size -= chunksize;
+    }
+
+    if ( (size != 0 && size != 4) || !nr )
+        goto err;
+
+    *pchunks = chunks;
+    return nr;
+
+ err:
+    free(chunks);
+    return -1;
+}
+
+/*
+ * The size a chunk decodes to, found by walking its sequences without
+ * decoding them, or -1 if it is malformed.
+ */
+static ssize_t lz4_chunk_size(const struct lz4_chunk *chunk)
+{
+    const unsigned char *ip = chunk->src, *end = ip + chunk->len;
+    size_t out = 0, len;
+    unsigned int token;
+
+    while ( ip < end )
+    {
+        token = *ip++;
+
+        len = token >> 4;
+        if ( len == 15 )
+            do {
+                if ( ip == end )
+                    return -1;
+                len += *ip;
+            } while ( *ip++ == 255 );
+        if ( len > (size_t)(end - ip) )
+            return -1;
+        ip += len;
+        out += len;
+
+        /* The last sequence has no match. */
+        if ( ip == end )
+            break;
+
+        if ( end - ip < 2 )
+            return -1;
+        ip += 2;
+        len = token & 15;
+        if ( len == 15 )
+            do {
+                if ( ip == end )
+                    return -1;
+                len += *ip;
+            } while ( *ip++ == 255 );
+        out += len + 4;
+        if ( out > LZ4_CHUNK_SIZE )
+            return -1;
+    }
+
+    return out <= LZ4_CHUNK_SIZE ? out : -1;
+}
+
+/*
+ * Check that every chunk but the last decodes to LZ4_CHUNK_SIZE bytes, and
+ * return the size of the whole output.  Returns 0 for any other layout, or
+ * if a chunk is malformed.
+ */
+static size_t lz4_uniform_size(const struct lz4_chunk *chunks,
+                               unsigned int nr)
+{
+    ssize_t len = 0;
+    unsigned int i;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        len = lz4_chunk_size(&chunks[i]);
+        if ( len < 0 || (i + 1 < nr && len != LZ4_CHUNK_SIZE) )
+            return 0;
+    }
+
+    return (size_t)(nr - 1) * LZ4_CHUNK_SIZE + len;
+}
+
+static int lz4_decode_chunk(struct lz4_job *job, unsigned int i)
+{
+    size_t off = (size_t)i * LZ4_CHUNK_SIZE, len;
+
+    if ( off >= job->out_len )
+        return -1;
+    len = job->out_len - off;
+    if ( len > LZ4_CHUNK_SIZE )
+        len = LZ4_CHUNK_SIZE;
+
+    if ( lz4_decompress_unknownoutputsize(job->chunks[i].src,
+                                          job->chunks[i].len,
+                                          job->out + off, &len) < 0 )
+        return -1;
+
+    /* Anything else means the offsets of later chunks were wrong. */
+    if ( i + 1 < job->nr ? len != LZ4_CHUNK_SIZE : off + len != job->out_len )
+        return -1;
+
+    return 0;
+}
+
+static void *lz4_worker(void *arg)
+{
+    struct lz4_job *job = arg;
+    unsigned int i;
+
+    while ( (i = __sync_fetch_and_add(&job->next, 1)) < job->nr )
+        if ( lz4_decode_chunk(job, i) )
+            job->failed = 1;
+
+    return NULL;
+}
+
+static int lz4_decode(const struct lz4_chunk *chunks, unsigned int nr,
+                      void *dst, size_t dstlen)
+{
+    struct lz4_job job = {
+        .chunks = chunks, .nr = nr, .out = dst, .out_len = dstlen,
+    };
+    pthread_t threads[LZ4_MAX_THREADS - 1];
+    unsigned int nr_threads = 0, want;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    want = nr < LZ4_MAX_THREADS ? nr : LZ4_MAX_THREADS;
+    if ( cpus > 0 && want > cpus )
+        want = cpus;
+
+    /* The calling thread decodes too; carry on with fewer if need be. */
+    while ( nr_threads + 1 < want &&
+            !pthread_create(&threads[nr_threads], NULL, lz4_worker, &job) )
+        nr_threads++;
+
+    lz4_worker(&job);
+
+    while ( nr_threads )
+        pthread_join(threads[--nr_threads], NULL);
+
+    return job.failed ? -1 : 0;
+}
+
+size_t xc_dom_check_lz4(xc_interface *xch, void *blob, size_t size)
+{
+    struct lz4_chunk *chunks;
+    size_t unlz4len;
+    int nr;
+
+    nr = lz4_scan(blob, size, &chunks);
+    if ( nr < 0 )
+        return 0;
+    unlz4len = lz4_uniform_size(chunks, nr);
+    free(chunks);
+
+    if ( !unlz4len )
+    {
+        xc_dom_printf(xch, "%s: chunks of irregular size, skip unlz4",
+                      __FUNCTION__);
+        return 0;
+    }
+
+    if ( unlz4len > XC_DOM_DECOMPRESS_MAX )
+    {
+        xc_dom_printf(xch, "%s: size (lz4 %zd, unlz4 %zd) looks insane, "
+                      "skip unlz4", __FUNCTION__, size, unlz4len);
+        return 0;
+    }
+
+    return unlz4len;
+}
+
+/* Decode the chunks one after the other, whatever their sizes. */
+static int lz4_decode_serial(const struct lz4_chunk *chunks, unsigned int nr,
+                             unsigned char *dst, size_t dstlen)
+{
+    size_t off = 0, len;
+    unsigned int i;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        len = dstlen - off;
+        if ( lz4_decompress_unknownoutputsize(chunks[i].src, chunks[i].len,
+                                              dst + off, &len) < 0 )
+            return -1;
+        off += len;
+    }
+
+    return 0;
+}
+
+int xc_dom_do_lz4(xc_interface *xch,
+                  void *src, size_t srclen, void *dst, size_t dstlen)
+{
+    struct lz4_chunk *chunks;
+    int nr, rc;
+
+    nr = lz4_scan(src, srclen, &chunks);
+    if ( nr < 0 )
+    {
+        xc_dom_panic(xch, XC_INTERNAL_ERROR,
+                     "%s: not a legacy LZ4 stream", __FUNCTION__);
+        return -1;
+    }
+
+    if ( lz4_uniform_size(chunks, nr) )
+        rc = lz4_decode(chunks, nr, dst, dstlen);
+    else
+    {
+        xc_dom_printf(xch, "%s: chunks of irregular size, decoding serially",
+                      __FUNCTION__);
+        rc = lz4_decode_serial(chunks, nr, dst, dstlen);
+    }
+    free(chunks);
+    if ( rc )
+    {
+        xc_dom_panic(xch, XC_INTERNAL_ERROR,
+                     "%s: decoding failed", __FUNCTION__);
+        return -1;
+    }
+
+    xc_dom_printf(xch, "%s: unlz4 ok, 0x%zx -> 0x%zx (%d chunks)",
+                  __FUNCTION__, srclen, dstlen, nr);
+    return 0;
+}
+
 int xc_try_lz4_decode(
-	struct xc_dom_image *dom, void **blob, size_t *psize)
+    struct xc_dom_image *dom, void **blob, size_t *psize)
 {
-	int ret = -1;
-	unsigned char *inp = *blob, *output, *outp;
-	ssize_t size = *psize - 4;
-	size_t out_len, dest_len, chunksize;
-	const char *msg;
-
-	if (size < 4) {
-		msg = "input too small";
-		goto exit_0;
-	}
-
-	out_len = get_unaligned_le32(inp + size);
-	if (xc_dom_kernel_check_size(dom, out_len)) {
-		msg = "Decompressed image too large";
-		goto exit_0;
-	}
-
-	output = malloc(out_len);
-	if (!output) {
-		msg = "Could not allocate output buffer";
-		goto exit_0;
-	}
-	outp = output;
-
-	chunksize = get_unaligned_le32(inp);
-	if (chunksize == ARCHIVE_MAGICNUMBER) {
-		inp += 4;
-		size -= 4;
-	} else {
-		msg = "invalid header";
-		goto exit_2;
-	}
-
-	for (;;) {
-		if (size < 4) {
-			msg = "missing data";
-			goto exit_2;
-		}
-		chunksize = get_unaligned_le32(inp);
-		if (chunksize == ARCHIVE_MAGICNUMBER) {
-			inp += 4;
-			size -= 4;
-			continue;
-		}
-		inp += 4;
-		size -= 4;
-		if (chunksize > size) {
-			msg = "insufficient input data";
-			goto exit_2;
-		}
-
-		dest_len = out_len - (outp - output);
-		ret = lz4_decompress_unknownoutputsize(inp, chunksize, outp,
-				&dest_len);
-		if (ret < 0) {
-			msg = "decoding failed";
-			goto exit_2;
-		}
-
-		ret = -1;
-		outp += dest_len;
-		size -= chunksize;
-
-		if (size == 0)
-		{
-			*blob = output;
-			*psize = out_len;
-			return 0;
-		}
-
-		if (size < 0) {
-			msg = "data corrupted";
-			goto exit_2;
-		}
-
-		inp += chunksize;
-	}
-
-exit_2:
-	free(output);
-exit_0:
-	DOMPRINTF("LZ4 decompression error: %s\n", msg);
-	return ret;
+    unsigned char *output;
+    size_t out_len;
+
+    if ( *psize < 8 )
+    {
+        DOMPRINTF("LZ4 decompression error: input too small\n");
+        return -1;
+    }
+
+    out_len = get_unaligned_le32((unsigned char *)*blob + *psize - 4);
+    if ( xc_dom_kernel_check_size(dom, out_len) )
+    {
+        DOMPRINTF("LZ4 decompression error: Decompressed image too large\n");
+        return -1;
+    }
+
+    output = malloc(out_len);
+    if ( !output )
+    {
+        DOMPRINTF("LZ4 decompression error: "
+                  "Could not allocate output buffer\n");
+        return -1;
+    }
+
+    if ( xc_dom_do_lz4(dom->xch, *blob, *psize, output, out_len) )
+    {
+        free(output);
+        return -1;
+    }
+
+    *blob = output;
+    *psize = out_len;
+    return 0;
 }
 
 #else /* __MINIOS__ */
@@ -133,4 +379,15 @@ int xc_try_lz4_decode(
     return xc_dom_decompress_unsafe(unlz4, dom, blob, size);
 }
 
+size_t xc_dom_check_lz4(xc_interface *xch, void *blob, size_t size)
+{
+    return 0;
+}
+
+int xc_dom_do_lz4(xc_interface *xch,
+                  void *src, size_t srclen, void *dst, size_t dstlen)
+{
+    return -1;
+}
+
 #endif
@@ -0,0 +1,580 @@
+/*
+ * Post-copy phase of HVM live migration.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * With XCFLAGS_POSTCOPY, xc_domain_save() gives up on pre-copy as soon as a
+ * round no longer sends fewer pages than the one before, and rather than
+ * sending what the guest dirtied since in the last iteration, only lists
+ * those pages (XC_SAVE_ID_POSTCOPY_PFNS).  The receiver pages them out with
+ * the interface xenpaging uses, lets the toolstack resume the guest, and
+ * fetches each page the guest touches over the migration socket, while the
+ * sender pushes the others in PFN order.  Downtime thus no longer depends
+ * on the guest's dirty rate; in exchange, the guest waits a round trip for
+ * every page it touches before it arrives, and is lost if either end fails
+ * before the phase completes.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/mman.h>
+
+#include "xg_private.h"
+#include "xg_save_restore.h"
+#include "xc_bitops.h"
+
+#include <xen/hvm/params.h>
+#include <xen/mem_event.h>
+
+/* Pages per chunk when pushing in the background. */
+#define POSTCOPY_BATCH     64
+/* Pages following a requested one sent along with it. */
+#define POSTCOPY_PREFETCH  15
+
+/* Sender */
+
+/* The next pending page from *CURSOR on, wrapping; there must be one. */
+static unsigned long next_pending(unsigned long *pending,
+                                  unsigned long p2m_size,
+                                  unsigned long *cursor)
+{
+    unsigned long pfn;
+
+    for ( pfn = *cursor; ; pfn++ )
+    {
+        if ( pfn >= p2m_size )
+            pfn = 0;
+        if ( !(pfn % BITS_PER_LONG) && !pending[pfn / BITS_PER_LONG] )
+        {
+            /* incremented again in for loop! */
+            pfn += BITS_PER_LONG - 1;
+            continue;
+        }
+        if ( test_bit(pfn, pending) )
+            break;
+    }
+
+    *cursor = pfn + 1;
+    return pfn;
+}
+
+static int send_pages(xc_interface *xch, int io_fd, uint32_t dom,
+                      xen_pfn_t *pfns, int *err, int nr)
+{
+    uint64_t list[POSTCOPY_BATCH + POSTCOPY_PREFETCH];
+    void *region;
+    int i, rc = -1;
+
+    region = xc_map_foreign_bulk(xch, dom, PROT_READ, pfns, err, nr);
+    if ( region == NULL )
+    {
+        PERROR("Failed to map %d pages", nr);
+        return -1;
+    }
+
+    for ( i = 0; i < nr; i++ )
+    {
+        if ( err[i] )
+        {
+            ERROR("Failed to map pfn %#lx: %d", (unsigned long)pfns[i],
+                  err[i]);
+            goto out;
+        }
+        list[i] = pfns[i];
+    }
+
+    if ( write_exact(io_fd, &nr, sizeof(int)) ||
+         write_exact(io_fd, list, nr * sizeof(*list)) ||
+         write_exact(io_fd, region, nr * PAGE_SIZE) )
+    {
+        PERROR("Error when writing post-copy pages");
+        goto out;
+    }
+    rc = 0;
+
+ out:
+    munmap(region, nr * PAGE_SIZE);
+    return rc;
+}
+
+int xc_postcopy_send(xc_interface *xch, int io_fd, uint32_t dom,
+                     unsigned long *pending, unsigned long p2m_size,
+                     unsigned long nr_pending)
+{
+    xen_pfn_t pfns[POSTCOPY_BATCH + POSTCOPY_PREFETCH];
+    int err[POSTCOPY_BATCH + POSTCOPY_PREFETCH];
+    struct pollfd pfd = { .fd = io_fd, .events = POLLIN };
+    unsigned long cursor = 0, requested = 0, prefetched = 0, pushed = 0;
+    unsigned long pfn;
+    uint64_t req;
+    int nr, zero = 0;
+
+    DPRINTF("Post-copy: %lu pages to send\n", nr_pending);
+
+    while ( nr_pending )
+    {
+        nr = 0;
+
+        /* Pages the guest waits for first, each with its successors. */
+        while ( nr < POSTCOPY_BATCH && poll(&pfd, 1, 0) > 0 )
+        {
+            if ( read_exact(io_fd, &req, sizeof(req)) )
+            {
+                PERROR("Error when reading post-copy request");
+                return -1;
+            }
+            /* Requests for pages already on the way are stale. */
+            if ( req >= p2m_size || !test_bit(req, pending) )
+                continue;
+            requested++;
+
+            for ( pfn = req;
+                  pfn < p2m_size && pfn <= req + POSTCOPY_PREFETCH; pfn++ )
+            {
+                if ( !test_and_clear_bit(pfn, pending) )
+                    continue;
+                pfns[nr++] = pfn;
+                nr_pending--;
+                prefetched += pfn != req;
+            }
+        }
+
+        /* Then push the rest in order. */
+        for ( ; nr < POSTCOPY_BATCH && nr_pending; nr_pending-- )
+        {
+            pfn = next_pending(pending, p2m_size, &cursor);
+            clear_bit(pfn, pending);
+            pfns[nr++] = pfn;
+            pushed++;
+        }
+
+        if ( send_pages(xch, io_fd, dom, pfns, err, nr) )
+            return -1;
+    }
+
+    if ( write_exact(io_fd, &zero, sizeof(zero)) )
+    {
+        PERROR("Error when writing post-copy end");
+        return -1;
+    }
+
+    DPRINTF("Post-copy: %lu pages requested, %lu prefetched, %lu pushed\n",
+            requested, prefetched, pushed);
+    return 0;
+}
+
+/* Receiver */
+
+struct postcopy_ctx {
+    xc_interface *xch;
+    uint32_t dom;
+    int io_fd;
+
+    unsigned long *pending;     /* not received yet */
+    unsigned long *requested;   /* asked the sender for */
+    unsigned long p2m_size;
+    unsigned long nr_pending;
+
+    /* The paging ring, set up as by xenpaging. */
+    xc_evtchn *xce;
+    int port;
+    mem_event_back_ring_t back_ring;
+    void *ring_page;
+    xen_pfn_t ring_pfn;
+    int enabled;
+
+    /* Requests for pages yet to arrive. */
+    mem_event_request_t *waiting;
+    unsigned int nr_waiting, max_waiting;
+
+    uint64_t *pfns;
+    void *page;                 /* page aligned, for xc_mem_paging_load() */
+    unsigned long nr_requested;
+};
+
+static int ring_setup(struct postcopy_ctx *pc)
+{
+    xc_interface *xch = pc->xch;
+    uint64_t ring_pfn;
+    uint32_t port;
+    int err, rc;
+
+    if ( xc_hvm_param_get(xch, pc->dom, HVM_PARAM_PAGING_RING_PFN,
+                          &ring_pfn) || !ring_pfn )
+    {
+        PERROR("Failed to get the paging ring pfn");
+        return -1;
+    }
+    pc->ring_pfn = ring_pfn;
+
+    pc->ring_page = xc_map_foreign_bulk(xch, pc->dom, PROT_READ | PROT_WRITE,
+                                        &pc->ring_pfn, &err, 1);
+    if ( pc->ring_page && err )
+    {
+        /* Map failed, populate ring page */
+        munmap(pc->ring_page, PAGE_SIZE);
+        pc->ring_page = NULL;
+        if ( xc_domain_populate_physmap_exact(xch, pc->dom, 1, 0, 0,
+                                              &pc->ring_pfn) == 0 )
+            pc->ring_page = xc_map_foreign_bulk(xch, pc->dom,
+                                                PROT_READ | PROT_WRITE,
+                                                &pc->ring_pfn, &err, 1);
+    }
+    if ( !pc->ring_page || err )
+    {
+        PERROR("Could not map the paging ring page");
+        if ( pc->ring_page )
+            munmap(pc->ring_page, PAGE_SIZE);
+        pc->ring_page = NULL;
+        return -1;
+    }
+
+    if ( xc_mem_paging_enable(xch, pc->dom, &port) )
+    {
+        PERROR("Failed to enable paging (needs HAP, no PoD or passthrough)");
+        return -1;
+    }
+    pc->enabled = 1;
+
+    pc->xce = xc_evtchn_open(NULL, 0);
+    if ( pc->xce == NULL )
+    {
+        PERROR("Failed to open event channel");
+        return -1;
+    }
+
+    rc = xc_evtchn_bind_interdomain(pc->xce, pc->dom, port);
+    if ( rc < 0 )
+    {
+        PERROR("Failed to bind event channel");
+        return -1;
+    }
+    pc->port = rc;
+
+    SHARED_RING_INIT((mem_event_sring_t *)pc->ring_page);
+    BACK_RING_INIT(&pc->back_ring, (mem_event_sring_t *)pc->ring_page,
+                   PAGE_SIZE);
+
+    /* Now that the ring is set, remove it from the guest's physmap */
+    if ( xc_domain_decrease_reservation_exact(xch, pc->dom, 1, 0,
+                                              &pc->ring_pfn) )
+        PERROR("Failed to remove ring from guest physmap");
+
+    return 0;
+}
+
+static void ring_teardown(struct postcopy_ctx *pc)
+{
+    xc_interface *xch = pc->xch;
+
+    if ( pc->ring_page )
+        munmap(pc->ring_page, PAGE_SIZE);
+    if ( pc->enabled && xc_mem_paging_disable(xch, pc->dom) )
+        PERROR("Error tearing down paging");
+    if ( pc->port > 0 )
+        xc_evtchn_unbind(pc->xce, pc->port);
+    if ( pc->xce )
+        xc_evtchn_close(pc->xce);
+}
+
+static void get_request(struct postcopy_ctx *pc, mem_event_request_t *req)
+{
+    mem_event_back_ring_t *back_ring = &pc->back_ring;
+    RING_IDX req_cons = back_ring->req_cons;
+
+    memcpy(req, RING_GET_REQUEST(back_ring, req_cons), sizeof(*req));
+    req_cons++;
+
+    back_ring->req_cons = req_cons;
+    back_ring->sring->req_event = req_cons + 1;
+}
+
+static void put_response(struct postcopy_ctx *pc, mem_event_request_t *req)
+{
+    mem_event_back_ring_t *back_ring = &pc->back_ring;
+    RING_IDX rsp_prod = back_ring->rsp_prod_pvt;
+    mem_event_response_t *rsp = RING_GET_RESPONSE(back_ring, rsp_prod);
+
+    memset(rsp, 0, sizeof(*rsp));
+    rsp->gfn = req->gfn;
+    rsp->vcpu_id = req->vcpu_id;
+    rsp->flags = req->flags;
+
+    back_ring->rsp_prod_pvt = rsp_prod + 1;
+    RING_PUSH_RESPONSES(back_ring);
+}
+
+/* Resume whoever waited for pages which have arrived since. */
+static int wake_waiters(struct postcopy_ctx *pc)
+{
+    xc_interface *xch = pc->xch;
+    unsigned int i, j;
+
+    for ( i = j = 0; i < pc->nr_waiting; i++ )
+    {
+        if ( test_bit(pc->waiting[i].gfn, pc->pending) )
+            pc->waiting[j++] = pc->waiting[i];
+        else
+            put_response(pc, &pc->waiting[i]);
+    }
+    if ( j == pc->nr_waiting )
+        return 0;
+    pc->nr_waiting = j;
+
+    if ( xc_evtchn_notify(pc->xce, pc->port) )
+    {
+        PERROR("Error notifying paging event channel");
+        return -1;
+    }
+    return 0;
+}
+
+static int handle_requests(struct postcopy_ctx *pc)
+{
+    xc_interface *xch = pc->xch;
+    mem_event_request_t req, *tmp;
+    uint64_t pfn;
+    int port, notify = 0;
+
+    port = xc_evtchn_pending(pc->xce);
+    if ( port == -1 || xc_evtchn_unmask(pc->xce, port) )
+    {
+        PERROR("Error getting paging event");
+        return -1;
+    }
+
+    while ( RING_HAS_UNCONSUMED_REQUESTS(&pc->back_ring) )
+    {
+        get_request(pc, &req);
+
+        if ( req.gfn >= pc->p2m_size || !test_bit(req.gfn, pc->pending) )
+        {
+            /* Arrived in the meantime. */
+            if ( req.flags & (MEM_EVENT_FLAG_VCPU_PAUSED |
+                              MEM_EVENT_FLAG_EVICT_FAIL) )
+            {
+                put_response(pc, &req);
+                notify = 1;
+            }
+            continue;
+        }
+
+        if ( req.flags & MEM_EVENT_FLAG_DROP_PAGE )
+        {
+            /* Ballooned out: whatever the sender has for it is stale. */
+            clear_bit(req.gfn, pc->pending);
+            pc->nr_pending--;
+            put_response(pc, &req);
+            notify = 1;
+            continue;
+        }
+
+        if ( !test_and_set_bit(req.gfn, pc->requested) )
+        {
+            pfn = req.gfn;
+            if ( write_exact(pc->io_fd, &pfn, sizeof(pfn)) )
+            {
+                PERROR("Error when writing post-copy request");
+                return -1;
+            }
+            pc->nr_requested++;
+        }
+
+        if ( pc->nr_waiting == pc->max_waiting )
+        {
+            pc->max_waiting = pc->max_waiting ? pc->max_waiting * 2 : 64;
+            tmp = realloc(pc->waiting,
+                          pc->max_waiting * sizeof(*pc->waiting));
+            if ( tmp == NULL )
+            {
+                ERROR("Unable to allocate paging requests");
+                return -1;
+            }
+            pc->waiting = tmp;
+        }
+        pc->waiting[pc->nr_waiting++] = req;
+    }
+
+    if ( notify && xc_evtchn_notify(pc->xce, pc->port) )
+    {
+        PERROR("Error notifying paging event channel");
+        return -1;
+    }
+    return 0;
+}
+
+/* Receive a chunk of pages; returns 1 at the end of the stream. */
+static int receive_pages(struct postcopy_ctx *pc)
+{
+    xc_interface *xch = pc->xch;
+    int nr, i;
+
+    if ( read_exact(pc->io_fd, &nr, sizeof(nr)) )
+    {
+        PERROR("Error when reading post-copy chunk");
+        return -1;
+    }
+    if ( nr == 0 )
+        return 1;
+    if ( nr < 0 || nr > MAX_BATCH_SIZE )
+    {
+        ERROR("Bad post-copy chunk of %d pages", nr);
+        return -1;
+    }
+
+    if ( read_exact(pc->io_fd, pc->pfns, nr * sizeof(*pc->pfns)) )
+    {
+        PERROR("Error when reading post-copy pfns");
+        return -1;
+    }
+
+    for ( i = 0; i < nr; i++ )
+    {
+        if ( read_exact(pc->io_fd, pc->page, PAGE_SIZE) )
+        {
+            PERROR("Error when reading post-copy page");
+            return -1;
+        }
+
+        /* Pages the receiver has let go of are simply dropped. */
+        if ( pc->pfns[i] >= pc->p2m_size ||
+             !test_bit(pc->pfns[i], pc->pending) )
+            continue;
+
+        if ( xc_mem_paging_load(xch, pc->dom, pc->pfns[i], pc->page) )
+        {
+            PERROR("Failed to load pfn %#"PRIx64, pc->pfns[i]);
+            return -1;
+        }
+        clear_bit(pc->pfns[i], pc->pending);
+        pc->nr_pending--;
+    }
+
+    return wake_waiters(pc);
+}
+
+int xc_postcopy_receive(xc_interface *xch, int io_fd, uint32_t dom,
+                        unsigned long *pending, unsigned long p2m_size,
+                        unsigned long nr_pending,
+                        int (*resume)(uint32_t domid, void *data),
+                        void *data)
+{
+    struct postcopy_ctx _pc, *pc = &_pc;
+    struct pollfd fds[2];
+    unsigned long pfn;
+    int rc = -1, done = 0;
+
+    memset(pc, 0, sizeof(*pc));
+    pc->xch = xch;
+    pc->dom = dom;
+    pc->io_fd = io_fd;
+    pc->pending = pending;
+    pc->p2m_size = p2m_size;
+    pc->nr_pending = nr_pending;
+
+    DPRINTF("Post-copy: %lu pages to receive\n", nr_pending);
+
+    pc->requested = bitmap_alloc(p2m_size);
+    pc->pfns = malloc(MAX_BATCH_SIZE * sizeof(*pc->pfns));
+    if ( !pc->requested || !pc->pfns ||
+         posix_memalign(&pc->page, PAGE_SIZE, PAGE_SIZE) )
+    {
+        ERROR("Unable to allocate memory for post-copy");
+        goto out;
+    }
+
+    if ( ring_setup(pc) )
+        goto out;
+
+    /* The ring page is no longer the guest's. */
+    if ( pc->ring_pfn < p2m_size &&
+         test_and_clear_bit(pc->ring_pfn, pending) )
+        pc->nr_pending--;
+
+    for ( pfn = 0; pfn < p2m_size; pfn++ )
+    {
+        if ( !(pfn % BITS_PER_LONG) && !pending[pfn / BITS_PER_LONG] )
+        {
+            pfn += BITS_PER_LONG - 1;
+            continue;
+        }
+        if ( test_bit(pfn, pending) &&
+             (xc_mem_paging_nominate(xch, dom, pfn) ||
+              xc_mem_paging_evict(xch, dom, pfn)) )
+        {
+            PERROR("Failed to page out pfn %#lx", pfn);
+            goto out;
+        }
+    }
+
+    if ( resume && resume(dom, data) )
+    {
+        ERROR("Post-copy resume callback failed");
+        goto out;
+    }
+
+    fds[0].fd = xc_evtchn_fd(pc->xce);
+    fds[0].events = POLLIN;
+    fds[1].fd = io_fd;
+    fds[1].events = POLLIN;
+
+    while ( !done )
+    {
+        if ( poll(fds, 2, -1) < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            PERROR("Error polling for post-copy events");
+            goto out;
+        }
+
+        if ( fds[0].revents && handle_requests(pc) )
+            goto out;
+        if ( fds[1].revents && (done = receive_pages(pc)) < 0 )
+            goto out;
+    }
+
+    if ( pc->nr_pending )
+    {
+        ERROR("Post-copy stream ended with %lu pages missing",
+              pc->nr_pending);
+        goto out;
+    }
+
+    DPRINTF("Post-copy: %lu pages requested\n", pc->nr_requested);
+    rc = 0;
+
+ out:
+    ring_teardown(pc);
+    free(pc->waiting);
+    free(pc->requested);
+    free(pc->pfns);
+    free(pc->page);
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -43,6 +43,7 @@
 #include "xg_private.h"
 #include "xg_save_restore.h"
 #include "xc_dom.h"
+#include "xc_bitops.h"
 
 #include <xen/hvm/ioreq.h>
 #include <xen/hvm/params.h>
@@ -61,6 +62,10 @@ struct restore_ctx {
     int completed; /* Set when a consistent image is available */
     int last_checkpoint; /* Set when we should commit to the current checkpoint when it completes. */
     int compressing; /* Set when sender signals that pages would be sent compressed (for Remus) */
+    uint8_t *hvm_base; /* HVM context sent before the guest was suspended */
+    uint32_t hvm_base_len;
+    unsigned long *postcopy_pending; /* Pages to come after the tail */
+    unsigned long nr_postcopy;
     struct domain_info_context dinfo;
 };
 
@@ -948,6 +953,79 @@ static int pagebuf_get_one(xc_interface *xch, struct restore_ctx *ctx,
             return pagebuf_get_one(xch, ctx, buf, fd, dom);
         }
 
+    case XC_SAVE_ID_HVM_CONTEXT:
+        {
+            uint32_t len;
+
+            if ( RDEXACT(fd, &len, sizeof(len)) )
+            {
+                PERROR("error read HVM context size");
+                return -1;
+            }
+            ptmp = realloc(ctx->hvm_base, len);
+            if ( ptmp == NULL )
+            {
+                PERROR("error memory allocation");
+                return -1;
+            }
+            ctx->hvm_base = ptmp;
+            ctx->hvm_base_len = len;
+            if ( RDEXACT(fd, ctx->hvm_base, len) )
+            {
+                PERROR("error read HVM context");
+                return -1;
+            }
+            return pagebuf_get_one(xch, ctx, buf, fd, dom);
+        }
+
+    case XC_SAVE_ID_POSTCOPY_PFNS:
+        {
+            uint64_t *pfns;
+            uint32_t nr, i;
+
+            if ( RDEXACT(fd, &nr, sizeof(nr)) )
+            {
+                PERROR("error read post-copy pfn count");
+                return -1;
+            }
+            if ( nr > MAX_BATCH_SIZE )
+            {
+                ERROR("too many post-copy pfns (%u)", nr);
+                return -1;
+            }
+            if ( !ctx->postcopy_pending &&
+                 !(ctx->postcopy_pending = bitmap_alloc(ctx->dinfo.p2m_size)) )
+            {
+                PERROR("error memory allocation");
+                return -1;
+            }
+            pfns = malloc(nr * sizeof(*pfns) ?: 1);
+            if ( pfns == NULL )
+            {
+                PERROR("error memory allocation");
+                return -1;
+            }
+            if ( RDEXACT(fd, pfns, nr * sizeof(*pfns)) )
+            {
+                PERROR("error read post-copy pfns");
+                free(pfns);
+                return -1;
+            }
+            for ( i = 0; i < nr; i++ )
+            {
+                if ( pfns[i] >= ctx->dinfo.p2m_size )
+                {
+                    ERROR("post-copy pfn %#"PRIx64" out of range", pfns[i]);
+                    free(pfns);
+                    return -1;
+                }
+                if ( !test_and_set_bit(pfns[i], ctx->postcopy_pending) )
+                    ctx->nr_postcopy++;
+            }
+            free(pfns);
+            return pagebuf_get_one(xch, ctx, buf, fd, dom);
+        }
+
     case XC_SAVE_ID_ENABLE_COMPRESSION:
         /* We cannot set compression flag directly in pagebuf structure,
          * since this pagebuf still has uncompressed pages that are yet to
@@ -1483,6 +1561,8 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
     struct toolstack_data_t tdata, tdatatmp;
     void* vcpup;
     uint64_t console_pfn = 0;
+    uint8_t *hvmbuf = NULL;
+    uint32_t hvmlen = 0;
 
     int orig_io_fd_flags;
 
@@ -2325,8 +2405,19 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
         *console_mfn = console_pfn;
     }
 
-    frc = xc_domain_hvm_setcontext(xch, dom, tailbuf.u.hvm.hvmbuf,
-                                   tailbuf.u.hvm.reclen);
+    if ( ctx->hvm_base )
+    {
+        /* The tail only has the records that changed since. */
+        hvmbuf = xc_hvm_context_expand(xch, ctx->hvm_base, ctx->hvm_base_len,
+                                       tailbuf.u.hvm.hvmbuf,
+                                       tailbuf.u.hvm.reclen, &hvmlen);
+        if ( !hvmbuf )
+            goto out;
+    }
+
+    frc = xc_domain_hvm_setcontext(xch, dom,
+                                   hvmbuf ?: tailbuf.u.hvm.hvmbuf,
+                                   hvmbuf ? hvmlen : tailbuf.u.hvm.reclen);
     if ( frc )
     {
         PERROR("error setting the HVM context");
@@ -2341,6 +2432,46 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
         goto out;
     }
 
+    if ( ctx->postcopy_pending )
+    {
+        uint64_t special[] = { tailbuf.u.hvm.magicpfns[0],
+                               tailbuf.u.hvm.magicpfns[1],
+                               tailbuf.u.hvm.magicpfns[2], console_pfn };
+
+        /* These were reset above, rather than restored. */
+        for ( i = 0; i < ARRAY_SIZE(special); i++ )
+            if ( special[i] && special[i] < dinfo->p2m_size &&
+                 test_and_clear_bit(special[i], ctx->postcopy_pending) )
+                ctx->nr_postcopy--;
+
+        /* Pages are paged out in place: allocate any never sent before. */
+        for ( pfn = n = 0; pfn < dinfo->p2m_size; pfn++ )
+        {
+            if ( test_bit(pfn, ctx->postcopy_pending) &&
+                 ctx->p2m[pfn] == INVALID_P2M_ENTRY )
+            {
+                region_mfn[n++] = pfn;
+                ctx->p2m[pfn] = pfn;
+            }
+            if ( n && (n == MAX_BATCH_SIZE || pfn == dinfo->p2m_size - 1) )
+            {
+                if ( xc_domain_populate_physmap_exact(xch, dom, n, 0, 0,
+                                                      region_mfn) )
+                {
+                    PERROR("Failed to allocate post-copy pages");
+                    goto out;
+                }
+                n = 0;
+            }
+        }
+
+        if ( xc_postcopy_receive(xch, io_fd, dom, ctx->postcopy_pending,
+                                 dinfo->p2m_size, ctx->nr_postcopy,
+                                 callbacks ? callbacks->postcopy_resume : NULL,
+                                 callbacks ? callbacks->data : NULL) )
+            goto out;
+    }
+
     /* HVM success! */
     rc = 0;
 
@@ -2355,6 +2486,9 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
     free(ctx->p2m_batch);
     pagebuf_free(&pagebuf);
     tailbuf_free(&tailbuf);
+    free(ctx->hvm_base);
+    free(ctx->postcopy_pending);
+    free(hvmbuf);
 
     /* discard cache for save file  */
     discard_file_cache(xch, io_fd, 1 /*flush*/);
@@ -325,6 +325,135 @@ static int print_stats(xc_interface *xch, uint32_t domid, int pages_sent,
 }
 
 
+/*
+ * Adaptive live migration (max_downtime_ms).  After each iteration, work out
+ * how fast the guest dirties its memory and how fast the link drains it,
+ * and from that the downtime of suspending the guest now and sending what
+ * it dirtied meanwhile.  Once that is within bounds, further iterations only
+ * cost time.  While the guest dirties pages at more than half the rate they
+ * are sent, further iterations will not get there either: its CPU time is
+ * then capped through the credit scheduler, a little more each iteration,
+ * until they do.
+ */
+#define CONVERGE_MIN_SAMPLE  256    /* pages sent for a bandwidth sample */
+#define CONVERGE_STALLS        2    /* iterations before throttling */
+#define THROTTLE_INITIAL      20    /* % of the guest's CPU time withheld */
+#define THROTTLE_STEP         10
+#define THROTTLE_MAX          90
+
+struct converge {
+    uint32_t max_downtime_ms;   /* 0: max_iters and max_factor only */
+    uint64_t bandwidth;         /* pages/s, smoothed */
+    uint64_t dirty_rate;        /* pages/s */
+    uint32_t remaining;         /* pages dirtied during the last iteration */
+    uint32_t downtime_ms;       /* predicted for stopping now */
+    unsigned int stalls;        /* iterations in a row not converging */
+    unsigned int throttle;      /* % of the guest's CPU time withheld */
+    int can_throttle;
+    int saved;                  /* sdom holds the parameters to restore */
+    struct xen_domctl_sched_credit sdom;
+};
+
+static int converge_update(xc_interface *xch, uint32_t domid,
+                           struct converge *cv, xc_hypercall_buffer_t *bitmap,
+                           unsigned long p2m_size, unsigned int sent,
+                           struct time_stats *last)
+{
+    xc_shadow_op_stats_t stats;
+    struct timeval now;
+    uint64_t us, downtime;
+
+    /* Only peek: the caller cleans the bitmap once it has decided. */
+    if ( xc_shadow_control(xch, domid, XEN_DOMCTL_SHADOW_OP_PEEK, bitmap,
+                           p2m_size, NULL, 0, &stats) != p2m_size )
+    {
+        PERROR("Error peeking shadow bitmap");
+        return -1;
+    }
+
+    /* The time stats were taken when the bitmap was last cleaned. */
+    gettimeofday(&now, NULL);
+    us = tv_delta(&now, &last->wall) ? : 1;
+
+    /* Small iterations measure the latency of the link more than its rate. */
+    if ( sent >= CONVERGE_MIN_SAMPLE )
+    {
+        uint64_t bw = sent * 1000000ULL / us;
+
+        cv->bandwidth = cv->bandwidth ? (cv->bandwidth + bw) / 2 : bw;
+    }
+
+    cv->remaining = stats.dirty_count;
+    cv->dirty_rate = stats.dirty_count * 1000000ULL / us;
+    downtime = cv->bandwidth ? cv->remaining * 1000ULL / cv->bandwidth : ~0ULL;
+    cv->downtime_ms = downtime > UINT32_MAX ? UINT32_MAX : downtime;
+
+    if ( cv->bandwidth && cv->dirty_rate * 2 > cv->bandwidth )
+        cv->stalls++;
+    else
+        cv->stalls = 0;
+
+    DPRINTF("dirty %"PRIu64" pages/s, sent %"PRIu64" pages/s, "
+            "%u pages left, downtime ~%ums\n", cv->dirty_rate,
+            cv->bandwidth, cv->remaining, cv->downtime_ms);
+
+    return 0;
+}
+
+/* Cap the guest's CPU time one step further, if it does not converge. */
+static void converge_throttle(xc_interface *xch, uint32_t domid,
+                              struct converge *cv, unsigned int nr_vcpus)
+{
+    struct xen_domctl_sched_credit sdom;
+    unsigned int throttle, cap;
+
+    if ( !cv->can_throttle || cv->stalls < CONVERGE_STALLS ||
+         cv->throttle >= THROTTLE_MAX )
+        return;
+
+    if ( !cv->saved )
+    {
+        if ( xc_sched_credit_domain_get(xch, domid, &cv->sdom) )
+        {
+            DPRINTF("Cannot throttle dom%u, not scheduled by credit\n",
+                    domid);
+            cv->can_throttle = 0;
+            return;
+        }
+        cv->saved = 1;
+    }
+
+    throttle = cv->throttle ? cv->throttle + THROTTLE_STEP : THROTTLE_INITIAL;
+    if ( throttle > THROTTLE_MAX )
+        throttle = THROTTLE_MAX;
+    cap = (nr_vcpus ? : 1) * (100 - throttle);
+
+    sdom = cv->sdom;
+    if ( !sdom.cap || cap < sdom.cap )
+        sdom.cap = cap;
+    if ( xc_sched_credit_domain_set(xch, domid, &sdom) )
+    {
+        PERROR("Could not throttle dom%u", domid);
+        cv->can_throttle = 0;
+        return;
+    }
+
+    cv->throttle = throttle;
+    DPRINTF("Throttled dom%u by %u%%, cap %u\n", domid, throttle, sdom.cap);
+}
+
+static void converge_unthrottle(xc_interface *xch, uint32_t domid,
+                                struct converge *cv)
+{
+    if ( !cv->saved )
+        return;
+
+    if ( xc_sched_credit_domain_set(xch, domid, &cv->sdom) )
+        PERROR("Could not restore the scheduling parameters of dom%u", domid);
+    cv->saved = 0;
+}
+
+
 static int analysis_phase(xc_interface *xch, uint32_t domid, struct save_ctx *ctx,
                           xc_hypercall_buffer_t *arr, int runs)
 {
@@ -800,9 +929,69 @@ static int save_tsc_info(xc_interface *xch, uint32_t dom, int io_fd)
     return 0;
 }
 
+/*
+ * Post-copy: leave the pages still to send out of the last iteration, moving
+ * them from TO_SEND to PENDING and listing them for the receiver.  Holes and
+ * broken pages stay in TO_SEND, as they carry no data.  Returns the number
+ * of pages left out, or -1 on error.
+ */
+static long postcopy_defer(xc_interface *xch, uint32_t dom,
+                           struct outbuf *ob, int io_fd,
+                           unsigned long *to_send, unsigned long *pending,
+                           unsigned long p2m_size, xen_pfn_t *pfn_type,
+                           unsigned long *pfn_batch)
+{
+    uint64_t pfns[MAX_BATCH_SIZE];
+    unsigned long n = 0;
+    long nr_pending = 0;
+    uint32_t batch, nr, i;
+    int id = XC_SAVE_ID_POSTCOPY_PFNS, listed = 0;
+
+    /* Always send a list, however short, to announce the post-copy phase. */
+    do {
+        for ( batch = 0; batch < MAX_BATCH_SIZE && n < p2m_size; n++ )
+        {
+            if ( !test_bit(n, to_send) )
+                continue;
+            pfn_batch[batch] = pfn_type[batch] = n;
+            batch++;
+        }
+
+        if ( batch && xc_get_pfn_type_batch(xch, dom, batch, pfn_type) )
+        {
+            PERROR("get_pfn_type_batch failed");
+            return -1;
+        }
+
+        for ( nr = i = 0; i < batch; i++ )
+        {
+            if ( pfn_type[i] == XEN_DOMCTL_PFINFO_XTAB ||
+                 pfn_type[i] == XEN_DOMCTL_PFINFO_BROKEN )
+                continue;
+            clear_bit(pfn_batch[i], to_send);
+            set_bit(pfn_batch[i], pending);
+            pfns[nr++] = pfn_batch[i];
+        }
+
+        if ( !nr && (listed || n < p2m_size) )
+            continue;
+        if ( write_buffer(xch, 1, ob, io_fd, &id, sizeof(id)) ||
+             write_buffer(xch, 1, ob, io_fd, &nr, sizeof(nr)) ||
+             write_buffer(xch, 1, ob, io_fd, pfns, nr * sizeof(*pfns)) )
+        {
+            PERROR("Error when writing post-copy pfns");
+            return -1;
+        }
+        nr_pending += nr;
+        listed = 1;
+    } while ( n < p2m_size );
+
+    return nr_pending;
+}
+
 int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iters,
-                   uint32_t max_factor, uint32_t flags,
-                   struct save_callbacks* callbacks, int hvm)
+                   uint32_t max_factor, uint32_t max_downtime_ms,
+                   uint32_t flags, struct save_callbacks* callbacks, int hvm)
 {
     xc_dominfo_t info;
     DECLARE_DOMCTL;
@@ -810,6 +999,7 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
     int rc, frc, i, j, last_iter = 0, iter = 0;
     int live  = (flags & XCFLAGS_LIVE);
     int debug = (flags & XCFLAGS_DEBUG);
+    int postcopy = (flags & XCFLAGS_POSTCOPY);
     int superpages = !!hvm;
     int race = 0, sent_last_iter, skip_this_iter = 0;
     unsigned int sent_this_iter = 0;
@@ -846,8 +1036,16 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
     DECLARE_HYPERCALL_BUFFER(unsigned long, to_send);
     unsigned long *to_fix = NULL;
 
+    /* Post-copy: pages left out of the last iteration. */
+    unsigned long *postcopy_pending = NULL;
+    long nr_postcopy = 0;
+
     struct time_stats time_stats;
     xc_shadow_op_stats_t shadow_stats;
+    struct converge converge = {
+        .max_downtime_ms = max_downtime_ms,
+        .can_throttle = 1,
+    };
 
     unsigned long needed_to_fix = 0;
     unsigned long total_sent    = 0;
@@ -855,8 +1053,8 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
     uint64_t vcpumap[XC_SR_MAX_VCPUS/64] = { 1ULL };
 
     /* HVM: a buffer for holding HVM context */
-    uint32_t hvm_buf_size = 0;
-    uint8_t *hvm_buf = NULL;
+    uint32_t hvm_buf_size = 0, hvm_base_len = 0;
+    uint8_t *hvm_buf = NULL, *hvm_base = NULL;
 
     /* HVM: magic frames for ioreqs and xenstore comms. */
     uint64_t magic_pfns[3]; /* ioreq_pfn, bufioreq_pfn, store_pfn */
@@ -903,6 +1101,15 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
         goto exit;
     }
 
+    if ( postcopy && (!hvm || !live || !callbacks->postcopy_begin ||
+                      callbacks->checkpoint) )
+    {
+        ERROR("Post-copy needs a live, uncheckpointed save of an HVM guest"
+              " and a postcopy_begin callback.");
+        errno = EINVAL;
+        goto exit;
+    }
+
     outbuf_init(xch, &ob_pagebuf, OUTBUF_SIZE);
 
     memset(ctx, 0, sizeof(*ctx));
@@ -1012,7 +1219,10 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
     to_skip = xc_hypercall_buffer_alloc_pages(xch, to_skip, NRPAGES(bitmap_size(dinfo->p2m_size)));
     to_fix  = calloc(1, bitmap_size(dinfo->p2m_size));
 
-    if ( !to_send || !to_fix || !to_skip )
+    if ( postcopy )
+        postcopy_pending = bitmap_alloc(dinfo->p2m_size);
+
+    if ( !to_send || !to_fix || !to_skip || (postcopy && !postcopy_pending) )
     {
         errno = ENOMEM;
         ERROR("Couldn't allocate to_send array");
@@ -1031,7 +1241,8 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
             goto out;
         }
         hvm_buf = malloc(hvm_buf_size);
-        if ( !hvm_buf )
+        hvm_base = live ? malloc(hvm_buf_size) : NULL;
+        if ( !hvm_buf || (live && !hvm_base) )
         {
             errno = ENOMEM;
             ERROR("Couldn't allocate memory");
@@ -1536,19 +1747,54 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
 
         if ( live )
         {
+            if ( converge_update(xch, dom, &converge, HYPERCALL_BUFFER(to_skip),
+                                 dinfo->p2m_size, sent_this_iter,
+                                 &time_stats) )
+                goto out;
+
             if ( (iter >= max_iters) ||
                  (sent_this_iter+skip_this_iter < 50) ||
-                 (total_sent > dinfo->p2m_size*max_factor) )
+                 (total_sent > dinfo->p2m_size*max_factor) ||
+                 /* Pre-copy no longer converges: leave it to post-copy. */
+                 (postcopy && iter > 1 && sent_this_iter >= sent_last_iter) ||
+                 (converge.max_downtime_ms &&
+                  converge.downtime_ms <= converge.max_downtime_ms) )
             {
                 DPRINTF("Start last iteration\n");
                 last_iter = 1;
 
+                /*
+                 * Send the HVM context while the guest still runs, so that
+                 * the tail need only carry the records that change until
+                 * it is suspended.
+                 */
+                if ( hvm )
+                {
+                    int id = XC_SAVE_ID_HVM_CONTEXT;
+
+                    if ( (hvm_base_len = xc_domain_hvm_getcontext(
+                              xch, dom, hvm_base, hvm_buf_size)) == -1 )
+                    {
+                        PERROR("HVM:Could not get hvm buffer");
+                        goto out;
+                    }
+                    if ( wrexact(io_fd, &id, sizeof(id)) ||
+                         wrexact(io_fd, &hvm_base_len, sizeof(uint32_t)) ||
+                         wrexact(io_fd, hvm_base, hvm_base_len) )
+                    {
+                        PERROR("Error when writing HVM context");
+                        goto out;
+                    }
+                }
+
                 if ( suspend_and_state(callbacks->suspend, callbacks->data,
                                        xch, io_fd, dom, &info) )
                 {
                     ERROR("Domain appears not to have suspended");
                     goto out;
                 }
+                /* Should the migration fail, it resumes at full speed. */
+                converge_unthrottle(xch, dom, &converge);
 
                 DPRINTF("SUSPEND shinfo %08lx\n", info.shared_info_frame);
                 if ( (tmem_saved > 0) &&
@@ -1566,6 +1812,16 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
 
 
             }
+            else if ( converge.max_downtime_ms && !postcopy )
+                converge_throttle(xch, dom, &converge, info.nr_online_vcpus);
+
+            if ( callbacks->migration_stats )
+                callbacks->migration_stats(iter, converge.remaining,
+                                           converge.dirty_rate,
+                                           converge.bandwidth,
+                                           converge.downtime_ms,
+                                           converge.throttle,
+                                           callbacks->data);
 
             if ( xc_shadow_control(xch, dom,
                                    XEN_DOMCTL_SHADOW_OP_CLEAN, HYPERCALL_BUFFER(to_send),
@@ -1575,6 +1831,17 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
                 goto out;
             }
 
+            if ( last_iter && postcopy )
+            {
+                nr_postcopy = postcopy_defer(xch, dom, ob, io_fd, to_send,
+                                             postcopy_pending,
+                                             dinfo->p2m_size, pfn_type,
+                                             pfn_batch);
+                if ( nr_postcopy < 0 )
+                    goto out;
+                DPRINTF("Left %ld pages to post-copy\n", nr_postcopy);
+            }
+
             sent_last_iter = sent_this_iter;
 
             print_stats(xch, dom, sent_this_iter, &time_stats, &shadow_stats, 1);
@@ -1832,6 +2099,16 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
             PERROR("HVM:Could not get hvm buffer");
             goto out;
         }
+
+        if ( hvm_base_len )
+        {
+            uint32_t full_size = rec_size;
+
+            rec_size = xc_hvm_context_delta(xch, hvm_base, hvm_base_len,
+                                            hvm_buf, rec_size);
+            DPRINTF("HVM context: %u bytes, %u after delta encoding\n",
+                    full_size, rec_size);
+        }
         
         if ( wrexact(io_fd, &rec_size, sizeof(uint32_t)) )
         {
@@ -2109,6 +2386,22 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
 
     discard_file_cache(xch, io_fd, 1 /* flush */);
 
+    /*
+     * The far end resumes the guest once it has the device model state,
+     * and then needs the pages left out of the last iteration.
+     */
+    if ( !rc && postcopy )
+    {
+        if ( callbacks->postcopy_begin(callbacks->data) )
+        {
+            ERROR("postcopy_begin callback failed");
+            rc = errno ?: EIO;
+        }
+        else if ( xc_postcopy_send(xch, io_fd, dom, postcopy_pending,
+                                   dinfo->p2m_size, nr_postcopy) )
+            rc = errno ?: EIO;
+    }
+
     /* Enable compression now, finally */
     compressing = (flags & XCFLAGS_CHECKPOINT_COMPRESS);
 
@@ -2150,6 +2443,7 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
             DPRINTF("Warning - couldn't disable shadow mode");
         if ( hvm && callbacks->switch_qemu_logdirty(dom, 0, callbacks->data) )
             DPRINTF("Warning - couldn't disable qemu log-dirty mode");
+        converge_unthrottle(xch, dom, &converge);
     }
 
     if (compress_ctx)
@@ -2171,7 +2465,9 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
     free(pfn_batch);
     free(pfn_err);
     free(to_fix);
+    free(postcopy_pending);
     free(hvm_buf);
+    free(hvm_base);
     outbuf_free(&ob_pagebuf);
 
     errno = rc;
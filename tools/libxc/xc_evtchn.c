@@ -78,6 +78,23 @@ int xc_evtchn_status(xc_interface *xch, xc_evtchn_status_t *status)
                         sizeof(*status), 1);
 }
 
+int xc_evtchn_send_batch(xc_interface *xch, const evtchn_port_t *ports,
+                         unsigned int nr_ports)
+{
+    struct evtchn_send_batch arg;
+
+    if ( nr_ports > EVTCHN_SEND_BATCH_MAX )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    arg.nr_ports = nr_ports;
+    memcpy(arg.ports, ports, nr_ports * sizeof(*ports));
+
+    return do_evtchn_op(xch, EVTCHNOP_send_batch, &arg, sizeof(arg), 0);
+}
+
 int xc_evtchn_fd(xc_evtchn *xce)
 {
     return xce->ops->u.evtchn.fd(xce, xce->ops_handle);
@@ -21,6 +21,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <zlib.h>
+#include <sys/time.h>
+#ifndef __MINIOS__
+#include <pthread.h>
+#endif
 
 #include "xg_private.h"
 #include "xc_private.h"
@@ -239,6 +243,264 @@ static int check_mmio_hole(uint64_t start, uint64_t memsize,
         return 1;
 }
 
+/*
+ * Guest memory is populated by several threads, each covering a span of
+ * guest physical memory, so that large guests are not built one hypercall
+ * at a time.  Spans start on 1GB boundaries so that no superpage is split
+ * between two of them.  Which node each extent comes from is left to Xen,
+ * which spreads successive allocations over the domain's node affinity.
+ */
+#define POPULATE_PAGES_PER_THREAD   (16UL << (30 - PAGE_SHIFT)) /* 16GB */
+#define POPULATE_THREADS_MAX        16
+
+struct populate_span {
+    xc_interface *xch;
+    uint32_t dom;
+    xen_pfn_t *page_array;
+    unsigned long start, end;       /* indices into page_array */
+    unsigned int memflags;
+    uint64_t mmio_start, mmio_size;
+    volatile int *abort;            /* set when any span fails */
+    unsigned long stat_normal_pages, stat_2mb_pages, stat_1gb_pages;
+    int rc;
+};
+
+static int populate_span(struct populate_span *s)
+{
+    xc_interface *xch = s->xch;
+    uint32_t dom = s->dom;
+    unsigned long i, cur_pages = s->start, cur_pfn;
+    int rc = 0;
+
+    /*
+     * We attempt to allocate 1GB pages if possible. It falls back on 2MB
+     * pages if 1GB allocation fails. 4KB pages will be used eventually if
+     * both fail.
+     * 
+     * A 1GB range that cannot have a 1GB page is filled with as many 2MB
+     * pages as possible in one hypercall; Xen preempts and continues the
+     * hypercall itself, so dom0 remains responsive.
+     */
+    while ( (rc == 0) && (s->end > cur_pages) && !*s->abort )
+    {
+        /* Clip count to maximum 1GB extent. */
+        unsigned long count = s->end - cur_pages;
+        unsigned long max_pages = SUPERPAGE_1GB_NR_PFNS;
+
+        if ( count > max_pages )
+            count = max_pages;
+
+        cur_pfn = s->page_array[cur_pages];
+
+        /* Take care the corner cases of super page tails */
+        if ( ((cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1)) != 0) &&
+             (count > (-cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1))) )
+            count = -cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1);
+        else if ( ((count & (SUPERPAGE_1GB_NR_PFNS-1)) != 0) &&
+                  (count > SUPERPAGE_1GB_NR_PFNS) )
+            count &= ~(SUPERPAGE_1GB_NR_PFNS - 1);
+
+        /* Attemp to allocate 1GB super page. Because in each pass we only
+         * allocate at most 1GB, we don't have to clip super page boundaries.
+         */
+        if ( ((count | cur_pfn) & (SUPERPAGE_1GB_NR_PFNS - 1)) == 0 &&
+             /* Check if there exists MMIO hole in the 1GB memory range */
+             !check_mmio_hole(cur_pfn << PAGE_SHIFT,
+                              SUPERPAGE_1GB_NR_PFNS << PAGE_SHIFT,
+                              s->mmio_start, s->mmio_size) )
+        {
+            long done;
+            unsigned long nr_extents = count >> SUPERPAGE_1GB_SHIFT;
+            xen_pfn_t sp_extents[nr_extents];
+
+            for ( i = 0; i < nr_extents; i++ )
+                sp_extents[i] = s->page_array[cur_pages+(i<<SUPERPAGE_1GB_SHIFT)];
+
+            done = xc_domain_populate_physmap(xch, dom, nr_extents, SUPERPAGE_1GB_SHIFT,
+                                              s->memflags, sp_extents);
+
+            if ( done > 0 )
+            {
+                s->stat_1gb_pages += done;
+                done <<= SUPERPAGE_1GB_SHIFT;
+                cur_pages += done;
+                count -= done;
+            }
+        }
+
+        if ( count != 0 )
+        {
+            /* Clip partial superpage extents to superpage boundaries. */
+            if ( ((cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1)) != 0) &&
+                 (count > (-cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1))) )
+                count = -cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1);
+            else if ( ((count & (SUPERPAGE_2MB_NR_PFNS-1)) != 0) &&
+                      (count > SUPERPAGE_2MB_NR_PFNS) )
+                count &= ~(SUPERPAGE_2MB_NR_PFNS - 1); /* clip non-s.p. tail */
+
+            /* Attempt to allocate superpage extents. */
+            if ( ((count | cur_pfn) & (SUPERPAGE_2MB_NR_PFNS - 1)) == 0 )
+            {
+                long done;
+                unsigned long nr_extents = count >> SUPERPAGE_2MB_SHIFT;
+                xen_pfn_t sp_extents[nr_extents];
+
+                for ( i = 0; i < nr_extents; i++ )
+                    sp_extents[i] = s->page_array[cur_pages+(i<<SUPERPAGE_2MB_SHIFT)];
+
+                done = xc_domain_populate_physmap(xch, dom, nr_extents, SUPERPAGE_2MB_SHIFT,
+                                                  s->memflags, sp_extents);
+
+                if ( done > 0 )
+                {
+                    s->stat_2mb_pages += done;
+                    done <<= SUPERPAGE_2MB_SHIFT;
+                    cur_pages += done;
+                    count -= done;
+                }
+            }
+        }
+
+        /* Fall back to 4kB extents. */
+        if ( count != 0 )
+        {
+            rc = xc_domain_populate_physmap_exact(
+                xch, dom, count, 0, s->memflags, &s->page_array[cur_pages]);
+            cur_pages += count;
+            s->stat_normal_pages += count;
+        }
+    }
+
+    if ( rc != 0 )
+        *s->abort = 1;
+    return rc;
+}
+
+#ifndef __MINIOS__
+static void *populate_worker(void *arg)
+{
+    struct populate_span *s = arg;
+
+    s->rc = populate_span(s);
+    return NULL;
+}
+#endif
+
+/* First index at or above @idx whose guest frame is 1GB aligned. */
+static unsigned long span_boundary(unsigned long idx, unsigned long nr_pages,
+                                   uint64_t mmio_start, uint64_t mmio_size)
+{
+    unsigned long mmio_pfn = mmio_start >> PAGE_SHIFT;
+    unsigned long mmio_pages = mmio_size >> PAGE_SHIFT;
+    unsigned long pfn = idx < mmio_pfn ? idx : idx + mmio_pages;
+
+    pfn = (pfn + SUPERPAGE_1GB_NR_PFNS - 1) & ~(SUPERPAGE_1GB_NR_PFNS - 1);
+    if ( pfn >= mmio_pfn && pfn < mmio_pfn + mmio_pages )
+        pfn = mmio_pfn + mmio_pages;
+    idx = pfn < mmio_pfn ? pfn : pfn - mmio_pages;
+
+    return idx < nr_pages ? idx : nr_pages;
+}
+
+/*
+ * Populate page_array[0xc0, nr_pages).  stats[] returns the number of
+ * 4KB, 2MB and 1GB extents used.
+ */
+static int populate_guest(xc_interface *xch, uint32_t dom,
+                          struct xc_hvm_build_args *args,
+                          xen_pfn_t *page_array, unsigned long nr_pages,
+                          unsigned int pod_mode, uint64_t mmio_start,
+                          uint64_t mmio_size, unsigned long stats[3])
+{
+    struct populate_span spans[POPULATE_THREADS_MAX];
+    unsigned int i, nr_spans = args->populate_threads;
+    unsigned long start = 0xc0, end;
+    volatile int abort = 0;
+    struct timeval t0, t1;
+    long cpus;
+    int rc = 0;
+
+    if ( nr_spans == 0 )
+    {
+        nr_spans = nr_pages / POPULATE_PAGES_PER_THREAD;
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if ( cpus > 0 && nr_spans > cpus )
+            nr_spans = cpus;
+    }
+    if ( nr_spans > POPULATE_THREADS_MAX )
+        nr_spans = POPULATE_THREADS_MAX;
+    if ( nr_spans == 0 || (xch->flags & XC_OPENFLAG_NON_REENTRANT) )
+        nr_spans = 1;
+#ifdef __MINIOS__
+    nr_spans = 1;
+#endif
+
+    gettimeofday(&t0, NULL);
+
+    for ( i = 0; i < nr_spans; i++ )
+    {
+        struct populate_span *s = &spans[i];
+
+        end = i + 1 == nr_spans ? nr_pages :
+            span_boundary(start + (nr_pages - 0xc0) / nr_spans, nr_pages,
+                          mmio_start, mmio_size);
+
+        memset(s, 0, sizeof(*s));
+        s->xch = xch;
+        s->dom = dom;
+        s->page_array = page_array;
+        s->start = start;
+        s->end = end;
+        s->memflags = pod_mode;
+        s->mmio_start = mmio_start;
+        s->mmio_size = mmio_size;
+        s->abort = &abort;
+
+        start = end;
+    }
+
+#ifndef __MINIOS__
+    if ( nr_spans > 1 )
+    {
+        pthread_t threads[POPULATE_THREADS_MAX];
+        unsigned int started;
+
+        for ( started = 0; started < nr_spans; started++ )
+            if ( pthread_create(&threads[started], NULL, populate_worker,
+                                &spans[started]) )
+                break;
+
+        /* Whatever could not be handed to a thread is done here. */
+        for ( i = started; i < nr_spans; i++ )
+            spans[i].rc = populate_span(&spans[i]);
+
+        for ( i = 0; i < started; i++ )
+            pthread_join(threads[i], NULL);
+    }
+    else
+#endif
+        spans[0].rc = populate_span(&spans[0]);
+
+    gettimeofday(&t1, NULL);
+
+    stats[0] = stats[1] = stats[2] = 0;
+    for ( i = 0; i < nr_spans; i++ )
+    {
+        if ( spans[i].rc && !rc )
+            rc = spans[i].rc;
+        stats[0] += spans[i].stat_normal_pages;
+        stats[1] += spans[i].stat_2mb_pages;
+        stats[2] += spans[i].stat_1gb_pages;
+    }
+
+    DPRINTF("Populated %luMB of guest memory in %lums with %u thread(s)\n",
+            nr_pages >> (20 - PAGE_SHIFT),
+            (t1.tv_sec - t0.tv_sec) * 1000 +
+            (t1.tv_usec - t0.tv_usec) / 1000, nr_spans);
+
+    return rc;
+}
+
 static int setup_guest(xc_interface *xch,
                        uint32_t dom, struct xc_hvm_build_args *args,
                        char *image, unsigned long image_size)
@@ -248,7 +510,7 @@ static int setup_guest(xc_interface *xch,
     unsigned long target_pages = args->mem_target >> PAGE_SHIFT;
     uint64_t mmio_start = (1ull << 32) - args->mmio_size;
     uint64_t mmio_size = args->mmio_size;
-    unsigned long entry_eip, cur_pages, cur_pfn;
+    unsigned long entry_eip, stats[3];
     void *hvm_info_page;
     uint32_t *ident_pt;
     struct elf_binary elf;
@@ -340,113 +602,13 @@ static int setup_guest(xc_interface *xch,
 
     /*
      * Allocate memory for HVM guest, skipping VGA hole 0xA0000-0xC0000.
-     *
-     * We attempt to allocate 1GB pages if possible. It falls back on 2MB
-     * pages if 1GB allocation fails. 4KB pages will be used eventually if
-     * both fail.
-     * 
-     * Under 2MB mode, we allocate pages in batches of no more than 8MB to 
-     * ensure that we can be preempted and hence dom0 remains responsive.
+     * Everything above the hole is left to populate_guest().
      */
     rc = xc_domain_populate_physmap_exact(
         xch, dom, 0xa0, 0, pod_mode, &page_array[0x00]);
-    cur_pages = 0xc0;
-    stat_normal_pages = 0xc0;
-
-    while ( (rc == 0) && (nr_pages > cur_pages) )
-    {
-        /* Clip count to maximum 1GB extent. */
-        unsigned long count = nr_pages - cur_pages;
-        unsigned long max_pages = SUPERPAGE_1GB_NR_PFNS;
-
-        if ( count > max_pages )
-            count = max_pages;
-
-        cur_pfn = page_array[cur_pages];
-
-        /* Take care the corner cases of super page tails */
-        if ( ((cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1)) != 0) &&
-             (count > (-cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1))) )
-            count = -cur_pfn & (SUPERPAGE_1GB_NR_PFNS-1);
-        else if ( ((count & (SUPERPAGE_1GB_NR_PFNS-1)) != 0) &&
-                  (count > SUPERPAGE_1GB_NR_PFNS) )
-            count &= ~(SUPERPAGE_1GB_NR_PFNS - 1);
-
-        /* Attemp to allocate 1GB super page. Because in each pass we only
-         * allocate at most 1GB, we don't have to clip super page boundaries.
-         */
-        if ( ((count | cur_pfn) & (SUPERPAGE_1GB_NR_PFNS - 1)) == 0 &&
-             /* Check if there exists MMIO hole in the 1GB memory range */
-             !check_mmio_hole(cur_pfn << PAGE_SHIFT,
-                              SUPERPAGE_1GB_NR_PFNS << PAGE_SHIFT,
-                              mmio_start, mmio_size) )
-        {
-            long done;
-            unsigned long nr_extents = count >> SUPERPAGE_1GB_SHIFT;
-            xen_pfn_t sp_extents[nr_extents];
-
-            for ( i = 0; i < nr_extents; i++ )
-                sp_extents[i] = page_array[cur_pages+(i<<SUPERPAGE_1GB_SHIFT)];
-
-            done = xc_domain_populate_physmap(xch, dom, nr_extents, SUPERPAGE_1GB_SHIFT,
-                                              pod_mode, sp_extents);
-
-            if ( done > 0 )
-            {
-                stat_1gb_pages += done;
-                done <<= SUPERPAGE_1GB_SHIFT;
-                cur_pages += done;
-                count -= done;
-            }
-        }
-
-        if ( count != 0 )
-        {
-            /* Clip count to maximum 8MB extent. */
-            max_pages = SUPERPAGE_2MB_NR_PFNS * 4;
-            if ( count > max_pages )
-                count = max_pages;
-            
-            /* Clip partial superpage extents to superpage boundaries. */
-            if ( ((cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1)) != 0) &&
-                 (count > (-cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1))) )
-                count = -cur_pfn & (SUPERPAGE_2MB_NR_PFNS-1);
-            else if ( ((count & (SUPERPAGE_2MB_NR_PFNS-1)) != 0) &&
-                      (count > SUPERPAGE_2MB_NR_PFNS) )
-                count &= ~(SUPERPAGE_2MB_NR_PFNS - 1); /* clip non-s.p. tail */
-
-            /* Attempt to allocate superpage extents. */
-            if ( ((count | cur_pfn) & (SUPERPAGE_2MB_NR_PFNS - 1)) == 0 )
-            {
-                long done;
-                unsigned long nr_extents = count >> SUPERPAGE_2MB_SHIFT;
-                xen_pfn_t sp_extents[nr_extents];
-
-                for ( i = 0; i < nr_extents; i++ )
-                    sp_extents[i] = page_array[cur_pages+(i<<SUPERPAGE_2MB_SHIFT)];
-
-                done = xc_domain_populate_physmap(xch, dom, nr_extents, SUPERPAGE_2MB_SHIFT,
-                                                  pod_mode, sp_extents);
-
-                if ( done > 0 )
-                {
-                    stat_2mb_pages += done;
-                    done <<= SUPERPAGE_2MB_SHIFT;
-                    cur_pages += done;
-                    count -= done;
-                }
-            }
-        }
-
-        /* Fall back to 4kB extents. */
-        if ( count != 0 )
-        {
-            rc = xc_domain_populate_physmap_exact(
-                xch, dom, count, 0, pod_mode, &page_array[cur_pages]);
-            cur_pages += count;
-            stat_normal_pages += count;
-        }
-    }
+    if ( rc == 0 )
+        rc = populate_guest(xch, dom, args, page_array, nr_pages, pod_mode,
+                            mmio_start, mmio_size, stats);
 
     if ( rc != 0 )
     {
@@ -454,6 +616,10 @@ static int setup_guest(xc_interface *xch,
         goto error_out;
     }
 
+    stat_normal_pages = 0xc0 + stats[0];
+    stat_2mb_pages = stats[1];
+    stat_1gb_pages = stats[2];
+
     DPRINTF("PHYSICAL MEMORY ALLOCATION:\n");
     DPRINTF("  4KB PAGES: 0x%016lx\n", stat_normal_pages);
     DPRINTF("  2MB PAGES: 0x%016lx\n", stat_2mb_pages);
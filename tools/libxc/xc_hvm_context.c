@@ -0,0 +1,247 @@
+/*
+ * Delta encoding of HVM context for save/restore.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * A live migration sends the HVM context once before the guest is suspended
+ * (XC_SAVE_ID_HVM_CONTEXT) and again in the tail.  Most records (MTRRs,
+ * HPET, PIT, IOAPIC, the LAPICs of idle vCPUs, ...) do not change in
+ * between, so the tail copy replaces each record identical to its
+ * counterpart in the earlier copy by its bare descriptor, with a length of
+ * XC_HVM_CONTEXT_UNCHANGED.  The tail keeps the order and the set of records
+ * of the current context: records which are gone (e.g. of vCPUs taken down
+ * since) are simply absent, and new ones are sent whole.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "xg_private.h"
+#include "xg_save_restore.h"
+
+#include <xen/hvm/save.h>
+
+#define REC_KEY(d)  (((uint32_t)(d)->typecode << 16) | (d)->instance)
+
+struct hvm_rec {
+    uint32_t key;               /* typecode and instance */
+    uint32_t off;               /* of the descriptor in the context */
+};
+
+static int rec_cmp(const void *a, const void *b)
+{
+    const struct hvm_rec *x = a, *y = b;
+
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+/*
+ * Walk a complete context of LEN bytes, checking that every record lies
+ * within it and that it ends with an END record.  With INDEX, also return
+ * the records sorted by typecode and instance.  Returns the number of
+ * records, or -1 if the context is malformed or names a record twice.
+ */
+static int scan_context(xc_interface *xch, const uint8_t *ctxt, uint32_t len,
+                        struct hvm_rec **index)
+{
+    const struct hvm_save_descriptor *desc;
+    struct hvm_rec *idx = NULL, *tmp;
+    unsigned int nr = 0, max = 0, i;
+    uint32_t off;
+
+    for ( off = 0; ; off += sizeof(*desc) + desc->length )
+    {
+        if ( len - off < sizeof(*desc) )
+            goto bad;
+        desc = (const void *)(ctxt + off);
+        if ( desc->typecode == HVM_SAVE_CODE(END) )
+            break;
+        if ( desc->length > len - off - sizeof(*desc) )
+            goto bad;
+
+        if ( !index )
+        {
+            nr++;
+            continue;
+        }
+        if ( nr == max )
+        {
+            max = max ? max * 2 : 64;
+            tmp = realloc(idx, max * sizeof(*idx));
+            if ( !tmp )
+            {
+                ERROR("Unable to allocate HVM context index");
+                free(idx);
+                return -1;
+            }
+            idx = tmp;
+        }
+        idx[nr].key = REC_KEY(desc);
+        idx[nr].off = off;
+        nr++;
+    }
+
+    if ( index )
+    {
+        qsort(idx, nr, sizeof(*idx), rec_cmp);
+        for ( i = 1; i < nr; i++ )
+            if ( idx[i].key == idx[i - 1].key )
+                goto bad;
+        *index = idx;
+    }
+    return nr;
+
+ bad:
+    ERROR("Malformed HVM context");
+    free(idx);
+    return -1;
+}
+
+static const struct hvm_save_descriptor *
+find_rec(const uint8_t *ctxt, const struct hvm_rec *idx, unsigned int nr,
+         const struct hvm_save_descriptor *desc)
+{
+    struct hvm_rec key = { .key = REC_KEY(desc) };
+    const struct hvm_rec *r = bsearch(&key, idx, nr, sizeof(*idx), rec_cmp);
+
+    return r ? (const void *)(ctxt + r->off) : NULL;
+}
+
+uint32_t xc_hvm_context_delta(xc_interface *xch,
+                              const uint8_t *base, uint32_t base_len,
+                              uint8_t *ctxt, uint32_t len)
+{
+    struct hvm_save_descriptor *desc;
+    const struct hvm_save_descriptor *old;
+    struct hvm_rec *idx;
+    uint32_t in, out, rec;
+    int nr, end;
+
+    if ( scan_context(xch, ctxt, len, NULL) < 0 ||
+         (nr = scan_context(xch, base, base_len, &idx)) < 0 )
+        return len;
+
+    /* Records only ever shrink, so this can be done in place. */
+    for ( in = out = 0; ; in += rec )
+    {
+        desc = (void *)(ctxt + in);
+        rec = sizeof(*desc) + desc->length;
+        /* The move below may overwrite *desc. */
+        end = desc->typecode == HVM_SAVE_CODE(END);
+
+        old = find_rec(base, idx, nr, desc);
+        if ( !end && old && old->length == desc->length &&
+             !memcmp(old + 1, desc + 1, desc->length) )
+        {
+            memmove(ctxt + out, desc, sizeof(*desc));
+            ((struct hvm_save_descriptor *)(ctxt + out))->length =
+                XC_HVM_CONTEXT_UNCHANGED;
+            out += sizeof(*desc);
+        }
+        else
+        {
+            memmove(ctxt + out, desc, rec);
+            out += rec;
+        }
+
+        if ( end )
+            break;
+    }
+
+    free(idx);
+    return out;
+}
+
+uint8_t *xc_hvm_context_expand(xc_interface *xch,
+                               const uint8_t *base, uint32_t base_len,
+                               const uint8_t *delta, uint32_t delta_len,
+                               uint32_t *len)
+{
+    const struct hvm_save_descriptor *desc, *src;
+    struct hvm_rec *idx;
+    uint8_t *ctxt = NULL;
+    uint32_t in, rec;
+    uint64_t out = 0;
+    int nr;
+
+    if ( (nr = scan_context(xch, base, base_len, &idx)) < 0 )
+        return NULL;
+
+    /* Size and check the result first, then fill it in. */
+    for ( ; ; )
+    {
+        for ( in = out = 0; ; in += rec )
+        {
+            if ( delta_len - in < sizeof(*desc) )
+                goto bad;
+            desc = src = (const void *)(delta + in);
+            rec = sizeof(*desc);
+            if ( desc->length == XC_HVM_CONTEXT_UNCHANGED )
+            {
+                if ( !(src = find_rec(base, idx, nr, desc)) )
+                    goto bad;
+            }
+            else if ( desc->length > delta_len - in - sizeof(*desc) )
+                goto bad;
+            else
+                rec += desc->length;
+
+            if ( ctxt )
+                memcpy(ctxt + out, src, sizeof(*src) + src->length);
+            out += sizeof(*src) + src->length;
+            /*
+             * A delta names each base record at most once, so the result
+             * is never longer than both together.  Anything longer repeats
+             * records, and could wrap *len.
+             */
+            if ( out > (uint64_t)base_len + delta_len || out > UINT32_MAX )
+                goto bad;
+
+            if ( desc->typecode == HVM_SAVE_CODE(END) )
+                break;
+        }
+
+        if ( ctxt )
+            break;
+        if ( !(ctxt = malloc(out)) )
+        {
+            ERROR("Unable to allocate %u bytes of HVM context", (uint32_t)out);
+            free(idx);
+            return NULL;
+        }
+    }
+
+    free(idx);
+    *len = out;
+    return ctxt;
+
+ bad:
+    ERROR("Malformed HVM context delta");
+    free(ctxt);
+    free(idx);
+    return NULL;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
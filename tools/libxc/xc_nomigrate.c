@@ -22,8 +22,8 @@
 #include <xenguest.h>
 
 int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iters,
-                   uint32_t max_factor, uint32_t flags,
-                   struct save_callbacks* callbacks, int hvm)
+                   uint32_t max_factor, uint32_t max_downtime_ms,
+                   uint32_t flags, struct save_callbacks* callbacks, int hvm)
 {
     errno = ENOSYS;
     return -1;
@@ -506,6 +506,30 @@ int xc_domain_dumpcore_via_callback(xc_interface *xch,
                                     void *arg,
                                     dumpcore_rtn_t dump_rtn);
 
+/* Flags for xc_domain_dumpcore_flags(). */
+#define XC_DUMPCORE_SPARSE      (1U << 0) /* leave holes for all-zero pages */
+/*
+ * Opt-in: write the pages LZ4-compressed, as .xen_pages_lz4 (dump format
+ * version 0.2, see xc_core.c).  This is a new format: tools which only
+ * know .xen_pages, such as crash, cannot read these dumps.
+ */
+#define XC_DUMPCORE_FORMAT_LZ4  (1U << 1)
+
+/*
+ * Like xc_domain_dumpcore() (which uses XC_DUMPCORE_SPARSE, and so writes
+ * the usual .xen_pages), but with explicit flags and the number of threads
+ * mapping and compressing pages while the caller's thread writes; 0 does
+ * everything in the caller's thread, as does a handle opened with
+ * XC_OPENFLAG_NON_REENTRANT.  corename may be a pipe, in which case
+ * XC_DUMPCORE_SPARSE is ignored and XC_DUMPCORE_FORMAT_LZ4 fails with
+ * EINVAL.
+ */
+int xc_domain_dumpcore_flags(xc_interface *xch,
+                             uint32_t domid,
+                             const char *corename,
+                             unsigned int flags,
+                             unsigned int nr_threads);
+
 /*
  * This function sets the maximum number of vcpus that a domain may create.
  *
@@ -875,6 +899,13 @@ int xc_sched_credit2_domain_get(xc_interface *xch,
                                uint32_t domid,
                                struct xen_domctl_sched_credit2 *sdom);
 
+int xc_sched_rtds_domain_set(xc_interface *xch,
+                            uint32_t domid,
+                            struct xen_domctl_sched_rtds *sdom);
+int xc_sched_rtds_domain_get(xc_interface *xch,
+                            uint32_t domid,
+                            struct xen_domctl_sched_rtds *sdom);
+
 int
 xc_sched_arinc653_schedule_set(
     xc_interface *xch,
@@ -1101,6 +1132,14 @@ int xc_evtchn_reset(xc_interface *xch,
 typedef struct evtchn_status xc_evtchn_status_t;
 int xc_evtchn_status(xc_interface *xch, xc_evtchn_status_t *status);
 
+/*
+ * Signal up to EVTCHN_SEND_BATCH_MAX of the calling domain's local ports in
+ * a single hypercall.  Ports are signalled in order; the first failure
+ * stops the batch.  Returns 0 on success, or -1 with errno set.
+ */
+int xc_evtchn_send_batch(xc_interface *xch, const evtchn_port_t *ports,
+                         unsigned int nr_ports);
+
 /*
  * Return a handle to the event channel driver, or NULL on failure, in
  * which case errno will be set appropriately.
@@ -28,6 +28,7 @@
 #define XCFLAGS_HVM       (1 << 2)
 #define XCFLAGS_STDVGA    (1 << 3)
 #define XCFLAGS_CHECKPOINT_COMPRESS    (1 << 4)
+#define XCFLAGS_POSTCOPY  (1 << 5)
 
 #define X86_64_B_SIZE   64 
 #define X86_32_B_SIZE   32
@@ -72,6 +73,24 @@ struct save_callbacks {
      */
     int (*toolstack_save)(uint32_t domid, uint8_t **buf, uint32_t *len, void *data);
 
+    /* Post-copy (XCFLAGS_POSTCOPY) only: called once the tail has been
+     * sent, with the guest still suspended.  The callback must append the
+     * device model record to the stream; xc_domain_save then serves the
+     * pages left out of the last iteration until the receiver has them all.
+     */
+    int (*postcopy_begin)(void *data);
+
+    /* Live saves only: called once per iteration, when xc_domain_save has
+     * decided whether to stop, with the pages dirtied during the iteration
+     * (which the next one would send), the guest's dirty rate and the
+     * link's throughput in pages/s, the downtime predicted for stopping now
+     * and the share of the guest's CPU time withheld by throttling, in %.
+     */
+    void (*migration_stats)(uint32_t iteration, uint32_t remaining,
+                            uint32_t dirty_rate, uint32_t bandwidth,
+                            uint32_t downtime_ms, uint32_t throttle,
+                            void *data);
+
     /* to be provided as the last argument to each callback function */
     void* data;
 };
@@ -82,12 +101,42 @@ struct save_callbacks {
  * @parm xch a handle to an open hypervisor interface
  * @parm fd the file descriptor to save a domain to
  * @parm dom the id of the domain
+ * @parm max_iters, max_factor limits on the iterations of a live save, and
+ *       on the pages sent in them as a multiple of the guest's memory;
+ *       0 for the defaults
+ * @parm max_downtime_ms stop iterating as soon as the remaining pages can
+ *       be sent within this long, and throttle the guest if they cannot
+ *       be brought down to that; 0 to rely on the above limits only
  * @return 0 on success, -1 on failure
  */
 int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iters,
-                   uint32_t max_factor, uint32_t flags /* XCFLAGS_xxx */,
+                   uint32_t max_factor, uint32_t max_downtime_ms,
+                   uint32_t flags /* XCFLAGS_xxx */,
                    struct save_callbacks* callbacks, int hvm);
 
+/**
+ * Delta-encode an HVM context against an earlier one of the same domain,
+ * in place: records identical to their counterpart in BASE shrink to their
+ * descriptor.  A malformed context is left whole.
+ *
+ * @parm base, base_len the earlier context, as from xc_domain_hvm_getcontext
+ * @parm ctxt, len the current context
+ * @return the length of the delta-encoded context
+ */
+uint32_t xc_hvm_context_delta(xc_interface *xch,
+                              const uint8_t *base, uint32_t base_len,
+                              uint8_t *ctxt, uint32_t len);
+
+/**
+ * Reverse xc_hvm_context_delta().
+ *
+ * @parm len returned with the length of the full context
+ * @return the full context, to be freed by the caller, or NULL on failure
+ */
+uint8_t *xc_hvm_context_expand(xc_interface *xch,
+                               const uint8_t *base, uint32_t base_len,
+                               const uint8_t *delta, uint32_t delta_len,
+                               uint32_t *len);
 
 /* callbacks provided by xc_domain_restore */
 struct restore_callbacks {
@@ -95,6 +144,14 @@ struct restore_callbacks {
     int (*toolstack_restore)(uint32_t domid, const uint8_t *buf,
             uint32_t size, void* data);
 
+    /* Post-copy only: called once the domain is ready to run, with the
+     * pages still to come from the sender paged out.  The toolstack may
+     * start the device model and unpause the domain from here; its pages
+     * are fetched as it touches them.  Without this callback they are
+     * pulled in while the domain stays paused.
+     */
+    int (*postcopy_resume)(uint32_t domid, void *data);
+
     /* to be provided as the last argument to each callback function */
     void* data;
 };
@@ -230,6 +287,9 @@ struct xc_hvm_build_args {
     struct xc_hvm_firmware_module smbios_module;
     /* Whether to use claim hypercall (1 - enable, 0 - disable). */
     int claim_enabled;
+
+    /* Threads populating guest memory (0 - chosen from the memory size). */
+    unsigned int populate_threads;
 };
 
 /**
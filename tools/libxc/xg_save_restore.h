@@ -217,6 +217,10 @@
  *  Xen HVM Context:
  *     uint32_t         : Length of context in bytes
  *     bytes            : Context data
+ *                        If the body carried an XC_SAVE_ID_HVM_CONTEXT
+ *                        chunk, records identical to those in it are sent
+ *                        as just their descriptor, with a length of
+ *                        XC_HVM_CONTEXT_UNCHANGED (see xc_hvm_context.c).
  *  Qemu context:
  *     char[21]         : Signature:
  *       "QemuDeviceModelRecord" : Read Qemu save data until EOF
@@ -238,6 +242,22 @@
  *                        present in extended-info header)
  *
  *  Shared Info Page    : 4096 bytes of shared info page
+ *
+ * POST-COPY PHASE
+ * ---------------
+ *
+ * Only follows an HVM stream whose body had XC_SAVE_ID_POSTCOPY_PFNS chunks,
+ * after its Qemu context: the pages those listed, while the receiver already
+ * runs the guest.  A series of chunks
+ *
+ *     int              : number of pages, at most MAX_BATCH_SIZE; 0 for
+ *                        the end of the stream
+ *     uint64_t[]       : their PFNs
+ *     bytes            : their contents
+ *
+ * in PFN order, except for the pages the receiver asks for (and a few that
+ * follow them) by writing their PFNs, as uint64_t, back into the stream.
+ * The stream must thus be a socket.
  */
 
 #define XC_SAVE_ID_ENABLE_VERIFY_MODE -1 /* Switch to validation phase. */
@@ -262,6 +282,21 @@
 /* These are a pair; it is an error for one to exist without the other */
 #define XC_SAVE_ID_HVM_IOREQ_SERVER_PFN -19
 #define XC_SAVE_ID_HVM_NR_IOREQ_SERVER_PAGES -20
+/*
+ * HVM context taken before the guest was suspended, which the context in
+ * the tail is delta-encoded against:
+ *     uint32_t         : Length of context in bytes
+ *     bytes            : Context data
+ */
+#define XC_SAVE_ID_HVM_CONTEXT        -21
+/*
+ * (HVM-only) Pages left to the post-copy phase; there may be several:
+ *     uint32_t         : Number of pages, at most MAX_BATCH_SIZE
+ *     uint64_t[]       : Their PFNs
+ */
+#define XC_SAVE_ID_POSTCOPY_PFNS      -22
+
+#define XC_HVM_CONTEXT_UNCHANGED      0xffffffffU
 
 /*
 ** We process save/restore/migrate in batches of pages; the below
@@ -276,6 +311,16 @@
 #define XC_SR_MAX_VCPUS 4096
 #define vcpumap_sz(max_id) (((max_id)/64+1)*sizeof(uint64_t))
 
+/* Post-copy phase, see xc_domain_postcopy.c. */
+int xc_postcopy_send(xc_interface *xch, int io_fd, uint32_t dom,
+                     unsigned long *pending, unsigned long p2m_size,
+                     unsigned long nr_pending);
+int xc_postcopy_receive(xc_interface *xch, int io_fd, uint32_t dom,
+                        unsigned long *pending, unsigned long p2m_size,
+                        unsigned long nr_pending,
+                        int (*resume)(uint32_t domid, void *data),
+                        void *data);
+
 
 /*
 ** Determine various platform information required for save/restore, in
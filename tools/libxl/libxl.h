@@ -483,6 +483,15 @@ typedef struct libxl__ctx libxl_ctx;
  */
 #define LIBXL_HAVE_DOMAIN_CREATE_RESTORE_PARAMS 1
 
+/*
+ * LIBXL_HAVE_DOMAIN_SUSPEND_PARAMS 1
+ *
+ * If this is defined, libxl_domain_suspend()'s API has changed to include
+ * a params structure, with the downtime allowed to a live migration, and
+ * an asyncprogress_how for domain_migration_progress events.
+ */
+#define LIBXL_HAVE_DOMAIN_SUSPEND_PARAMS 1
+
 /*
  * LIBXL_HAVE_CREATEINFO_PVH
  * If this is defined, then libxl supports creation of a PVH guest.
@@ -498,6 +507,16 @@ typedef struct libxl__ctx libxl_ctx;
  */
 #define LIBXL_HAVE_DRIVER_DOMAIN_CREATION 1
 
+/*
+ * LIBXL_HAVE_SCHED_RTDS
+ *
+ * If this is defined, the RTDS scheduler is supported: the libxl_scheduler
+ * enumeration has LIBXL_SCHEDULER_RTDS, and libxl_domain_sched_params has
+ * a 'budget' field which, together with 'period', is used to set the RTDS
+ * parameters of a domain (both in microseconds).
+ */
+#define LIBXL_HAVE_SCHED_RTDS 1
+
 /*
  * LIBXL_HAVE_SIGCHLD_SELECTIVE_REAP
  *
@@ -827,11 +846,32 @@ void libxl_domain_config_dispose(libxl_domain_config *d_config);
 
 int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd,
                          int flags, /* LIBXL_SUSPEND_* */
-                         const libxl_asyncop_how *ao_how)
+                         const libxl_domain_suspend_params *params,
+                         const libxl_asyncop_how *ao_how,
+                         const libxl_asyncprogress_how *aop_migration_how)
                          LIBXL_EXTERNAL_CALLERS_ONLY;
 #define LIBXL_SUSPEND_DEBUG 1
 #define LIBXL_SUSPEND_LIVE 2
 
+#if defined(LIBXL_API_VERSION) && LIBXL_API_VERSION < 0x040500
+
+int static inline libxl_domain_suspend_0x040200(
+    libxl_ctx *ctx, uint32_t domid, int fd, int flags,
+    const libxl_asyncop_how *ao_how)
+    LIBXL_EXTERNAL_CALLERS_ONLY
+{
+    return libxl_domain_suspend(ctx, domid, fd, flags, NULL, ao_how, NULL);
+}
+
+#define libxl_domain_suspend libxl_domain_suspend_0x040200
+
+#endif
+
+  /* params may be NULL, for the defaults.  During a live suspend, a
+   * progress report of type domain_migration_progress is made via
+   * aop_migration_how after each iteration over the guest's memory.
+   */
+
 /* @param suspend_cancel [from xenctrl.h:xc_domain_resume( @param fast )]
  *   If this parameter is true, use co-operative resume. The guest
  *   must support this.
@@ -1240,6 +1280,7 @@ int libxl_sched_credit_params_set(libxl_ctx *ctx, uint32_t poolid,
 #define LIBXL_DOMAIN_SCHED_PARAM_SLICE_DEFAULT     -1
 #define LIBXL_DOMAIN_SCHED_PARAM_LATENCY_DEFAULT   -1
 #define LIBXL_DOMAIN_SCHED_PARAM_EXTRATIME_DEFAULT -1
+#define LIBXL_DOMAIN_SCHED_PARAM_BUDGET_DEFAULT    -1
 
 int libxl_domain_sched_params_get(libxl_ctx *ctx, uint32_t domid,
                                   libxl_domain_sched_params *params);
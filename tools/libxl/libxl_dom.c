@@ -389,11 +389,215 @@ retry_transaction:
     return 0;
 }
 
+/*
+ * Decompressed PV kernels are kept in the run directory, named after the
+ * SHA-256 of the image they were produced from, so that booting the same
+ * image again hands the domain builder a plain ELF and skips the
+ * decompression.  The run directory does not survive a host reboot; in
+ * the meantime the cache is kept below KERNEL_CACHE_MAX_SIZE by dropping
+ * the entries used least recently (a hit touches the entry's mtime).
+ */
+#define KERNEL_CACHE_DIR "kernel-cache"
+#define KERNEL_CACHE_MAX_SIZE (256UL << 20)
+
+/*
+ * Whether the image starts like something the domain builder decompresses:
+ * a compressed stream, or an x86 bzImage (whose payload is compressed).
+ */
+static bool kernel_is_compressed(const uint8_t *p, size_t len)
+{
+    static const struct {
+        const char *magic;
+        size_t len;
+    } magics[] = {
+        { "\x1f\x8b", 2 },                      /* gzip */
+        { "BZh", 3 },                           /* bzip2 */
+        { "\x5d\x00\x00", 3 },                  /* lzma */
+        { "\xfd" "7zXZ\x00", 6 },               /* xz */
+        { "\x89LZO\x00\r\n\x1a\n", 9 },         /* lzo */
+        { "\x02\x21\x4c\x18", 4 },              /* lz4, legacy format */
+    };
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(magics); i++)
+        if (len >= magics[i].len &&
+            !memcmp(p, magics[i].magic, magics[i].len))
+            return true;
+
+    return len >= 0x206 && !memcmp(p + 0x202, "HdrS", 4);
+}
+
+/* NULL if the kernel is not compressed, or cannot be read. */
+static char *kernel_cache_path(libxl__gc *gc, libxl__file_reference *kernel,
+                               size_t *size_r)
+{
+    libxl__sha256_ctx c;
+    uint8_t digest[LIBXL__SHA256_DIGEST_SIZE];
+    char hex[2 * LIBXL__SHA256_DIGEST_SIZE + 1], buf[65536];
+    ssize_t r;
+    int fd, i;
+
+    libxl__sha256_init(&c);
+    if (kernel->mapped) {
+        if (!kernel_is_compressed(kernel->data, kernel->size))
+            return NULL;
+        libxl__sha256_update(&c, kernel->data, kernel->size);
+        *size_r = kernel->size;
+    } else {
+        fd = open(kernel->path, O_RDONLY);
+        if (fd < 0)
+            return NULL;
+        *size_r = 0;
+        while ((r = read(fd, buf, sizeof(buf))) > 0) {
+            if (!*size_r && !kernel_is_compressed((uint8_t *)buf, r)) {
+                r = -1;
+                break;
+            }
+            libxl__sha256_update(&c, buf, r);
+            *size_r += r;
+        }
+        close(fd);
+        if (r < 0)
+            return NULL;
+    }
+    libxl__sha256_final(&c, digest);
+
+    for (i = 0; i < LIBXL__SHA256_DIGEST_SIZE; i++)
+        sprintf(hex + 2 * i, "%02x", digest[i]);
+
+    return GCSPRINTF("%s/" KERNEL_CACHE_DIR "/%s", libxl__run_dir_path(), hex);
+}
+
+struct kernel_cache_entry {
+    char *path;
+    off_t size;
+    time_t mtime;
+};
+
+static int kernel_cache_entry_cmp(const void *a, const void *b)
+{
+    const struct kernel_cache_entry *x = a, *y = b;
+
+    return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+/*
+ * Drop the least recently used entries until the cache fits in
+ * KERNEL_CACHE_MAX_SIZE.  Other builders may be doing the same, so entries
+ * vanishing underneath are fine; one already opened stays readable.
+ */
+static void kernel_cache_trim(libxl__gc *gc, const char *dir)
+{
+    struct kernel_cache_entry *ents = NULL;
+    struct dirent *de;
+    struct stat st;
+    uint64_t total = 0;
+    int nr = 0, i;
+    DIR *d;
+
+    d = opendir(dir);
+    if (!d) {
+        LOGE(DEBUG, "unable to open %s", dir);
+        return;
+    }
+    while ((de = readdir(d))) {
+        char *path = GCSPRINTF("%s/%s", dir, de->d_name);
+
+        if (stat(path, &st) || !S_ISREG(st.st_mode))
+            continue;
+        GCREALLOC_ARRAY(ents, nr + 1);
+        ents[nr].path = path;
+        ents[nr].size = st.st_size;
+        ents[nr].mtime = st.st_mtime;
+        total += st.st_size;
+        nr++;
+    }
+    closedir(d);
+
+    if (total <= KERNEL_CACHE_MAX_SIZE)
+        return;
+
+    qsort(ents, nr, sizeof(*ents), kernel_cache_entry_cmp);
+    for (i = 0; i < nr && total > KERNEL_CACHE_MAX_SIZE; i++) {
+        if (unlink(ents[i].path) && errno != ENOENT) {
+            LOGE(DEBUG, "unable to evict %s from the kernel cache",
+                 ents[i].path);
+            continue;
+        }
+        LOG(DEBUG, "evicted %s from the kernel cache", ents[i].path);
+        total -= ents[i].size;
+    }
+}
+
+/*
+ * Hand the cache entry ENTRY->path to the builder, if there is one.  It is
+ * opened and mapped once, so it stays usable if it is evicted meanwhile.
+ * On failure, the caller loads the original image instead.
+ */
+static int kernel_cache_load(libxl__gc *gc, struct xc_dom_image *dom,
+                             libxl__file_reference *entry)
+{
+    if (libxl__file_reference_map(entry))
+        return ERROR_FAIL;
+
+    if (xc_dom_kernel_mem(dom, entry->data, entry->size)) {
+        LOG(DEBUG, "unable to load %s, using the original kernel",
+            entry->path);
+        libxl__file_reference_unmap(entry);
+        return ERROR_FAIL;
+    }
+
+    LOG(DEBUG, "pv kernel found in cache as %s", entry->path);
+    /* Mark it recently used. */
+    if (utimes(entry->path, NULL))
+        LOGE(DEBUG, "unable to touch %s", entry->path);
+    return 0;
+}
+
+/* Best effort: a kernel that cannot be cached is simply decompressed again. */
+static void kernel_cache_store(libxl__gc *gc, const char *path,
+                               const void *data, size_t size)
+{
+    char *dir = GCSPRINTF("%s/" KERNEL_CACHE_DIR, libxl__run_dir_path());
+    char *tmp = GCSPRINTF("%s.XXXXXX", path);
+    int fd, rc;
+
+    if (size > KERNEL_CACHE_MAX_SIZE)
+        return;
+
+    if (mkdir(dir, 0700) && errno != EEXIST) {
+        LOGE(DEBUG, "unable to create %s", dir);
+        return;
+    }
+
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        LOGE(DEBUG, "unable to create %s", tmp);
+        return;
+    }
+    rc = libxl_write_exactly(CTX, fd, data, size, tmp, "kernel cache entry");
+    if (close(fd))
+        rc = ERROR_FAIL;
+
+    /* The rename makes sure no builder ever sees a partial entry. */
+    if (rc || rename(tmp, path)) {
+        LOGE(DEBUG, "unable to add %s to the kernel cache", path);
+        unlink(tmp);
+        return;
+    }
+
+    LOG(DEBUG, "cached decompressed kernel as %s", path);
+    kernel_cache_trim(gc, dir);
+}
+
 int libxl__build_pv(libxl__gc *gc, uint32_t domid,
              libxl_domain_build_info *info, libxl__domain_build_state *state)
 {
     libxl_ctx *ctx = libxl__gc_owner(gc);
     struct xc_dom_image *dom;
+    libxl__file_reference cached = { .mapped = 0 };
+    char *cache;
+    size_t kernel_size;
     int ret;
     int flags = 0;
 
@@ -409,7 +613,11 @@ int libxl__build_pv(libxl__gc *gc, uint32_t domid,
 
     LOG(DEBUG, "pv kernel mapped %d path %s", state->pv_kernel.mapped, state->pv_kernel.path);
 
-    if (state->pv_kernel.mapped) {
+    cache = kernel_cache_path(gc, &state->pv_kernel, &kernel_size);
+    cached.path = cache;
+    if (cache && !kernel_cache_load(gc, dom, &cached)) {
+        cache = NULL;
+    } else if (state->pv_kernel.mapped) {
         ret = xc_dom_kernel_mem(dom,
                                 state->pv_kernel.data,
                                 state->pv_kernel.size);
@@ -460,6 +668,9 @@ int libxl__build_pv(libxl__gc *gc, uint32_t domid,
         LOGE(ERROR, "xc_dom_parse_image failed");
         goto out;
     }
+    /* Only worth caching if the builder had to decompress the image. */
+    if (cache && dom->kernel_size != kernel_size)
+        kernel_cache_store(gc, cache, dom->kernel_blob, dom->kernel_size);
     if ( (ret = libxl__arch_domain_init_hw_description(gc, info, dom)) != 0 ) {
         LOGE(ERROR, "libxl__arch_domain_init_hw_description failed");
         goto out;
@@ -503,6 +714,7 @@ int libxl__build_pv(libxl__gc *gc, uint32_t domid,
     ret = 0;
 out:
     xc_dom_release(dom);
+    libxl__file_reference_unmap(&cached);
     return ret == 0 ? 0 : ERROR_FAIL;
 }
 
@@ -1460,6 +1672,27 @@ static void domain_suspend_callback_common_done(libxl__egc *egc,
     libxl__xc_domain_saverestore_async_callback_done(egc, &dss->shs, ok);
 }
 
+static void libxl__domain_migration_stats_callback(uint32_t iteration,
+                uint32_t remaining, uint32_t dirty_rate, uint32_t bandwidth,
+                uint32_t downtime_ms, uint32_t throttle, void *data)
+{
+    libxl__save_helper_state *shs = data;
+    libxl__egc *egc = shs->egc;
+    libxl__domain_suspend_state *dss = CONTAINER_OF(shs, *dss, shs);
+    STATE_AO_GC(dss->ao);
+    libxl_event *ev;
+
+    ev = NEW_EVENT(egc, DOMAIN_MIGRATION_PROGRESS, dss->domid,
+                   dss->aop_migration_how.for_event);
+    ev->u.domain_migration_progress.iteration = iteration;
+    ev->u.domain_migration_progress.remaining_pages = remaining;
+    ev->u.domain_migration_progress.dirty_rate = dirty_rate;
+    ev->u.domain_migration_progress.bandwidth = bandwidth;
+    ev->u.domain_migration_progress.predicted_downtime_ms = downtime_ms;
+    ev->u.domain_migration_progress.throttle = throttle;
+    libxl__ao_progress_report(egc, ao, &dss->aop_migration_how, ev);
+}
+
 /*----- remus callbacks -----*/
 
 static void libxl__remus_domain_suspend_callback(void *data)
@@ -1596,8 +1829,10 @@ void libxl__domain_suspend(libxl__egc *egc, libxl__domain_suspend_state *dss)
         callbacks->suspend = libxl__remus_domain_suspend_callback;
         callbacks->postcopy = libxl__remus_domain_resume_callback;
         callbacks->checkpoint = libxl__remus_domain_checkpoint_callback;
-    } else
+    } else {
         callbacks->suspend = libxl__domain_suspend_callback;
+        callbacks->migration_stats = libxl__domain_migration_stats_callback;
+    }
 
     callbacks->switch_qemu_logdirty = libxl__domain_suspend_common_switch_qemu_logdirty;
     dss->shs.callbacks.save.toolstack_save = libxl__toolstack_save;
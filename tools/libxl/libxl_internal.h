@@ -2058,6 +2058,22 @@ _hidden const char *libxl__xen_script_dir_path(void);
 _hidden const char *libxl__lock_dir_path(void);
 _hidden const char *libxl__run_dir_path(void);
 
+/*----- SHA-256, for content-addressed caches -----*/
+
+#define LIBXL__SHA256_DIGEST_SIZE 32
+
+typedef struct {
+    uint32_t h[8];
+    uint64_t len;
+    uint8_t buf[64];
+} libxl__sha256_ctx;
+
+_hidden void libxl__sha256_init(libxl__sha256_ctx *c);
+_hidden void libxl__sha256_update(libxl__sha256_ctx *c,
+                                  const void *data, size_t len);
+_hidden void libxl__sha256_final(libxl__sha256_ctx *c,
+                                 uint8_t digest[LIBXL__SHA256_DIGEST_SIZE]);
+
 /*----- subprocess execution with timeout -----*/
 
 typedef struct libxl__async_exec_state libxl__async_exec_state;
@@ -2498,7 +2514,9 @@ struct libxl__domain_suspend_state {
     libxl_domain_type type;
     int live;
     int debug;
+    uint32_t max_downtime_ms;
     const libxl_domain_remus_info *remus;
+    libxl_asyncprogress_how aop_migration_how;
     /* private */
     libxl__ev_evtchn guest_evtchn;
     int guest_evtchn_lockfd;
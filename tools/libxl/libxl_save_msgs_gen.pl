@@ -35,6 +35,12 @@ our @msgs = (
                                               'unsigned long', 'console_mfn'] ],
     [  9, 'srW',    "complete",              [qw(int retval
                                                  int errnoval)] ],
+    [ 10, 'scx',    "migration_stats",       [qw(uint32_t iteration
+                                                 uint32_t remaining
+                                                 uint32_t dirty_rate
+                                                 uint32_t bandwidth
+                                                 uint32_t downtime_ms
+                                                 uint32_t throttle)] ],
 );
 
 #----------------------------------------
@@ -781,6 +781,8 @@ static void parse_config_data(const char *config_source,
         b_info->sched_params.latency = l;
     if (!xlu_cfg_get_long (config, "extratime", &l, 0))
         b_info->sched_params.extratime = l;
+    if (!xlu_cfg_get_long (config, "budget", &l, 0))
+        b_info->sched_params.budget = l;
 
     if (!xlu_cfg_get_long (config, "vcpus", &l, 0)) {
         b_info->max_vcpus = l;
@@ -3378,7 +3380,7 @@ static int save_domain(uint32_t domid, const char *filename, int checkpoint,
 
     save_domain_core_writeconfig(fd, filename, config_data, config_len);
 
-    int rc = libxl_domain_suspend(ctx, domid, fd, 0, NULL);
+    int rc = libxl_domain_suspend(ctx, domid, fd, 0, NULL, NULL, NULL);
     close(fd);
 
     if (rc < 0) {
@@ -3540,7 +3542,30 @@ static void migrate_do_preamble(int send_fd, int recv_fd, pid_t child,
 
 }
 
+static void migration_progress(libxl_ctx *ctx_ignored,
+                               libxl_event *ev, void *priv)
+{
+    const typeof(ev->u.domain_migration_progress) *p =
+        &ev->u.domain_migration_progress;
+
+    /* Rates are in pages/s: 256 pages make a MiB. */
+    fprintf(stderr, "migration sender: iteration %"PRIu32": %"PRIu32
+            " pages dirty, guest dirtying %"PRIu32"MiB/s, link %"PRIu32
+            "MiB/s, ", p->iteration, p->remaining_pages,
+            p->dirty_rate / 256, p->bandwidth / 256);
+    if (p->predicted_downtime_ms == UINT32_MAX)
+        fprintf(stderr, "downtime unknown");
+    else
+        fprintf(stderr, "downtime ~%"PRIu32"ms", p->predicted_downtime_ms);
+    if (p->throttle)
+        fprintf(stderr, ", guest throttled by %"PRIu32"%%", p->throttle);
+    fprintf(stderr, "\n");
+
+    libxl_event_free(ctx, ev);
+}
+
 static void migrate_domain(uint32_t domid, const char *rune, int debug,
+                           uint32_t max_downtime_ms,
                            const char *override_config_file)
 {
     pid_t child = -1;
@@ -3550,6 +3575,8 @@ static void migrate_domain(uint32_t domid, const char *rune, int debug,
     char rc_buf;
     uint8_t *config_data;
     int config_len, flags = LIBXL_SUSPEND_LIVE;
+    libxl_domain_suspend_params params;
+    libxl_asyncprogress_how progress_how;
 
     save_domain_core_begin(domid, override_config_file,
                            &config_data, &config_len);
@@ -3569,7 +3596,14 @@ static void migrate_domain(uint32_t domid, const char *rune, int debug,
 
     if (debug)
         flags |= LIBXL_SUSPEND_DEBUG;
-    rc = libxl_domain_suspend(ctx, domid, send_fd, flags, NULL);
+    libxl_domain_suspend_params_init(&params);
+    params.max_downtime_ms = max_downtime_ms;
+    progress_how.callback = migration_progress;
+    progress_how.for_event = 0;
+    progress_how.for_callback = NULL;
+    rc = libxl_domain_suspend(ctx, domid, send_fd, flags, &params, NULL,
+                              &progress_how);
+    libxl_domain_suspend_params_dispose(&params);
     if (rc) {
         fprintf(stderr, "migration sender: libxl_domain_suspend failed"
                 " (rc=%d)\n", rc);
@@ -3958,8 +3992,10 @@ int main_migrate(int argc, char **argv)
     char *rune = NULL;
     char *host;
     int opt, daemonize = 1, monitor = 1, debug = 0;
+    uint32_t max_downtime_ms = 0;
     static struct option opts[] = {
         {"debug", 0, 0, 0x100},
+        {"max-downtime", 1, 0, 0x200},
         COMMON_LONG_OPTS,
         {0, 0, 0, 0}
     };
@@ -3981,6 +4017,9 @@ int main_migrate(int argc, char **argv)
     case 0x100:
         debug = 1;
         break;
+    case 0x200:
+        max_downtime_ms = strtoul(optarg, NULL, 10);
+        break;
     }
 
     domid = find_domain(argv[optind]);
@@ -4011,7 +4050,7 @@ int main_migrate(int argc, char **argv)
             return 1;
     }
 
-    migrate_domain(domid, rune, debug, config_filename);
+    migrate_domain(domid, rune, debug, max_downtime_ms, config_filename);
     return 0;
 }
 #endif
@@ -5100,6 +5139,36 @@ static int sched_sedf_domain_output(
     return 0;
 }
 
+static int sched_rtds_domain_output(
+    int domid)
+{
+    char *domname;
+    libxl_domain_sched_params scinfo;
+    int rc = 0;
+
+    if (domid < 0) {
+        printf("%-33s %4s %9s %9s\n", "Name", "ID", "Period", "Budget");
+        return 0;
+    }
+
+    libxl_domain_sched_params_init(&scinfo);
+    rc = sched_domain_get(LIBXL_SCHEDULER_RTDS, domid, &scinfo);
+    if (rc)
+        goto out;
+
+    domname = libxl_domid_to_name(ctx, domid);
+    printf("%-33s %4d %9d %9d\n",
+        domname,
+        domid,
+        scinfo.period,
+        scinfo.budget);
+    free(domname);
+
+out:
+    libxl_domain_sched_params_dispose(&scinfo);
+    return rc;
+}
+
 static int sched_default_pool_output(uint32_t poolid)
 {
     char *poolname;
@@ -5467,6 +5536,87 @@ int main_sched_sedf(int argc, char **argv)
     return 0;
 }
 
+/*
+ * <nothing>            : List all domain paramters and sched params
+ * -d [domid]           : List domain params for domain
+ * -d [domid] [params]  : Set domain params for domain
+ */
+int main_sched_rtds(int argc, char **argv)
+{
+    const char *dom = NULL;
+    const char *cpupool = NULL;
+    int period = 0; /* period is in microsecond */
+    int budget = 0; /* budget is in microsecond */
+    int opt_p = 0;
+    int opt_b = 0;
+    int opt, rc;
+    static struct option opts[] = {
+        {"domain", 1, 0, 'd'},
+        {"period", 1, 0, 'p'},
+        {"budget", 1, 0, 'b'},
+        {"cpupool", 1, 0, 'c'},
+        COMMON_LONG_OPTS,
+        {0, 0, 0, 0}
+    };
+
+    SWITCH_FOREACH_OPT(opt, "d:p:b:c:h", opts, "sched-rtds", 0) {
+    case 'd':
+        dom = optarg;
+        break;
+    case 'p':
+        period = strtol(optarg, NULL, 10);
+        opt_p = 1;
+        break;
+    case 'b':
+        budget = strtol(optarg, NULL, 10);
+        opt_b = 1;
+        break;
+    case 'c':
+        cpupool = optarg;
+        break;
+    }
+
+    if (cpupool && (dom || opt_p || opt_b)) {
+        fprintf(stderr, "Specifying a cpupool is not allowed with "
+                "other options.\n");
+        return 1;
+    }
+    if (!dom && (opt_p || opt_b)) {
+        fprintf(stderr, "Must specify a domain.\n");
+        return 1;
+    }
+    if (opt_p != opt_b) {
+        fprintf(stderr, "Must specify period and budget\n");
+        return 1;
+    }
+
+    if (!dom) { /* list all domain's rt scheduler info */
+        return -sched_domain_output(LIBXL_SCHEDULER_RTDS,
+                                    sched_rtds_domain_output,
+                                    sched_default_pool_output,
+                                    cpupool);
+    } else {
+        uint32_t domid = find_domain(dom);
+        if (!opt_p && !opt_b) { /* output rt scheduler info */
+            sched_rtds_domain_output(-1);
+            return -sched_rtds_domain_output(domid);
+        } else { /* set rt scheduler paramaters */
+            libxl_domain_sched_params scinfo;
+            libxl_domain_sched_params_init(&scinfo);
+            scinfo.sched = LIBXL_SCHEDULER_RTDS;
+            scinfo.period = period;
+            scinfo.budget = budget;
+
+            rc = sched_domain_set(domid, &scinfo);
+            libxl_domain_sched_params_dispose(&scinfo);
+            if (rc)
+                return -rc;
+        }
+    }
+
+    return 0;
+}
+
 int main_domid(int argc, char **argv)
 {
     uint32_t domid;
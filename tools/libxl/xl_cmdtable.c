@@ -160,7 +160,10 @@ struct cmd_spec cmd_table[] = {
       "                migrate-receive [-d -e]\n"
       "-e              Do not wait in the background (on <host>) for the death\n"
       "                of the domain.\n"
-      "--debug         Print huge (!) amount of debug during the migration process."
+      "--debug         Print huge (!) amount of debug during the migration process.\n"
+      "--max-downtime <ms>\n"
+      "                Stop pre-copying once the rest can be sent within <ms>,\n"
+      "                throttling the domain if it dirties memory too fast."
     },
     { "restore",
       &main_restore, 0, 1,
@@ -277,6 +280,15 @@ struct cmd_spec cmd_table[] = {
       "                               --period/--slice)\n"
       "-c CPUPOOL, --cpupool=CPUPOOL  Restrict output to CPUPOOL"
     },
+    { "sched-rtds",
+      &main_sched_rtds, 0, 1,
+      "Get/set rtds scheduler parameters",
+      "[-d <Domain> [-p[=PERIOD]] [-b[=BUDGET]]] [-c CPUPOOL]",
+      "-d DOMAIN, --domain=DOMAIN     Domain to modify\n"
+      "-p PERIOD, --period=PERIOD     Period (us)\n"
+      "-b BUDGET, --budget=BUDGET     Budget (us)\n"
+      "-c CPUPOOL, --cpupool=CPUPOOL  Restrict output to CPUPOOL"
+    },
     { "domid",
       &main_domid, 0, 0,
       "Convert a domain name to domain id",
@@ -204,15 +204,21 @@ void parse_client(char *s)
     unsigned long long succ_eph_gets = parse(s,"Ge");
     unsigned long long succ_pers_puts = parse(s,"Pp");
     unsigned long long succ_pers_gets = parse(s,"Gp");
+    unsigned long long puts = parse(s,"Pt");
+    unsigned long long gets = parse(s,"Gt");
+    unsigned long long put_rate = parse(s,"Pr");
+    unsigned long long get_rate = parse(s,"Gr");
 
     printf("domid%lu: weight=%lu,cap=%lu,compress=%d,frozen=%d,"
            "total_cycles=%llu,succ_eph_gets=%llu,"
            "succ_pers_puts=%llu,succ_pers_gets=%llu,"
            "eph_count=%llu,max_eph=%llu,"
+           "puts=%llu (%llu/s),gets=%llu (%llu/s),"
            "compression ratio=%lu%% (samples=%llu,poor=%llu,nomem=%llu)\n",
            cli_id, weight, cap, compress?1:0, frozen?1:0,
            total_cycles, succ_eph_gets, succ_pers_puts, succ_pers_gets, 
            eph_count, max_eph_count,
+           puts, put_rate, gets, get_rate,
            compressed_pages ?  (long)((compressed_sum_size*100LL) /
                                       (compressed_pages*PAGE_SIZE)) : 0,
            compressed_pages, compress_poor, compress_nomem);
@@ -139,6 +139,9 @@ let get_watches (con: t) path =
 	then Hashtbl.find con.watches path
 	else []
 
+let get_watch_paths con =
+	Hashtbl.fold (fun apath _ acc -> apath :: acc) con.watches []
+
 let get_children_watches con path =
 	let path = path ^ "/" in
 	List.concat (Hashtbl.fold (fun p w l ->
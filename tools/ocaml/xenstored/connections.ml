@@ -48,15 +48,33 @@ let find cons fd =
 let find_domain cons id =
 	Hashtbl.find cons.domains id
 
+let key_of_str path =
+	if path.[0] = '@'
+	then [path]
+	else "" :: Store.Path.to_string_list (Store.Path.of_string path)
+
+let key_of_path path =
+	"" :: Store.Path.to_string_list path
+
 let del_watches_of_con con watches =
 	match List.filter (fun w -> Connection.get_con w != con) watches with
 	| [] -> None
 	| ws -> Some ws 
 
+(* only visit the trie nodes [con] has watches on, not the whole index *)
+let del_watches cons con =
+	List.iter (fun apath ->
+		let key = key_of_str apath in
+		if Trie.mem cons.watches key then
+			match del_watches_of_con con (Trie.find cons.watches key) with
+			| None    -> cons.watches <- Trie.unset cons.watches key
+			| Some ws -> cons.watches <- Trie.set cons.watches key ws
+	) (Connection.get_watch_paths con)
+
 let del_anonymous cons con =
 	try
 		cons.anonymous <- Utils.list_remove con cons.anonymous;
-		cons.watches <- Trie.map (del_watches_of_con con) cons.watches;
+		del_watches cons con;
 		Connection.close con
 	with exn ->
 		debug "del anonymous %s" (Printexc.to_string exn)
@@ -65,7 +83,7 @@ let del_domain cons id =
 	try
 		let con = find_domain cons id in
 		Hashtbl.remove cons.domains id;
-		cons.watches <- Trie.map (del_watches_of_con con) cons.watches;
+		del_watches cons con;
 		Connection.close con
 	with exn ->
 		debug "del domain %u: %s" id (Printexc.to_string exn)
@@ -86,14 +104,6 @@ let has_more_work cons =
 		else
 			acc) cons.domains []
 
-let key_of_str path =
-	if path.[0] = '@'
-	then [path]
-	else "" :: Store.Path.to_string_list (Store.Path.of_string path)
-
-let key_of_path path =
-	"" :: Store.Path.to_string_list path
-
 let add_watch cons con path token =
 	let apath, watch = Connection.add_watch con path token in
 	let key = key_of_str apath in
@@ -133,8 +143,9 @@ let fire_watches cons path recurse =
 		Trie.iter fire_rec (Trie.sub cons.watches key)
 
 let fire_spec_watches cons specpath =
-	iter cons (fun con ->
-		List.iter (fun w -> Connection.fire_single_watch w) (Connection.get_watches con specpath))
+	let key = key_of_str specpath in
+	if Trie.mem cons.watches key then
+		List.iter Connection.fire_single_watch (Trie.find cons.watches key)
 
 let set_target cons domain target_domain =
 	let con = find_domain cons domain in
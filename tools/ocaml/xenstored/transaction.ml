@@ -85,7 +85,8 @@ let make id store =
 	{
 		ty = ty;
 		store = if id = none then store else Store.copy store;
-		quota = Quota.copy store.Store.quota;
+		(* only transactions need a snapshot; plain requests use the store's *)
+		quota = if id = none then store.Store.quota else Quota.copy store.Store.quota;
 		ops = [];
 		read_lowpath = None;
 		write_lowpath = None;
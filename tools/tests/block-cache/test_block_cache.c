@@ -0,0 +1,297 @@
+/*
+ * test_block_cache.c
+ *
+ * Drive blktap2's block-cache driver, built here unchanged, against a
+ * fake parent image whose sector contents are a function of the sector
+ * number.  Every read is checked against that pattern, and after every
+ * read the cache must stay within TAPDISK2_CACHE_SIZE: a sequential scan
+ * triggers readahead, which must be accounted for like any other data.
+ *
+ * The driver's own size accounting is checked, and so is the memory its
+ * sector buffers really pin: posix_memalign() and free() are wrapped at
+ * link time (see the Makefile) to keep a tally of live buffers.
+ *
+ * usage: test_block_cache [-n reads] [-m cache_mb] [-s image_sectors]
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tapdisk.h"
+#include "tapdisk-utils.h"
+#include "tapdisk-driver.h"
+#include "tapdisk-server.h"
+#include "tapdisk-interface.h"
+
+#define SECTOR_SIZE 512
+
+extern struct tap_disk tapdisk_block_cache;
+
+static uint64_t forwarded;
+static unsigned long completed, errors;
+
+/* Live posix_memalign() buffers, hashed on their address. */
+#define BUF_HASH 4096
+
+struct live_buf {
+	void               *ptr;
+	size_t              size;
+	struct live_buf    *next;
+};
+
+static struct live_buf *live_bufs[BUF_HASH];
+static uint64_t pinned;
+
+int __real_posix_memalign(void **ptr, size_t align, size_t size);
+void __real_free(void *ptr);
+
+static inline struct live_buf **
+live_buf_slot(void *ptr)
+{
+	return &live_bufs[((uintptr_t)ptr >> 9) % BUF_HASH];
+}
+
+int
+__wrap_posix_memalign(void **ptr, size_t align, size_t size)
+{
+	struct live_buf *b, **slot;
+	int err;
+
+	err = __real_posix_memalign(ptr, align, size);
+	if (err)
+		return err;
+
+	b = malloc(sizeof(*b));
+	if (!b) {
+		__real_free(*ptr);
+		return ENOMEM;
+	}
+
+	slot    = live_buf_slot(*ptr);
+	b->ptr  = *ptr;
+	b->size = size;
+	b->next = *slot;
+	*slot   = b;
+	pinned += size;
+
+	return 0;
+}
+
+void
+__wrap_free(void *ptr)
+{
+	struct live_buf *b, **prev;
+
+	if (!ptr)
+		return;
+
+	for (prev = live_buf_slot(ptr); (b = *prev); prev = &b->next)
+		if (b->ptr == ptr) {
+			*prev   = b->next;
+			pinned -= b->size;
+			__real_free(b);
+			break;
+		}
+
+	__real_free(ptr);
+}
+
+#define PATTERN(sec, off) ((char)((sec) * 7 + (off)))
+
+/* The handful of tapdisk services the driver uses. */
+
+event_id_t
+tapdisk_server_register_event(char mode, int fd, int timeout,
+			      event_cb_t cb, void *data)
+{
+	return 1;
+}
+
+void
+tapdisk_server_unregister_event(event_id_t id)
+{
+}
+
+int
+tapdisk_namedup(char **dup, const char *name)
+{
+	*dup = strdup(name);
+	return *dup ? 0 : -ENOMEM;
+}
+
+void
+__tlog_write(int level, const char *func, const char *fmt, ...)
+{
+}
+
+void
+td_complete_request(td_request_t treq, int res)
+{
+	((td_callback_t)treq.cb)(treq, res);
+}
+
+/* The parent image: synchronous, and filled with the pattern. */
+void
+td_forward_request(td_request_t treq)
+{
+	int i, j;
+
+	forwarded += treq.secs;
+	for (i = 0; i < treq.secs; i++)
+		for (j = 0; j < SECTOR_SIZE; j++)
+			treq.buf[i * SECTOR_SIZE + j] =
+				PATTERN(treq.sec + i, j);
+
+	td_complete_request(treq, 0);
+}
+
+static void
+read_done(td_request_t treq, int res)
+{
+	int i, j;
+
+	completed++;
+	if (res) {
+		errors++;
+		return;
+	}
+
+	for (i = 0; i < treq.secs; i++)
+		for (j = 0; j < SECTOR_SIZE; j++)
+			if (treq.buf[i * SECTOR_SIZE + j] !=
+			    PATTERN(treq.sec + i, j)) {
+				errors++;
+				return;
+			}
+}
+
+static int
+run(const char *what, td_driver_t *driver, unsigned long reads,
+    uint64_t max_size, int sequential)
+{
+	char buf[8 * SECTOR_SIZE];
+	td_cache_stats_t st;
+	td_request_t treq;
+	uint64_t next, peak, peak_pinned;
+	unsigned long i;
+
+	memset(&treq, 0, sizeof(treq));
+	treq.op  = TD_OP_READ;
+	treq.buf = buf;
+	treq.cb  = read_done;
+
+	next = peak = peak_pinned = 0;
+	completed = errors = forwarded = 0;
+
+	for (i = 0; i < reads; i++) {
+		if (sequential) {
+			treq.secs = 8;
+			if (next + treq.secs > driver->info.size)
+				next = 0;
+			treq.sec = next;
+			next += treq.secs;
+		} else {
+			treq.secs = 1 + random() % 8;
+			treq.sec  = random() % (driver->info.size - treq.secs);
+		}
+
+		tapdisk_block_cache.td_queue_read(driver, treq);
+
+		tapdisk_block_cache.td_cache_stats(driver, &st);
+		if (st.size > peak)
+			peak = st.size;
+		if (st.size > max_size) {
+			printf("%s: read %lu: cache at %"PRIu64" bytes, "
+			       "above its %"PRIu64" byte limit\n",
+			       what, i, st.size, max_size);
+			return 1;
+		}
+
+		if (pinned > peak_pinned)
+			peak_pinned = pinned;
+		if (pinned > max_size) {
+			printf("%s: read %lu: %"PRIu64" bytes of buffers "
+			       "pinned, above the %"PRIu64" byte limit\n",
+			       what, i, pinned, max_size);
+			return 1;
+		}
+	}
+
+	printf("%-10s %lu reads, %"PRIu64" hits, %"PRIu64" readahead, "
+	       "%"PRIu64" sectors forwarded\n"
+	       "%-10s peak %"PRIu64" bytes accounted, %"PRIu64" pinned, "
+	       "limit %"PRIu64"\n",
+	       what, reads, st.hits, st.readahead, forwarded,
+	       "", peak, peak_pinned, max_size);
+
+	if (completed != reads || errors) {
+		printf("%s: %lu of %lu reads completed, %lu bad\n",
+		       what, completed, reads, errors);
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned long reads = 200000, mb = 1;
+	uint64_t sectors = 1 << 20;
+	td_driver_t driver;
+	char size[32];
+	int c, err;
+
+	while ((c = getopt(argc, argv, "n:m:s:")) != -1) {
+		switch (c) {
+		case 'n':
+			reads = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			mb = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			sectors = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n reads] [-m cache_mb] "
+				"[-s image_sectors]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (!mb || sectors < 16) {
+		fprintf(stderr, "cache and image must not be empty\n");
+		return 2;
+	}
+
+	snprintf(size, sizeof(size), "%lu", mb);
+	setenv("TAPDISK2_CACHE_SIZE", size, 1);
+
+	err = 0;
+	for (c = 0; c < 2; c++) {
+		memset(&driver, 0, sizeof(driver));
+		driver.info.size        = sectors;
+		driver.info.sector_size = SECTOR_SIZE;
+		driver.data = calloc(1, tapdisk_block_cache.private_data_size);
+		if (!driver.data ||
+		    tapdisk_block_cache.td_open(&driver, "test", TD_OPEN_RDONLY)) {
+			fprintf(stderr, "cannot open the cache\n");
+			return 1;
+		}
+
+		srandom(1);
+		err |= run(c ? "random" : "sequential", &driver, reads,
+			   (uint64_t)mb << 20, !c);
+
+		tapdisk_block_cache.td_close(&driver);
+		free(driver.data);
+	}
+
+	printf("%s\n", err ? "FAIL" : "PASS");
+	return err;
+}
@@ -0,0 +1,121 @@
+/*
+ * dumpcore-bench.c
+ *
+ * Dom0 benchmark for xc_domain_dumpcore_flags(): dumps the same domain
+ * with everything done in the calling thread and no holes (what
+ * xc_domain_dumpcore() used to do), then with parallel page workers and
+ * sparse output, then LZ4-compressed.  Reports throughput in guest memory
+ * dumped per second and the disk space each dump takes.
+ *
+ * Usage: dumpcore-bench domid [corefile] [threads]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <xenctrl.h>
+
+#define DEFAULT_COREFILE "/var/tmp/dumpcore-bench.core"
+#define DEFAULT_THREADS 8
+
+static double now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static int run(xc_interface *xch, uint32_t domid, const char *corefile,
+               const char *what, unsigned int flags, unsigned int threads,
+               unsigned long nr_pages)
+{
+    struct stat st;
+    double start, us;
+
+    start = now_us();
+    if ( xc_domain_dumpcore_flags(xch, domid, corefile, flags, threads) )
+    {
+        fprintf(stderr, "%s: dump failed: %s\n", what, strerror(errno));
+        return -1;
+    }
+    us = now_us() - start;
+
+    if ( stat(corefile, &st) )
+    {
+        perror(corefile);
+        return -1;
+    }
+
+    printf("%-9s %2u threads: %8.0f ms, %7.1f MB/s, %6lu MB on disk\n",
+           what, threads, us / 1000,
+           (double)nr_pages * XC_PAGE_SIZE / us,
+           (unsigned long)(((uint64_t)st.st_blocks * 512) >> 20));
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *corefile = DEFAULT_COREFILE;
+    unsigned int threads = DEFAULT_THREADS;
+    xc_interface *xch;
+    xc_dominfo_t info;
+    uint32_t domid;
+    int rc = 1;
+
+    if ( argc < 2 )
+    {
+        fprintf(stderr, "usage: %s domid [corefile] [threads]\n", argv[0]);
+        return 1;
+    }
+    domid = strtoul(argv[1], NULL, 0);
+    if ( argc > 2 )
+        corefile = argv[2];
+    if ( argc > 3 )
+        threads = strtoul(argv[3], NULL, 0);
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+    {
+        perror("xc_interface_open");
+        return 1;
+    }
+
+    if ( xc_domain_getinfo(xch, domid, 1, &info) != 1 ||
+         info.domid != domid )
+    {
+        fprintf(stderr, "no domain %u\n", domid);
+        goto out;
+    }
+
+    printf("domain %u: %lu MB\n", domid, info.nr_pages >> (20 - XC_PAGE_SHIFT));
+
+    if ( run(xch, domid, corefile, "serial", 0, 0, info.nr_pages) ||
+         run(xch, domid, corefile, "sparse", XC_DUMPCORE_SPARSE, threads,
+             info.nr_pages) ||
+         run(xch, domid, corefile, "lz4", XC_DUMPCORE_FORMAT_LZ4, threads,
+             info.nr_pages) )
+        goto out;
+
+    rc = 0;
+
+ out:
+    unlink(corefile);
+    xc_interface_close(xch);
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
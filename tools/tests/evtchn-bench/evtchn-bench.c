@@ -0,0 +1,145 @@
+/*
+ * evtchn-bench.c
+ *
+ * Dom0 microbenchmark comparing one EVTCHNOP_send per port against
+ * EVTCHNOP_send_batch, the way a multi-queue backend notifies its
+ * frontend.  Each "queue" is a loopback interdomain channel within dom0.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
+
+#include <xenctrl.h>
+
+#define DEFAULT_QUEUES 16
+#define DEFAULT_ROUNDS 100000
+
+static double now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+/* Consume and unmask whatever the loopback ends have received. */
+static void drain(xc_evtchn *xce)
+{
+    struct pollfd pfd = { .fd = xc_evtchn_fd(xce), .events = POLLIN };
+    evtchn_port_or_error_t port;
+
+    while ( poll(&pfd, 1, 0) > 0 )
+    {
+        port = xc_evtchn_pending(xce);
+        if ( port < 0 )
+            break;
+        xc_evtchn_unmask(xce, port);
+    }
+}
+
+static void report(const char *what, unsigned int rounds,
+                   unsigned int queues, double us)
+{
+    printf("%-8s %u rounds x %u ports: %.0f us, %.1f ns/port, "
+           "%.0f ports/s\n", what, rounds, queues, us,
+           us * 1000.0 / ((double)rounds * queues),
+           (double)rounds * queues * 1e6 / us);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int queues = DEFAULT_QUEUES, rounds = DEFAULT_ROUNDS, i, r;
+    evtchn_port_t *ports;
+    xc_interface *xch;
+    xc_evtchn *xce;
+    double start;
+    int rc = 1;
+
+    if ( argc > 1 )
+        queues = strtoul(argv[1], NULL, 0);
+    if ( argc > 2 )
+        rounds = strtoul(argv[2], NULL, 0);
+    if ( queues == 0 || queues > EVTCHN_SEND_BATCH_MAX || rounds == 0 )
+    {
+        fprintf(stderr, "usage: %s [queues (1-%u)] [rounds]\n",
+                argv[0], EVTCHN_SEND_BATCH_MAX);
+        return 1;
+    }
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    xce = xc_evtchn_open(NULL, 0);
+    ports = calloc(queues, sizeof(*ports));
+    if ( !xch || !xce || !ports )
+    {
+        perror("setup");
+        goto out;
+    }
+
+    for ( i = 0; i < queues; i++ )
+    {
+        evtchn_port_or_error_t remote, local;
+
+        remote = xc_evtchn_bind_unbound_port(xce, 0);
+        if ( remote < 0 )
+        {
+            perror("xc_evtchn_bind_unbound_port");
+            goto out;
+        }
+        local = xc_evtchn_bind_interdomain(xce, 0, remote);
+        if ( local < 0 )
+        {
+            perror("xc_evtchn_bind_interdomain");
+            goto out;
+        }
+        ports[i] = local;
+    }
+
+    start = now_us();
+    for ( r = 0; r < rounds; r++ )
+    {
+        for ( i = 0; i < queues; i++ )
+            if ( xc_evtchn_notify(xce, ports[i]) < 0 )
+            {
+                perror("xc_evtchn_notify");
+                goto out;
+            }
+        drain(xce);
+    }
+    report("single", rounds, queues, now_us() - start);
+
+    start = now_us();
+    for ( r = 0; r < rounds; r++ )
+    {
+        if ( xc_evtchn_send_batch(xch, ports, queues) < 0 )
+        {
+            perror("xc_evtchn_send_batch");
+            goto out;
+        }
+        drain(xce);
+    }
+    report("batched", rounds, queues, now_us() - start);
+
+    rc = 0;
+
+ out:
+    free(ports);
+    if ( xce )
+        xc_evtchn_close(xce);
+    if ( xch )
+        xc_interface_close(xch);
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,242 @@
+/*
+ * test_gnttab_superpage.c
+ *
+ * Build the hypervisor's superpage grant mapping code
+ * (xen/common/grant_superpage.c) against models of the arch hooks and page
+ * reference counting, and map and unmap superpage grants as each kind of
+ * grantee would:
+ *
+ *  pv   x86 PV: host mappings are PTEs; the hook takes any flags
+ *  hvm  x86 HVM and PVH: host mappings are P2M entries; the hook refuses
+ *       cache attributes and any flag but GNTMAP_host_map|GNTMAP_readonly
+ *  arm  like hvm
+ *
+ * After every operation, the pages must hold exactly the references and
+ * mappings that are still expected: none after an unmap, and none after a
+ * map that failed half-way.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xen/xen.h>
+#include <xen/grant_table.h>
+
+typedef bool bool_t;
+
+#define PAGE_SIZE           4096UL
+#define PGT_writable_page   1
+
+#define XENLOG_INFO
+#define XENLOG_WARNING
+#define gdprintk(lvl, fmt, args...) ((void)0)
+
+struct domain {
+    bool is_dying;
+};
+
+struct page_info {
+    struct domain *owner;
+    unsigned int count;
+    unsigned int type_count;
+    bool fail_get;              /* make get_page() fail on this page */
+};
+
+#define NR_FRAMES   (4 * GNTTAB_SUPERPAGE_FRAMES)
+#define BASE_ADDR   (1UL << 32)     /* the grantee maps from here */
+
+enum grantee { PV, HVM, ARM };
+static const char *const grantee_name[] = { "pv", "hvm", "arm" };
+
+static struct page_info frame_table[NR_FRAMES];
+static enum grantee grantee;
+static unsigned long mapped[NR_FRAMES];    /* frame + 1 per mapped page */
+static unsigned long fail_map_at = ~0UL;   /* make the hook fail here */
+static unsigned int failures;
+
+static struct page_info *mfn_to_page(unsigned long mfn)
+{
+    return &frame_table[mfn];
+}
+
+static int get_page(struct page_info *pg, struct domain *d)
+{
+    if ( pg->fail_get || pg->owner != d )
+        return 0;
+    pg->count++;
+    return 1;
+}
+
+static void put_page(struct page_info *pg)
+{
+    if ( !pg->count )
+        abort();
+    pg->count--;
+}
+
+static int get_page_type(struct page_info *pg, unsigned long type)
+{
+    pg->type_count++;
+    return 1;
+}
+
+static void put_page_type(struct page_info *pg)
+{
+    if ( !pg->type_count )
+        abort();
+    pg->type_count--;
+}
+
+static int create_grant_host_mapping(uint64_t addr, unsigned long frame,
+                                     unsigned int flags,
+                                     unsigned int cache_flags)
+{
+    unsigned long slot = (addr - BASE_ADDR) / PAGE_SIZE;
+
+    if ( grantee != PV &&
+         (cache_flags || (flags & ~GNTMAP_readonly) != GNTMAP_host_map) )
+        return GNTST_general_error;
+    if ( slot == fail_map_at || mapped[slot] )
+        return GNTST_general_error;
+    mapped[slot] = frame + 1;
+    return GNTST_okay;
+}
+
+static int replace_grant_host_mapping(uint64_t addr, unsigned long frame,
+                                      uint64_t new_addr, unsigned int flags)
+{
+    unsigned long slot = (addr - BASE_ADDR) / PAGE_SIZE;
+
+    if ( new_addr || (flags & GNTMAP_contains_pte) )
+        return GNTST_general_error;
+    if ( mapped[slot] != frame + 1 )
+        return GNTST_general_error;
+    mapped[slot] = 0;
+    return GNTST_okay;
+}
+
+#include "grant_superpage.c"
+
+#define check(cond, what)                                               \
+    do {                                                                \
+        if ( !(cond) )                                                  \
+        {                                                               \
+            fprintf(stderr, "FAIL %s grantee, %s: %s\n",                \
+                    grantee_name[grantee], what, #cond);                \
+            failures++;                                                 \
+        }                                                               \
+    } while ( 0 )
+
+/*
+ * The superpage at FRAME is mapped (or not) at BASE_ADDR, holding one
+ * reference per page, and a type reference too if TYPED.
+ */
+static void check_state(const char *what, unsigned long frame, bool is_mapped,
+                        bool typed)
+{
+    unsigned long i;
+
+    for ( i = 0; i < NR_FRAMES; i++ )
+    {
+        bool in = is_mapped && i >= frame &&
+                  i < frame + GNTTAB_SUPERPAGE_FRAMES;
+
+        if ( frame_table[i].count != in ||
+             frame_table[i].type_count != (in && typed) )
+        {
+            check(!"references", what);
+            return;
+        }
+    }
+    for ( i = 0; i < NR_FRAMES; i++ )
+        if ( mapped[i] != (is_mapped && i < GNTTAB_SUPERPAGE_FRAMES ?
+                           frame + i + 1 : 0) )
+        {
+            check(!"mappings", what);
+            return;
+        }
+}
+
+static void run(enum grantee g)
+{
+    struct domain granter = { .is_dying = false };
+    struct gnttab_map_grant_ref op = {
+        .host_addr = BASE_ADDR,
+        .ref = 8,
+    };
+    unsigned long frame = 2 * GNTTAB_SUPERPAGE_FRAMES;
+    uint32_t flags[] = {
+        GNTMAP_host_map | GNTMAP_superpage,
+        GNTMAP_host_map | GNTMAP_readonly | GNTMAP_superpage,
+    };
+    unsigned int i, f;
+    int rc;
+
+    grantee = g;
+    memset(frame_table, 0, sizeof(frame_table));
+    memset(mapped, 0, sizeof(mapped));
+    for ( i = 0; i < NR_FRAMES; i++ )
+        frame_table[i].owner = &granter;
+
+    for ( f = 0; f < sizeof(flags) / sizeof(flags[0]); f++ )
+    {
+        bool typed = !(flags[f] & GNTMAP_readonly);
+
+        op.flags = flags[f];
+
+        rc = gnttab_map_superpage(&op, &granter, frame, typed, 0);
+        check(rc == GNTST_okay, "map");
+        check_state("map", frame, rc == GNTST_okay, typed);
+
+        rc = gnttab_unmap_superpage(op.host_addr, frame, op.flags);
+        check(rc == GNTST_okay, "unmap");
+        gnttab_put_superpage(frame, typed);
+        check_state("unmap", frame, false, typed);
+
+        /* A page of the region can't be referenced. */
+        frame_table[frame + 300].fail_get = true;
+        rc = gnttab_map_superpage(&op, &granter, frame, typed, 0);
+        frame_table[frame + 300].fail_get = false;
+        check(rc == GNTST_general_error, "pin failure");
+        check_state("pin failure", frame, false, typed);
+
+        /* The hook fails on the last page. */
+        fail_map_at = GNTTAB_SUPERPAGE_FRAMES - 1;
+        rc = gnttab_map_superpage(&op, &granter, frame, typed, 0);
+        fail_map_at = ~0UL;
+        check(rc == GNTST_general_error, "map failure");
+        check_state("map failure", frame, false, typed);
+
+        /* Cache attributes are refused up front. */
+        rc = gnttab_map_superpage(&op, &granter, frame, typed, GTF_PCD);
+        check(rc == GNTST_general_error, "cache attributes");
+        check_state("cache attributes", frame, false, typed);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    run(PV);
+    run(HVM);
+    run(ARM);
+
+    if ( failures )
+    {
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,193 @@
+/*
+ * hvmctx-bench.c
+ *
+ * Local save/restore loop over the HVM context of a guest, timing the part
+ * of a migration's downtime spent on it: with the guest paused, fetch the
+ * context, encode it for the stream, decode it and load it back.
+ *
+ *  full   the whole context, as sent in the tail of a migration stream by
+ *         older versions
+ *  delta  the context delta-encoded against one taken while the guest was
+ *         still running, as xc_domain_save() now sends it
+ *
+ * usage: hvmctx-bench [-n rounds] [-s ms] [-b Mbit/s] domid
+ *
+ *  -s  let the guest run this long between the live and the paused copy
+ *  -b  add the time to send the encoded context over a link this fast
+ *
+ * Every round loads the guest's own state back into it, so point it at a
+ * test guest, ideally one with many vCPUs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <xenctrl.h>
+#include <xenguest.h>
+
+static double now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+struct result {
+    double us;
+    unsigned long long bytes;
+};
+
+/*
+ * One round: the time the guest is paused, and the bytes that would have
+ * gone on the wire.  BASE is NULL for a full copy.
+ */
+static int round_trip(xc_interface *xch, uint32_t domid, uint8_t *buf,
+                      uint32_t size, const uint8_t *base, uint32_t base_len,
+                      struct result *res)
+{
+    uint8_t *ctxt = NULL;
+    uint32_t len, sent;
+    double us;
+    int rc = -1;
+
+    if ( xc_domain_pause(xch, domid) )
+    {
+        perror("xc_domain_pause");
+        return -1;
+    }
+
+    us = now_us();
+    if ( (len = xc_domain_hvm_getcontext(xch, domid, buf, size)) == -1 )
+    {
+        perror("xc_domain_hvm_getcontext");
+        goto out;
+    }
+    sent = len;
+    if ( base )
+    {
+        sent = xc_hvm_context_delta(xch, base, base_len, buf, len);
+        if ( !(ctxt = xc_hvm_context_expand(xch, base, base_len,
+                                            buf, sent, &len)) )
+            goto out;
+    }
+    if ( xc_domain_hvm_setcontext(xch, domid, ctxt ?: buf, len) )
+    {
+        perror("xc_domain_hvm_setcontext");
+        goto out;
+    }
+    res->us += now_us() - us;
+    res->bytes += sent;
+    rc = 0;
+
+ out:
+    free(ctxt);
+    xc_domain_unpause(xch, domid);
+    return rc;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n rounds] [-s ms] [-b Mbit/s] domid\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int rounds = 100, sleep_ms = 10, mbps = 0, r;
+    struct result full = { 0 }, delta = { 0 };
+    uint8_t *buf = NULL, *base = NULL;
+    uint32_t domid, size, base_len;
+    xc_interface *xch;
+    int c, rc = 1;
+
+    while ( (c = getopt(argc, argv, "n:s:b:")) != -1 )
+    {
+        switch ( c )
+        {
+        case 'n':
+            rounds = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            sleep_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            mbps = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if ( optind != argc - 1 || !rounds )
+        usage(argv[0]);
+    domid = strtoul(argv[optind], NULL, 0);
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+    {
+        perror("xc_interface_open");
+        return 1;
+    }
+
+    if ( (size = xc_domain_hvm_getcontext(xch, domid, NULL, 0)) == -1 )
+    {
+        perror("xc_domain_hvm_getcontext");
+        goto out;
+    }
+    buf = malloc(size);
+    base = malloc(size);
+    if ( !buf || !base )
+    {
+        perror("malloc");
+        goto out;
+    }
+
+    for ( r = 0; r < rounds; r++ )
+    {
+        if ( round_trip(xch, domid, buf, size, NULL, 0, &full) )
+            goto out;
+
+        if ( (base_len = xc_domain_hvm_getcontext(xch, domid, base,
+                                                  size)) == -1 )
+        {
+            perror("xc_domain_hvm_getcontext");
+            goto out;
+        }
+        usleep(sleep_ms * 1000);
+        if ( round_trip(xch, domid, buf, size, base, base_len, &delta) )
+            goto out;
+    }
+
+    printf("dom%u, %u rounds, %u ms between copies:\n",
+           domid, rounds, sleep_ms);
+    printf("  full   %8llu bytes, %8.1f us paused\n",
+           full.bytes / rounds, full.us / rounds);
+    printf("  delta  %8llu bytes, %8.1f us paused\n",
+           delta.bytes / rounds, delta.us / rounds);
+    if ( mbps )
+        printf("  at %u Mbit/s: full %.1f us, delta %.1f us of downtime\n",
+               mbps, (full.us + full.bytes * 8.0 / mbps) / rounds,
+               (delta.us + delta.bytes * 8.0 / mbps) / rounds);
+    rc = 0;
+
+ out:
+    free(buf);
+    free(base);
+    xc_interface_close(xch);
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
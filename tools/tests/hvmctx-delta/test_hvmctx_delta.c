@@ -0,0 +1,206 @@
+/*
+ * test_hvmctx_delta.c
+ *
+ * Exercise the HVM context delta encoding of libxc (xc_hvm_context.c,
+ * built here unchanged) on synthetic contexts, without a hypervisor:
+ *
+ *  - contexts delta-encoded against an earlier copy must expand back to
+ *    themselves, whether records changed, appeared or disappeared;
+ *  - malformed deltas, as a broken or hostile stream could carry them,
+ *    must be refused rather than expanded.  Among them are deltas which
+ *    name the same large base record over and over, whose expanded size
+ *    does not fit in 32 bits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "xg_private.h"
+#include "xg_save_restore.h"
+
+#include <xen/hvm/save.h>
+
+static unsigned int failures, errors;
+
+/* The library reports through this; no handle is ever opened. */
+void xc_report_error(xc_interface *xch, int code, const char *fmt, ...)
+{
+    errors++;
+}
+
+struct ctxt {
+    uint8_t *buf;
+    uint32_t len;
+};
+
+static void add_rec(struct ctxt *c, uint16_t type, uint16_t inst,
+                    uint32_t length, uint8_t fill)
+{
+    struct hvm_save_descriptor *d;
+
+    c->buf = realloc(c->buf, c->len + sizeof(*d) + length);
+    if ( !c->buf )
+    {
+        perror("realloc");
+        exit(1);
+    }
+    d = (void *)(c->buf + c->len);
+    d->typecode = type;
+    d->instance = inst;
+    d->length = length;
+    memset(d + 1, fill, length);
+    c->len += sizeof(*d) + length;
+}
+
+static void add_end(struct ctxt *c)
+{
+    add_rec(c, HVM_SAVE_CODE(END), 0, 0, 0);
+}
+
+#define check(cond, what)                                       \
+    do {                                                        \
+        if ( !(cond) )                                          \
+        {                                                       \
+            fprintf(stderr, "FAIL %s: %s\n", what, #cond);      \
+            failures++;                                         \
+        }                                                       \
+    } while ( 0 )
+
+/* Encode CUR against BASE and check that it expands back. */
+static void round_trip(const char *what, const struct ctxt *base,
+                       const struct ctxt *cur, uint32_t max_sent)
+{
+    uint8_t *enc = malloc(cur->len), *out;
+    uint32_t sent, len = 0;
+
+    memcpy(enc, cur->buf, cur->len);
+    sent = xc_hvm_context_delta(NULL, base->buf, base->len, enc, cur->len);
+    check(sent <= max_sent, what);
+    out = xc_hvm_context_expand(NULL, base->buf, base->len, enc, sent, &len);
+    check(out != NULL, what);
+    if ( out )
+        check(len == cur->len && !memcmp(out, cur->buf, len), what);
+    free(out);
+    free(enc);
+}
+
+/* DELTA must be refused, with an error reported. */
+static void refused(const char *what, const struct ctxt *base,
+                    const struct ctxt *delta)
+{
+    unsigned int before = errors;
+    uint32_t len = 0;
+    uint8_t *out = xc_hvm_context_expand(NULL, base->buf, base->len,
+                                         delta->buf, delta->len, &len);
+
+    check(out == NULL, what);
+    check(errors > before, what);
+    free(out);
+}
+
+#define BIG (1U << 20)
+
+int main(void)
+{
+    struct ctxt base = { 0 }, cur = { 0 }, d = { 0 };
+    unsigned int i;
+
+    /* A header, two vCPUs, a large record and a small one. */
+    add_rec(&base, HVM_SAVE_CODE(HEADER), 0, 16, 1);
+    add_rec(&base, HVM_SAVE_CODE(CPU), 0, 64, 2);
+    add_rec(&base, HVM_SAVE_CODE(CPU), 1, 64, 3);
+    add_rec(&base, HVM_SAVE_CODE(MTRR), 0, BIG, 4);
+    add_rec(&base, HVM_SAVE_CODE(PIT), 0, 32, 5);
+    add_end(&base);
+
+    /* Nothing changed: every record but END shrinks to its descriptor. */
+    round_trip("unchanged", &base, &base,
+               6 * sizeof(struct hvm_save_descriptor));
+
+    /* vCPU 1 is gone, vCPU 0 and the PIT changed, vCPU 2 is new. */
+    add_rec(&cur, HVM_SAVE_CODE(HEADER), 0, 16, 1);
+    add_rec(&cur, HVM_SAVE_CODE(CPU), 0, 64, 6);
+    add_rec(&cur, HVM_SAVE_CODE(CPU), 2, 64, 7);
+    add_rec(&cur, HVM_SAVE_CODE(MTRR), 0, BIG, 4);
+    add_rec(&cur, HVM_SAVE_CODE(PIT), 0, 40, 5);
+    add_end(&cur);
+    round_trip("changed", &base, &cur, cur.len - BIG - 16);
+
+    /* No END record. */
+    add_rec(&d, HVM_SAVE_CODE(HEADER), 0, XC_HVM_CONTEXT_UNCHANGED, 0);
+    d.len = sizeof(struct hvm_save_descriptor);
+    refused("no end", &base, &d);
+
+    /* A record running past the end of the delta. */
+    d.len = 0;
+    add_rec(&d, HVM_SAVE_CODE(PIT), 0, 32, 5);
+    add_end(&d);
+    ((struct hvm_save_descriptor *)d.buf)->length = d.len;
+    refused("overrun", &base, &d);
+
+    /* An unchanged record which the base does not have. */
+    d.len = 0;
+    add_rec(&d, HVM_SAVE_CODE(CPU), 7, 0, 0);
+    ((struct hvm_save_descriptor *)d.buf)->length = XC_HVM_CONTEXT_UNCHANGED;
+    add_end(&d);
+    refused("unknown record", &base, &d);
+
+    /* The same base record twice. */
+    d.len = 0;
+    for ( i = 0; i < 2; i++ )
+    {
+        add_rec(&d, HVM_SAVE_CODE(MTRR), 0, 0, 0);
+        ((struct hvm_save_descriptor *)(d.buf + d.len) - 1)->length =
+            XC_HVM_CONTEXT_UNCHANGED;
+    }
+    add_end(&d);
+    refused("repeated record", &base, &d);
+
+    /*
+     * Enough repeats of the 1MB record that the expanded size wraps a
+     * uint32_t (4097 x 1MB), and again so that it wraps to a few bytes.
+     */
+    d.len = 0;
+    for ( i = 0; i < 4097; i++ )
+    {
+        add_rec(&d, HVM_SAVE_CODE(MTRR), 0, 0, 0);
+        ((struct hvm_save_descriptor *)(d.buf + d.len) - 1)->length =
+            XC_HVM_CONTEXT_UNCHANGED;
+    }
+    add_end(&d);
+    refused("wrapping size", &base, &d);
+
+    d.len = 0;
+    for ( i = 0; i < 4096; i++ )
+    {
+        add_rec(&d, HVM_SAVE_CODE(MTRR), 0, 0, 0);
+        ((struct hvm_save_descriptor *)(d.buf + d.len) - 1)->length =
+            XC_HVM_CONTEXT_UNCHANGED;
+    }
+    add_end(&d);
+    refused("wrapping to zero", &base, &d);
+
+    free(base.buf);
+    free(cur.buf);
+    free(d.buf);
+
+    if ( failures )
+    {
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
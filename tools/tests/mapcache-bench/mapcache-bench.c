@@ -0,0 +1,235 @@
+/*
+ * mapcache-bench.c
+ *
+ * Dom0 microbenchmark for map_domain_page(): GNTTABOP_copy between pages
+ * dom0 grants to itself, each copy mapping a source and a destination
+ * page.  The working set, and hence the maphash hit rate, is set by the
+ * number of pages; the mapcache's perf counters are sampled around the run
+ * when the hypervisor has them.  With -n, each pair of pages gets that many
+ * consecutive sub-page copies, the way netback chops up packets, which the
+ * hypervisor can serve without re-pinning or re-mapping the grants.
+ *
+ * usage: mapcache-bench [-p pages] [-b batch] [-r rounds] [-l len] [-n run]
+ *
+ * The mapcache is only used by PV domains, and only by debug hypervisors
+ * or when the direct map does not cover all of memory (e.g. with mem= or
+ * memory hotplug), so run it in a PV dom0 on such a host: otherwise every
+ * mapping goes through the direct map and the counters stay at zero.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <xenctrl.h>
+#include <xen/grant_table.h>
+
+#define DEFAULT_PAGES  64
+#define DEFAULT_BATCH  32
+#define DEFAULT_ROUNDS 20000
+#define MAX_BATCH      256
+
+static const char *const counters[] = {
+    "map_domain_page count",
+    "map_domain_page maphash hits",
+    "map_domain_page maphash misses",
+    "mapcache wraps",
+    "domain page tlb flushes",
+};
+#define NR_COUNTERS (sizeof(counters) / sizeof(counters[0]))
+
+static double now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+/* Sum the mapcache counters over all CPUs; -1 without perf counters. */
+static int sample(xc_interface *xch, unsigned long long *sum)
+{
+    DECLARE_HYPERCALL_BUFFER(xc_perfc_desc_t, pcd);
+    DECLARE_HYPERCALL_BUFFER(xc_perfc_val_t, pcv);
+    int num_desc, num_val, i, j, rc = -1;
+    unsigned int c;
+    xc_perfc_val_t *val;
+
+    if ( xc_perfc_query_number(xch, &num_desc, &num_val) )
+        return -1;
+
+    pcd = xc_hypercall_buffer_alloc(xch, pcd, sizeof(*pcd) * num_desc);
+    pcv = xc_hypercall_buffer_alloc(xch, pcv, sizeof(*pcv) * num_val);
+    if ( !pcd || !pcv ||
+         xc_perfc_query(xch, HYPERCALL_BUFFER(pcd), HYPERCALL_BUFFER(pcv)) )
+        goto out;
+
+    memset(sum, 0, NR_COUNTERS * sizeof(*sum));
+    for ( i = 0, val = pcv; i < num_desc; val += pcd[i++].nr_vals )
+        for ( c = 0; c < NR_COUNTERS; c++ )
+            if ( !strcmp(pcd[i].name, counters[c]) )
+                for ( j = 0; j < pcd[i].nr_vals; j++ )
+                    sum[c] += val[j];
+    rc = 0;
+
+ out:
+    xc_hypercall_buffer_free(xch, pcd);
+    xc_hypercall_buffer_free(xch, pcv);
+    return rc;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-p pages] [-b batch (1-%u)] [-r rounds] "
+            "[-l len] [-n run]\n", prog, MAX_BATCH);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int pages = DEFAULT_PAGES, batch = DEFAULT_BATCH;
+    unsigned int rounds = DEFAULT_ROUNDS, len = 64, run = 1, i, r;
+    unsigned int next = 0, off = 0;
+    unsigned long long before[NR_COUNTERS], after[NR_COUNTERS];
+    xc_interface *xch = NULL;
+    xc_gntshr *xgs = NULL;
+    gnttab_copy_t *ops = NULL;
+    uint32_t *refs = NULL;
+    void *area = NULL;
+    int c, counted, rc = 1;
+    double us;
+
+    while ( (c = getopt(argc, argv, "p:b:r:l:n:")) != -1 )
+    {
+        switch ( c )
+        {
+        case 'p':
+            pages = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            batch = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rounds = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            len = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            run = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if ( pages < 2 || !batch || batch > MAX_BATCH || !rounds ||
+         !len || len > XC_PAGE_SIZE || !run )
+        usage(argv[0]);
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    xgs = xc_gntshr_open(NULL, 0);
+    refs = calloc(pages, sizeof(*refs));
+    ops = calloc(batch, sizeof(*ops));
+    if ( !xch || !xgs || !refs || !ops )
+    {
+        perror("setup");
+        goto out;
+    }
+
+    area = xc_gntshr_share_pages(xgs, 0, pages, refs, 1);
+    if ( !area )
+    {
+        perror("xc_gntshr_share_pages");
+        goto out;
+    }
+    memset(area, 0x5a, (size_t)pages * XC_PAGE_SIZE);
+
+    counted = !sample(xch, before);
+
+    us = now_us();
+    for ( r = 0; r < rounds; r++ )
+    {
+        /*
+         * Walk the pages round robin, copying each into its successor, RUN
+         * chunks at a time.
+         */
+        for ( i = 0; i < batch; i++ )
+        {
+            ops[i].source.u.ref = refs[next];
+            ops[i].source.domid = DOMID_SELF;
+            ops[i].source.offset = (off * len) % (XC_PAGE_SIZE - len + 1);
+            ops[i].dest.u.ref = refs[(next + 1) % pages];
+            ops[i].dest.domid = DOMID_SELF;
+            ops[i].dest.offset = ops[i].source.offset;
+            ops[i].len = len;
+            ops[i].flags = GNTCOPY_source_gref | GNTCOPY_dest_gref;
+            if ( ++off == run )
+            {
+                off = 0;
+                next = (next + 1) % pages;
+            }
+        }
+
+        if ( xc_gnttab_op(xch, GNTTABOP_copy, ops, sizeof(*ops), batch) )
+        {
+            perror("GNTTABOP_copy");
+            goto out;
+        }
+        for ( i = 0; i < batch; i++ )
+            if ( ops[i].status != GNTST_okay )
+            {
+                fprintf(stderr, "copy %u failed: %d\n", i, ops[i].status);
+                goto out;
+            }
+    }
+    us = now_us() - us;
+
+    printf("%u pages, %u rounds x %u copies of %u bytes, %u per page: "
+           "%.0f us, %.1f ns/copy, %.0f copies/s\n", pages, rounds, batch,
+           len, run, us, us * 1000.0 / ((double)rounds * batch),
+           (double)rounds * batch * 1e6 / us);
+
+    if ( counted && !sample(xch, after) )
+    {
+        unsigned long long d[NR_COUNTERS];
+
+        for ( i = 0; i < NR_COUNTERS; i++ )
+        {
+            d[i] = after[i] - before[i];
+            printf("  %-32s %llu\n", counters[i], d[i]);
+        }
+        if ( d[1] + d[2] )
+            printf("  maphash hit rate %.1f%%, %.2f flushes per 1000 maps\n",
+                   d[1] * 100.0 / (d[1] + d[2]),
+                   d[0] ? d[4] * 1000.0 / d[0] : 0.0);
+    }
+    else
+        printf("  (no perf counters: build Xen with perfc=y to see the "
+               "hit rate)\n");
+
+    rc = 0;
+
+ out:
+    if ( area )
+        xc_gntshr_munmap(xgs, area, pages);
+    free(ops);
+    free(refs);
+    if ( xgs )
+        xc_gntshr_close(xgs);
+    if ( xch )
+        xc_interface_close(xch);
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
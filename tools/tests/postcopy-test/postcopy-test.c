@@ -0,0 +1,469 @@
+/*
+ * postcopy-test.c
+ *
+ * Loopback test of post-copy live migration: migrate an HVM guest into a
+ * new domain on the same host over a socketpair, with XCFLAGS_POSTCOPY, and
+ * check that every page of the new domain matches the old one.
+ *
+ * usage: postcopy-test [-w pages/ms] [-r readers] [-v] domid
+ *
+ *  -w  during pre-copy, also dirty this many random pages of the guest per
+ *      millisecond from dom0, marking them as qemu does for DMA, on top of
+ *      whatever the guest's own workload dirties
+ *  -r  threads reading random pages of the new domain during post-copy:
+ *      each read of a page not there yet faults it in from the sender
+ *  -v  log libxc's progress, with the number of pages requested, prefetched
+ *      and pushed during post-copy
+ *
+ * The new domain has no device model and is never unpaused: the readers
+ * stand in for its vCPUs.  The guest's own device model is left alone, so
+ * keep its disk and network idle.  The guest is suspended for the
+ * migration and resumed when done.  Needs HAP.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <xenctrl.h>
+#include <xenguest.h>
+#include <xen/hvm/params.h>
+
+#define MAX_READERS 64
+#define BATCH       256
+
+static const char dm_record[] = "DeviceModelRecord0002";
+
+/* Shared between the saving and the restoring process. */
+struct stats {
+    double suspended, resumed, restored;
+    unsigned long faults, reads;
+    double fault_us;
+};
+
+static struct stats *stats;
+static uint32_t domid, newdom;
+static unsigned long nr_pfns;
+static unsigned int dirty_rate, nr_readers = 4;
+static volatile int stop;
+
+static double now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+/* Saving side */
+
+static pthread_t churn_thread;
+static int churning;
+
+static void *churn(void *arg)
+{
+    xc_interface *xch = xc_interface_open(NULL, NULL, 0);
+    unsigned int seed = getpid(), i;
+    xen_pfn_t pfn;
+    uint32_t *p;
+    int err;
+
+    if ( !xch )
+        return NULL;
+
+    while ( !stop )
+    {
+        for ( i = 0; i < dirty_rate; i++ )
+        {
+            pfn = rand_r(&seed) % nr_pfns;
+            p = xc_map_foreign_bulk(xch, domid, PROT_READ | PROT_WRITE,
+                                    &pfn, &err, 1);
+            if ( !p )
+                continue;
+            if ( !err )
+            {
+                /* An atomic no-op write: dirty, but unchanged for the guest. */
+                __sync_fetch_and_add(&p[rand_r(&seed) % (XC_PAGE_SIZE /
+                                                         sizeof(*p))], 0);
+                xc_hvm_modified_memory(xch, domid, pfn, 1);
+            }
+            munmap(p, XC_PAGE_SIZE);
+        }
+        usleep(1000);
+    }
+
+    xc_interface_close(xch);
+    return NULL;
+}
+
+static int suspend(void *data)
+{
+    xc_interface *xch = data;
+
+    stop = 1;
+    if ( churning )
+        pthread_join(churn_thread, NULL);
+    churning = 0;
+
+    stats->suspended = now_us();
+    return !xc_domain_shutdown(xch, domid, SHUTDOWN_suspend);
+}
+
+static int switch_qemu_logdirty(int dom, unsigned enable, void *data)
+{
+    return 0;
+}
+
+static int io_fd;
+
+static int postcopy_begin(void *data)
+{
+    uint32_t len = 0;
+
+    /* No device model state. */
+    if ( write(io_fd, dm_record, strlen(dm_record)) != strlen(dm_record) ||
+         write(io_fd, &len, sizeof(len)) != sizeof(len) )
+        return -1;
+    return 0;
+}
+
+/* Restoring side */
+
+static struct reader {
+    pthread_t thread;
+    unsigned int seed;
+    unsigned long faults, reads;
+    double fault_us;
+} readers[MAX_READERS];
+
+static void *reader(void *arg)
+{
+    struct reader *r = arg;
+    xc_interface *xch = xc_interface_open(NULL, NULL, 0);
+    double t;
+    volatile uint8_t *p;
+    xen_pfn_t pfn;
+    int err;
+
+    if ( !xch )
+        return NULL;
+
+    while ( !stop )
+    {
+        pfn = rand_r(&r->seed) % nr_pfns;
+        p = xc_map_foreign_bulk(xch, newdom, PROT_READ, &pfn, &err, 1);
+        if ( p && err == -ENOENT )
+        {
+            /* Paged out: the mapping attempt asked for it, so wait. */
+            t = now_us();
+            do {
+                munmap((void *)p, XC_PAGE_SIZE);
+                usleep(20);
+                p = xc_map_foreign_bulk(xch, newdom, PROT_READ,
+                                        &pfn, &err, 1);
+            } while ( p && err == -ENOENT && !stop );
+            if ( !err )
+            {
+                r->faults++;
+                r->fault_us += now_us() - t;
+            }
+        }
+        if ( p )
+        {
+            if ( !err )
+            {
+                (void)p[rand_r(&r->seed) % XC_PAGE_SIZE];
+                r->reads++;
+            }
+            munmap((void *)p, XC_PAGE_SIZE);
+        }
+    }
+
+    xc_interface_close(xch);
+    return NULL;
+}
+
+static int postcopy_resume(uint32_t dom, void *data)
+{
+    unsigned int i;
+
+    stats->resumed = now_us();
+    for ( i = 0; i < nr_readers; i++ )
+    {
+        readers[i].seed = i + 1;
+        if ( pthread_create(&readers[i].thread, NULL, reader, &readers[i]) )
+        {
+            nr_readers = i;
+            break;
+        }
+    }
+    return 0;
+}
+
+static int restore(int fd, unsigned int store_evtchn,
+                   unsigned int console_evtchn, xentoollog_logger *lg)
+{
+    struct restore_callbacks callbacks = {
+        .postcopy_resume = postcopy_resume,
+    };
+    unsigned long store_mfn, console_mfn;
+    xc_interface *xch = xc_interface_open(lg, NULL, 0);
+    unsigned int i;
+    int rc;
+
+    if ( !xch )
+        return -1;
+
+    rc = xc_domain_restore(xch, fd, newdom, store_evtchn, &store_mfn, 0,
+                           console_evtchn, &console_mfn, 0, 1, 1, 0, 0,
+                           &callbacks);
+    stats->restored = now_us();
+
+    stop = 1;
+    for ( i = 0; i < nr_readers; i++ )
+    {
+        pthread_join(readers[i].thread, NULL);
+        stats->faults += readers[i].faults;
+        stats->reads += readers[i].reads;
+        stats->fault_us += readers[i].fault_us;
+    }
+
+    xc_interface_close(xch);
+    return rc;
+}
+
+/* Compare the two domains, but for the pages restore resets. */
+static int compare(xc_interface *xch)
+{
+    static const int params[] = {
+        HVM_PARAM_IOREQ_PFN, HVM_PARAM_BUFIOREQ_PFN, HVM_PARAM_STORE_PFN,
+        HVM_PARAM_CONSOLE_PFN, HVM_PARAM_PAGING_RING_PFN,
+    };
+    uint64_t skip[sizeof(params) / sizeof(params[0])] = { 0 };
+    xen_pfn_t src_pfns[BATCH], dst_pfns[BATCH];
+    int src_err[BATCH], dst_err[BATCH];
+    unsigned long pfn, compared = 0, missing = 0, differ = 0;
+    unsigned int i, j, n;
+    uint8_t *src, *dst;
+
+    for ( i = 0; i < sizeof(params) / sizeof(params[0]); i++ )
+        xc_hvm_param_get(xch, domid, params[i], &skip[i]);
+
+    for ( pfn = 0; pfn < nr_pfns; pfn += n )
+    {
+        n = nr_pfns - pfn < BATCH ? nr_pfns - pfn : BATCH;
+        for ( i = 0; i < n; i++ )
+            src_pfns[i] = dst_pfns[i] = pfn + i;
+
+        src = xc_map_foreign_bulk(xch, domid, PROT_READ, src_pfns,
+                                  src_err, n);
+        dst = xc_map_foreign_bulk(xch, newdom, PROT_READ, dst_pfns,
+                                  dst_err, n);
+        if ( !src || !dst )
+        {
+            perror("xc_map_foreign_bulk");
+            return -1;
+        }
+
+        for ( i = 0; i < n; i++ )
+        {
+            for ( j = 0; j < sizeof(skip) / sizeof(skip[0]); j++ )
+                if ( skip[j] && skip[j] == pfn + i )
+                    break;
+            if ( j < sizeof(skip) / sizeof(skip[0]) || src_err[i] )
+                continue;
+
+            if ( dst_err[i] )
+            {
+                if ( missing++ < 10 )
+                    fprintf(stderr, "pfn %#lx missing: %d\n", pfn + i,
+                            dst_err[i]);
+                continue;
+            }
+            if ( memcmp(src + i * XC_PAGE_SIZE, dst + i * XC_PAGE_SIZE,
+                        XC_PAGE_SIZE) && differ++ < 10 )
+                fprintf(stderr, "pfn %#lx differs\n", pfn + i);
+            compared++;
+        }
+
+        munmap(src, n * XC_PAGE_SIZE);
+        munmap(dst, n * XC_PAGE_SIZE);
+    }
+
+    printf("  %lu pages compared, %lu missing, %lu differ\n",
+           compared, missing, differ);
+    return (missing || differ) ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-w pages/ms] [-r readers (0-%u)] [-v] "
+            "domid\n", prog, MAX_READERS);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct save_callbacks callbacks = {
+        .suspend = suspend,
+        .switch_qemu_logdirty = switch_qemu_logdirty,
+        .postcopy_begin = postcopy_begin,
+    };
+    xen_domain_handle_t handle = { 0 };
+    xentoollog_logger *lg = NULL;
+    xc_interface *xch = NULL;
+    unsigned long shadow_mb;
+    xc_dominfo_t info;
+    int store_evtchn, console_evtchn;
+    int c, sv[2], status, save_rc, rc = 1, verbose = 0;
+    char path[256];
+    double start;
+    pid_t pid;
+
+    while ( (c = getopt(argc, argv, "w:r:v")) != -1 )
+    {
+        switch ( c )
+        {
+        case 'w':
+            dirty_rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            nr_readers = strtoul(optarg, NULL, 0);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if ( optind != argc - 1 || nr_readers > MAX_READERS )
+        usage(argv[0]);
+    domid = strtoul(argv[optind], NULL, 0);
+
+    if ( verbose )
+        lg = (xentoollog_logger *)
+            xtl_createlogger_stdiostream(stderr, XTL_DETAIL, 0);
+
+    stats = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    xch = xc_interface_open(lg, NULL, 0);
+    if ( stats == MAP_FAILED || !xch )
+    {
+        perror("setup");
+        return 1;
+    }
+
+    if ( xc_domain_getinfo(xch, domid, 1, &info) != 1 ||
+         info.domid != domid || !info.hvm )
+    {
+        fprintf(stderr, "dom%u is not an HVM guest\n", domid);
+        goto out;
+    }
+    nr_pfns = xc_domain_maximum_gpfn(xch, domid) + 1;
+
+    /* The new domain, set up as the toolstack would. */
+    shadow_mb = (256 * (info.max_vcpu_id + 1) +
+                 2 * (info.max_memkb / 1024) + 255) / 256;
+    if ( xc_domain_create(xch, 0, handle, XEN_DOMCTL_CDF_hvm_guest |
+                          XEN_DOMCTL_CDF_hap, &newdom) )
+    {
+        perror("xc_domain_create");
+        goto out;
+    }
+    if ( xc_domain_max_vcpus(xch, newdom, info.max_vcpu_id + 1) ||
+         xc_domain_setmaxmem(xch, newdom, info.max_memkb) ||
+         xc_shadow_control(xch, newdom, XEN_DOMCTL_SHADOW_OP_SET_ALLOCATION,
+                           NULL, 0, &shadow_mb, 0, NULL) ||
+         (store_evtchn = xc_evtchn_alloc_unbound(xch, newdom, 0)) < 0 ||
+         (console_evtchn = xc_evtchn_alloc_unbound(xch, newdom, 0)) < 0 )
+    {
+        perror("setting up the new domain");
+        goto destroy;
+    }
+
+    if ( socketpair(AF_UNIX, SOCK_STREAM, 0, sv) )
+    {
+        perror("socketpair");
+        goto destroy;
+    }
+
+    pid = fork();
+    if ( pid < 0 )
+    {
+        perror("fork");
+        goto destroy;
+    }
+    if ( pid == 0 )
+    {
+        close(sv[0]);
+        _exit(restore(sv[1], store_evtchn, console_evtchn, lg) ? 1 : 0);
+    }
+    close(sv[1]);
+    io_fd = sv[0];
+
+    printf("dom%u -> dom%u, %lu pages, %u pages/ms dirtied, %u readers\n",
+           domid, newdom, nr_pfns, dirty_rate, nr_readers);
+
+    if ( dirty_rate && !pthread_create(&churn_thread, NULL, churn, NULL) )
+        churning = 1;
+
+    callbacks.data = xch;
+    start = now_us();
+    save_rc = xc_domain_save(xch, io_fd, domid, 0, 0, 0,
+                             XCFLAGS_LIVE | XCFLAGS_HVM | XCFLAGS_POSTCOPY,
+                             &callbacks, 1);
+    stop = 1;
+    if ( churning )
+        pthread_join(churn_thread, NULL);
+    close(io_fd);
+
+    if ( waitpid(pid, &status, 0) != pid )
+        status = -1;
+    if ( save_rc || !WIFEXITED(status) || WEXITSTATUS(status) )
+    {
+        fprintf(stderr, "migration failed: save %d, restore %#x\n",
+                save_rc, status);
+        goto resume;
+    }
+
+    printf("  pre-copy %.1f ms, downtime %.1f ms, post-copy %.1f ms\n",
+           (stats->suspended - start) / 1000,
+           (stats->resumed - stats->suspended) / 1000,
+           (stats->restored - stats->resumed) / 1000);
+    printf("  %lu reads, %lu faulted, %.1f us per fault\n",
+           stats->reads, stats->faults,
+           stats->faults ? stats->fault_us / stats->faults : 0.0);
+
+    if ( !compare(xch) )
+        rc = 0;
+
+ resume:
+    if ( xc_domain_resume(xch, domid, 1) )
+        perror("xc_domain_resume");
+ destroy:
+    xc_domain_destroy(xch, newdom);
+    snprintf(path, sizeof(path), XC_DEVICE_MODEL_RESTORE_FILE".%u", newdom);
+    unlink(path);
+ out:
+    xc_interface_close(xch);
+    xtl_logger_destroy(lg);
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,357 @@
+/*
+ * spinlock-bench.c
+ *
+ * Lock contention microbenchmark for the hypervisor's spinlock flavours:
+ * the old test-and-set lock, ticket locks and the NUMA-aware queued locks
+ * of xen/common/qspinlock.h, which is built here unchanged.  One thread is
+ * pinned to each CPU and they all hammer a single lock, reporting
+ * throughput, the spread of acquisitions between threads and how often
+ * the lock crossed a NUMA node.
+ *
+ * usage: spinlock-bench [-t threads] [-s seconds] [-c cs] [-d delay]
+ *                       [-N nodes] [tas|ticket|queued ...]
+ *
+ *  -c  cache lines written inside the critical section
+ *  -d  pause loops between releasing and retaking the lock
+ *  -N  pretend CPUs are spread round-robin over this many nodes, instead
+ *      of using the host's topology
+ *
+ * Threads spin in user space, so run no more threads than there are idle
+ * CPUs: a preempted ticket holder or queued waiter stalls everyone behind.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+
+#define MAX_CPUS 1024
+#define CACHE_LINE 64
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+#define barrier()           asm volatile ( "" : : : "memory" )
+#define smp_mb()            __sync_synchronize()
+#define smp_rmb()           __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb()           __atomic_thread_fence(__ATOMIC_RELEASE)
+#define read_atomic(p)      __atomic_load_n(p, __ATOMIC_RELAXED)
+#define write_atomic(p, x)  __atomic_store_n(p, x, __ATOMIC_RELAXED)
+#define cmpxchg(p, o, n)    __sync_val_compare_and_swap(p, o, n)
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax()         asm volatile ( "rep; nop" : : : "memory" )
+#else
+#define cpu_relax()         barrier()
+#endif
+
+/* As in xen/include/xen/spinlock.h. */
+typedef union {
+    u32 head_tail;
+    struct {
+        u16 head;
+        u16 tail;
+    };
+    struct {
+        u8 locked;
+        u8 released;
+        u16 queue;
+    };
+} spinlock_tickets_t;
+
+static __thread unsigned int this_cpu;
+static unsigned int cpu_node[MAX_CPUS];
+
+#define smp_processor_id()  this_cpu
+#define cpu_to_node(cpu)    cpu_node[cpu]
+
+#include "qspinlock.h"
+
+static struct qspin_node qnodes[MAX_CPUS][QSPIN_NODES];
+static __thread unsigned int qdepth;
+
+static struct qspin_node *qspin_node(unsigned int cpu, unsigned int idx)
+{
+    return &qnodes[cpu][idx];
+}
+
+static unsigned int *qspin_depth(void)
+{
+    return &qdepth;
+}
+
+/* The lock used up to Xen 4.5: xchg on a byte, spin while it is held. */
+static void tas_lock(spinlock_tickets_t *t)
+{
+    while ( __sync_lock_test_and_set(&t->locked, 1) )
+        while ( read_atomic(&t->locked) )
+            cpu_relax();
+}
+
+static void tas_unlock(spinlock_tickets_t *t)
+{
+    __sync_lock_release(&t->locked);
+}
+
+/* As _spin_lock() and _spin_unlock() in xen/common/spinlock.c. */
+static void ticket_lock(spinlock_tickets_t *t)
+{
+    spinlock_tickets_t tickets = { .tail = 1 };
+
+    tickets.head_tail = __sync_fetch_and_add(&t->head_tail,
+                                             tickets.head_tail);
+    while ( tickets.tail != read_atomic(&t->head) )
+        cpu_relax();
+    smp_rmb();
+}
+
+static void ticket_unlock(spinlock_tickets_t *t)
+{
+    smp_mb();
+    write_atomic(&t->head, t->head + 1);
+}
+
+static void queued_lock(spinlock_tickets_t *t)
+{
+    if ( !queued_spin_trylock(t) )
+        queued_spin_lock_slow(t);
+}
+
+static const struct variant {
+    const char *name;
+    void (*lock)(spinlock_tickets_t *);
+    void (*unlock)(spinlock_tickets_t *);
+} variants[] = {
+    { "tas",    tas_lock,    tas_unlock },
+    { "ticket", ticket_lock, ticket_unlock },
+    { "queued", queued_lock, queued_spin_unlock },
+};
+
+static struct {
+    spinlock_tickets_t lock __attribute__((aligned(CACHE_LINE)));
+    unsigned long count __attribute__((aligned(CACHE_LINE)));
+    unsigned long migrations;
+    unsigned int last_node;
+} shared;
+
+static char *cs_data;
+static unsigned int cs_lines, delay;
+static volatile int go, stop;
+static const struct variant *variant;
+
+/* Threads are the "CPUs" of the lock code; pcpu is where they run. */
+struct worker {
+    pthread_t thread;
+    unsigned int cpu, pcpu;
+    unsigned long acquired;
+} __attribute__((aligned(CACHE_LINE)));
+
+static void *worker_fn(void *arg)
+{
+    struct worker *w = arg;
+    unsigned int i, node;
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(w->pcpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    this_cpu = w->cpu;
+    node = cpu_node[w->cpu];
+
+    while ( !go )
+        cpu_relax();
+
+    while ( !stop )
+    {
+        variant->lock(&shared.lock);
+        shared.count++;
+        if ( shared.last_node != node )
+        {
+            shared.migrations++;
+            shared.last_node = node;
+        }
+        for ( i = 0; i < cs_lines; i++ )
+            cs_data[i * CACHE_LINE]++;
+        variant->unlock(&shared.lock);
+
+        w->acquired++;
+        for ( i = 0; i < delay; i++ )
+            cpu_relax();
+    }
+
+    return NULL;
+}
+
+static double now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+/* Node of each CPU from sysfs, i.e. the nodeN link in its directory. */
+static void read_topology(unsigned int *phys_node)
+{
+    char path[64];
+    struct dirent *de;
+    unsigned int cpu;
+    DIR *dir;
+
+    for ( cpu = 0; cpu < MAX_CPUS; cpu++ )
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+        if ( !(dir = opendir(path)) )
+            continue;
+        while ( (de = readdir(dir)) )
+            if ( sscanf(de->d_name, "node%u", &phys_node[cpu]) == 1 )
+                break;
+        closedir(dir);
+    }
+}
+
+static int run(const struct variant *v, unsigned int *cpus,
+               unsigned int nr, unsigned int seconds)
+{
+    struct worker *workers = calloc(nr, sizeof(*workers));
+    unsigned long total = 0, min = ~0UL, max = 0;
+    unsigned int i;
+    double us;
+
+    if ( !workers )
+        return -1;
+
+    memset(&shared, 0, sizeof(shared));
+    variant = v;
+    go = stop = 0;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        workers[i].cpu = i;
+        workers[i].pcpu = cpus[i];
+        if ( pthread_create(&workers[i].thread, NULL, worker_fn,
+                            &workers[i]) )
+        {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    us = now_us();
+    go = 1;
+    sleep(seconds);
+    stop = 1;
+    for ( i = 0; i < nr; i++ )
+        pthread_join(workers[i].thread, NULL);
+    us = now_us() - us;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        total += workers[i].acquired;
+        if ( workers[i].acquired < min )
+            min = workers[i].acquired;
+        if ( workers[i].acquired > max )
+            max = workers[i].acquired;
+    }
+
+    printf("%-7s %u threads: %.0f locks/s, %.1f ns/lock, per-thread "
+           "min/max %.2f, %.1f%% cross-node\n",
+           v->name, nr, total * 1e6 / us, us * 1e3 / total,
+           max ? (double)min / max : 0.0,
+           total ? shared.migrations * 100.0 / total : 0.0);
+
+    free(workers);
+    if ( shared.count != total )
+    {
+        fprintf(stderr, "%s: lost updates: %lu != %lu\n",
+                v->name, shared.count, total);
+        return -1;
+    }
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-t threads] [-s seconds] [-c cs] "
+            "[-d delay] [-N nodes] [tas|ticket|queued ...]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int threads = 0, seconds = 2, nodes = 0, nr = 0, i, j;
+    unsigned int cpus[MAX_CPUS], phys_node[MAX_CPUS] = { 0 };
+    cpu_set_t set;
+    int c, rc = 0;
+
+    while ( (c = getopt(argc, argv, "t:s:c:d:N:")) != -1 )
+    {
+        switch ( c )
+        {
+        case 't':
+            threads = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            cs_lines = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            delay = strtoul(optarg, NULL, 0);
+            break;
+        case 'N':
+            nodes = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if ( sched_getaffinity(0, sizeof(set), &set) )
+    {
+        perror("sched_getaffinity");
+        return 1;
+    }
+    for ( i = 0; i < MAX_CPUS && i < CPU_SETSIZE; i++ )
+        if ( CPU_ISSET(i, &set) )
+            cpus[nr++] = i;
+    if ( !threads )
+        threads = nr;
+    /* More threads than CPUs share CPUs, which spinning copes badly with. */
+    for ( i = nr; i < threads && i < MAX_CPUS; i++ )
+        cpus[i] = cpus[i % nr];
+    if ( threads > MAX_CPUS || !seconds )
+        usage(argv[0]);
+
+    if ( !nodes )
+        read_topology(phys_node);
+    for ( i = 0; i < threads; i++ )
+        cpu_node[i] = nodes ? i % nodes : phys_node[cpus[i]];
+
+    cs_data = calloc(cs_lines + 1, CACHE_LINE);
+    if ( !cs_data )
+        return 1;
+
+    for ( i = 0; i < sizeof(variants) / sizeof(variants[0]); i++ )
+    {
+        if ( optind < argc )
+        {
+            for ( j = optind; j < argc; j++ )
+                if ( !strcmp(argv[j], variants[i].name) )
+                    break;
+            if ( j == argc )
+                continue;
+        }
+        if ( run(&variants[i], cpus, threads, seconds) )
+            rc = 1;
+    }
+
+    return rc;
+}
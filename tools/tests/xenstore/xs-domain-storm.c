@@ -0,0 +1,214 @@
+/*
+ * xs-domain-storm.c
+ *
+ * Benchmark for xenstored watch dispatch.  A number of connections each
+ * register watches the way per-domain backends and toolstacks do, then a
+ * storm of "domains" is created and destroyed under a scratch subtree
+ * while all resulting watch events are drained.
+ *
+ * Usage: xs-domain-storm [domains] [watches-per-connection]
+ *
+ * Must be run in dom0 against a live xenstored.  Everything is done below
+ * /xs-domain-storm, which is removed on exit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
+
+#include <xenstore.h>
+
+#define ROOT "/xs-domain-storm"
+
+#define DEFAULT_DOMAINS 300
+#define DEFAULT_WATCHES 128
+
+/* Nodes written for each domain, loosely modelled on a PV guest. */
+static const char *const domain_nodes[] = {
+	"name", "vm", "memory/target", "cpu/0/availability",
+	"device/vbd/51712/state", "device/vbd/51712/backend",
+	"device/vif/0/state", "device/vif/0/backend", "device/vif/0/mac",
+	"console/ring-ref", "console/port", "store/ring-ref", "store/port",
+	"control/shutdown", "control/platform-feature-multiprocessor-suspend",
+};
+
+static unsigned long events;
+
+static double now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+static void drain(struct xs_handle **hs, unsigned int nr, int timeout_ms)
+{
+	struct pollfd *pfds = calloc(nr, sizeof(*pfds));
+	unsigned int i;
+	char **ev;
+
+	if (!pfds)
+		return;
+
+	for (i = 0; i < nr; i++) {
+		pfds[i].fd = xs_fileno(hs[i]);
+		pfds[i].events = POLLIN;
+	}
+
+	while (poll(pfds, nr, timeout_ms) > 0) {
+		for (i = 0; i < nr; i++) {
+			if (!(pfds[i].revents & POLLIN))
+				continue;
+			while ((ev = xs_check_watch(hs[i])) != NULL) {
+				events++;
+				free(ev);
+			}
+		}
+	}
+
+	free(pfds);
+}
+
+static int write_domain(struct xs_handle *h, unsigned int domid)
+{
+	char path[256];
+	xs_transaction_t t;
+	unsigned int i;
+
+ again:
+	t = xs_transaction_start(h);
+	if (t == XBT_NULL)
+		return -1;
+
+	for (i = 0; i < sizeof(domain_nodes) / sizeof(domain_nodes[0]); i++) {
+		snprintf(path, sizeof(path), ROOT "/local/domain/%u/%s",
+			 domid, domain_nodes[i]);
+		if (!xs_write(h, t, path, "1", 1)) {
+			xs_transaction_end(h, t, true);
+			return -1;
+		}
+	}
+
+	if (!xs_transaction_end(h, t, false)) {
+		if (errno == EAGAIN)
+			goto again;
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_domains = DEFAULT_DOMAINS, nr_watches = DEFAULT_WATCHES;
+	struct xs_handle *h, **watchers;
+	unsigned int i, j;
+	char path[256], token[32];
+	double start, setup, create, destroy;
+	int rc = 1;
+
+	if (argc > 1)
+		nr_domains = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		nr_watches = strtoul(argv[2], NULL, 0);
+	if (nr_domains == 0) {
+		fprintf(stderr, "usage: %s [domains] [watches-per-connection]\n",
+			argv[0]);
+		return 1;
+	}
+
+	h = xs_open(0);
+	watchers = calloc(nr_domains, sizeof(*watchers));
+	if (!h || !watchers) {
+		perror("xs_open");
+		return 1;
+	}
+
+	/*
+	 * One watching connection per domain, as a backend would have.  Most
+	 * watches are on other domains' subtrees, so only a few match any
+	 * given write: exactly the case a linear scan handles badly.
+	 */
+	start = now_us();
+	for (i = 0; i < nr_domains; i++) {
+		watchers[i] = xs_open(0);
+		if (!watchers[i]) {
+			perror("xs_open");
+			goto out;
+		}
+		for (j = 0; j < nr_watches; j++) {
+			snprintf(path, sizeof(path),
+				 ROOT "/local/domain/%u/device/w%u",
+				 (i + j) % nr_domains, j);
+			snprintf(token, sizeof(token), "t%u", j);
+			if (!xs_watch(watchers[i], path, token)) {
+				perror("xs_watch");
+				goto out;
+			}
+		}
+		/* Toolstack-style watch on the domain's whole subtree. */
+		snprintf(path, sizeof(path), ROOT "/local/domain/%u", i);
+		if (!xs_watch(watchers[i], path, "dom")) {
+			perror("xs_watch");
+			goto out;
+		}
+	}
+	drain(watchers, nr_domains, 100);
+	setup = now_us() - start;
+
+	events = 0;
+	start = now_us();
+	for (i = 0; i < nr_domains; i++) {
+		if (write_domain(h, i) < 0) {
+			perror("write_domain");
+			goto out;
+		}
+		drain(watchers, nr_domains, 0);
+	}
+	drain(watchers, nr_domains, 100);
+	create = now_us() - start;
+	printf("create:  %u domains in %.0f us (%.1f us/domain), %lu events\n",
+	       nr_domains, create, create / nr_domains, events);
+
+	events = 0;
+	start = now_us();
+	for (i = 0; i < nr_domains; i++) {
+		snprintf(path, sizeof(path), ROOT "/local/domain/%u", i);
+		if (!xs_rm(h, XBT_NULL, path)) {
+			perror("xs_rm");
+			goto out;
+		}
+		drain(watchers, nr_domains, 0);
+	}
+	drain(watchers, nr_domains, 100);
+	destroy = now_us() - start;
+	printf("destroy: %u domains in %.0f us (%.1f us/domain), %lu events\n",
+	       nr_domains, destroy, destroy / nr_domains, events);
+	printf("setup:   %u connections x %u watches in %.0f us\n",
+	       nr_domains, nr_watches + 1, setup);
+
+	rc = 0;
+
+ out:
+	for (i = 0; i < nr_domains; i++)
+		if (watchers[i])
+			xs_close(watchers[i]);
+	free(watchers);
+	xs_rm(h, XBT_NULL, ROOT);
+	xs_close(h);
+	return rc;
+}
+
+/*
+ * Local variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
@@ -24,8 +24,10 @@
 #include <sys/time.h>
 #include <time.h>
 #include <assert.h>
+#include <string.h>
 #include "talloc.h"
 #include "list.h"
+#include "hashtable.h"
 #include "xenstored_watch.h"
 #include "xenstore_lib.h"
 #include "utils.h"
@@ -33,11 +35,39 @@
 
 extern int quota_nb_watch_per_domain;
 
+/*
+ * Watches are indexed by node path so that firing costs O(depth + matches)
+ * rather than O(all watches).  Each watched path has an index node, which
+ * holds the watches on exactly that path; index nodes are also created for
+ * every ancestor so that the subtree below a path can be walked on rm.
+ * Special ("@...") watch paths get a parentless index node of their own.
+ */
+struct watch_index_node
+{
+	/* Full path: also the key in watch_index, which owns it. */
+	char *path;
+
+	struct watch_index_node *parent;
+	struct list_head children;
+	struct list_head sibling;
+
+	/* Watches registered on exactly this path. */
+	struct list_head watches;
+};
+
+static struct hashtable *watch_index;
+
 struct watch
 {
 	/* Watches on this connection */
 	struct list_head list;
 
+	/* Watches on the same path, and the index node holding them. */
+	struct list_head index_list;
+	struct watch_index_node *inode;
+
+	struct connection *conn;
+
 	/* Current outstanding events applying to this watch. */
 	struct list_head events;
 
@@ -86,28 +116,167 @@ static void add_event(struct connection *conn,
 	talloc_free(data);
 }
 
+static unsigned int watch_hash_fn(void *k)
+{
+	char *str = k;
+	unsigned int hash = 5381;
+	char c;
+
+	while ((c = *str++))
+		hash = ((hash << 5) + hash) + (unsigned int)c;
+
+	return hash;
+}
+
+static int watch_equal_fn(void *key1, void *key2)
+{
+	return streq(key1, key2);
+}
+
+static struct watch_index_node *index_lookup(const char *path)
+{
+	if (!watch_index)
+		return NULL;
+	return hashtable_search(watch_index, (void *)path);
+}
+
+/* Find or create the index node for path, and those of its ancestors. */
+static struct watch_index_node *index_get(const char *path)
+{
+	struct watch_index_node *inode, *parent = NULL;
+	char *slash;
+
+	inode = index_lookup(path);
+	if (inode)
+		return inode;
+
+	if (!watch_index) {
+		watch_index = create_hashtable(64, watch_hash_fn,
+					       watch_equal_fn);
+		if (!watch_index)
+			return NULL;
+	}
+
+	if (path[0] == '/' && !streq(path, "/")) {
+		char *parent_path;
+
+		slash = strrchr(path + 1, '/');
+		parent_path = slash ?
+			talloc_asprintf(NULL, "%.*s", (int)(slash - path), path) :
+			talloc_strdup(NULL, "/");
+		if (!parent_path)
+			return NULL;
+		parent = index_get(parent_path);
+		talloc_free(parent_path);
+		if (!parent)
+			return NULL;
+	}
+
+	inode = talloc(NULL, struct watch_index_node);
+	if (!inode)
+		return NULL;
+	inode->path = strdup(path);
+	if (!inode->path ||
+	    !hashtable_insert(watch_index, inode->path, inode)) {
+		free(inode->path);
+		talloc_free(inode);
+		return NULL;
+	}
+
+	inode->parent = parent;
+	INIT_LIST_HEAD(&inode->children);
+	INIT_LIST_HEAD(&inode->watches);
+	if (parent)
+		list_add_tail(&inode->sibling, &parent->children);
+
+	return inode;
+}
+
+/* Drop index nodes which no longer lead to any watch. */
+static void index_put(struct watch_index_node *inode)
+{
+	struct watch_index_node *parent;
+
+	while (inode && list_empty(&inode->watches) &&
+	       list_empty(&inode->children)) {
+		parent = inode->parent;
+		if (parent)
+			list_del(&inode->sibling);
+		/* Frees inode->path, the key. */
+		hashtable_remove(watch_index, inode->path);
+		talloc_free(inode);
+		inode = parent;
+	}
+}
+
+/* Fire the watches strictly below inode on their own node (rm). */
+static void fire_subtree(struct watch_index_node *inode)
+{
+	struct watch_index_node *child;
+	struct watch *watch;
+
+	list_for_each_entry(child, &inode->children, sibling) {
+		list_for_each_entry(watch, &child->watches, index_list)
+			add_event(watch->conn, watch, watch->node);
+		fire_subtree(child);
+	}
+}
+
 void fire_watches(struct connection *conn, const char *name, bool recurse)
 {
-	struct connection *i;
+	struct watch_index_node *inode;
 	struct watch *watch;
+	char *path, *slash;
 
 	/* During transactions, don't fire watches. */
 	if (conn && conn->transaction)
 		return;
 
-	/* Create an event for each watch. */
-	list_for_each_entry(i, &connections, list) {
-		list_for_each_entry(watch, &i->watches, list) {
-			if (is_child(name, watch->node))
-				add_event(i, watch, name);
-			else if (recurse && is_child(watch->node, name))
-				add_event(i, watch, watch->node);
-		}
+	if (!watch_index)
+		return;
+
+	/* Watches on name itself, then on each of its ancestors. */
+	path = talloc_strdup(NULL, name);
+	if (!path)
+		return;
+	for (;;) {
+		inode = index_lookup(path);
+		if (inode)
+			list_for_each_entry(watch, &inode->watches, index_list)
+				add_event(watch->conn, watch, name);
+
+		if (path[0] != '/' || streq(path, "/"))
+			break;
+		slash = strrchr(path + 1, '/');
+		if (slash)
+			*slash = '\0';
+		else
+			strcpy(path, "/");
+	}
+	talloc_free(path);
+
+	/* A watch on / sees everything, special events included. */
+	if (name[0] != '/') {
+		inode = index_lookup("/");
+		if (inode)
+			list_for_each_entry(watch, &inode->watches, index_list)
+				add_event(watch->conn, watch, name);
+	}
+
+	/* Everything below name went away too. */
+	if (recurse) {
+		inode = index_lookup(name);
+		if (inode)
+			fire_subtree(inode);
 	}
 }
 
 static int destroy_watch(void *_watch)
 {
+	struct watch *watch = _watch;
+
+	list_del(&watch->index_list);
+	index_put(watch->inode);
 	trace_destroy(_watch, "watch");
 	return 0;
 }
@@ -156,6 +325,7 @@ void do_watch(struct connection *conn, struct buffered_data *in)
 	watch = talloc(conn, struct watch);
 	watch->node = talloc_strdup(watch, vec[0]);
 	watch->token = talloc_strdup(watch, vec[1]);
+	watch->conn = conn;
 	if (relative)
 		watch->relative_path = get_implicit_path(conn);
 	else
@@ -163,8 +333,16 @@ void do_watch(struct connection *conn, struct buffered_data *in)
 
 	INIT_LIST_HEAD(&watch->events);
 
+	watch->inode = index_get(watch->node);
+	if (!watch->inode) {
+		talloc_free(watch);
+		send_error(conn, ENOMEM);
+		return;
+	}
+
 	domain_watch_inc(conn);
 	list_add_tail(&watch->list, &conn->watches);
+	list_add_tail(&watch->index_list, &watch->inode->watches);
 	trace_create(watch, "watch");
 	talloc_set_destructor(watch, destroy_watch);
 	send_ack(conn, XS_WATCH);
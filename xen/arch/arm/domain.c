@@ -40,18 +40,22 @@ DEFINE_PER_CPU(struct vcpu *, curr_vcpu);
 
 void idle_loop(void)
 {
+    unsigned int cpu = smp_processor_id();
+
     for ( ; ; )
     {
-        if ( cpu_is_offline(smp_processor_id()) )
+        if ( cpu_is_offline(cpu) )
             stop_cpu();
 
+        rcu_idle_enter(cpu);
         local_irq_disable();
-        if ( cpu_is_haltable(smp_processor_id()) )
+        if ( cpu_is_haltable(cpu) )
         {
             dsb(sy);
             wfi();
         }
         local_irq_enable();
+        rcu_idle_exit(cpu);
 
         do_tasklet();
         do_softirq();
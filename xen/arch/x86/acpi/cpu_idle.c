@@ -503,6 +503,8 @@ static void acpi_processor_idle(void)
     /* sched_tick_suspend() can raise TIMER_SOFTIRQ. Process it now. */
     process_pending_softirqs();
 
+    rcu_idle_enter(smp_processor_id());
+
     /*
      * Interrupts must be disabled during bus mastering calculations and
      * for C2/C3 transitions.
@@ -512,6 +514,7 @@ static void acpi_processor_idle(void)
     if ( !cpu_is_haltable(smp_processor_id()) )
     {
         local_irq_enable();
+        rcu_idle_exit(smp_processor_id());
         sched_tick_resume();
         cpufreq_dbs_timer_resume();
         return;
@@ -633,6 +636,7 @@ static void acpi_processor_idle(void)
         /* Now in C0 */
         power->last_state = &power->states[0];
         local_irq_enable();
+        rcu_idle_exit(smp_processor_id());
         sched_tick_resume();
         cpufreq_dbs_timer_resume();
         return;
@@ -641,6 +645,7 @@ static void acpi_processor_idle(void)
     /* Now in C0 */
     power->last_state = &power->states[0];
 
+    rcu_idle_exit(smp_processor_id());
     sched_tick_resume();
     cpufreq_dbs_timer_resume();
 
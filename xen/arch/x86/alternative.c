@@ -130,7 +130,13 @@ static void __init add_nops(void *insns, unsigned int len)
  */
 static void *__init text_poke_early(void *addr, const void *opcode, size_t len)
 {
-    memcpy(addr, opcode, len);
+    long d0, d1, d2;
+
+    /* Not memcpy(), which may itself be what is being patched. */
+    asm volatile ( "rep movsb"
+                   : "=&c" (d0), "=&D" (d1), "=&S" (d2)
+                   : "0" (len), "1" (addr), "2" (opcode)
+                   : "memory" );
     sync_core();
 
     return addr;
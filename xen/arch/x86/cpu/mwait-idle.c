@@ -473,11 +473,14 @@ static void mwait_idle(void)
 	/* sched_tick_suspend() can raise TIMER_SOFTIRQ. Process it now. */
 	process_pending_softirqs();
 
+	rcu_idle_enter(cpu);
+
 	/* Interrupts must be disabled for C2 and higher transitions. */
 	local_irq_disable();
 
 	if (!cpu_is_haltable(cpu)) {
 		local_irq_enable();
+		rcu_idle_exit(cpu);
 		sched_tick_resume();
 		cpufreq_dbs_timer_resume();
 		return;
@@ -521,6 +524,7 @@ static void mwait_idle(void)
 	/* Now back in C0. */
 	power->last_state = &power->states[0];
 
+	rcu_idle_exit(cpu);
 	sched_tick_resume();
 	cpufreq_dbs_timer_resume();
 
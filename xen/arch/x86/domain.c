@@ -73,11 +73,15 @@ static void paravirt_ctxt_switch_to(struct vcpu *v);
 
 static void default_idle(void)
 {
+    unsigned int cpu = smp_processor_id();
+
+    rcu_idle_enter(cpu);
     local_irq_disable();
-    if ( cpu_is_haltable(smp_processor_id()) )
+    if ( cpu_is_haltable(cpu) )
         safe_halt();
     else
         local_irq_enable();
+    rcu_idle_exit(cpu);
 }
 
 void default_dead_idle(void)
@@ -52,17 +52,73 @@ void __init mapcache_override_current(struct vcpu *v)
     override = v;
 }
 
+/*
+ * Each VCPU maps through its own slice of the map area.  A PV VCPU only
+ * runs on one CPU at a time, and every CPU flushes the non-global TLB
+ * entries of a VCPU's page tables when it switches to them, so stale
+ * translations of a slice can only live in the TLB of the CPU currently
+ * using it.  Freed slots are therefore zapped and marked as garbage, and
+ * reaped in batches with a single local flush when the slice wraps.
+ *
+ * The maphash keeps recently unmapped pages mapped, so that mapping them
+ * again costs nothing.  It is MAPHASH_WAYS-way set associative, with least
+ * recently used replacement; entries hit MAPHASH_HOT times are pinned until
+ * their hit count decays, which it does at every wrap.
+ */
 #define mapcache_l2_entry(e) ((e) >> PAGETABLE_ORDER)
 #define MAPCACHE_L2_ENTRIES (mapcache_l2_entry(MAPCACHE_ENTRIES - 1) + 1)
-#define MAPCACHE_L1ENT(idx) \
-    __linear_l1_table[l1_linear_offset(MAPCACHE_VIRT_START + pfn_to_paddr(idx))]
+#define MAPCACHE_L1ENT(v, idx) \
+    __linear_l1_table[l1_linear_offset(MAPCACHE_VCPU_VIRT_START(v) + \
+                                       pfn_to_paddr(idx))]
+
+static struct vcpu_maphash_entry *maphash_find(struct mapcache_vcpu *vcache,
+                                               unsigned long mfn)
+{
+    struct vcpu_maphash_entry *hashent = &vcache->hash[MAPHASH_HASHFN(mfn)];
+    unsigned int i;
+
+    for ( i = 0; i < MAPHASH_WAYS; i++, hashent++ )
+        if ( hashent->mfn == mfn )
+            return hashent;
+
+    return NULL;
+}
+
+/* Should A rather be replaced than B?  Neither may be referenced. */
+static bool_t maphash_colder(const struct vcpu_maphash_entry *a,
+                             const struct vcpu_maphash_entry *b)
+{
+    bool_t a_hot = a->hits >= MAPHASH_HOT, b_hot = b->hits >= MAPHASH_HOT;
+
+    if ( a_hot != b_hot )
+        return b_hot;
+    return (int32_t)(a->stamp - b->stamp) < 0;
+}
+
+/* The entry of MFN's set to replace, or NULL if all are in use or pinned. */
+static struct vcpu_maphash_entry *maphash_victim(struct mapcache_vcpu *vcache,
+                                                 unsigned long mfn)
+{
+    struct vcpu_maphash_entry *hashent = &vcache->hash[MAPHASH_HASHFN(mfn)];
+    struct vcpu_maphash_entry *victim = NULL;
+    unsigned int i;
+
+    for ( i = 0; i < MAPHASH_WAYS; i++, hashent++ )
+    {
+        if ( hashent->idx == MAPHASHENT_NOTINUSE )
+            return hashent;
+        if ( !hashent->refcnt && (!victim || maphash_colder(hashent, victim)) )
+            victim = hashent;
+    }
+
+    return victim && victim->hits < MAPHASH_HOT ? victim : NULL;
+}
 
 void *map_domain_page(unsigned long mfn)
 {
     unsigned long flags;
     unsigned int idx, i;
     struct vcpu *v;
-    struct mapcache_domain *dcache;
     struct mapcache_vcpu *vcache;
     struct vcpu_maphash_entry *hashent;
 
@@ -72,102 +128,92 @@ void *map_domain_page(unsigned long mfn)
 #endif
 
     v = mapcache_current_vcpu();
-    if ( !v || !is_pv_vcpu(v) )
+    if ( !v || !is_pv_vcpu(v) || !v->domain->arch.pv_domain.mapcache.enabled )
         return mfn_to_virt(mfn);
 
-    dcache = &v->domain->arch.pv_domain.mapcache;
     vcache = &v->arch.pv_vcpu.mapcache;
-    if ( !dcache->inuse )
-        return mfn_to_virt(mfn);
 
     perfc_incr(map_domain_page_count);
 
     local_irq_save(flags);
 
-    hashent = &vcache->hash[MAPHASH_HASHFN(mfn)];
-    if ( hashent->mfn == mfn )
+    ++vcache->clock;
+    hashent = maphash_find(vcache, mfn);
+    if ( hashent )
     {
+        perfc_incr(map_domain_page_hit);
         idx = hashent->idx;
-        ASSERT(idx < dcache->entries);
+        ASSERT(idx < MAPCACHE_VCPU_ENTRIES);
         hashent->refcnt++;
         ASSERT(hashent->refcnt);
-        ASSERT(l1e_get_pfn(MAPCACHE_L1ENT(idx)) == mfn);
+        hashent->stamp = vcache->clock;
+        if ( hashent->hits < 2 * MAPHASH_HOT )
+            hashent->hits++;
+        ASSERT(l1e_get_pfn(MAPCACHE_L1ENT(v, idx)) == mfn);
         goto out;
     }
 
-    spin_lock(&dcache->lock);
+    perfc_incr(map_domain_page_miss);
 
-    /* Has some other CPU caused a wrap? We must flush if so. */
-    if ( unlikely(dcache->epoch != vcache->shadow_epoch) )
+    idx = find_next_zero_bit(vcache->inuse, MAPCACHE_VCPU_ENTRIES,
+                             vcache->cursor);
+    if ( unlikely(idx >= MAPCACHE_VCPU_ENTRIES) )
     {
-        vcache->shadow_epoch = dcache->epoch;
-        if ( NEED_FLUSH(this_cpu(tlbflush_time), dcache->tlbflush_timestamp) )
-        {
-            perfc_incr(domain_page_tlb_flush);
-            flush_tlb_local();
-        }
-    }
-
-    idx = find_next_zero_bit(dcache->inuse, dcache->entries, dcache->cursor);
-    if ( unlikely(idx >= dcache->entries) )
-    {
-        unsigned long accum = 0, prev = 0;
+        perfc_incr(mapcache_wrap);
 
         /* /First/, clean the garbage map and update the inuse list. */
-        for ( i = 0; i < BITS_TO_LONGS(dcache->entries); i++ )
+        for ( i = 0; i < BITS_TO_LONGS(MAPCACHE_VCPU_ENTRIES); i++ )
         {
-            accum |= prev;
-            dcache->inuse[i] &= ~xchg(&dcache->garbage[i], 0);
-            prev = ~dcache->inuse[i];
+            vcache->inuse[i] &= ~vcache->garbage[i];
+            vcache->garbage[i] = 0;
         }
 
-        if ( accum | (prev & BITMAP_LAST_WORD_MASK(dcache->entries)) )
-            idx = find_first_zero_bit(dcache->inuse, dcache->entries);
-        else
+        idx = find_first_zero_bit(vcache->inuse, MAPCACHE_VCPU_ENTRIES);
+        if ( idx >= MAPCACHE_VCPU_ENTRIES )
         {
-            /* Replace a hash entry instead. */
-            i = MAPHASH_HASHFN(mfn);
-            do {
+            struct vcpu_maphash_entry *victim = NULL;
+
+            /* Replace a hash entry instead, the coldest one. */
+            for ( i = 0; i < MAPHASH_ENTRIES; i++ )
+            {
                 hashent = &vcache->hash[i];
-                if ( hashent->idx != MAPHASHENT_NOTINUSE && !hashent->refcnt )
-                {
-                    idx = hashent->idx;
-                    ASSERT(l1e_get_pfn(MAPCACHE_L1ENT(idx)) == hashent->mfn);
-                    l1e_write(&MAPCACHE_L1ENT(idx), l1e_empty());
-                    hashent->idx = MAPHASHENT_NOTINUSE;
-                    hashent->mfn = ~0UL;
-                    break;
-                }
-                if ( ++i == MAPHASH_ENTRIES )
-                    i = 0;
-            } while ( i != MAPHASH_HASHFN(mfn) );
+                if ( hashent->idx != MAPHASHENT_NOTINUSE && !hashent->refcnt &&
+                     (!victim || maphash_colder(hashent, victim)) )
+                    victim = hashent;
+            }
+            BUG_ON(!victim);
+
+            idx = victim->idx;
+            ASSERT(l1e_get_pfn(MAPCACHE_L1ENT(v, idx)) == victim->mfn);
+            l1e_write(&MAPCACHE_L1ENT(v, idx), l1e_empty());
+            victim->idx = MAPHASHENT_NOTINUSE;
+            victim->mfn = ~0UL;
         }
-        BUG_ON(idx >= dcache->entries);
+
+        /* Pinned entries have to keep being hit to stay pinned. */
+        for ( i = 0; i < MAPHASH_ENTRIES; i++ )
+            vcache->hash[i].hits >>= 1;
 
         /* /Second/, flush TLBs. */
         perfc_incr(domain_page_tlb_flush);
         flush_tlb_local();
-        vcache->shadow_epoch = ++dcache->epoch;
-        dcache->tlbflush_timestamp = tlbflush_current_time();
     }
 
-    set_bit(idx, dcache->inuse);
-    dcache->cursor = idx + 1;
+    __set_bit(idx, vcache->inuse);
+    vcache->cursor = idx + 1;
 
-    spin_unlock(&dcache->lock);
-
-    l1e_write(&MAPCACHE_L1ENT(idx), l1e_from_pfn(mfn, __PAGE_HYPERVISOR));
+    l1e_write(&MAPCACHE_L1ENT(v, idx), l1e_from_pfn(mfn, __PAGE_HYPERVISOR));
 
  out:
     local_irq_restore(flags);
-    return (void *)MAPCACHE_VIRT_START + pfn_to_paddr(idx);
+    return (void *)MAPCACHE_VCPU_VIRT_START(v) + pfn_to_paddr(idx);
 }
 
 void unmap_domain_page(const void *ptr)
 {
     unsigned int idx;
     struct vcpu *v;
-    struct mapcache_domain *dcache;
+    struct mapcache_vcpu *vcache;
     unsigned long va = (unsigned long)ptr, mfn, flags;
     struct vcpu_maphash_entry *hashent;
 
@@ -178,44 +224,47 @@ void unmap_domain_page(const void *ptr)
 
     v = mapcache_current_vcpu();
     ASSERT(v && is_pv_vcpu(v));
+    ASSERT(v->domain->arch.pv_domain.mapcache.enabled);
 
-    dcache = &v->domain->arch.pv_domain.mapcache;
-    ASSERT(dcache->inuse);
-
-    idx = PFN_DOWN(va - MAPCACHE_VIRT_START);
-    mfn = l1e_get_pfn(MAPCACHE_L1ENT(idx));
-    hashent = &v->arch.pv_vcpu.mapcache.hash[MAPHASH_HASHFN(mfn)];
+    vcache = &v->arch.pv_vcpu.mapcache;
+    idx = PFN_DOWN(va - MAPCACHE_VCPU_VIRT_START(v));
+    ASSERT(idx < MAPCACHE_VCPU_ENTRIES);
+    mfn = l1e_get_pfn(MAPCACHE_L1ENT(v, idx));
 
     local_irq_save(flags);
 
-    if ( hashent->idx == idx )
+    hashent = maphash_find(vcache, mfn);
+    if ( hashent && hashent->idx == idx )
     {
-        ASSERT(hashent->mfn == mfn);
         ASSERT(hashent->refcnt);
         hashent->refcnt--;
+        hashent->stamp = vcache->clock;
     }
-    else if ( !hashent->refcnt )
+    else if ( hashent ? !hashent->refcnt
+                      : (hashent = maphash_victim(vcache, mfn)) != NULL )
     {
         if ( hashent->idx != MAPHASHENT_NOTINUSE )
         {
             /* /First/, zap the PTE. */
-            ASSERT(l1e_get_pfn(MAPCACHE_L1ENT(hashent->idx)) ==
+            ASSERT(l1e_get_pfn(MAPCACHE_L1ENT(v, hashent->idx)) ==
                    hashent->mfn);
-            l1e_write(&MAPCACHE_L1ENT(hashent->idx), l1e_empty());
+            l1e_write(&MAPCACHE_L1ENT(v, hashent->idx), l1e_empty());
             /* /Second/, mark as garbage. */
-            set_bit(hashent->idx, dcache->garbage);
+            __set_bit(hashent->idx, vcache->garbage);
         }
 
         /* Add newly-freed mapping to the maphash. */
         hashent->mfn = mfn;
         hashent->idx = idx;
+        hashent->stamp = vcache->clock;
+        hashent->hits = 0;
     }
     else
     {
         /* /First/, zap the PTE. */
-        l1e_write(&MAPCACHE_L1ENT(idx), l1e_empty());
+        l1e_write(&MAPCACHE_L1ENT(v, idx), l1e_empty());
         /* /Second/, mark as garbage. */
-        set_bit(idx, dcache->garbage);
+        __set_bit(idx, vcache->garbage);
     }
 
     local_irq_restore(flags);
@@ -241,9 +290,6 @@ void copy_domain_page(unsigned long dmfn, unsigned long smfn)
 
 int mapcache_domain_init(struct domain *d)
 {
-    struct mapcache_domain *dcache = &d->arch.pv_domain.mapcache;
-    unsigned int bitmap_pages;
-
     if ( !is_pv_domain(d) || is_idle_domain(d) )
         return 0;
 
@@ -252,54 +298,32 @@ int mapcache_domain_init(struct domain *d)
         return 0;
 #endif
 
-    BUILD_BUG_ON(MAPCACHE_VIRT_END + PAGE_SIZE * (3 +
-                 2 * PFN_UP(BITS_TO_LONGS(MAPCACHE_ENTRIES) * sizeof(long))) >
+    BUILD_BUG_ON(MAPCACHE_VIRT_END >
                  MAPCACHE_VIRT_START + (PERDOMAIN_SLOT_MBYTES << 20));
-    bitmap_pages = PFN_UP(BITS_TO_LONGS(MAPCACHE_ENTRIES) * sizeof(long));
-    dcache->inuse = (void *)MAPCACHE_VIRT_END + PAGE_SIZE;
-    dcache->garbage = dcache->inuse +
-                      (bitmap_pages + 1) * PAGE_SIZE / sizeof(long);
 
-    spin_lock_init(&dcache->lock);
+    d->arch.pv_domain.mapcache.enabled = 1;
 
-    return create_perdomain_mapping(d, (unsigned long)dcache->inuse,
-                                    2 * bitmap_pages + 1,
-                                    NIL(l1_pgentry_t *), NULL);
+    return 0;
 }
 
 int mapcache_vcpu_init(struct vcpu *v)
 {
     struct domain *d = v->domain;
-    struct mapcache_domain *dcache = &d->arch.pv_domain.mapcache;
     unsigned long i;
-    unsigned int ents = d->max_vcpus * MAPCACHE_VCPU_ENTRIES;
-    unsigned int nr = PFN_UP(BITS_TO_LONGS(ents) * sizeof(long));
+    int rc;
 
-    if ( !is_pv_vcpu(v) || !dcache->inuse )
+    if ( !is_pv_vcpu(v) || !d->arch.pv_domain.mapcache.enabled )
         return 0;
 
-    if ( ents > dcache->entries )
-    {
-        /* Populate page tables. */
-        int rc = create_perdomain_mapping(d, MAPCACHE_VIRT_START, ents,
-                                          NIL(l1_pgentry_t *), NULL);
-
-        /* Populate bit maps. */
-        if ( !rc )
-            rc = create_perdomain_mapping(d, (unsigned long)dcache->inuse,
-                                          nr, NULL, NIL(struct page_info *));
-        if ( !rc )
-            rc = create_perdomain_mapping(d, (unsigned long)dcache->garbage,
-                                          nr, NULL, NIL(struct page_info *));
-
-        if ( rc )
-            return rc;
-
-        dcache->entries = ents;
-    }
+    /* Populate page tables for this VCPU's slice. */
+    rc = create_perdomain_mapping(d, MAPCACHE_VCPU_VIRT_START(v),
+                                  MAPCACHE_VCPU_ENTRIES,
+                                  NIL(l1_pgentry_t *), NULL);
+    if ( rc )
+        return rc;
 
     /* Mark all maphash entries as not in use. */
-    BUILD_BUG_ON(MAPHASHENT_NOTINUSE < MAPCACHE_ENTRIES);
+    BUILD_BUG_ON(MAPHASHENT_NOTINUSE < MAPCACHE_VCPU_ENTRIES);
     for ( i = 0; i < MAPHASH_ENTRIES; i++ )
     {
         struct vcpu_maphash_entry *hashent = &v->arch.pv_vcpu.mapcache.hash[i];
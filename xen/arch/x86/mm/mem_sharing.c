@@ -178,6 +178,8 @@ typedef struct gfn_info
     struct list_head list;
 } gfn_info_t;
 
+static struct xmem_cache *gfn_info_cache;
+
 static inline void
 rmap_init(struct page_info *page)
 {
@@ -373,7 +375,7 @@ static inline gfn_info_t *mem_sharing_gfn_alloc(struct page_info *page,
                                                 struct domain *d,
                                                 unsigned long gfn)
 {
-    gfn_info_t *gfn_info = xmalloc(gfn_info_t);
+    gfn_info_t *gfn_info = xmem_cache_alloc(gfn_info_cache);
 
     if ( gfn_info == NULL )
         return NULL; 
@@ -398,7 +400,7 @@ static inline void mem_sharing_gfn_destroy(struct page_info *page,
 
     /* Free the gfn_info structure. */
     rmap_del(gfn_info, page, 1);
-    xfree(gfn_info);
+    xmem_cache_free(gfn_info_cache, gfn_info);
 }
 
 static struct page_info* mem_sharing_lookup(unsigned long mfn)
@@ -1521,6 +1523,8 @@ int mem_sharing_domctl(struct domain *d, xen_domctl_mem_sharing_op_t *mec)
 void __init mem_sharing_init(void)
 {
     printk("Initing memory sharing.\n");
+    gfn_info_cache = xmem_cache_create_type("gfn_info", gfn_info_t);
+    BUG_ON(!gfn_info_cache);
 #if MEM_SHARING_AUDIT
     spin_lock_init(&shr_audit_lock);
     INIT_LIST_HEAD(&shr_audit_list);
@@ -7,18 +7,24 @@
 
 #include <xen/config.h>
 #include <xen/lib.h>
+#include <asm/alternative.h>
+#include <asm/cpufeature.h>
 
 #undef memcpy
 void *memcpy(void *dest, const void *src, size_t n)
 {
     long d0, d1, d2;
 
+    /*
+     * With enhanced REP MOVSB, one byte-wise string copy is as fast as the
+     * word-wise one and saves starting up a second for the tail.
+     */
     asm volatile (
-        "   rep ; movs"__OS" ; "
-        "   mov %4,%3        ; "
-        "   rep ; movsb        "
+        ALTERNATIVE("rep movs"__OS"; mov %4,%3; rep movsb",
+                    "mov %5,%3; rep movsb", X86_FEATURE_ERMS)
         : "=&c" (d0), "=&D" (d1), "=&S" (d2)
-        : "0" (n/BYTES_PER_LONG), "r" (n%BYTES_PER_LONG), "1" (dest), "2" (src)
+        : "0" (n/BYTES_PER_LONG), "r" (n%BYTES_PER_LONG), "r" (n),
+          "1" (dest), "2" (src)
         : "memory" );
 
     return dest;
@@ -26,19 +26,49 @@ static void evtchn_2l_set_pending(struct vcpu *v, struct evtchn *evtchn)
      * others may require explicit memory barriers.
      */
 
-    if ( test_and_set_bit(port, &shared_info(d, evtchn_pending)) )
+    /*
+     * Look before taking the cache line exclusively: a port which is
+     * already pending needs no further work.
+     */
+    if ( test_bit(port, &shared_info(d, evtchn_pending)) ||
+         test_and_set_bit(port, &shared_info(d, evtchn_pending)) )
         return;
 
-    if ( !test_bit        (port, &shared_info(d, evtchn_mask)) &&
-         !test_and_set_bit(port / BITS_PER_EVTCHN_WORD(d),
-                           &vcpu_info(v, evtchn_pending_sel)) )
+    if ( !test_bit(port, &shared_info(d, evtchn_mask)) )
     {
-        vcpu_mark_events_pending(v);
+        /*
+         * Within a batch, collect the selector bit in the per-VCPU shadow
+         * and leave publishing it (and the upcall) to evtchn_2l_flush().
+         */
+        if ( evtchn_batch_defer(v) )
+            set_bit(port / BITS_PER_EVTCHN_WORD(d), v->evtchn_2l_pending_sel);
+        else if ( !test_and_set_bit(port / BITS_PER_EVTCHN_WORD(d),
+                                    &vcpu_info(v, evtchn_pending_sel)) )
+            vcpu_mark_events_pending(v);
     }
 
     evtchn_check_pollers(d, port);
 }
 
+static void evtchn_2l_flush(struct vcpu *v)
+{
+    unsigned int sel;
+    bool_t notify = 0;
+
+    for ( sel = find_first_bit(v->evtchn_2l_pending_sel, BITS_PER_XEN_ULONG);
+          sel < BITS_PER_XEN_ULONG;
+          sel = find_next_bit(v->evtchn_2l_pending_sel, BITS_PER_XEN_ULONG,
+                              sel + 1) )
+    {
+        if ( test_and_clear_bit(sel, v->evtchn_2l_pending_sel) &&
+             !test_and_set_bit(sel, &vcpu_info(v, evtchn_pending_sel)) )
+            notify = 1;
+    }
+
+    if ( notify )
+        vcpu_mark_events_pending(v);
+}
+
 static void evtchn_2l_clear_pending(struct domain *d, struct evtchn *evtchn)
 {
     clear_bit(evtchn->port, &shared_info(d, evtchn_pending));
@@ -91,6 +121,7 @@ static const struct evtchn_port_ops evtchn_port_ops_2l =
     .is_pending    = evtchn_2l_is_pending,
     .is_masked     = evtchn_2l_is_masked,
     .print_state   = evtchn_2l_print_state,
+    .flush         = evtchn_2l_flush,
 };
 
 void evtchn_2l_init(struct domain *d)
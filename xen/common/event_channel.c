@@ -599,33 +599,27 @@ static long evtchn_close(evtchn_close_t *close)
     return __evtchn_close(current->domain, close->port);
 }
 
-int evtchn_send(struct domain *d, unsigned int lport)
+static int __evtchn_send(struct domain *ld, unsigned int lport)
 {
     struct evtchn *lchn, *rchn;
-    struct domain *ld = d, *rd;
+    struct domain *rd;
     struct vcpu   *rvcpu;
-    int            rport, ret = 0;
+    int            rport, ret;
 
-    spin_lock(&ld->event_lock);
+    ASSERT(spin_is_locked(&ld->event_lock));
 
     if ( unlikely(!port_is_valid(ld, lport)) )
-    {
-        spin_unlock(&ld->event_lock);
         return -EINVAL;
-    }
 
     lchn = evtchn_from_port(ld, lport);
 
     /* Guest cannot send via a Xen-attached event channel. */
     if ( unlikely(consumer_is_xen(lchn)) )
-    {
-        spin_unlock(&ld->event_lock);
         return -EINVAL;
-    }
 
     ret = xsm_evtchn_send(XSM_HOOK, ld, lchn);
     if ( ret )
-        goto out;
+        return ret;
 
     switch ( lchn->state )
     {
@@ -649,12 +643,105 @@ int evtchn_send(struct domain *d, unsigned int lport)
         ret = -EINVAL;
     }
 
-out:
-    spin_unlock(&ld->event_lock);
+    return ret;
+}
+
+int evtchn_send(struct domain *d, unsigned int lport)
+{
+    int ret;
+
+    spin_lock(&d->event_lock);
+    ret = __evtchn_send(d, lport);
+    spin_unlock(&d->event_lock);
 
     return ret;
 }
 
+static long evtchn_send_batch(struct evtchn_send_batch *batch)
+{
+    struct domain *ld = current->domain;
+    unsigned int i;
+    long rc = 0;
+
+    if ( batch->nr_ports > EVTCHN_SEND_BATCH_MAX )
+        return -EINVAL;
+
+    perfc_incr(evtchn_send_batch);
+    perfc_add(evtchn_send_batch_ports, batch->nr_ports);
+
+    spin_lock(&ld->event_lock);
+
+    /*
+     * The remote ends cannot be closed while we hold our event lock, so
+     * the deferred upcalls are flushed before it is dropped.
+     */
+    evtchn_batch_begin();
+    for ( i = 0; i < batch->nr_ports && !rc; i++ )
+        rc = __evtchn_send(ld, batch->ports[i]);
+    evtchn_batch_end();
+
+    spin_unlock(&ld->event_lock);
+
+    return rc;
+}
+
+/*
+ * Per-CPU record of the VCPUs whose upcall has been deferred by the port
+ * ops during the current batch.
+ */
+#define EVTCHN_BATCH_VCPUS 16
+struct evtchn_batch {
+    bool_t active;
+    unsigned int nr_vcpus;
+    struct vcpu *vcpu[EVTCHN_BATCH_VCPUS];
+};
+static DEFINE_PER_CPU(struct evtchn_batch, evtchn_batch);
+
+void evtchn_batch_begin(void)
+{
+    struct evtchn_batch *batch = &this_cpu(evtchn_batch);
+
+    ASSERT(!batch->active);
+    batch->nr_vcpus = 0;
+    batch->active = 1;
+}
+
+void evtchn_batch_end(void)
+{
+    struct evtchn_batch *batch = &this_cpu(evtchn_batch);
+    unsigned int i;
+
+    ASSERT(batch->active);
+    batch->active = 0;
+
+    for ( i = 0; i < batch->nr_vcpus; i++ )
+        evtchn_port_flush(batch->vcpu[i]);
+}
+
+/*
+ * Returns 1 if the caller may leave delivering the upcall for @v to the
+ * end of the current batch, or 0 if it must be delivered immediately.
+ */
+bool_t evtchn_batch_defer(struct vcpu *v)
+{
+    struct evtchn_batch *batch = &this_cpu(evtchn_batch);
+    unsigned int i;
+
+    /* Interrupt handlers may interleave with a batch; never defer those. */
+    if ( !batch->active || in_irq() )
+        return 0;
+
+    for ( i = 0; i < batch->nr_vcpus; i++ )
+        if ( batch->vcpu[i] == v )
+            return 1;
+
+    if ( batch->nr_vcpus == ARRAY_SIZE(batch->vcpu) )
+        return 0;
+
+    batch->vcpu[batch->nr_vcpus++] = v;
+    return 1;
+}
+
 static void evtchn_set_pending(struct vcpu *v, int port)
 {
     evtchn_port_set_pending(v, evtchn_from_port(v->domain, port));
@@ -1059,6 +1146,14 @@ long do_event_channel_op(int cmd, XEN_GUEST_HANDLE_PARAM(void) arg)
         break;
     }
 
+    case EVTCHNOP_send_batch: {
+        struct evtchn_send_batch send_batch;
+        if ( copy_from_guest(&send_batch, arg, 1) != 0 )
+            return -EFAULT;
+        rc = evtchn_send_batch(&send_batch);
+        break;
+    }
+
     case EVTCHNOP_status: {
         struct evtchn_status status;
         if ( copy_from_guest(&status, arg, 1) != 0 )
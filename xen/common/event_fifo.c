@@ -165,6 +165,20 @@ static void evtchn_fifo_set_pending(struct vcpu *v, struct evtchn *evtchn)
         return;
     }
 
+    /*
+     * Notify suppression: an event that is already pending and linked
+     * will be found by the guest when it next walks its queue, so there
+     * is nothing to link and no upcall to raise.  Check with a plain read
+     * so that the event word isn't pulled in exclusively for nothing.
+     */
+    if ( (read_atomic(word) & ((1 << EVTCHN_FIFO_PENDING) |
+                                (1 << EVTCHN_FIFO_LINKED))) ==
+         ((1 << EVTCHN_FIFO_PENDING) | (1 << EVTCHN_FIFO_LINKED)) )
+    {
+        perfc_incr(evtchn_fifo_suppressed);
+        return;
+    }
+
     was_pending = test_and_set_bit(EVTCHN_FIFO_PENDING, word);
 
     /*
@@ -485,7 +499,7 @@ int evtchn_fifo_init_control(struct evtchn_init_control *init_control)
     uint32_t vcpu_id;
     uint64_t gfn;
     uint32_t offset;
-    struct vcpu *v;
+    struct vcpu *v, *w;
     int rc;
 
     init_control->link_bits = EVTCHN_FIFO_LINK_BITS;
@@ -521,6 +535,14 @@ int evtchn_fifo_init_control(struct evtchn_init_control *init_control)
             cleanup_control_block(v);
         else
         {
+            /*
+             * Publish the selector bits an event batch may still be holding
+             * back under the 2-level ABI, before the 2-level state is
+             * handed over.
+             */
+            for_each_vcpu ( d, w )
+                evtchn_port_flush(w);
+
             d->evtchn_port_ops = &evtchn_port_ops_fifo;
             d->max_evtchns = EVTCHN_FIFO_NR_CHANNELS;
             setup_ports(d);
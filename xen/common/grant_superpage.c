@@ -0,0 +1,121 @@
+/******************************************************************************
+ * common/grant_superpage.c
+ *
+ * Host mappings of superpage grants (GTF_superpage), made one frame at a
+ * time through the arch hooks for single-page grants.  Included by
+ * grant_table.c; tools/tests/gnttab-superpage builds it against models of
+ * those hooks.
+ */
+
+/*
+ * Take references to the pages of a superpage grant, and map them all.
+ * The arch hooks only know the flags of a single-page map, and superpages
+ * are always RAM, which is never mapped with the cache attributes of a
+ * grant.
+ */
+static int gnttab_map_superpage(const struct gnttab_map_grant_ref *op,
+                                struct domain *rd, unsigned long frame,
+                                bool_t get_type, unsigned int cache_flags)
+{
+    uint32_t flags = op->flags & ~GNTMAP_superpage;
+    struct page_info *pg;
+    unsigned int i;
+    int rc = GNTST_okay;
+
+    if ( cache_flags )
+    {
+        gdprintk(XENLOG_INFO,
+                 "Superpage grant %d has cache attributes %x\n",
+                 op->ref, cache_flags);
+        return GNTST_general_error;
+    }
+
+    for ( i = 0; i < GNTTAB_SUPERPAGE_FRAMES; i++ )
+    {
+        pg = mfn_to_page(frame + i);
+        if ( !get_page(pg, rd) )
+            break;
+        if ( get_type && !get_page_type(pg, PGT_writable_page) )
+        {
+            put_page(pg);
+            break;
+        }
+
+        rc = create_grant_host_mapping(op->host_addr + i * PAGE_SIZE,
+                                       frame + i, flags, 0);
+        if ( rc != GNTST_okay )
+        {
+            if ( get_type )
+                put_page_type(pg);
+            put_page(pg);
+            break;
+        }
+    }
+
+    if ( i == GNTTAB_SUPERPAGE_FRAMES )
+        return GNTST_okay;
+
+    if ( rc == GNTST_okay )
+    {
+        if ( !rd->is_dying )
+            gdprintk(XENLOG_WARNING, "Could not pin grant frame %lx\n",
+                     frame + i);
+        rc = GNTST_general_error;
+    }
+
+    while ( i-- )
+    {
+        pg = mfn_to_page(frame + i);
+        replace_grant_host_mapping(op->host_addr + i * PAGE_SIZE, frame + i,
+                                   0, flags);
+        if ( get_type )
+            put_page_type(pg);
+        put_page(pg);
+    }
+
+    return rc;
+}
+
+/*
+ * Unmap a superpage grant.  On failure, the references to all its pages
+ * are leaked, as the reference to the page of a single grant would be.
+ */
+static int gnttab_unmap_superpage(uint64_t addr, unsigned long frame,
+                                  uint32_t flags)
+{
+    unsigned int i;
+    int rc = GNTST_okay, err;
+
+    flags &= ~GNTMAP_superpage;
+    for ( i = 0; i < GNTTAB_SUPERPAGE_FRAMES; i++ )
+    {
+        err = replace_grant_host_mapping(addr + i * PAGE_SIZE, frame + i,
+                                         0, flags);
+        if ( err < 0 )
+            rc = err;
+    }
+
+    return rc;
+}
+
+static void gnttab_put_superpage(unsigned long frame, bool_t put_type)
+{
+    unsigned int i;
+
+    for ( i = 0; i < GNTTAB_SUPERPAGE_FRAMES; i++ )
+    {
+        if ( put_type )
+            put_page_type(mfn_to_page(frame + i));
+        put_page(mfn_to_page(frame + i));
+    }
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -137,7 +137,8 @@ struct active_grant_entry {
     unsigned long frame;  /* Frame being granted.                     */
     unsigned long gfn;    /* Guest's idea of the frame being granted. */
     unsigned      is_sub_page:1; /* True if this is a sub-page grant. */
-    unsigned      start:15; /* For sub-page grants, the start offset
+    unsigned      is_superpage:1; /* True if this is a superpage grant. */
+    unsigned      start:14; /* For sub-page grants, the start offset
                                in the page.                           */
     unsigned      length:16; /* For sub-page grants, the length of the
                                 grant.                                */
@@ -212,6 +213,39 @@ static int __get_paged_frame(unsigned long gfn, unsigned long *frame, struct pag
     return rc;
 }
 
+/*
+ * Check that the region of a superpage grant starting at GFN is naturally
+ * aligned and contiguous in machine memory, and return its first frame.
+ * No references are kept: like any grant, it is pinned by the maps taking
+ * references to its pages.
+ */
+static int gnttab_get_superpage(unsigned long gfn, unsigned long *frame,
+                                int readonly, struct domain *rd)
+{
+    struct page_info *page;
+    unsigned long mfn;
+    unsigned int i;
+    int rc;
+
+    if ( gfn & (GNTTAB_SUPERPAGE_FRAMES - 1) )
+        return GNTST_bad_page;
+
+    for ( i = 0; i < GNTTAB_SUPERPAGE_FRAMES; i++ )
+    {
+        rc = __get_paged_frame(gfn + i, &mfn, &page, readonly, rd);
+        if ( rc != GNTST_okay )
+            return rc;
+        put_page(page);
+
+        if ( !i )
+            *frame = mfn;
+        if ( mfn != *frame + i || (*frame & (GNTTAB_SUPERPAGE_FRAMES - 1)) )
+            return GNTST_bad_page;
+    }
+
+    return GNTST_okay;
+}
+
 static inline void
 double_gt_lock(struct grant_table *lgt, struct grant_table *rgt)
 {
@@ -504,6 +538,8 @@ static void mapcount(
     }
 }
 
+#include "grant_superpage.c"
+
 /*
  * Returns 0 if TLB flush / invalidate required by caller.
  * va will indicate the address to be invalidated.
@@ -524,6 +560,7 @@ __gnttab_map_grant_ref(
     int            rc = GNTST_okay;
     u32            old_pin;
     u32            act_pin;
+    bool_t         superpage;
     unsigned int   cache_flags;
     struct active_grant_entry *act = NULL;
     struct grant_mapping *mt;
@@ -551,6 +588,20 @@ __gnttab_map_grant_ref(
         return;
     }
 
+    superpage = !!(op->flags & GNTMAP_superpage);
+    if ( unlikely(superpage &&
+                  ((op->flags & (GNTMAP_device_map|GNTMAP_host_map|
+                                 GNTMAP_contains_pte)) != GNTMAP_host_map ||
+                   (op->host_addr &
+                    ((PAGE_SIZE << GNTTAB_SUPERPAGE_ORDER) - 1)) ||
+                   gnttab_need_iommu_mapping(ld))) )
+    {
+        gdprintk(XENLOG_INFO, "Bad superpage grant map (%x, %"PRIx64").\n",
+                 op->flags, op->host_addr);
+        op->status = GNTST_general_error;
+        return;
+    }
+
     if ( unlikely((rd = rcu_lock_domain_by_id(op->dom)) == NULL) )
     {
         gdprintk(XENLOG_INFO, "Could not find domain %d\n", op->dom);
@@ -602,10 +653,12 @@ __gnttab_map_grant_ref(
     if ( act->pin &&
          ((act->domid != ld->domain_id) ||
           (act->pin & 0x80808080U) != 0 ||
-          (act->is_sub_page)) )
+          (act->is_sub_page) ||
+          (act->is_superpage != superpage)) )
         PIN_FAIL(unlock_out, GNTST_general_error,
-                 "Bad domain (%d != %d), or risk of counter overflow %08x, or subpage %d\n",
-                 act->domid, ld->domain_id, act->pin, act->is_sub_page);
+                 "Bad domain (%d != %d), or risk of counter overflow %08x, or subpage %d, or superpage %d\n",
+                 act->domid, ld->domain_id, act->pin, act->is_sub_page,
+                 act->is_superpage);
 
     if ( !act->pin ||
          (!(op->flags & GNTMAP_readonly) &&
@@ -621,8 +674,17 @@ __gnttab_map_grant_ref(
             unsigned long frame;
 
             unsigned long gfn = sha1 ? sha1->frame : sha2->full_page.frame;
-            rc = __get_paged_frame(gfn, &frame, &pg, 
-                                    !!(op->flags & GNTMAP_readonly), rd);
+
+            if ( (sha2 && (shah->flags & GTF_superpage)) != superpage )
+                PIN_FAIL(unlock_out_clear, GNTST_general_error,
+                         "Superpage grant %d needs GNTMAP_superpage, and "
+                         "only it\n", op->ref);
+            if ( superpage )
+                rc = gnttab_get_superpage(gfn, &frame,
+                                          !!(op->flags & GNTMAP_readonly), rd);
+            else
+                rc = __get_paged_frame(gfn, &frame, &pg,
+                                       !!(op->flags & GNTMAP_readonly), rd);
             if ( rc != GNTST_okay )
                 goto unlock_out_clear;
             act->gfn = gfn;
@@ -631,6 +693,7 @@ __gnttab_map_grant_ref(
             act->start = 0;
             act->length = PAGE_SIZE;
             act->is_sub_page = 0;
+            act->is_superpage = superpage;
             act->trans_domain = rd;
             act->trans_gref = op->ref;
         }
@@ -651,6 +714,16 @@ __gnttab_map_grant_ref(
 
     spin_unlock(&rgt->lock);
 
+    if ( superpage )
+    {
+        rc = gnttab_map_superpage(op, rd, frame,
+                                  gnttab_host_mapping_get_page_type(op, ld, rd),
+                                  cache_flags);
+        if ( rc != GNTST_okay )
+            goto undo_out;
+        goto track;
+    }
+
     /* pg may be set, with a refcount included, from __get_paged_frame */
     if ( !pg )
     {
@@ -725,6 +798,7 @@ __gnttab_map_grant_ref(
         goto undo_out;
     }
 
+ track:
     double_gt_lock(lgt, rgt);
 
     if ( gnttab_need_iommu_mapping(ld) )
@@ -899,6 +973,10 @@ __gnttab_unmap_common(
     op->rd = rd;
     act = &active_entry(rgt, op->map->ref);
 
+    if ( unlikely((op->flags & GNTMAP_superpage) && op->new_addr) )
+        PIN_FAIL(unmap_out, GNTST_general_error,
+                 "Superpage grant mappings can't be replaced\n");
+
     if ( op->frame == 0 )
     {
         op->frame = act->frame;
@@ -922,9 +1000,13 @@ __gnttab_unmap_common(
 
     if ( (op->host_addr != 0) && (op->flags & GNTMAP_host_map) )
     {
-        if ( (rc = replace_grant_host_mapping(op->host_addr,
-                                              op->frame, op->new_addr, 
-                                              op->flags)) < 0 )
+        if ( op->flags & GNTMAP_superpage )
+            rc = gnttab_unmap_superpage(op->host_addr, op->frame, op->flags);
+        else
+            rc = replace_grant_host_mapping(op->host_addr,
+                                            op->frame, op->new_addr, 
+                                            op->flags);
+        if ( rc < 0 )
             goto unmap_out;
 
         ASSERT(act->pin & (GNTPIN_hstw_mask | GNTPIN_hstr_mask));
@@ -953,7 +1035,13 @@ __gnttab_unmap_common(
 
     /* If just unmapped a writable mapping, mark as dirtied */
     if ( !(op->flags & GNTMAP_readonly) )
-         gnttab_mark_dirty(rd, op->frame);
+    {
+        unsigned int i, nr = (op->flags & GNTMAP_superpage) ?
+                             GNTTAB_SUPERPAGE_FRAMES : 1;
+
+        for ( i = 0; i < nr; i++ )
+            gnttab_mark_dirty(rd, op->frame + i);
+    }
 
  unmap_out:
     double_gt_unlock(lgt, rgt);
@@ -1032,7 +1120,10 @@ __gnttab_unmap_common_complete(struct gnttab_unmap_common *op)
             goto unmap_out;
         }
 
-        if ( !is_iomem_page(op->frame) ) 
+        if ( op->flags & GNTMAP_superpage )
+            gnttab_put_superpage(op->frame,
+                                 gnttab_host_mapping_get_page_type(op, ld, rd));
+        else if ( !is_iomem_page(op->frame) ) 
         {
             if ( gnttab_host_mapping_get_page_type(op, ld, rd) )
                 put_page_type(pg);
@@ -1875,9 +1966,10 @@ __acquire_grant_for_copy(
     }
 
     /* If already pinned, check the active domid and avoid refcnt overflow. */
-    if ( act->pin && ((act->domid != ldom) || (act->pin & 0x80808080U) != 0) )
+    if ( act->pin && ((act->domid != ldom) || (act->pin & 0x80808080U) != 0 ||
+                      act->is_superpage) )
         PIN_FAIL(unlock_out, GNTST_general_error,
-                 "Bad domain (%d != %d), or risk of counter overflow %08x\n",
+                 "Bad domain (%d != %d), or risk of counter overflow %08x, or superpage\n",
                  act->domid, ldom, act->pin);
 
     old_pin = act->pin;
@@ -1963,6 +2055,9 @@ __acquire_grant_for_copy(
             trans_page_off = 0;
             trans_length = PAGE_SIZE;
         }
+        else if ( sha2->hdr.flags & GTF_superpage )
+            PIN_FAIL(unlock_out_clear, GNTST_general_error,
+                     "superpage grants can only be mapped\n");
         else if ( !(sha2->hdr.flags & GTF_sub_page) )
         {
             rc = __get_paged_frame(sha2->full_page.frame, &grant_frame, page, readonly, rd);
@@ -1988,6 +2083,7 @@ __acquire_grant_for_copy(
         {
             act->domid = ldom;
             act->is_sub_page = is_sub_page;
+            act->is_superpage = 0;
             act->start = trans_page_off;
             act->length = trans_length;
             act->trans_domain = td;
@@ -2024,152 +2120,271 @@ __acquire_grant_for_copy(
     return rc;
 }
 
+/*
+ * One side of a batch of copies.  Netback and the like issue many sub-page
+ * copies from and to the same few frames, so the domain, the grant pin, the
+ * page references and the mapping are kept from one op to the next for as
+ * long as consecutive ops name the same domain and reference (or frame).
+ */
+struct gnttab_copy_buf {
+    struct domain *domain;
+    domid_t domid;
+    bool_t read_only;
+
+    /* What the buffer holds: a grant reference, or a frame of DOMID_SELF. */
+    bool_t is_gref;
+    xen_pfn_t gfn;
+
+    unsigned long frame;
+    struct page_info *page;
+    unsigned int start, len;
+    void *virt;
+    bool_t have_grant;
+    bool_t have_type;
+};
+
 static void
-__gnttab_copy(
-    struct gnttab_copy *op)
+gnttab_copy_release_buf(struct gnttab_copy_buf *buf)
 {
-    struct domain *sd = NULL, *dd = NULL;
-    unsigned long s_frame, d_frame;
-    struct page_info *s_pg = NULL, *d_pg = NULL;
-    char *sp, *dp;
-    s16 rc = GNTST_okay;
-    int have_d_grant = 0, have_s_grant = 0;
-    int src_is_gref, dest_is_gref;
-
-    if ( ((op->source.offset + op->len) > PAGE_SIZE) ||
-         ((op->dest.offset + op->len) > PAGE_SIZE) )
-        PIN_FAIL(error_out, GNTST_bad_copy_arg, "copy beyond page area.\n");
+    if ( buf->virt )
+    {
+        unmap_domain_page(buf->virt);
+        buf->virt = NULL;
+    }
+    if ( buf->have_type )
+    {
+        put_page_type(buf->page);
+        buf->have_type = 0;
+    }
+    if ( buf->page )
+    {
+        put_page(buf->page);
+        buf->page = NULL;
+    }
+    if ( buf->have_grant )
+    {
+        __release_grant_for_copy(buf->domain, buf->gfn, buf->read_only);
+        buf->have_grant = 0;
+    }
+}
 
-    src_is_gref = op->flags & GNTCOPY_source_gref;
-    dest_is_gref = op->flags & GNTCOPY_dest_gref;
+static void
+gnttab_copy_unlock_domains(struct gnttab_copy_buf *src,
+                           struct gnttab_copy_buf *dest)
+{
+    if ( src->domain )
+    {
+        rcu_unlock_domain(src->domain);
+        src->domain = NULL;
+    }
+    if ( dest->domain )
+    {
+        rcu_unlock_domain(dest->domain);
+        dest->domain = NULL;
+    }
+}
 
-    if ( (op->source.domid != DOMID_SELF && !src_is_gref ) ||
-         (op->dest.domid   != DOMID_SELF && !dest_is_gref)   )
-        PIN_FAIL(error_out, GNTST_permission_denied,
-                 "only allow copy-by-mfn for DOMID_SELF.\n");
+static int
+gnttab_copy_lock_domain(domid_t domid, struct gnttab_copy_buf *buf)
+{
+    if ( domid == DOMID_SELF )
+        buf->domain = rcu_lock_current_domain();
+    else if ( (buf->domain = rcu_lock_domain_by_id(domid)) == NULL )
+    {
+        gdprintk(XENLOG_WARNING, "couldn't find %d\n", domid);
+        return GNTST_bad_domain;
+    }
 
-    if ( op->source.domid == DOMID_SELF )
-        sd = rcu_lock_current_domain();
-    else if ( (sd = rcu_lock_domain_by_id(op->source.domid)) == NULL )
-        PIN_FAIL(error_out, GNTST_bad_domain,
-                 "couldn't find %d\n", op->source.domid);
+    buf->domid = domid;
+    return GNTST_okay;
+}
 
-    if ( op->dest.domid == DOMID_SELF )
-        dd = rcu_lock_current_domain();
-    else if ( (dd = rcu_lock_domain_by_id(op->dest.domid)) == NULL )
-        PIN_FAIL(error_out, GNTST_bad_domain,
-                 "couldn't find %d\n", op->dest.domid);
+static int
+gnttab_copy_lock_domains(const struct gnttab_copy *op,
+                         struct gnttab_copy_buf *src,
+                         struct gnttab_copy_buf *dest)
+{
+    int rc;
 
-    rc = xsm_grant_copy(XSM_HOOK, sd, dd);
-    if ( rc )
-    {
+    rc = gnttab_copy_lock_domain(op->source.domid, src);
+    if ( rc == GNTST_okay )
+        rc = gnttab_copy_lock_domain(op->dest.domid, dest);
+    if ( rc == GNTST_okay && xsm_grant_copy(XSM_HOOK, src->domain,
+                                            dest->domain) )
         rc = GNTST_permission_denied;
-        goto error_out;
-    }
 
-    if ( src_is_gref )
+    if ( rc != GNTST_okay )
+        gnttab_copy_unlock_domains(src, dest);
+    return rc;
+}
+
+/* Pin, reference and map what BUF is to hold for this op. */
+static int
+gnttab_copy_claim_buf(struct gnttab_copy_buf *buf, bool_t is_gref,
+                      xen_pfn_t gfn)
+{
+    int rc;
+
+    buf->is_gref = is_gref;
+    buf->gfn = gfn;
+
+    if ( is_gref )
     {
-        unsigned source_off, source_len;
-        rc = __acquire_grant_for_copy(sd, op->source.u.ref,
-                                      current->domain->domain_id, 1,
-                                      &s_frame, &s_pg,
-                                      &source_off, &source_len, 1);
+        rc = __acquire_grant_for_copy(buf->domain, gfn,
+                                      current->domain->domain_id,
+                                      buf->read_only, &buf->frame, &buf->page,
+                                      &buf->start, &buf->len, 1);
         if ( rc != GNTST_okay )
-            goto error_out;
-        have_s_grant = 1;
-        if ( op->source.offset < source_off ||
-             op->len > source_len )
-            PIN_FAIL(error_out, GNTST_general_error,
-                     "copy source out of bounds: %d < %d || %d > %d\n",
-                     op->source.offset, source_off,
-                     op->len, source_len);
+            return rc;
+        buf->have_grant = 1;
     }
     else
     {
-        rc = __get_paged_frame(op->source.u.gmfn, &s_frame, &s_pg, 1, sd);
+        rc = __get_paged_frame(gfn, &buf->frame, &buf->page,
+                               buf->read_only, buf->domain);
         if ( rc != GNTST_okay )
-            PIN_FAIL(error_out, rc,
-                     "source frame %lx invalid.\n", s_frame);
+            PIN_FAIL(out, rc, "%s frame %lx invalid.\n",
+                     buf->read_only ? "source" : "destination", buf->frame);
+        buf->start = 0;
+        buf->len = PAGE_SIZE;
     }
 
-    if ( dest_is_gref )
+    if ( !buf->read_only )
     {
-        unsigned dest_off, dest_len;
-        rc = __acquire_grant_for_copy(dd, op->dest.u.ref,
-                                      current->domain->domain_id, 0,
-                                      &d_frame, &d_pg, &dest_off, &dest_len, 1);
+        if ( !get_page_type(buf->page, PGT_writable_page) )
+        {
+            if ( !buf->domain->is_dying )
+                gdprintk(XENLOG_WARNING, "Could not get dst frame %lx\n",
+                         buf->frame);
+            return GNTST_general_error;
+        }
+        buf->have_type = 1;
+    }
+
+    buf->virt = map_domain_page(buf->frame);
+
+ out:
+    return rc;
+}
+
+static bool_t
+gnttab_copy_buf_valid(const struct gnttab_copy_buf *buf, bool_t is_gref,
+                      xen_pfn_t gfn)
+{
+    return buf->virt && buf->is_gref == is_gref && buf->gfn == gfn;
+}
+
+static int
+gnttab_copy_one(const struct gnttab_copy *op, struct gnttab_copy_buf *src,
+                struct gnttab_copy_buf *dest)
+{
+    bool_t src_is_gref = !!(op->flags & GNTCOPY_source_gref);
+    bool_t dest_is_gref = !!(op->flags & GNTCOPY_dest_gref);
+    xen_pfn_t s_gfn = src_is_gref ? op->source.u.ref : op->source.u.gmfn;
+    xen_pfn_t d_gfn = dest_is_gref ? op->dest.u.ref : op->dest.u.gmfn;
+    s16 rc = GNTST_okay;
+
+    if ( ((op->source.offset + op->len) > PAGE_SIZE) ||
+         ((op->dest.offset + op->len) > PAGE_SIZE) )
+        PIN_FAIL(out, GNTST_bad_copy_arg, "copy beyond page area.\n");
+
+    if ( (op->source.domid != DOMID_SELF && !src_is_gref ) ||
+         (op->dest.domid   != DOMID_SELF && !dest_is_gref)   )
+        PIN_FAIL(out, GNTST_permission_denied,
+                 "only allow copy-by-mfn for DOMID_SELF.\n");
+
+    /* A different pair of domains drops everything held for the last one. */
+    if ( !src->domain || src->domid != op->source.domid ||
+         !dest->domain || dest->domid != op->dest.domid )
+    {
+        gnttab_copy_release_buf(src);
+        gnttab_copy_release_buf(dest);
+        gnttab_copy_unlock_domains(src, dest);
+
+        rc = gnttab_copy_lock_domains(op, src, dest);
         if ( rc != GNTST_okay )
-            goto error_out;
-        have_d_grant = 1;
-        if ( op->dest.offset < dest_off ||
-             op->len > dest_len )
-            PIN_FAIL(error_out, GNTST_general_error,
-                     "copy dest out of bounds: %d < %d || %d > %d\n",
-                     op->dest.offset, dest_off,
-                     op->len, dest_len);
+            goto out;
     }
-    else
+
+    if ( !gnttab_copy_buf_valid(src, src_is_gref, s_gfn) )
     {
-        rc = __get_paged_frame(op->dest.u.gmfn, &d_frame, &d_pg, 0, dd);
+        gnttab_copy_release_buf(src);
+        rc = gnttab_copy_claim_buf(src, src_is_gref, s_gfn);
         if ( rc != GNTST_okay )
-            PIN_FAIL(error_out, rc,
-                     "destination frame %lx invalid.\n", d_frame);
+            goto out;
     }
 
-    if ( !get_page_type(d_pg, PGT_writable_page) )
+    if ( !gnttab_copy_buf_valid(dest, dest_is_gref, d_gfn) )
     {
-        if ( !dd->is_dying )
-            gdprintk(XENLOG_WARNING, "Could not get dst frame %lx\n", d_frame);
-        rc = GNTST_general_error;
-        goto error_out;
+        gnttab_copy_release_buf(dest);
+        rc = gnttab_copy_claim_buf(dest, dest_is_gref, d_gfn);
+        if ( rc != GNTST_okay )
+            goto out;
     }
 
-    sp = map_domain_page(s_frame);
-    dp = map_domain_page(d_frame);
+    if ( op->source.offset < src->start || op->len > src->len )
+        PIN_FAIL(out, GNTST_general_error,
+                 "copy source out of bounds: %d < %d || %d > %d\n",
+                 op->source.offset, src->start, op->len, src->len);
 
-    memcpy(dp + op->dest.offset, sp + op->source.offset, op->len);
+    if ( op->dest.offset < dest->start || op->len > dest->len )
+        PIN_FAIL(out, GNTST_general_error,
+                 "copy dest out of bounds: %d < %d || %d > %d\n",
+                 op->dest.offset, dest->start, op->len, dest->len);
 
-    unmap_domain_page(dp);
-    unmap_domain_page(sp);
+    memcpy(dest->virt + op->dest.offset, src->virt + op->source.offset,
+           op->len);
 
-    gnttab_mark_dirty(dd, d_frame);
+    gnttab_mark_dirty(dest->domain, dest->frame);
 
-    put_page_type(d_pg);
- error_out:
-    if ( d_pg )
-        put_page(d_pg);
-    if ( s_pg )
-        put_page(s_pg);
-    if ( have_s_grant )
-        __release_grant_for_copy(sd, op->source.u.ref, 1);
-    if ( have_d_grant )
-        __release_grant_for_copy(dd, op->dest.u.ref, 0);
-    if ( sd )
-        rcu_unlock_domain(sd);
-    if ( dd )
-        rcu_unlock_domain(dd);
-    op->status = rc;
+ out:
+    return rc;
 }
 
 static long
 gnttab_copy(
     XEN_GUEST_HANDLE_PARAM(gnttab_copy_t) uop, unsigned int count)
 {
-    int i;
+    unsigned int i;
     struct gnttab_copy op;
+    struct gnttab_copy_buf src = { .read_only = 1 };
+    struct gnttab_copy_buf dest = { .read_only = 0 };
+    long rc = 0;
 
     for ( i = 0; i < count; i++ )
     {
-        if (i && hypercall_preempt_check())
-            return i;
+        if ( i && hypercall_preempt_check() )
+        {
+            rc = i;
+            break;
+        }
         if ( unlikely(__copy_from_guest(&op, uop, 1)) )
-            return -EFAULT;
-        __gnttab_copy(&op);
+        {
+            rc = -EFAULT;
+            break;
+        }
+
+        op.status = gnttab_copy_one(&op, &src, &dest);
+        /* Don't carry a half-claimed buffer over to the next op. */
+        if ( op.status != GNTST_okay )
+        {
+            gnttab_copy_release_buf(&src);
+            gnttab_copy_release_buf(&dest);
+        }
+
         if ( unlikely(__copy_field_to_guest(uop, &op, status)) )
-            return -EFAULT;
+        {
+            rc = -EFAULT;
+            break;
+        }
         guest_handle_add_offset(uop, 1);
     }
-    return 0;
+
+    gnttab_copy_release_buf(&src);
+    gnttab_copy_release_buf(&dest);
+    gnttab_copy_unlock_domains(&src, &dest);
+
+    return rc;
 }
 
 static long
@@ -2755,7 +2970,10 @@ gnttab_release_mappings(
                 BUG_ON(!(act->pin & GNTPIN_hstr_mask));
                 act->pin -= GNTPIN_hstr_inc;
                 if ( gnttab_release_host_mappings(d) &&
-                     !is_iomem_page(act->frame) )
+                     (map->flags & GNTMAP_superpage) )
+                    gnttab_put_superpage(act->frame, 0);
+                else if ( gnttab_release_host_mappings(d) &&
+                          !is_iomem_page(act->frame) )
                     put_page(pg);
             }
         }
@@ -2774,7 +2992,11 @@ gnttab_release_mappings(
                 BUG_ON(!(act->pin & GNTPIN_hstw_mask));
                 act->pin -= GNTPIN_hstw_inc;
                 if ( gnttab_release_host_mappings(d) &&
-                     !is_iomem_page(act->frame) )
+                     (map->flags & GNTMAP_superpage) )
+                    gnttab_put_superpage(act->frame,
+                        gnttab_host_mapping_get_page_type(map, d, rd));
+                else if ( gnttab_release_host_mappings(d) &&
+                          !is_iomem_page(act->frame) )
                 {
                     if ( gnttab_host_mapping_get_page_type(map, d, rd) )
                         put_page_type(pg);
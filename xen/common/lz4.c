@@ -0,0 +1,26 @@
+/*
+ *  lz4.c -- LZ4 block compression and decompression at run time, for tmem.
+ *
+ *  The boot time decompressor (unlz4.c) uses the same lz4_decompress().
+ */
+
+#include <xen/config.h>
+#include <xen/lib.h>
+#include <xen/types.h>
+#include <xen/lz4.h>
+
+#ifndef CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS
+#define get_unaligned(p) ({                 \
+    typeof(*(p)) v_;                        \
+    memcpy(&v_, p, sizeof(v_));             \
+    v_;                                     \
+})
+#define put_unaligned(v, p) ({              \
+    typeof(*(p)) v_ = (v);                  \
+    memcpy(p, &v_, sizeof(v_));             \
+})
+#endif
+
+#define INIT
+#include "lz4/decompress.c"
+#include "lz4/compress.c"
@@ -8,6 +8,9 @@
  * published by the Free Software Foundation.
  */
 
+#ifndef __LZ4_DEFS_H__
+#define __LZ4_DEFS_H__
+
 #ifdef __XEN__
 #include <asm/byteorder.h>
 #endif
@@ -168,3 +171,5 @@ typedef struct _U64_S { u64 v; } U64_S;
 		LZ4_WILDCOPY(s, d, e);	\
 		d = e;	\
 	} while (0)
+
+#endif /* __LZ4_DEFS_H__ */
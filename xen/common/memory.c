@@ -92,12 +92,21 @@ static void increase_reservation(struct memop_args *a)
     a->nr_done = i;
 }
 
+/*
+ * The extent list is read, and for non-translated guests written back, a
+ * batch at a time rather than one entry per extent.  Batches of superpage
+ * extents are a single extent, so preemption is checked as often as
+ * before wherever an extent is any real work.
+ */
+#define POPULATE_BATCH 64
+
 static void populate_physmap(struct memop_args *a)
 {
     struct page_info *page;
-    unsigned long i, j;
-    xen_pfn_t gpfn, mfn;
+    unsigned long i, j, k, nr = 0;
+    xen_pfn_t gpfns[POPULATE_BATCH], gpfn, mfn;
     struct domain *d = a->domain;
+    bool_t write_back = 0;
 
     if ( !guest_handle_subrange_okay(a->extent_list, a->nr_done,
                                      a->nr_extents-1) )
@@ -107,7 +116,7 @@ static void populate_physmap(struct memop_args *a)
          !multipage_allocation_permitted(current->domain, a->extent_order) )
         return;
 
-    for ( i = a->nr_done; i < a->nr_extents; i++ )
+    for ( i = a->nr_done; i < a->nr_extents; i += nr )
     {
         if ( i != a->nr_done && hypercall_preempt_check() )
         {
@@ -115,17 +124,23 @@ static void populate_physmap(struct memop_args *a)
             goto out;
         }
 
-        if ( unlikely(__copy_from_guest_offset(&gpfn, a->extent_list, i, 1)) )
+        nr = min_t(unsigned long, a->nr_extents - i,
+                   a->extent_order ? 1 : POPULATE_BATCH);
+        if ( unlikely(__copy_from_guest_offset(gpfns, a->extent_list, i, nr)) )
             goto out;
 
-        if ( a->memflags & MEMF_populate_on_demand )
-        {
-            if ( guest_physmap_mark_populate_on_demand(d, gpfn,
-                                                       a->extent_order) < 0 )
-                goto out;
-        }
-        else
+        for ( k = 0; k < nr; k++ )
         {
+            gpfn = gpfns[k];
+
+            if ( a->memflags & MEMF_populate_on_demand )
+            {
+                if ( guest_physmap_mark_populate_on_demand(d, gpfn,
+                                                           a->extent_order) < 0 )
+                    break;
+                continue;
+            }
+
             if ( is_domain_direct_mapped(d) )
             {
                 mfn = gpfn;
@@ -133,7 +148,7 @@ static void populate_physmap(struct memop_args *a)
                 {
                     gdprintk(XENLOG_INFO, "Invalid mfn %#"PRI_xen_pfn"\n",
                              mfn);
-                    goto out;
+                    break;
                 }
 
                 page = mfn_to_page(mfn);
@@ -142,7 +157,7 @@ static void populate_physmap(struct memop_args *a)
                     gdprintk(XENLOG_INFO,
                              "mfn %#"PRI_xen_pfn" doesn't belong to the"
                              " domain\n", mfn);
-                    goto out;
+                    break;
                 }
                 put_page(page);
             }
@@ -155,8 +170,8 @@ static void populate_physmap(struct memop_args *a)
                     gdprintk(XENLOG_INFO, "Could not allocate order=%d extent:"
                              " id=%d memflags=%x (%ld of %d)\n",
                              a->extent_order, d->domain_id, a->memflags,
-                             i, a->nr_extents);
-                goto out;
+                             i + k, a->nr_extents);
+                break;
             }
 
             mfn = page_to_mfn(page);
@@ -168,10 +183,20 @@ static void populate_physmap(struct memop_args *a)
                     set_gpfn_from_mfn(mfn + j, gpfn + j);
 
                 /* Inform the domain of the new page's machine address. */ 
-                if ( unlikely(__copy_to_guest_offset(a->extent_list, i, &mfn, 1)) )
-                    goto out;
+                gpfns[k] = mfn;
+                write_back = 1;
             }
         }
+
+        if ( write_back &&
+             unlikely(__copy_to_guest_offset(a->extent_list, i, gpfns, k)) )
+            goto out;
+
+        if ( k != nr )
+        {
+            i += k;
+            goto out;
+        }
     }
 
 out:
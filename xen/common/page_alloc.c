@@ -291,7 +291,7 @@ static long total_avail_pages;
 static long midsize_alloc_zone_pages;
 #define MIDSIZE_ALLOC_FRAC 128
 
-static DEFINE_SPINLOCK(heap_lock);
+static DEFINE_QUEUED_SPINLOCK(heap_lock);
 static long outstanding_claims; /* total outstanding claims by all domains */
 
 unsigned long domain_adjust_tot_pages(struct domain *d, long pages)
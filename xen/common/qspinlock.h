@@ -0,0 +1,251 @@
+/******************************************************************************
+ * qspinlock.h
+ *
+ * NUMA-aware queued spinlocks.
+ *
+ * The lock word (spinlock_tickets_t) holds a locked byte, a release count
+ * and the tail of an MCS queue of waiters.  An uncontended lock is taken
+ * with a single cmpxchg on the word.  Contending CPUs append a per-CPU
+ * queue node and spin on that, so only the waiter at the head of the queue
+ * watches the lock word, and a release touches one remote cache line.
+ *
+ * On hand-over the head of the queue prefers a waiter on its own NUMA node,
+ * parking the remote waiters it skips on a secondary queue (the compact
+ * NUMA-aware lock scheme of Dice and Kogan).  The secondary queue is put
+ * back in front after QSPIN_LOCAL_HANDOFFS local hand-overs, or as soon as
+ * no local waiter is left, so nobody starves.
+ *
+ * This file has no includes of its own: it is included by common/spinlock.c
+ * and by tools/tests/spinlock, which provide the primitives it needs
+ * (cmpxchg, read_atomic, write_atomic, smp_*mb, cpu_relax,
+ * smp_processor_id, cpu_to_node) as well as qspin_node() and qspin_depth()
+ * below.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define QSPIN_LOCKED            1U
+#define QSPIN_LOCKED_MASK       0x000000ffU
+#define QSPIN_RELEASED_MASK     0x0000ff00U
+#define QSPIN_QUEUE_SHIFT       16
+#define QSPIN_QUEUE_MASK        0xffff0000U
+
+/*
+ * One node per nesting level a CPU can be spinning at (normal, IRQ, NMI and
+ * #MC context).  Deeper nesting falls back to spinning on the lock word.
+ */
+#define QSPIN_NODES             4
+
+/* Consecutive hand-overs within a node before remote waiters get a turn. */
+#define QSPIN_LOCAL_HANDOFFS    64
+
+#define QSPIN_ONCE(x)           (*(volatile typeof(x) *)&(x))
+
+struct qspin_node {
+    struct qspin_node *next;            /* main queue */
+    struct qspin_node *sec_head;        /* secondary queue, passed on */
+    struct qspin_node *sec_tail;        /*   with the head of the queue */
+    unsigned int handoffs;              /* local hand-overs so far */
+    unsigned int node;                  /* NUMA node of the waiter */
+    u16 tail;                           /* our encoding in the lock word */
+    u8 locked;                          /* we are the head of the queue */
+};
+
+/* Queue node IDX of CPU, and the current CPU's nesting depth. */
+static struct qspin_node *qspin_node(unsigned int cpu, unsigned int idx);
+static unsigned int *qspin_depth(void);
+
+static inline u16 qspin_encode(unsigned int cpu, unsigned int idx)
+{
+    return ((cpu + 1) << 2) | idx;
+}
+
+static inline struct qspin_node *qspin_decode(u16 tail)
+{
+    return qspin_node((tail >> 2) - 1, tail & 3);
+}
+
+static inline int queued_spin_is_locked(spinlock_tickets_t *t)
+{
+    return !!(read_atomic(&t->head_tail) &
+              (QSPIN_LOCKED_MASK | QSPIN_QUEUE_MASK));
+}
+
+/* Only succeeds if nobody holds the lock or is queued for it. */
+static inline int queued_spin_trylock(spinlock_tickets_t *t)
+{
+    u32 old = read_atomic(&t->head_tail);
+
+    if ( old & (QSPIN_LOCKED_MASK | QSPIN_QUEUE_MASK) )
+        return 0;
+    return cmpxchg(&t->head_tail, old, old | QSPIN_LOCKED) == old;
+}
+
+static inline void queued_spin_unlock(spinlock_tickets_t *t)
+{
+    smp_mb();
+    /*
+     * Only the holder writes the low half.  Waiters update the queue with
+     * cmpxchg on the whole word, which is atomic against this store.
+     */
+    write_atomic(&t->head, (u16)((t->released + 1) << 8));
+}
+
+/* Wait until the lock is (or was, at some point) free. */
+static inline void queued_spin_barrier(spinlock_tickets_t *t)
+{
+    spinlock_tickets_t sample;
+
+    sample.head_tail = read_atomic(&t->head_tail);
+    if ( !sample.locked )
+        return;
+    while ( QSPIN_ONCE(t->released) == sample.released )
+        cpu_relax();
+}
+
+/*
+ * Pick who gets the lock after NODE, NEXT being NODE's successor in the main
+ * queue, and hand NODE's secondary queue on to it.
+ */
+static struct qspin_node *qspin_pick(struct qspin_node *node,
+                                     struct qspin_node *next)
+{
+    struct qspin_node *n, *last = NULL;
+
+    if ( node->handoffs < QSPIN_LOCAL_HANDOFFS )
+    {
+        for ( n = next; n && n->node != node->node; n = QSPIN_ONCE(n->next) )
+            last = n;
+
+        if ( n )
+        {
+            /* Park next..last, which are all remote, on the secondary queue. */
+            if ( last )
+            {
+                last->next = NULL;
+                if ( node->sec_tail )
+                    node->sec_tail->next = next;
+                else
+                    node->sec_head = next;
+                node->sec_tail = last;
+            }
+            n->sec_head = node->sec_head;
+            n->sec_tail = node->sec_tail;
+            n->handoffs = node->handoffs + 1;
+            return n;
+        }
+    }
+
+    /* No local waiter, or remote ones have waited long enough. */
+    if ( node->sec_head )
+    {
+        node->sec_tail->next = next;
+        next = node->sec_head;
+    }
+    next->sec_head = next->sec_tail = NULL;
+    next->handoffs = 0;
+    return next;
+}
+
+static void queued_spin_lock_slow(spinlock_tickets_t *t)
+{
+    unsigned int cpu = smp_processor_id();
+    unsigned int *depth = qspin_depth();
+    unsigned int idx = (*depth)++;
+    struct qspin_node *node, *next;
+    u32 old, new;
+
+    barrier();
+
+    if ( idx >= QSPIN_NODES )
+    {
+        while ( !queued_spin_trylock(t) )
+            cpu_relax();
+        goto out;
+    }
+
+    node = qspin_node(cpu, idx);
+    node->next = NULL;
+    node->sec_head = node->sec_tail = NULL;
+    node->handoffs = 0;
+    node->node = cpu_to_node(cpu);
+    node->tail = qspin_encode(cpu, idx);
+    node->locked = 0;
+
+    /* Make the node visible before linking it in. */
+    smp_wmb();
+
+    do {
+        old = read_atomic(&t->head_tail);
+        new = (old & ~QSPIN_QUEUE_MASK) |
+              ((u32)node->tail << QSPIN_QUEUE_SHIFT);
+    } while ( cmpxchg(&t->head_tail, old, new) != old );
+
+    if ( old & QSPIN_QUEUE_MASK )
+    {
+        QSPIN_ONCE(qspin_decode(old >> QSPIN_QUEUE_SHIFT)->next) = node;
+        while ( !QSPIN_ONCE(node->locked) )
+            cpu_relax();
+        /* Pairs with the smp_wmb() before our predecessor set ->locked. */
+        smp_rmb();
+    }
+
+    /* Head of the queue: wait for the holder to release the lock. */
+    for ( ; ; )
+    {
+        old = read_atomic(&t->head_tail);
+        if ( old & QSPIN_LOCKED_MASK )
+        {
+            cpu_relax();
+            continue;
+        }
+
+        if ( (old >> QSPIN_QUEUE_SHIFT) == node->tail )
+        {
+            /*
+             * Nobody behind us: take the lock and leave the queue, which
+             * then consists of the secondary queue, if any.
+             */
+            new = (old & QSPIN_RELEASED_MASK) | QSPIN_LOCKED;
+            if ( node->sec_tail )
+                new |= (u32)node->sec_tail->tail << QSPIN_QUEUE_SHIFT;
+            if ( cmpxchg(&t->head_tail, old, new) != old )
+                continue;
+            if ( !node->sec_head )
+                goto out;
+            next = node->sec_head;
+            next->sec_head = next->sec_tail = NULL;
+            next->handoffs = 0;
+            goto handoff;
+        }
+
+        /* Others are queued, so no one but us can take the lock now. */
+        if ( cmpxchg(&t->head_tail, old, old | QSPIN_LOCKED) == old )
+            break;
+    }
+
+    /* Our successor may not have linked itself in yet. */
+    while ( !(next = QSPIN_ONCE(node->next)) )
+        cpu_relax();
+    next = qspin_pick(node, next);
+
+ handoff:
+    smp_wmb();
+    QSPIN_ONCE(next->locked) = 1;
+
+ out:
+    barrier();
+    (*depth)--;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -9,6 +9,7 @@
 
 #include <xen/sched.h>
 #include <xen/errno.h>
+#include <xen/init.h>
 #include <xen/rangeset.h>
 #include <xsm/xsm.h>
 
@@ -37,6 +38,16 @@ struct rangeset {
     unsigned int     flags;
 };
 
+/* Ranges come and go at a high rate (I/O port and MMIO permissions). */
+static struct xmem_cache *range_cache;
+
+static int __init rangeset_cache_init(void)
+{
+    range_cache = xmem_cache_create_type("rangeset", struct range);
+    return 0;
+}
+presmp_initcall(rangeset_cache_init);
+
 /*****************************
  * Private range functions hide the underlying linked-list implemnetation.
  */
@@ -89,7 +100,10 @@ static void destroy_range(
     r->nr_ranges++;
 
     list_del(&x->list);
-    xfree(x);
+    if ( range_cache )
+        xmem_cache_free(range_cache, x);
+    else
+        xfree(x);
 }
 
 /* Allocate a new range */
@@ -101,7 +115,8 @@ static struct range *alloc_range(
     if ( r->nr_ranges == 0 )
         return NULL;
 
-    x = xmalloc(struct range);
+    /* Rangesets set up early in boot predate the cache. */
+    x = range_cache ? xmem_cache_alloc(range_cache) : xmalloc(struct range);
     if ( x )
         --r->nr_ranges;
 
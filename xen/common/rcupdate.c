@@ -45,6 +45,24 @@
 #include <xen/softirq.h>
 #include <xen/cpu.h>
 #include <xen/stop_machine.h>
+#include <xen/tasklet.h>
+#include <xen/keyhandler.h>
+#include <xen/nodemask.h>
+#include <xen/numa.h>
+#include <xen/time.h>
+
+/*
+ * Quiescent states are tracked in a two level tree: each NUMA node has a
+ * struct rcu_node with the mask of its CPUs still to pass through a
+ * quiescent state, and the root (rcu_ctrlblk) only has the mask of nodes
+ * with such CPUs left.  CPUs therefore only contend on their node's lock,
+ * and the last CPU of a node to report takes the root lock once for all
+ * of them.
+ *
+ * Idle CPUs are in an extended quiescent state: they are left out of new
+ * grace periods and report for the current one when going idle, so that
+ * they are neither woken nor waited for.
+ */
 
 /* Global control variables for rcupdate callback mechanism. */
 static struct rcu_ctrlblk {
@@ -53,14 +71,45 @@ static struct rcu_ctrlblk {
     int  next_pending;  /* Is the next batch already waiting?         */
 
     spinlock_t  lock __cacheline_aligned;
-    cpumask_t   cpumask; /* CPUs that need to switch in order    */
-    /* for current batch to proceed.        */
+    nodemask_t  nodemask; /* nodes with CPUs that need to switch in    */
+                          /* order for current batch to proceed.       */
+    nodemask_t  cpu_nodes; /* nodes which have (had) CPUs              */
+
+    cpumask_t   idle_cpumask __cacheline_aligned; /* in rcu_idle_enter() */
+    cpumask_t   idle_cb_cpumask; /* ... with callbacks waiting for a batch */
+
+    /* Grace period statistics, under lock. */
+    s_time_t    gp_start;
+    s_time_t    gp_last, gp_max, gp_total;
+    unsigned long nr_gps;
 } __cacheline_aligned rcu_ctrlblk = {
     .cur = -300,
     .completed = -300,
     .lock = SPIN_LOCK_UNLOCKED,
 };
 
+struct rcu_node {
+    spinlock_t lock;
+    long       gpnum;        /* Batch cpumask is for                   */
+    cpumask_t  cpumask;      /* CPUs yet to pass a quiescent state     */
+    cpumask_t  cpus;         /* CPUs of the node, online or coming up  */
+
+    /*
+     * Completed callbacks handed over by the node's CPUs, to be invoked
+     * by cb_tasklet on another (preferably idle) CPU of the node.
+     */
+    spinlock_t cb_lock __cacheline_aligned;
+    struct rcu_head *cblist;
+    struct rcu_head **cbtail;
+    long       cblen;
+    bool_t     cb_busy;      /* cb_tasklet is invoking callbacks       */
+    unsigned int cb_cpu;     /* CPU cb_tasklet was last scheduled on   */
+    unsigned long cb_invoked;
+    struct tasklet cb_tasklet;
+} __cacheline_aligned;
+
+static struct rcu_node rcu_nodes[MAX_NUMNODES];
+
 /*
  * Per-CPU data for Read-Copy Update.
  * nxtlist - new callbacks are added here
@@ -76,14 +125,17 @@ struct rcu_data {
     struct rcu_head *nxtlist;
     struct rcu_head **nxttail;
     long            qlen;             /* # of queued callbacks */
+    long            nxtlen, curlen, donelen; /* ... on each list */
     struct rcu_head *curlist;
     struct rcu_head **curtail;
     struct rcu_head *donelist;
     struct rcu_head **donetail;
     long            blimit;           /* Upper limit on a processed batch */
     int cpu;
+    unsigned int node;                /* rcu_nodes[] entry of the cpu */
     struct rcu_head barrier;
     long            last_rs_qlen;     /* qlen during the last resched */
+    unsigned long   invoked;          /* callbacks invoked on this cpu */
 };
 
 static DEFINE_PER_CPU(struct rcu_data, rcu_data);
@@ -93,6 +145,13 @@ static int qhimark = 10000;
 static int qlowmark = 100;
 static int rsinterval = 1000;
 
+/*
+ * Completed batches of more than this many callbacks are invoked by a
+ * worker of the node rather than by the CPU which queued them (0: never).
+ */
+static unsigned int __read_mostly rcu_offload = 1000;
+integer_param("rcu_offload", rcu_offload);
+
 struct rcu_barrier_data {
     struct rcu_head head;
     atomic_t *cpu_count;
@@ -116,6 +175,8 @@ static int rcu_barrier_action(void *_cpu_count)
      * When callback is executed, all previously-queued RCU work on this CPU
      * is completed. When all CPUs have executed their callback, data.cpu_count
      * will have been incremented to include every online CPU.
+     * Offloaded callbacks are invoked in order from a softirq tasklet, which
+     * process_pending_softirqs() below runs too.
      */
     call_rcu(&data.head, rcu_barrier_callback);
 
@@ -152,14 +213,20 @@ static void force_quiescent_state(struct rcu_data *rdp,
                                   struct rcu_ctrlblk *rcp)
 {
     cpumask_t cpumask;
+    unsigned int node;
+
     raise_softirq(SCHEDULE_SOFTIRQ);
     if (unlikely(rdp->qlen - rdp->last_rs_qlen > rsinterval)) {
         rdp->last_rs_qlen = rdp->qlen;
         /*
          * Don't send IPI to itself. With irqs disabled,
-         * rdp->cpu is the current cpu.
+         * rdp->cpu is the current cpu.  The masks are read unlocked: at
+         * worst a CPU which just reported gets a needless IPI.
          */
-        cpumask_andnot(&cpumask, &rcp->cpumask, cpumask_of(rdp->cpu));
+        cpumask_clear(&cpumask);
+        for_each_node_mask ( node, rcp->nodemask )
+            cpumask_or(&cpumask, &cpumask, &rcu_nodes[node].cpumask);
+        cpumask_clear_cpu(rdp->cpu, &cpumask);
         cpumask_raise_softirq(&cpumask, SCHEDULE_SOFTIRQ);
     }
 }
@@ -187,6 +254,7 @@ void call_rcu(struct rcu_head *head,
     rdp = &__get_cpu_var(rcu_data);
     *rdp->nxttail = head;
     rdp->nxttail = &head->next;
+    rdp->nxtlen++;
     if (unlikely(++rdp->qlen > qhimark)) {
         rdp->blimit = INT_MAX;
         force_quiescent_state(rdp, &rcu_ctrlblk);
@@ -194,6 +262,102 @@ void call_rcu(struct rcu_head *head,
     local_irq_restore(flags);
 }
 
+/*
+ * Offloading of completed callbacks.  A node's worker is a softirq tasklet,
+ * so that callbacks still run in the same context as when invoked from
+ * RCU_SOFTIRQ.  It is scheduled on an idle CPU of the node when there is
+ * one: that CPU had nothing better to do, and remains on the node whose
+ * memory the callbacks are most likely to free.
+ */
+static void rcu_offload_kick(struct rcu_node *rnp)
+{
+    unsigned int cpu = rnp->cb_cpu, i, n = cpumask_weight(&rnp->cpus);
+
+    for ( i = 0; i < n; i++ )
+    {
+        cpu = cpumask_cycle(cpu, &rnp->cpus);
+        if ( cpu != smp_processor_id() && cpu_online(cpu) &&
+             cpumask_test_cpu(cpu, &rcu_ctrlblk.idle_cpumask) )
+            break;
+    }
+    if ( i == n )
+        cpu = smp_processor_id();
+    rnp->cb_cpu = cpu;
+    tasklet_schedule_on_cpu(&rnp->cb_tasklet, cpu);
+}
+
+static void rcu_offload_work(unsigned long node)
+{
+    struct rcu_node *rnp = &rcu_nodes[node];
+    struct rcu_head *list, *next, **tail;
+    int count;
+
+    /* Take up to blimit callbacks at a time, not to hog the CPU. */
+    spin_lock(&rnp->cb_lock);
+    list = rnp->cblist;
+    for ( tail = &rnp->cblist, count = 0; *tail && count < blimit; count++ )
+        tail = &(*tail)->next;
+    rnp->cblist = *tail;
+    *tail = NULL;
+    if ( !rnp->cblist )
+        rnp->cbtail = &rnp->cblist;
+    rnp->cblen -= count;
+    rnp->cb_busy = 1;
+    spin_unlock(&rnp->cb_lock);
+
+    for ( ; list; list = next )
+    {
+        next = list->next;
+        list->func(list);
+    }
+
+    spin_lock(&rnp->cb_lock);
+    rnp->cb_busy = 0;
+    rnp->cb_invoked += count;
+    if ( rnp->cblist )
+        tasklet_schedule(&rnp->cb_tasklet);
+    spin_unlock(&rnp->cb_lock);
+}
+
+/*
+ * Hand the completed callbacks of rdp to its node's worker if there are
+ * many of them, or if earlier ones are still queued there: callbacks of a
+ * CPU must be invoked in order, for rcu_barrier().
+ */
+static int rcu_offload_batch(struct rcu_data *rdp)
+{
+    struct rcu_node *rnp = &rcu_nodes[rdp->node];
+    bool_t kick;
+
+    if ( !rcu_offload ||
+         (rdp->donelen <= rcu_offload && !read_atomic(&rnp->cblen) &&
+          !read_atomic(&rnp->cb_busy)) )
+        return 0;
+
+    spin_lock(&rnp->cb_lock);
+    if ( rdp->donelen <= rcu_offload && !rnp->cblen && !rnp->cb_busy )
+    {
+        spin_unlock(&rnp->cb_lock);
+        return 0;
+    }
+    kick = !rnp->cblen && !rnp->cb_busy;
+    *rnp->cbtail = rdp->donelist;
+    rnp->cbtail = rdp->donetail;
+    rnp->cblen += rdp->donelen;
+    if ( kick )
+        rcu_offload_kick(rnp);
+    spin_unlock(&rnp->cb_lock);
+
+    local_irq_disable();
+    rdp->qlen -= rdp->donelen;
+    local_irq_enable();
+    rdp->donelen = 0;
+    rdp->donelist = NULL;
+    rdp->donetail = &rdp->donelist;
+
+    return 1;
+}
+
 /*
  * Invoke the completed RCU callbacks. They are expected to be in
  * a per-cpu list.
@@ -203,15 +367,20 @@ static void rcu_do_batch(struct rcu_data *rdp)
     struct rcu_head *next, *list;
     int count = 0;
 
+    if ( rcu_offload_batch(rdp) )
+        return;
+
     list = rdp->donelist;
     while (list) {
         next = rdp->donelist = list->next;
         list->func(list);
         list = next;
         rdp->qlen--;
+        rdp->donelen--;
         if (++count >= rdp->blimit)
             break;
     }
+    rdp->invoked += count;
     if (rdp->blimit == INT_MAX && rdp->qlen <= qlowmark)
         rdp->blimit = blimit;
     if (!rdp->donelist)
@@ -226,16 +395,17 @@ static void rcu_do_batch(struct rcu_data *rdp)
  * - A new grace period is started.
  *   This is done by rcu_start_batch. The start is not broadcasted to
  *   all cpus, they must pick this up by comparing rcp->cur with
- *   rdp->quiescbatch. All cpus are recorded  in the
- *   rcu_ctrlblk.cpumask bitmap.
+ *   rdp->quiescbatch. All non-idle cpus are recorded in the cpumask of
+ *   their node, and the nodes in rcu_ctrlblk.nodemask.
  * - All cpus must go through a quiescent state.
  *   Since the start of the grace period is not broadcasted, at least two
  *   calls to rcu_check_quiescent_state are required:
  *   The first call just notices that a new grace period is running. The
  *   following calls check if there was a quiescent state since the beginning
- *   of the grace period. If so, it updates rcu_ctrlblk.cpumask. If
- *   the bitmap is empty, then the grace period is completed.
- *   rcu_check_quiescent_state calls rcu_start_batch(0) to start the next grace
+ *   of the grace period. If so, it updates the cpumask of its node, and the
+ *   last cpu of the node updates rcu_ctrlblk.nodemask. If that is empty,
+ *   then the grace period is completed.
+ *   rcu_report_qs calls rcu_start_batch(0) to start the next grace
  *   period (if necessary).
  */
 /*
@@ -243,35 +413,113 @@ static void rcu_do_batch(struct rcu_data *rdp)
  * active batch and the batch to be registered has not already occurred.
  * Caller must hold rcu_ctrlblk.lock.
  */
+static void rcu_end_batch(struct rcu_ctrlblk *rcp);
+
 static void rcu_start_batch(struct rcu_ctrlblk *rcp)
 {
+    struct rcu_node *rnp;
+    unsigned int node;
+
     if (rcp->next_pending &&
         rcp->completed == rcp->cur) {
         rcp->next_pending = 0;
+
+        /*
+         * Fill in the node masks.  A CPU going idle sets its bit in
+         * idle_cpumask and then checks its node's mask unlocked, while
+         * this sets the node mask and then checks idle_cpumask: with a
+         * barrier on both sides, at least one of them sees the other's
+         * update, so an idle CPU is never waited for.  Stale reports for
+         * the previous batch are told apart by gpnum.
+         */
+        for_each_node_mask ( node, rcp->cpu_nodes )
+        {
+            rnp = &rcu_nodes[node];
+            spin_lock(&rnp->lock);
+            rnp->gpnum = rcp->cur + 1;
+            cpumask_and(&rnp->cpumask, &rnp->cpus, &cpu_online_map);
+            smp_mb();
+            cpumask_andnot(&rnp->cpumask, &rnp->cpumask, &rcp->idle_cpumask);
+            if ( !cpumask_empty(&rnp->cpumask) )
+                node_set(node, rcp->nodemask);
+            spin_unlock(&rnp->lock);
+        }
+
         /*
          * next_pending == 0 must be visible in
          * __rcu_process_callbacks() before it can see new value of cur.
          */
         smp_wmb();
         rcp->cur++;
+        rcp->gp_start = NOW();
 
-        cpumask_copy(&rcp->cpumask, &cpu_online_map);
+        /* Every CPU is idle: nothing to wait for. */
+        if ( nodes_empty(rcp->nodemask) )
+            rcu_end_batch(rcp);
     }
 }
 
+/* Called with rcu_ctrlblk.lock held, when the last node reported. */
+static void rcu_end_batch(struct rcu_ctrlblk *rcp)
+{
+    s_time_t gp = NOW() - rcp->gp_start;
+
+    /* batch completed ! */
+    rcp->completed = rcp->cur;
+    rcp->gp_last = gp;
+    rcp->gp_total += gp;
+    if ( gp > rcp->gp_max )
+        rcp->gp_max = gp;
+    rcp->nr_gps++;
+
+    /* Idle cpus don't notice on their own that their batch completed. */
+    if ( !cpumask_empty(&rcp->idle_cb_cpumask) )
+        cpumask_raise_softirq(&rcp->idle_cb_cpumask, RCU_SOFTIRQ);
+
+    rcu_start_batch(rcp);
+}
+
 /*
- * cpu went through a quiescent state since the beginning of the grace period.
- * Clear it from the cpu mask and complete the grace period if it was the last
- * cpu. Start another grace period if someone has further entries pending
+ * cpu went through a quiescent state since the beginning of grace period
+ * gp (any grace period waiting for it, if any_gp).  Clear it from its
+ * node's mask and, if it was the last cpu of the node, clear the node and
+ * complete the grace period if it was the last node.  Start another grace
+ * period if someone has further entries pending.
  */
-static void cpu_quiet(int cpu, struct rcu_ctrlblk *rcp)
+static void rcu_report_qs(struct rcu_ctrlblk *rcp, unsigned int cpu,
+                          long gp, bool_t any_gp)
 {
-    cpumask_clear_cpu(cpu, &rcp->cpumask);
-    if (cpumask_empty(&rcp->cpumask)) {
-        /* batch completed ! */
-        rcp->completed = rcp->cur;
-        rcu_start_batch(rcp);
+    unsigned int node = per_cpu(rcu_data, cpu).node;
+    struct rcu_node *rnp = &rcu_nodes[node];
+    bool_t last;
+
+    spin_lock(&rnp->lock);
+    if ( any_gp )
+        gp = rnp->gpnum;
+    /*
+     * rdp->quiescbatch/rcp->cur and the cpu masks can come out of sync
+     * during cpu startup, or when the cpu was idle at the start of the
+     * grace period. Ignore the quiescent state then.
+     */
+    if ( rnp->gpnum != gp || !cpumask_test_cpu(cpu, &rnp->cpumask) )
+    {
+        spin_unlock(&rnp->lock);
+        return;
     }
+    cpumask_clear_cpu(cpu, &rnp->cpumask);
+    last = cpumask_empty(&rnp->cpumask);
+    spin_unlock(&rnp->lock);
+
+    if ( !last )
+        return;
+
+    /* No new batch can start before we cleared the node, so cur is gp. */
+    spin_lock(&rcp->lock);
+    ASSERT(rcp->cur == gp);
+    node_clear(node, rcp->nodemask);
+    if ( nodes_empty(rcp->nodemask) )
+        rcu_end_batch(rcp);
+    spin_unlock(&rcp->lock);
 }
 
 /*
@@ -298,15 +546,7 @@ static void rcu_check_quiescent_state(struct rcu_ctrlblk *rcp,
 
     rdp->qs_pending = 0;
 
-    spin_lock(&rcp->lock);
-    /*
-     * rdp->quiescbatch/rcp->cur and the cpu bitmap can come out of sync
-     * during cpu startup. Ignore the quiescent state.
-     */
-    if (likely(rdp->quiescbatch == rcp->cur))
-        cpu_quiet(rdp->cpu, rcp);
-
-    spin_unlock(&rcp->lock);
+    rcu_report_qs(rcp, rdp->cpu, rdp->quiescbatch, 0);
 }
 
 
@@ -319,16 +559,20 @@ static void __rcu_process_callbacks(struct rcu_ctrlblk *rcp,
     if (rdp->curlist && !rcu_batch_before(rcp->completed, rdp->batch)) {
         *rdp->donetail = rdp->curlist;
         rdp->donetail = rdp->curtail;
+        rdp->donelen += rdp->curlen;
         rdp->curlist = NULL;
         rdp->curtail = &rdp->curlist;
+        rdp->curlen = 0;
     }
 
     local_irq_disable();
     if (rdp->nxtlist && !rdp->curlist) {
         rdp->curlist = rdp->nxtlist;
         rdp->curtail = rdp->nxttail;
+        rdp->curlen = rdp->nxtlen;
         rdp->nxtlist = NULL;
         rdp->nxttail = &rdp->nxtlist;
+        rdp->nxtlen = 0;
         local_irq_enable();
 
         /*
@@ -409,13 +653,50 @@ void rcu_check_callbacks(int cpu)
     raise_softirq(RCU_SOFTIRQ);
 }
 
+/*
+ * The idle loop calls these around putting the cpu to sleep, with
+ * interrupts enabled and outside of any RCU read-side critical section.
+ * A cpu with callbacks of its own still waiting gets woken (through
+ * RCU_SOFTIRQ) whenever a grace period completes.
+ */
+void rcu_idle_enter(unsigned int cpu)
+{
+    struct rcu_ctrlblk *rcp = &rcu_ctrlblk;
+
+    ASSERT(!cpumask_test_cpu(cpu, &rcp->idle_cpumask));
+    cpumask_set_cpu(cpu, &rcp->idle_cpumask);
+    if ( rcu_needs_cpu(cpu) )
+        cpumask_set_cpu(cpu, &rcp->idle_cb_cpumask);
+    /* Pairs with the barrier in rcu_start_batch(). */
+    smp_mb();
+
+    /* Don't hold up the current grace period either. */
+    if ( cpumask_test_cpu(cpu, &rcu_nodes[this_cpu(rcu_data).node].cpumask) )
+        rcu_report_qs(rcp, cpu, 0, 1);
+}
+
+void rcu_idle_exit(unsigned int cpu)
+{
+    struct rcu_ctrlblk *rcp = &rcu_ctrlblk;
+
+    ASSERT(cpumask_test_cpu(cpu, &rcp->idle_cpumask));
+    cpumask_clear_cpu(cpu, &rcp->idle_cb_cpumask);
+    cpumask_clear_cpu(cpu, &rcp->idle_cpumask);
+    /*
+     * Grace periods which started while we were idle don't wait for us:
+     * order our subsequent reads after their start.
+     */
+    smp_mb();
+}
+
 static void rcu_move_batch(struct rcu_data *this_rdp, struct rcu_head *list,
-                           struct rcu_head **tail)
+                           struct rcu_head **tail, long len)
 {
     local_irq_disable();
     *this_rdp->nxttail = list;
     if (list)
         this_rdp->nxttail = tail;
+    this_rdp->nxtlen += len;
     local_irq_enable();
 }
 
@@ -425,20 +706,27 @@ static void rcu_offline_cpu(struct rcu_data *this_rdp,
     /* If the cpu going offline owns the grace period we can block
      * indefinitely waiting for it, so flush it here.
      */
-    spin_lock(&rcp->lock);
-    if (rcp->cur != rcp->completed)
-        cpu_quiet(rdp->cpu, rcp);
-    spin_unlock(&rcp->lock);
+    rcu_report_qs(rcp, rdp->cpu, 0, 1);
+    cpumask_clear_cpu(rdp->cpu, &rcu_nodes[rdp->node].cpus);
+    cpumask_clear_cpu(rdp->cpu, &rcp->idle_cb_cpumask);
+    cpumask_clear_cpu(rdp->cpu, &rcp->idle_cpumask);
 
-    rcu_move_batch(this_rdp, rdp->donelist, rdp->donetail);
-    rcu_move_batch(this_rdp, rdp->curlist, rdp->curtail);
-    rcu_move_batch(this_rdp, rdp->nxtlist, rdp->nxttail);
+    rcu_move_batch(this_rdp, rdp->donelist, rdp->donetail, rdp->donelen);
+    rcu_move_batch(this_rdp, rdp->curlist, rdp->curtail, rdp->curlen);
+    rcu_move_batch(this_rdp, rdp->nxtlist, rdp->nxttail, rdp->nxtlen);
 
     local_irq_disable();
     this_rdp->qlen += rdp->qlen;
     local_irq_enable();
 }
 
+static unsigned int rcu_cpu_node(unsigned int cpu)
+{
+    unsigned int node = cpu_to_node(cpu);
+
+    return node < MAX_NUMNODES ? node : 0;
+}
+
 static void rcu_init_percpu_data(int cpu, struct rcu_ctrlblk *rcp,
                                  struct rcu_data *rdp)
 {
@@ -449,7 +737,13 @@ static void rcu_init_percpu_data(int cpu, struct rcu_ctrlblk *rcp,
     rdp->quiescbatch = rcp->completed;
     rdp->qs_pending = 0;
     rdp->cpu = cpu;
+    rdp->node = rcu_cpu_node(cpu);
     rdp->blimit = blimit;
+
+    cpumask_set_cpu(cpu, &rcu_nodes[rdp->node].cpus);
+    spin_lock(&rcp->lock);
+    node_set(rdp->node, rcp->cpu_nodes);
+    spin_unlock(&rcp->lock);
 }
 
 static int cpu_callback(
@@ -478,10 +772,77 @@ static struct notifier_block cpu_nfb = {
     .notifier_call = cpu_callback
 };
 
+static void rcu_dump_stats(unsigned char key)
+{
+    struct rcu_ctrlblk *rcp = &rcu_ctrlblk;
+    unsigned long invoked = 0, nr_gps;
+    s_time_t last, max, total;
+    long cur, completed;
+    unsigned int cpu, node;
+
+    spin_lock(&rcp->lock);
+    cur = rcp->cur;
+    completed = rcp->completed;
+    nr_gps = rcp->nr_gps;
+    last = rcp->gp_last;
+    max = rcp->gp_max;
+    total = rcp->gp_total;
+    spin_unlock(&rcp->lock);
+
+    printk("RCU: batch %ld, completed %ld, %lu grace periods\n",
+           cur, completed, nr_gps);
+    printk("  grace period last %"PRI_stime"us, avg %"PRI_stime"us, "
+           "max %"PRI_stime"us\n", last / 1000,
+           nr_gps ? total / nr_gps / 1000 : 0, max / 1000);
+    if ( cur != completed )
+        printk("  current one running for %"PRI_stime"us\n",
+               (NOW() - rcp->gp_start) / 1000);
+    printk("  idle cpus %u (%u with callbacks)\n",
+           cpumask_weight(&rcp->idle_cpumask),
+           cpumask_weight(&rcp->idle_cb_cpumask));
+
+    for_each_node_mask ( node, rcp->cpu_nodes )
+    {
+        struct rcu_node *rnp = &rcu_nodes[node];
+        long qlen = 0;
+
+        for_each_cpu ( cpu, &rnp->cpus )
+        {
+            qlen += per_cpu(rcu_data, cpu).qlen;
+            invoked += per_cpu(rcu_data, cpu).invoked;
+        }
+        printk("  node %u: %u cpus, %u awaited, %ld queued, "
+               "%ld offloaded, %lu invoked offloaded\n",
+               node, cpumask_weight(&rnp->cpus),
+               node_isset(node, rcp->nodemask) ?
+               cpumask_weight(&rnp->cpumask) : 0,
+               qlen, rnp->cblen, rnp->cb_invoked);
+    }
+    printk("  %lu callbacks invoked by queueing cpus\n", invoked);
+}
+
+static struct keyhandler rcu_stats_keyhandler = {
+    .diagnostic = 1,
+    .u.fn = rcu_dump_stats,
+    .desc = "dump RCU grace period and callback statistics"
+};
+
 void __init rcu_init(void)
 {
     void *cpu = (void *)(long)smp_processor_id();
+    unsigned int node;
+
+    for ( node = 0; node < MAX_NUMNODES; node++ )
+    {
+        spin_lock_init(&rcu_nodes[node].lock);
+        spin_lock_init(&rcu_nodes[node].cb_lock);
+        rcu_nodes[node].cbtail = &rcu_nodes[node].cblist;
+        softirq_tasklet_init(&rcu_nodes[node].cb_tasklet,
+                             rcu_offload_work, node);
+    }
+
     cpu_callback(&cpu_nfb, CPU_UP_PREPARE, cpu);
     register_cpu_notifier(&cpu_nfb);
     open_softirq(RCU_SOFTIRQ, rcu_process_callbacks);
+    register_keyhandler('G', &rcu_stats_keyhandler);
 }
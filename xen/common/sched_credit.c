@@ -206,6 +206,7 @@ struct csched_private {
     struct list_head active_sdom;
     uint32_t ncpus;
     struct timer  master_ticker;
+    bool_t master_ticker_live;
     unsigned int master;
     cpumask_var_t idlers;
     cpumask_var_t cpus;
@@ -481,7 +482,10 @@ csched_free_pdata(const struct scheduler *ops, void *pcpu, int cpu)
     }
     kill_timer(&spc->ticker);
     if ( prv->ncpus == 0 )
+    {
         kill_timer(&prv->master_ticker);
+        prv->master_ticker_live = 0;
+    }
 
     spin_unlock_irqrestore(&prv->lock, flags);
 
@@ -517,12 +521,15 @@ csched_alloc_pdata(const struct scheduler *ops, int cpu)
     {
         prv->master = cpu;
         init_timer(&prv->master_ticker, csched_acct, prv, cpu);
-        set_timer(&prv->master_ticker,
-                  NOW() + MILLISECS(prv->tslice_ms));
+        prv->master_ticker_live = 0;
     }
 
+    /*
+     * The ticker is only armed while a non-idle VCPU runs on this PCPU
+     * (see csched_schedule()), so an idling PCPU takes no periodic
+     * interrupts on behalf of the scheduler.
+     */
     init_timer(&spc->ticker, csched_tick, (void *)(unsigned long)cpu, cpu);
-    set_timer(&spc->ticker, NOW() + MICROSECS(prv->tick_period_us) );
 
     INIT_LIST_HEAD(&spc->runq);
     spc->runq_sort_last = prv->runq_sort;
@@ -782,6 +789,17 @@ __csched_vcpu_acct_start(struct csched_private *prv, struct csched_vcpu *svc)
         {
             list_add(&sdom->active_sdom_elem, &prv->active_sdom);
         }
+
+        /*
+         * The accounting master stops when there is nothing to account
+         * for. Restart it now that someone is competing for credits.
+         */
+        if ( !prv->master_ticker_live )
+        {
+            prv->master_ticker_live = 1;
+            set_timer(&prv->master_ticker,
+                      NOW() + MILLISECS(prv->tslice_ms));
+        }
     }
 
     TRACE_3D(TRC_CSCHED_ACCOUNT_START, sdom->dom->domain_id,
@@ -819,6 +837,8 @@ csched_vcpu_acct(struct csched_private *prv, unsigned int cpu)
 {
     struct csched_vcpu * const svc = CSCHED_VCPU(current);
     const struct scheduler *ops = per_cpu(scheduler, cpu);
+    spinlock_t *lock;
+    unsigned long flags;
 
     ASSERT( current->processor == cpu );
     ASSERT( svc->sdom != NULL );
@@ -832,10 +852,15 @@ csched_vcpu_acct(struct csched_private *prv, unsigned int cpu)
         svc->pri = CSCHED_PRI_TS_UNDER;
 
     /*
-     * Update credits
+     * Update credits.  csched_vcpu_wake() burns them too, possibly from
+     * another PCPU, so do it under this PCPU's schedule lock.
      */
     if ( !is_idle_vcpu(svc->vcpu) )
+    {
+        lock = pcpu_schedule_lock_irqsave(cpu, &flags);
         burn_credits(svc, NOW());
+        pcpu_schedule_unlock_irqrestore(lock, flags, cpu);
+    }
 
     /*
      * Put this VCPU and domain back on the active list if it was
@@ -967,6 +992,15 @@ csched_vcpu_wake(const struct scheduler *ops, struct vcpu *vc)
     else
         SCHED_STAT_CRANK(vcpu_wake_not_runnable);
 
+    /*
+     * Bring the credits of whoever is running on the target PCPU up to
+     * date, rather than waiting for its next tick to do so.  Our caller
+     * holds that PCPU's schedule lock, which its own accounting in
+     * csched_vcpu_acct() and csched_schedule() takes as well.
+     */
+    if ( !is_idle_vcpu(curr_on_cpu(cpu)) )
+        burn_credits(CSCHED_VCPU(curr_on_cpu(cpu)), NOW());
+
     /*
      * We temporarly boost the priority of awaking VCPUs!
      *
@@ -1224,10 +1258,15 @@ csched_acct(void* dummy)
 
     if ( unlikely(weight_total == 0) )
     {
+        /*
+         * No active VCPUs: let the master ticker lapse. It is rearmed by
+         * __csched_vcpu_acct_start() as soon as a VCPU starts competing.
+         */
         prv->credit_balance = 0;
+        prv->master_ticker_live = 0;
         spin_unlock_irqrestore(&prv->lock, flags);
         SCHED_STAT_CRANK(acct_no_work);
-        goto out;
+        return;
     }
 
     SCHED_STAT_CRANK(acct_run);
@@ -1392,7 +1431,6 @@ csched_acct(void* dummy)
     /* Inform each CPU that its runq needs to be sorted */
     prv->runq_sort++;
 
-out:
     set_timer( &prv->master_ticker,
                NOW() + MILLISECS(prv->tslice_ms));
 }
@@ -1421,7 +1459,12 @@ csched_tick(void *_cpu)
      */
     csched_runq_sort(prv, cpu);
 
-    set_timer(&spc->ticker, NOW() + MICROSECS(prv->tick_period_us) );
+    /*
+     * Only keep ticking while there is a VCPU to account for. The ticker
+     * is rearmed by csched_schedule() when this PCPU picks up work again.
+     */
+    if ( !is_idle_vcpu(curr_on_cpu(cpu)) )
+        set_timer(&spc->ticker, NOW() + MICROSECS(prv->tick_period_us) );
 }
 
 static struct csched_vcpu *
@@ -1705,6 +1748,16 @@ csched_schedule(
         snext->start_time += now;
 
 out:
+    /*
+     * Tickless operation: the accounting tick only runs while a non-idle
+     * VCPU occupies this PCPU.
+     */
+    if ( is_idle_vcpu(snext->vcpu) )
+        stop_timer(&CSCHED_PCPU(cpu)->ticker);
+    else if ( is_idle_vcpu(current) )
+        set_timer(&CSCHED_PCPU(cpu)->ticker,
+                  now + MICROSECS(prv->tick_period_us));
+
     /*
      * Return task to run next...
      */
@@ -1799,7 +1852,7 @@ csched_dump(const struct scheduler *ops)
 
     printk("info:\n"
            "\tncpus              = %u\n"
-           "\tmaster             = %u\n"
+           "\tmaster             = %u (%s)\n"
            "\tcredit             = %u\n"
            "\tcredit balance     = %d\n"
            "\tweight             = %u\n"
@@ -1812,6 +1865,7 @@ csched_dump(const struct scheduler *ops)
            "\tmigration delay    = %uus\n",
            prv->ncpus,
            prv->master,
+           prv->master_ticker_live ? "ticking" : "stopped",
            prv->credit,
            prv->credit_balance,
            prv->weight,
@@ -1924,6 +1978,10 @@ static void csched_tick_resume(const struct scheduler *ops, unsigned int cpu)
 
     spc = CSCHED_PCPU(cpu);
 
+    /* Idle PCPUs don't tick; csched_schedule() rearms us when needed. */
+    if ( is_idle_vcpu(curr_on_cpu(cpu)) )
+        return;
+
     prv = CSCHED_PRIV(ops);
 
     set_timer(&spc->ticker, now + MICROSECS(prv->tick_period_us)
@@ -1900,7 +1900,7 @@ static void activate_runqueue(struct csched2_private *prv, int rqi)
     rqd->id = rqi;
     INIT_LIST_HEAD(&rqd->svc);
     INIT_LIST_HEAD(&rqd->runq);
-    spin_lock_init(&rqd->lock);
+    spin_lock_init_queued(&rqd->lock);
 
     cpumask_set_cpu(rqi, &prv->active_queues);
 }
@@ -0,0 +1,1279 @@
+/*****************************************************************************
+ * Preemptive Global Earliest Deadline First (EDF) scheduler for Xen
+ * EDF scheduling is a real-time scheduling algorithm used in embedded field.
+ *
+ *        File: common/sched_rt.c
+ *
+ * Description: Real-time deferrable-server scheduler for cpupools.
+ *
+ * Each vcpu is a deferrable server with a (period, budget) pair.  At the
+ * start of every period the vcpu's budget is replenished and its deadline
+ * moved to the end of the period; the runnable vcpu with the earliest
+ * deadline and some budget left runs.  Budget that is not used while the
+ * vcpu is blocked is preserved until the end of the period.
+ *
+ * The scheduler is tickless: the only timers it relies on are the generic
+ * per-cpu scheduling timer, armed for the remaining budget of the vcpu that
+ * was picked, and one replenishment timer per scheduler instance, armed for
+ * the earliest pending replenishment.  An idle pcpu is never woken up by
+ * this scheduler unless there is work for it.
+ */
+
+#include <xen/config.h>
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/sched.h>
+#include <xen/domain.h>
+#include <xen/delay.h>
+#include <xen/event.h>
+#include <xen/time.h>
+#include <xen/timer.h>
+#include <xen/perfc.h>
+#include <xen/sched-if.h>
+#include <xen/softirq.h>
+#include <asm/atomic.h>
+#include <xen/errno.h>
+#include <xen/trace.h>
+#include <xen/cpu.h>
+
+/*
+ * Design:
+ *
+ * All vcpus of a cpupool using this scheduler share one global runqueue,
+ * protected by the scheduler private lock, which is also installed as the
+ * schedule lock of every pcpu of the pool.  Each cpupool has its own
+ * instance of the scheduler, and hence its own lock and queues, so pools
+ * do not contend with each other.
+ *
+ * Runnable vcpus with budget left are kept on the runqueue, ordered by
+ * deadline.  Runnable vcpus which used up their budget wait on the
+ * depleted queue until their next replenishment.  Vcpus that are runnable
+ * or running are also linked on the replenishment queue, ordered by the
+ * time of their next replenishment (which is their current deadline).
+ * Blocked vcpus are not on the replenishment queue: their deadline is
+ * brought up to date when they wake up, so they never cause a timer
+ * interrupt while asleep.
+ */
+
+/*
+ * Default parameters:
+ * Period and budget in default are 10 and 4 ms, respectively
+ */
+#define RTDS_DEFAULT_PERIOD     (MICROSECS(10000))
+#define RTDS_DEFAULT_BUDGET     (MICROSECS(4000))
+
+/*
+ * Updates from now on to a deadline this many periods away are done
+ * with a division rather than by looping.
+ */
+#define UPDATE_LIMIT_SHIFT      10
+
+/* Parameters are accepted in this range (in microseconds) */
+#define RTDS_MIN_PERIOD_US      10
+#define RTDS_MAX_PERIOD_US      (10U * 1000 * 1000)
+
+/*
+ * Flags
+ */
+/*
+ * RTDS_scheduled: Is this vcpu either running on, or context-switching off,
+ * a phyiscal cpu?
+ * + Accessed only with global lock held.
+ * + Set when chosen as next in rt_schedule().
+ * + Cleared after context switch has been saved in rt_context_saved()
+ * + Checked in vcpu_wake to see if we can add to the runqueue, or if we should
+ *   set RTDS_delayed_runq_add
+ * + Checked to be false in runq_insert.
+ */
+#define __RTDS_scheduled            1
+#define RTDS_scheduled (1<<__RTDS_scheduled)
+/*
+ * RTDS_delayed_runq_add: Do we need to add this to the runqueue once it'd done
+ * being context switched out?
+ * + Set when scheduling out in rt_schedule() if prev is runnable
+ * + Set in rt_vcpu_wake if it finds RTDS_scheduled set
+ * + Read in rt_context_saved(). If set, it adds prev to the runqueue and
+ *   clears the bit.
+ */
+#define __RTDS_delayed_runq_add     2
+#define RTDS_delayed_runq_add (1<<__RTDS_delayed_runq_add)
+/*
+ * RTDS_depleted: Has this vcpu run out of budget?
+ * + Set when the vcpu is put on the depleted queue.
+ * + Cleared when its budget is replenished, at which point the vcpu is
+ *   a candidate for tickling.
+ */
+#define __RTDS_depleted             3
+#define RTDS_depleted (1<<__RTDS_depleted)
+
+/*
+ * rt tracing events ("only" 512 available!). Check
+ * include/public/trace.h for more details.
+ */
+#define TRC_RTDS_TICKLE           TRC_SCHED_CLASS_EVT(RTDS, 1)
+#define TRC_RTDS_RUNQ_PICK        TRC_SCHED_CLASS_EVT(RTDS, 2)
+#define TRC_RTDS_BUDGET_BURN      TRC_SCHED_CLASS_EVT(RTDS, 3)
+#define TRC_RTDS_BUDGET_REPLENISH TRC_SCHED_CLASS_EVT(RTDS, 4)
+#define TRC_RTDS_SCHED_TASKLET    TRC_SCHED_CLASS_EVT(RTDS, 5)
+
+/*
+ * Useful inline functions
+ */
+#define RT_PRIV(_ops)       ((struct rt_private *)((_ops)->sched_data))
+#define RT_VCPU(_vcpu)      ((struct rt_vcpu *)(_vcpu)->sched_priv)
+#define RT_DOM(_dom)        ((struct rt_dom *)(_dom)->sched_priv)
+
+/*
+ * System-wide private data, include global RunQueue/DepletedQ
+ * Global lock is referenced by schedule_data.schedule_lock from all
+ * physical cpus. It can be grabbed via vcpu_schedule_lock_irq()
+ */
+struct rt_private {
+    spinlock_t lock;            /* the global coarse grand lock */
+    struct list_head sdom;      /* list of availalbe domains, used for dump */
+    struct list_head runq;      /* ordered list of runnable vcpus */
+    struct list_head depletedq; /* unordered list of depleted vcpus */
+    struct list_head replq;     /* ordered list of pending replenishments */
+    cpumask_t cpus;             /* cpus handled by this instance */
+    cpumask_t tickled;          /* cpus been tickled */
+    struct timer repl_timer;    /* replenishment timer */
+    bool_t repl_timer_live;     /* has repl_timer been initialised? */
+};
+
+/*
+ * Virtual CPU
+ */
+struct rt_vcpu {
+    struct list_head q_elem;     /* on the runq/depletedq list */
+    struct list_head replq_elem; /* on the replenishment queue */
+    struct list_head sdom_elem;  /* on the domain's vcpu list */
+
+    /* Up-pointers */
+    struct rt_dom *sdom;
+    struct vcpu *vcpu;
+
+    /* VCPU parameters, in nanoseconds */
+    s_time_t period;
+    s_time_t budget;
+
+    /* VCPU current infomation in nanosecond */
+    s_time_t cur_budget;        /* current budget */
+    s_time_t last_start;        /* last start time */
+    s_time_t cur_deadline;      /* current deadline for EDF */
+
+    unsigned flags;             /* mark __RTDS_scheduled, etc.. */
+};
+
+/*
+ * Domain
+ */
+struct rt_dom {
+    struct list_head vcpu;      /* link its VCPUs */
+    struct list_head sdom_elem; /* link list on rt_priv */
+    struct domain *dom;         /* pointer to upper domain */
+};
+
+/*
+ * Queue helper functions for runq, depletedq and replq
+ */
+static int
+__vcpu_on_q(const struct rt_vcpu *svc)
+{
+   return !list_empty(&svc->q_elem);
+}
+
+static int
+__vcpu_on_replq(const struct rt_vcpu *svc)
+{
+   return !list_empty(&svc->replq_elem);
+}
+
+static struct rt_vcpu *
+__q_elem(struct list_head *elem)
+{
+    return list_entry(elem, struct rt_vcpu, q_elem);
+}
+
+static struct rt_vcpu *
+__replq_elem(struct list_head *elem)
+{
+    return list_entry(elem, struct rt_vcpu, replq_elem);
+}
+
+/*
+ * Debug related code, dump vcpu/cpu information
+ */
+static void
+rt_dump_vcpu(const struct scheduler *ops, const struct rt_vcpu *svc)
+{
+    char cpustr[1024];
+    cpumask_t cpus;
+
+    ASSERT(svc != NULL);
+    /* idle vcpu */
+    if( svc->sdom == NULL )
+    {
+        printk("\n");
+        return;
+    }
+
+    cpumask_and(&cpus, svc->vcpu->cpu_hard_affinity,
+                cpupool_scheduler_cpumask(svc->vcpu->domain->cpupool));
+    cpumask_scnprintf(cpustr, sizeof(cpustr), &cpus);
+    printk("[%5d.%-2u] cpu %u, (%"PRI_stime", %"PRI_stime"),"
+           " cur_b=%"PRI_stime" cur_d=%"PRI_stime" last_start=%"PRI_stime"\n"
+           " \t\t onQ=%d runnable=%d flags=%x effective hard_affinity=%s\n",
+            svc->vcpu->domain->domain_id,
+            svc->vcpu->vcpu_id,
+            svc->vcpu->processor,
+            svc->period,
+            svc->budget,
+            svc->cur_budget,
+            svc->cur_deadline,
+            svc->last_start,
+            __vcpu_on_q(svc),
+            vcpu_runnable(svc->vcpu),
+            svc->flags,
+            cpustr);
+}
+
+static void
+rt_dump_pcpu(const struct scheduler *ops, int cpu)
+{
+    struct rt_vcpu *svc = RT_VCPU(curr_on_cpu(cpu));
+
+    printk("CPU[%02d] ", cpu);
+    rt_dump_vcpu(ops, svc);
+}
+
+static void
+rt_dump(const struct scheduler *ops)
+{
+    struct list_head *iter_sdom, *iter_svc;
+    struct rt_private *prv = RT_PRIV(ops);
+    struct rt_vcpu *svc;
+    struct rt_dom *sdom;
+    unsigned long flags;
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    if ( list_empty(&prv->sdom) )
+        goto out;
+
+    printk("Global RunQueue info:\n");
+    list_for_each( iter_svc, &prv->runq )
+    {
+        svc = __q_elem(iter_svc);
+        rt_dump_vcpu(ops, svc);
+    }
+
+    printk("Global DepletedQueue info:\n");
+    list_for_each( iter_svc, &prv->depletedq )
+    {
+        svc = __q_elem(iter_svc);
+        rt_dump_vcpu(ops, svc);
+    }
+
+    printk("Global Replenishment Events info:\n");
+    list_for_each( iter_svc, &prv->replq )
+    {
+        svc = __replq_elem(iter_svc);
+        rt_dump_vcpu(ops, svc);
+    }
+
+    printk("Domain info:\n");
+    list_for_each( iter_sdom, &prv->sdom )
+    {
+        sdom = list_entry(iter_sdom, struct rt_dom, sdom_elem);
+        printk("\tdomain: %d\n", sdom->dom->domain_id);
+
+        list_for_each( iter_svc, &sdom->vcpu )
+        {
+            svc = list_entry(iter_svc, struct rt_vcpu, sdom_elem);
+            rt_dump_vcpu(ops, svc);
+        }
+    }
+
+ out:
+    spin_unlock_irqrestore(&prv->lock, flags);
+}
+
+/*
+ * update deadline and budget when now >= cur_deadline
+ * it need to be updated to the deadline of the current period
+ */
+static void
+rt_update_deadline(s_time_t now, struct rt_vcpu *svc)
+{
+    ASSERT(now >= svc->cur_deadline);
+    ASSERT(svc->period != 0);
+
+    if ( svc->cur_deadline + (svc->period << UPDATE_LIMIT_SHIFT) > now )
+    {
+        do
+            svc->cur_deadline += svc->period;
+        while ( svc->cur_deadline <= now );
+    }
+    else
+    {
+        long count = ((now - svc->cur_deadline) / svc->period) + 1;
+        svc->cur_deadline += count * svc->period;
+    }
+
+    svc->cur_budget = svc->budget;
+
+    /* TRACE */
+    {
+        struct {
+            unsigned dom:16,vcpu:16;
+            unsigned cur_deadline_lo, cur_deadline_hi;
+            unsigned cur_budget_lo, cur_budget_hi;
+        } d;
+        d.dom = svc->vcpu->domain->domain_id;
+        d.vcpu = svc->vcpu->vcpu_id;
+        d.cur_deadline_lo = (unsigned) svc->cur_deadline;
+        d.cur_deadline_hi = (unsigned) (svc->cur_deadline >> 32);
+        d.cur_budget_lo = (unsigned) svc->cur_budget;
+        d.cur_budget_hi = (unsigned) (svc->cur_budget >> 32);
+        trace_var(TRC_RTDS_BUDGET_REPLENISH, 1,
+                  sizeof(d),
+                  (unsigned char *) &d);
+    }
+
+    return;
+}
+
+static inline void
+__q_remove(struct rt_vcpu *svc)
+{
+    if ( __vcpu_on_q(svc) )
+        list_del_init(&svc->q_elem);
+}
+
+/*
+ * Insert svc with budget in RunQ according to EDF:
+ * vcpus with smaller deadlines go first.
+ * Insert svc without budget in DepletedQ unsorted;
+ */
+static void
+__runq_insert(const struct scheduler *ops, struct rt_vcpu *svc)
+{
+    struct rt_private *prv = RT_PRIV(ops);
+    struct list_head *runq = &prv->runq;
+    struct list_head *iter;
+
+    ASSERT( spin_is_locked(&prv->lock) );
+
+    ASSERT( !__vcpu_on_q(svc) );
+
+    /* add svc to runq if svc still has budget */
+    if ( svc->cur_budget > 0 )
+    {
+        list_for_each(iter, runq)
+        {
+            struct rt_vcpu * iter_svc = __q_elem(iter);
+            if ( svc->cur_deadline <= iter_svc->cur_deadline )
+                    break;
+         }
+        list_add_tail(&svc->q_elem, iter);
+    }
+    else
+    {
+        list_add(&svc->q_elem, &prv->depletedq);
+        __set_bit(__RTDS_depleted, &svc->flags);
+    }
+}
+
+/*
+ * Insert svc in the replenishment queue, ordered by the time of its next
+ * replenishment, and make sure the replenishment timer fires for the
+ * earliest one.
+ */
+static void
+__replq_insert(const struct scheduler *ops, struct rt_vcpu *svc)
+{
+    struct rt_private *prv = RT_PRIV(ops);
+    struct list_head *replq = &prv->replq;
+    struct list_head *iter;
+
+    ASSERT( spin_is_locked(&prv->lock) );
+
+    ASSERT( !__vcpu_on_replq(svc) );
+
+    list_for_each(iter, replq)
+    {
+        struct rt_vcpu * iter_svc = __replq_elem(iter);
+        if ( svc->cur_deadline <= iter_svc->cur_deadline )
+                break;
+    }
+    list_add_tail(&svc->replq_elem, iter);
+
+    /* New earliest replenishment: reprogram the timer. */
+    if ( replq->next == &svc->replq_elem && prv->repl_timer_live )
+        set_timer(&prv->repl_timer, svc->cur_deadline);
+}
+
+static void
+__replq_remove(const struct scheduler *ops, struct rt_vcpu *svc)
+{
+    struct rt_private *prv = RT_PRIV(ops);
+    struct list_head *replq = &prv->replq;
+    bool_t was_first;
+
+    ASSERT( spin_is_locked(&prv->lock) );
+
+    if ( !__vcpu_on_replq(svc) )
+        return;
+
+    was_first = (replq->next == &svc->replq_elem);
+    list_del_init(&svc->replq_elem);
+
+    if ( !was_first || !prv->repl_timer_live )
+        return;
+
+    if ( list_empty(replq) )
+        stop_timer(&prv->repl_timer);
+    else
+        set_timer(&prv->repl_timer, __replq_elem(replq->next)->cur_deadline);
+}
+
+/*
+ * Init/Free related code
+ */
+static int
+rt_init(struct scheduler *ops)
+{
+    struct rt_private *prv = xzalloc(struct rt_private);
+
+    printk("Initializing RTDS scheduler\n"
+           "WARNING: This is experimental software in development.\n"
+           "Use at your own risk.\n");
+
+    if ( prv == NULL )
+        return -ENOMEM;
+
+    spin_lock_init_queued(&prv->lock);
+    INIT_LIST_HEAD(&prv->sdom);
+    INIT_LIST_HEAD(&prv->runq);
+    INIT_LIST_HEAD(&prv->depletedq);
+    INIT_LIST_HEAD(&prv->replq);
+
+    cpumask_clear(&prv->cpus);
+    cpumask_clear(&prv->tickled);
+
+    ops->sched_data = prv;
+
+    return 0;
+}
+
+static void
+rt_deinit(const struct scheduler *ops)
+{
+    struct rt_private *prv = RT_PRIV(ops);
+
+    if ( prv->repl_timer_live )
+        kill_timer(&prv->repl_timer);
+    xfree(prv);
+}
+
+static void repl_timer_handler(void *data);
+
+/*
+ * Point per_cpu spinlock to the global system lock;
+ * All cpu have same global system lock
+ */
+static void *
+rt_alloc_pdata(const struct scheduler *ops, int cpu)
+{
+    struct rt_private *prv = RT_PRIV(ops);
+    unsigned long flags;
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    per_cpu(schedule_data, cpu).schedule_lock = &prv->lock;
+    cpumask_set_cpu(cpu, &prv->cpus);
+
+    /* The first cpu of the instance hosts the replenishment timer. */
+    if ( !prv->repl_timer_live )
+    {
+        init_timer(&prv->repl_timer, repl_timer_handler, (void *)ops, cpu);
+        prv->repl_timer_live = 1;
+        if ( !list_empty(&prv->replq) )
+            set_timer(&prv->repl_timer,
+                      __replq_elem(prv->replq.next)->cur_deadline);
+    }
+
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    /* 1 indicates alloc. succeed in schedule.c */
+    return (void *)1;
+}
+
+static void
+rt_free_pdata(const struct scheduler *ops, void *pcpu, int cpu)
+{
+    struct rt_private *prv = RT_PRIV(ops);
+    struct schedule_data *sd = &per_cpu(schedule_data, cpu);
+    unsigned long flags;
+    unsigned int new_cpu;
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    cpumask_clear_cpu(cpu, &prv->cpus);
+    cpumask_clear_cpu(cpu, &prv->tickled);
+
+    /* Move the replenishment timer off a cpu that is leaving us. */
+    if ( prv->repl_timer_live && prv->repl_timer.cpu == cpu )
+    {
+        new_cpu = cpumask_any(&prv->cpus);
+        if ( new_cpu < nr_cpu_ids )
+            migrate_timer(&prv->repl_timer, new_cpu);
+        else
+        {
+            spin_unlock_irqrestore(&prv->lock, flags);
+            kill_timer(&prv->repl_timer);
+            spin_lock_irqsave(&prv->lock, flags);
+            prv->repl_timer_live = 0;
+        }
+    }
+
+    /*
+     * Move spinlock back to the default lock, unless the new scheduler of
+     * this cpu already installed its own.
+     */
+    if ( sd->schedule_lock == &prv->lock )
+    {
+        ASSERT(!spin_is_locked(&sd->_lock));
+        sd->schedule_lock = &sd->_lock;
+    }
+
+    spin_unlock_irqrestore(&prv->lock, flags);
+}
+
+static void *
+rt_alloc_domdata(const struct scheduler *ops, struct domain *dom)
+{
+    unsigned long flags;
+    struct rt_dom *sdom;
+    struct rt_private * prv = RT_PRIV(ops);
+
+    sdom = xzalloc(struct rt_dom);
+    if ( sdom == NULL )
+        return NULL;
+
+    INIT_LIST_HEAD(&sdom->vcpu);
+    INIT_LIST_HEAD(&sdom->sdom_elem);
+    sdom->dom = dom;
+
+    /* spinlock here to insert the dom */
+    spin_lock_irqsave(&prv->lock, flags);
+    list_add_tail(&sdom->sdom_elem, &(prv->sdom));
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    return sdom;
+}
+
+static void
+rt_free_domdata(const struct scheduler *ops, void *data)
+{
+    unsigned long flags;
+    struct rt_dom *sdom = data;
+    struct rt_private *prv = RT_PRIV(ops);
+
+    spin_lock_irqsave(&prv->lock, flags);
+    list_del_init(&sdom->sdom_elem);
+    spin_unlock_irqrestore(&prv->lock, flags);
+    xfree(data);
+}
+
+static int
+rt_dom_init(const struct scheduler *ops, struct domain *dom)
+{
+    struct rt_dom *sdom;
+
+    /* IDLE Domain does not link on rt_private */
+    if ( is_idle_domain(dom) )
+        return 0;
+
+    sdom = rt_alloc_domdata(ops, dom);
+    if ( sdom == NULL )
+        return -ENOMEM;
+
+    dom->sched_priv = sdom;
+
+    return 0;
+}
+
+static void
+rt_dom_destroy(const struct scheduler *ops, struct domain *dom)
+{
+    BUG_ON(!list_empty(&RT_DOM(dom)->vcpu));
+
+    rt_free_domdata(ops, RT_DOM(dom));
+}
+
+static void *
+rt_alloc_vdata(const struct scheduler *ops, struct vcpu *vc, void *dd)
+{
+    struct rt_vcpu *svc;
+
+    /* Allocate per-VCPU info */
+    svc = xzalloc(struct rt_vcpu);
+    if ( svc == NULL )
+        return NULL;
+
+    INIT_LIST_HEAD(&svc->q_elem);
+    INIT_LIST_HEAD(&svc->replq_elem);
+    INIT_LIST_HEAD(&svc->sdom_elem);
+    svc->flags = 0U;
+    svc->sdom = dd;
+    svc->vcpu = vc;
+    svc->last_start = 0;
+
+    svc->period = RTDS_DEFAULT_PERIOD;
+    if ( !is_idle_vcpu(vc) )
+        svc->budget = RTDS_DEFAULT_BUDGET;
+
+    SCHED_STAT_CRANK(vcpu_init);
+
+    return svc;
+}
+
+static void
+rt_free_vdata(const struct scheduler *ops, void *priv)
+{
+    struct rt_vcpu *svc = priv;
+
+    xfree(svc);
+}
+
+/*
+ * This function is called in sched_move_domain() in schedule.c
+ * When move a domain to a new cpupool.
+ * It inserts vcpus of moving domain to the scheduler's RunQ in
+ * dest. cpupool.
+ */
+static void
+rt_vcpu_insert(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_vcpu *svc = RT_VCPU(vc);
+    s_time_t now = NOW();
+    spinlock_t *lock;
+
+    /* not addlocate idle vcpu to dom vcpu list */
+    if ( is_idle_vcpu(vc) )
+        return;
+
+    lock = vcpu_schedule_lock_irq(vc);
+    if ( now >= svc->cur_deadline )
+        rt_update_deadline(now, svc);
+
+    if ( !__vcpu_on_q(svc) && vcpu_runnable(vc) )
+    {
+        __replq_insert(ops, svc);
+        if ( !vc->is_running )
+            __runq_insert(ops, svc);
+    }
+    vcpu_schedule_unlock_irq(lock, vc);
+
+    /* add rt_vcpu svc to scheduler-specific vcpu list of the dom */
+    list_add_tail(&svc->sdom_elem, &svc->sdom->vcpu);
+}
+
+/*
+ * Remove rt_vcpu svc from the old scheduler in source cpupool.
+ */
+static void
+rt_vcpu_remove(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_vcpu * const svc = RT_VCPU(vc);
+    struct rt_dom * const sdom = svc->sdom;
+    spinlock_t *lock;
+
+    SCHED_STAT_CRANK(vcpu_destroy);
+
+    BUG_ON( sdom == NULL );
+
+    lock = vcpu_schedule_lock_irq(vc);
+    __q_remove(svc);
+    __replq_remove(ops, svc);
+    vcpu_schedule_unlock_irq(lock, vc);
+
+    if ( !is_idle_vcpu(vc) )
+        list_del_init(&svc->sdom_elem);
+}
+
+/*
+ * Pick a valid CPU for the vcpu vc
+ * Valid CPU of a vcpu is intesection of vcpu's affinity
+ * and available cpus
+ */
+static int
+rt_cpu_pick(const struct scheduler *ops, struct vcpu *vc)
+{
+    cpumask_t cpus;
+    cpumask_t *online;
+    int cpu;
+
+    online = cpupool_scheduler_cpumask(vc->domain->cpupool);
+    cpumask_and(&cpus, online, vc->cpu_hard_affinity);
+
+    cpu = cpumask_test_cpu(vc->processor, &cpus)
+            ? vc->processor
+            : cpumask_cycle(vc->processor, &cpus);
+    ASSERT( !cpumask_empty(&cpus) && cpumask_test_cpu(cpu, &cpus) );
+
+    return cpu;
+}
+
+/*
+ * Burn budget in nanosecond granularity
+ */
+static void
+burn_budget(const struct scheduler *ops, struct rt_vcpu *svc, s_time_t now)
+{
+    s_time_t delta;
+
+    /* don't burn budget for idle VCPU */
+    if ( is_idle_vcpu(svc->vcpu) )
+        return;
+
+    /* burn at nanoseconds level */
+    delta = now - svc->last_start;
+    /*
+     * NOW() can appear to go backwards across pcpus when running nested on
+     * another hypervisor.  Charge nothing for such an interval rather than
+     * handing the vcpu budget back; this runs on every schedule, so it is
+     * not worth a message.
+     */
+    if ( delta < 0 )
+    {
+        svc->last_start = now;
+        return;
+    }
+
+    svc->cur_budget -= delta;
+    svc->last_start = now;
+
+    if ( svc->cur_budget < 0 )
+        svc->cur_budget = 0;
+
+    /* TRACE */
+    {
+        struct {
+            unsigned dom:16, vcpu:16;
+            unsigned cur_budget_lo;
+            unsigned cur_budget_hi;
+            int delta;
+        } d;
+        d.dom = svc->vcpu->domain->domain_id;
+        d.vcpu = svc->vcpu->vcpu_id;
+        d.cur_budget_lo = (unsigned) svc->cur_budget;
+        d.cur_budget_hi = (unsigned) (svc->cur_budget >> 32);
+        d.delta = delta;
+        trace_var(TRC_RTDS_BUDGET_BURN, 1,
+                  sizeof(d),
+                  (unsigned char *) &d);
+    }
+}
+
+/*
+ * RunQ is sorted. Pick first one within cpumask. If no one, return NULL
+ * lock is grabbed before calling this function
+ */
+static struct rt_vcpu *
+__runq_pick(const struct scheduler *ops, const cpumask_t *mask)
+{
+    struct list_head *runq = &RT_PRIV(ops)->runq;
+    struct list_head *iter;
+    struct rt_vcpu *svc = NULL;
+    struct rt_vcpu *iter_svc = NULL;
+    cpumask_t cpu_common;
+    cpumask_t *online;
+
+    list_for_each(iter, runq)
+    {
+        iter_svc = __q_elem(iter);
+
+        /* mask cpu_hard_affinity & cpupool & mask */
+        online = cpupool_scheduler_cpumask(iter_svc->vcpu->domain->cpupool);
+        cpumask_and(&cpu_common, online, iter_svc->vcpu->cpu_hard_affinity);
+        cpumask_and(&cpu_common, mask, &cpu_common);
+        if ( cpumask_empty(&cpu_common) )
+            continue;
+
+        ASSERT( iter_svc->cur_budget > 0 );
+
+        svc = iter_svc;
+        break;
+    }
+
+    /* TRACE */
+    {
+        if( svc != NULL )
+        {
+            struct {
+                unsigned dom:16, vcpu:16;
+                unsigned cur_deadline_lo, cur_deadline_hi;
+                unsigned cur_budget_lo, cur_budget_hi;
+            } d;
+            d.dom = svc->vcpu->domain->domain_id;
+            d.vcpu = svc->vcpu->vcpu_id;
+            d.cur_deadline_lo = (unsigned) svc->cur_deadline;
+            d.cur_deadline_hi = (unsigned) (svc->cur_deadline >> 32);
+            d.cur_budget_lo = (unsigned) svc->cur_budget;
+            d.cur_budget_hi = (unsigned) (svc->cur_budget >> 32);
+            trace_var(TRC_RTDS_RUNQ_PICK, 1,
+                      sizeof(d),
+                      (unsigned char *) &d);
+        }
+        else
+            trace_var(TRC_RTDS_RUNQ_PICK, 1, 0, NULL);
+    }
+
+    return svc;
+}
+
+/*
+ * schedule function for rt scheduler.
+ * The lock is already grabbed in schedule.c, no need to lock here
+ */
+static struct task_slice
+rt_schedule(const struct scheduler *ops, s_time_t now, bool_t tasklet_work_scheduled)
+{
+    const int cpu = smp_processor_id();
+    struct rt_private *prv = RT_PRIV(ops);
+    struct rt_vcpu *const scurr = RT_VCPU(current);
+    struct rt_vcpu *snext = NULL;
+    struct task_slice ret = { .migrated = 0 };
+
+    /* clear ticked bit now that we've been scheduled */
+    cpumask_clear_cpu(cpu, &prv->tickled);
+
+    /* burn_budget would return for IDLE VCPU */
+    burn_budget(ops, scurr, now);
+
+    if ( tasklet_work_scheduled )
+    {
+        trace_var(TRC_RTDS_SCHED_TASKLET, 1, 0,  NULL);
+        snext = RT_VCPU(idle_vcpu[cpu]);
+    }
+    else
+    {
+        snext = __runq_pick(ops, cpumask_of(cpu));
+        if ( snext == NULL )
+            snext = RT_VCPU(idle_vcpu[cpu]);
+
+        /* if scurr has higher priority and budget, still pick scurr */
+        if ( !is_idle_vcpu(current) &&
+             vcpu_runnable(current) &&
+             scurr->cur_budget > 0 &&
+             ( is_idle_vcpu(snext->vcpu) ||
+               scurr->cur_deadline <= snext->cur_deadline ) )
+            snext = scurr;
+    }
+
+    if ( snext != scurr &&
+         !is_idle_vcpu(current) &&
+         vcpu_runnable(current) )
+        __set_bit(__RTDS_delayed_runq_add, &scurr->flags);
+
+    snext->last_start = now;
+    ret.time = -1; /* if an idle vcpu is picked, no timer is needed */
+    if ( !is_idle_vcpu(snext->vcpu) )
+    {
+        if ( snext != scurr )
+        {
+            __q_remove(snext);
+            __set_bit(__RTDS_scheduled, &snext->flags);
+        }
+        if ( snext->vcpu->processor != cpu )
+        {
+            snext->vcpu->processor = cpu;
+            ret.migrated = 1;
+        }
+        ret.time = snext->cur_budget; /* invoke the scheduler next time */
+    }
+
+    ret.task = snext->vcpu;
+
+    return ret;
+}
+
+/*
+ * Remove VCPU from RunQ
+ * The lock is already grabbed in schedule.c, no need to lock here
+ */
+static void
+rt_vcpu_sleep(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_vcpu * const svc = RT_VCPU(vc);
+
+    BUG_ON( is_idle_vcpu(vc) );
+    SCHED_STAT_CRANK(vcpu_sleep);
+
+    if ( curr_on_cpu(vc->processor) == vc )
+        cpu_raise_softirq(vc->processor, SCHEDULE_SOFTIRQ);
+    else if ( __vcpu_on_q(svc) )
+    {
+        __q_remove(svc);
+        __replq_remove(ops, svc);
+    }
+    else if ( svc->flags & RTDS_delayed_runq_add )
+        __clear_bit(__RTDS_delayed_runq_add, &svc->flags);
+}
+
+/*
+ * Pick a cpu where to run a vcpu,
+ * possibly kicking out the vcpu running there
+ * Called by wake() and context_saved()
+ * We have a running candidate here, the kick logic is:
+ * Among all the cpus that are within the cpu affinity
+ * 1) if the new->cpu is idle, kick it. This could benefit cache hit
+ * 2) if there are any idle vcpu, kick it.
+ * 3) now all pcpus are busy;
+ *    among all the running vcpus, pick lowest priority one
+ *    if snext has higher priority, kick it.
+ *
+ * The vcpu preempted may belong to the same domain as new: priority alone
+ * decides, even though that swap buys the domain nothing.
+ *
+ * lock is grabbed before calling this function
+ */
+static void
+runq_tickle(const struct scheduler *ops, struct rt_vcpu *new)
+{
+    struct rt_private *prv = RT_PRIV(ops);
+    struct rt_vcpu *latest_deadline_vcpu = NULL; /* lowest priority */
+    struct rt_vcpu *iter_svc;
+    struct vcpu *iter_vc;
+    int cpu = 0, cpu_to_tickle = 0;
+    cpumask_t not_tickled;
+    cpumask_t *online;
+
+    if ( new == NULL || is_idle_vcpu(new->vcpu) )
+        return;
+
+    online = cpupool_scheduler_cpumask(new->vcpu->domain->cpupool);
+    cpumask_and(&not_tickled, online, new->vcpu->cpu_hard_affinity);
+    cpumask_andnot(&not_tickled, &not_tickled, &prv->tickled);
+
+    /* 1) if new's previous cpu is idle, kick it for cache benefit */
+    if ( is_idle_vcpu(curr_on_cpu(new->vcpu->processor)) &&
+         cpumask_test_cpu(new->vcpu->processor, &not_tickled) )
+    {
+        cpu_to_tickle = new->vcpu->processor;
+        goto out;
+    }
+
+    /* 2) if there are any idle pcpu, kick it */
+    /* The same loop also find the one with lowest priority */
+    for_each_cpu(cpu, &not_tickled)
+    {
+        iter_vc = curr_on_cpu(cpu);
+        if ( is_idle_vcpu(iter_vc) )
+        {
+            cpu_to_tickle = cpu;
+            goto out;
+        }
+        iter_svc = RT_VCPU(iter_vc);
+        if ( latest_deadline_vcpu == NULL ||
+             iter_svc->cur_deadline > latest_deadline_vcpu->cur_deadline )
+            latest_deadline_vcpu = iter_svc;
+    }
+
+    /* 3) candicate has higher priority, kick out the lowest priority vcpu */
+    if ( latest_deadline_vcpu != NULL &&
+         new->cur_deadline < latest_deadline_vcpu->cur_deadline )
+    {
+        cpu_to_tickle = latest_deadline_vcpu->vcpu->processor;
+        goto out;
+    }
+
+    /* didn't tickle any cpu */
+    SCHED_STAT_CRANK(tickle_idlers_none);
+    return;
+ out:
+    /* TRACE */
+    {
+        struct {
+            unsigned cpu:16, pad:16;
+        } d;
+        d.cpu = cpu_to_tickle;
+        d.pad = 0;
+        trace_var(TRC_RTDS_TICKLE, 0,
+                  sizeof(d),
+                  (unsigned char *)&d);
+    }
+
+    cpumask_set_cpu(cpu_to_tickle, &prv->tickled);
+    cpu_raise_softirq(cpu_to_tickle, SCHEDULE_SOFTIRQ);
+    return;
+}
+
+/*
+ * Should always wake up runnable vcpu, put it back to RunQ.
+ * Check priority to raise interrupt
+ * The lock is already grabbed in schedule.c, no need to lock here
+ */
+static void
+rt_vcpu_wake(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_vcpu * const svc = RT_VCPU(vc);
+    s_time_t now = NOW();
+
+    BUG_ON( is_idle_vcpu(vc) );
+
+    if ( unlikely(curr_on_cpu(vc->processor) == vc) )
+    {
+        SCHED_STAT_CRANK(vcpu_wake_running);
+        return;
+    }
+
+    /* on RunQ/DepletedQ, just update info is ok */
+    if ( unlikely(__vcpu_on_q(svc)) )
+    {
+        SCHED_STAT_CRANK(vcpu_wake_onrunq);
+        return;
+    }
+
+    if ( likely(vcpu_runnable(vc)) )
+        SCHED_STAT_CRANK(vcpu_wake_runnable);
+    else
+        SCHED_STAT_CRANK(vcpu_wake_not_runnable);
+
+    /*
+     * A blocked vcpu had no pending replenishment: bring its deadline up to
+     * date, keeping whatever budget it has left in the current period
+     * (deferrable server), and start tracking it again.
+     */
+    if ( now >= svc->cur_deadline )
+        rt_update_deadline(now, svc);
+    if ( !__vcpu_on_replq(svc) )
+        __replq_insert(ops, svc);
+
+    /*
+     * If context hasn't been saved for this vcpu yet, we can't put it on
+     * the Runqueue/DepletedQ. Instead, we set a flag so that it will be
+     * put on the Runqueue/DepletedQ after the context has been saved.
+     */
+    if ( unlikely(svc->flags & RTDS_scheduled) )
+    {
+        __set_bit(__RTDS_delayed_runq_add, &svc->flags);
+        return;
+    }
+
+    /* insert svc to runq/depletedq because svc is not in queue now */
+    __runq_insert(ops, svc);
+
+    if ( svc->cur_budget > 0 )
+        runq_tickle(ops, svc);
+}
+
+/*
+ * scurr has finished context switch, insert it back to the RunQ,
+ * and then pick the highest priority vcpu from runq to run
+ */
+static void
+rt_context_saved(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_vcpu *svc = RT_VCPU(vc);
+    spinlock_t *lock = vcpu_schedule_lock_irq(vc);
+
+    __clear_bit(__RTDS_scheduled, &svc->flags);
+    /* not insert idle vcpu to runq */
+    if ( is_idle_vcpu(vc) )
+        goto out;
+
+    if ( __test_and_clear_bit(__RTDS_delayed_runq_add, &svc->flags) &&
+         likely(vcpu_runnable(vc)) )
+    {
+        __runq_insert(ops, svc);
+        if ( svc->cur_budget > 0 )
+            runq_tickle(ops, svc);
+    }
+    else if ( !vcpu_runnable(vc) )
+        __replq_remove(ops, svc);
+
+ out:
+    vcpu_schedule_unlock_irq(lock, vc);
+}
+
+/*
+ * The replenishment timer handler: refill the budget of all the vcpus
+ * whose period ended, put them back in deadline order, and kick the pcpus
+ * that should now be running something else.  The timer is then armed
+ * for the next pending replenishment, if any.
+ */
+static void repl_timer_handler(void *data)
+{
+    const struct scheduler *ops = data;
+    struct rt_private *prv = RT_PRIV(ops);
+    struct list_head *replq = &prv->replq;
+    struct list_head *runq = &prv->runq;
+    struct list_head *iter, *tmp;
+    struct rt_vcpu *svc;
+    s_time_t now = NOW();
+    LIST_HEAD(tmp_replq);
+
+    spin_lock_irq(&prv->lock);
+
+    /*
+     * Do the replenishment and move replenished vcpus to the temporary
+     * list to tickle.
+     */
+    list_for_each_safe ( iter, tmp, replq )
+    {
+        svc = __replq_elem(iter);
+
+        if ( now < svc->cur_deadline )
+            break;
+
+        list_del_init(&svc->replq_elem);
+
+        /* Charge a running vcpu for what it used before refilling it. */
+        if ( curr_on_cpu(svc->vcpu->processor) == svc->vcpu )
+            burn_budget(ops, svc, now);
+
+        rt_update_deadline(now, svc);
+        list_add(&svc->replq_elem, &tmp_replq);
+
+        if ( __vcpu_on_q(svc) )
+        {
+            __q_remove(svc);
+            __runq_insert(ops, svc);
+        }
+    }
+
+    /*
+     * Iterate through the list of updated vcpus: queue them back for their
+     * next replenishment and tickle where needed.
+     */
+    list_for_each_safe ( iter, tmp, &tmp_replq )
+    {
+        svc = __replq_elem(iter);
+
+        list_del_init(&svc->replq_elem);
+        __replq_insert(ops, svc);
+
+        /*
+         * A running vcpu got a new budget (and a later deadline): its pcpu
+         * must rearm its scheduling timer, and maybe pick someone else.
+         */
+        if ( curr_on_cpu(svc->vcpu->processor) == svc->vcpu )
+        {
+            if ( !cpumask_test_cpu(svc->vcpu->processor, &prv->tickled) )
+            {
+                cpumask_set_cpu(svc->vcpu->processor, &prv->tickled);
+                cpu_raise_softirq(svc->vcpu->processor, SCHEDULE_SOFTIRQ);
+            }
+        }
+        else if ( __vcpu_on_q(svc) &&
+                  __test_and_clear_bit(__RTDS_depleted, &svc->flags) )
+            runq_tickle(ops, svc);
+    }
+
+    /* Waiting vcpus may now have an earlier deadline than running ones. */
+    if ( !list_empty(runq) )
+        runq_tickle(ops, __q_elem(runq->next));
+
+    /*
+     * __replq_insert() reprograms the timer only for a new head; make sure
+     * it is armed if the head did not change.
+     */
+    if ( !list_empty(replq) )
+        set_timer(&prv->repl_timer, __replq_elem(replq->next)->cur_deadline);
+
+    spin_unlock_irq(&prv->lock);
+}
+
+/*
+ * set/get each vcpu info of each domain
+ */
+static int
+rt_dom_cntl(
+    const struct scheduler *ops,
+    struct domain *d,
+    struct xen_domctl_scheduler_op *op)
+{
+    struct rt_private *prv = RT_PRIV(ops);
+    struct rt_dom * const sdom = RT_DOM(d);
+    struct rt_vcpu *svc;
+    struct list_head *iter;
+    unsigned long flags;
+    int rc = 0;
+
+    switch ( op->cmd )
+    {
+    case XEN_DOMCTL_SCHEDOP_getinfo:
+        spin_lock_irqsave(&prv->lock, flags);
+        if ( list_empty(&sdom->vcpu) )
+        {
+            op->u.rtds.period = RTDS_DEFAULT_PERIOD / MICROSECS(1);
+            op->u.rtds.budget = RTDS_DEFAULT_BUDGET / MICROSECS(1);
+        }
+        else
+        {
+            svc = list_entry(sdom->vcpu.next, struct rt_vcpu, sdom_elem);
+            op->u.rtds.period = svc->period / MICROSECS(1); /* transfer to us */
+            op->u.rtds.budget = svc->budget / MICROSECS(1);
+        }
+        spin_unlock_irqrestore(&prv->lock, flags);
+        break;
+    case XEN_DOMCTL_SCHEDOP_putinfo:
+        if ( op->u.rtds.period < RTDS_MIN_PERIOD_US ||
+             op->u.rtds.period > RTDS_MAX_PERIOD_US ||
+             op->u.rtds.budget == 0 ||
+             op->u.rtds.budget > op->u.rtds.period )
+        {
+            rc = -EINVAL;
+            break;
+        }
+        spin_lock_irqsave(&prv->lock, flags);
+        list_for_each( iter, &sdom->vcpu )
+        {
+            svc = list_entry(iter, struct rt_vcpu, sdom_elem);
+            svc->period = MICROSECS(op->u.rtds.period); /* transfer to nanosec */
+            svc->budget = MICROSECS(op->u.rtds.budget);
+            /* New parameters take effect at the next replenishment. */
+            if ( svc->cur_budget > svc->budget )
+                svc->cur_budget = svc->budget;
+        }
+        spin_unlock_irqrestore(&prv->lock, flags);
+        break;
+    }
+
+    return rc;
+}
+
+static struct rt_private _rt_priv;
+
+const struct scheduler sched_rtds_def = {
+    .name           = "SMP RTDS Scheduler",
+    .opt_name       = "rtds",
+    .sched_id       = XEN_SCHEDULER_RTDS,
+    .sched_data     = &_rt_priv,
+
+    .dump_cpu_state = rt_dump_pcpu,
+    .dump_settings  = rt_dump,
+    .init           = rt_init,
+    .deinit         = rt_deinit,
+    .alloc_pdata    = rt_alloc_pdata,
+    .free_pdata     = rt_free_pdata,
+    .alloc_domdata  = rt_alloc_domdata,
+    .free_domdata   = rt_free_domdata,
+    .init_domain    = rt_dom_init,
+    .destroy_domain = rt_dom_destroy,
+    .alloc_vdata    = rt_alloc_vdata,
+    .free_vdata     = rt_free_vdata,
+    .insert_vcpu    = rt_vcpu_insert,
+    .remove_vcpu    = rt_vcpu_remove,
+
+    .adjust         = rt_dom_cntl,
+
+    .pick_cpu       = rt_cpu_pick,
+    .do_schedule    = rt_schedule,
+    .sleep          = rt_vcpu_sleep,
+    .wake           = rt_vcpu_wake,
+    .context_saved  = rt_context_saved,
+};
@@ -69,6 +69,7 @@ static const struct scheduler *schedulers[] = {
     &sched_credit_def,
     &sched_credit2_def,
     &sched_arinc653_def,
+    &sched_rtds_def,
 };
 
 static struct scheduler __read_mostly ops;
@@ -1309,7 +1310,7 @@ static int cpu_schedule_up(unsigned int cpu)
     struct schedule_data *sd = &per_cpu(schedule_data, cpu);
 
     per_cpu(scheduler, cpu) = &ops;
-    spin_lock_init(&sd->_lock);
+    spin_lock_init_queued(&sd->_lock);
     sd->schedule_lock = &sd->_lock;
     sd->curr = idle_vcpu[cpu];
     init_timer(&sd->s_timer, s_timer_fn, NULL, cpu);
@@ -2,6 +2,8 @@
 #include <xen/config.h>
 #include <xen/irq.h>
 #include <xen/smp.h>
+#include <xen/numa.h>
+#include <xen/percpu.h>
 #include <xen/time.h>
 #include <xen/spinlock.h>
 #include <xen/guest_access.h>
@@ -10,6 +12,8 @@
 #include <asm/processor.h>
 #include <asm/atomic.h>
 
+#include "qspinlock.h"
+
 #ifndef NDEBUG
 
 static atomic_t spin_debug __read_mostly = ATOMIC_INIT(0);
@@ -115,16 +119,91 @@ void spin_debug_disable(void)
 
 #endif
 
+static DEFINE_PER_CPU(struct qspin_node[QSPIN_NODES], qspin_nodes);
+static DEFINE_PER_CPU(unsigned int, qspin_depth);
+
+static struct qspin_node *qspin_node(unsigned int cpu, unsigned int idx)
+{
+    return &per_cpu(qspin_nodes, cpu)[idx];
+}
+
+static unsigned int *qspin_depth(void)
+{
+    return &this_cpu(qspin_depth);
+}
+
+static always_inline spinlock_tickets_t observe_lock(spinlock_tickets_t *t)
+{
+    spinlock_tickets_t v;
+
+    smp_rmb();
+    v.head_tail = read_atomic(&t->head_tail);
+    return v;
+}
+
+static always_inline u16 observe_head(spinlock_tickets_t *t)
+{
+    smp_rmb();
+    return read_atomic(&t->head);
+}
+
+static always_inline int __spin_is_locked(spinlock_t *lock)
+{
+    spinlock_tickets_t v;
+
+    if ( lock->queued )
+        return queued_spin_is_locked(&lock->tickets);
+    v = observe_lock(&lock->tickets);
+    return v.head != v.tail;
+}
+
+static always_inline int __spin_trylock(spinlock_t *lock)
+{
+    spinlock_tickets_t old, new;
+
+    if ( lock->queued )
+        return queued_spin_trylock(&lock->tickets);
+
+    old = observe_lock(&lock->tickets);
+    if ( old.head != old.tail )
+        return 0;
+    new = old;
+    new.tail++;
+    return cmpxchg(&lock->tickets.head_tail,
+                   old.head_tail, new.head_tail) == old.head_tail;
+}
+
+/*
+ * Waiters are served in order, so a waiter cannot briefly re-enable
+ * interrupts the way the old test-and-set loop did: its ticket (or queue
+ * node) would stall everybody behind it.  The _irq and _irqsave variants
+ * therefore spin with interrupts disabled.
+ */
 void _spin_lock(spinlock_t *lock)
 {
+    spinlock_tickets_t tickets = { .tail = 1 };
     LOCK_PROFILE_VAR;
 
     check_lock(&lock->debug);
-    while ( unlikely(!_raw_spin_trylock(&lock->raw)) )
+    if ( lock->queued )
+    {
+        if ( unlikely(!queued_spin_trylock(&lock->tickets)) )
+        {
+            LOCK_PROFILE_BLOCK;
+            queued_spin_lock_slow(&lock->tickets);
+        }
+    }
+    else
     {
-        LOCK_PROFILE_BLOCK;
-        while ( likely(_raw_spin_is_locked(&lock->raw)) )
+        tickets.head_tail = arch_fetch_and_add(&lock->tickets.head_tail,
+                                               tickets.head_tail);
+        while ( tickets.tail != observe_head(&lock->tickets) )
+        {
+            LOCK_PROFILE_BLOCK;
             cpu_relax();
+        }
+        /* Keep the critical section from moving up past the wait. */
+        smp_mb();
     }
     LOCK_PROFILE_GOT;
     preempt_disable();
@@ -132,76 +211,56 @@ void _spin_lock(spinlock_t *lock)
 
 void _spin_lock_irq(spinlock_t *lock)
 {
-    LOCK_PROFILE_VAR;
-
     ASSERT(local_irq_is_enabled());
     local_irq_disable();
-    check_lock(&lock->debug);
-    while ( unlikely(!_raw_spin_trylock(&lock->raw)) )
-    {
-        LOCK_PROFILE_BLOCK;
-        local_irq_enable();
-        while ( likely(_raw_spin_is_locked(&lock->raw)) )
-            cpu_relax();
-        local_irq_disable();
-    }
-    LOCK_PROFILE_GOT;
-    preempt_disable();
+    _spin_lock(lock);
 }
 
 unsigned long _spin_lock_irqsave(spinlock_t *lock)
 {
     unsigned long flags;
-    LOCK_PROFILE_VAR;
 
     local_irq_save(flags);
-    check_lock(&lock->debug);
-    while ( unlikely(!_raw_spin_trylock(&lock->raw)) )
-    {
-        LOCK_PROFILE_BLOCK;
-        local_irq_restore(flags);
-        while ( likely(_raw_spin_is_locked(&lock->raw)) )
-            cpu_relax();
-        local_irq_save(flags);
-    }
-    LOCK_PROFILE_GOT;
-    preempt_disable();
+    _spin_lock(lock);
     return flags;
 }
 
 void _spin_unlock(spinlock_t *lock)
 {
+    ASSERT(__spin_is_locked(lock));
     preempt_enable();
     LOCK_PROFILE_REL;
-    _raw_spin_unlock(&lock->raw);
+    if ( lock->queued )
+        queued_spin_unlock(&lock->tickets);
+    else
+    {
+        smp_mb();
+        write_atomic(&lock->tickets.head, lock->tickets.head + 1);
+    }
 }
 
 void _spin_unlock_irq(spinlock_t *lock)
 {
-    preempt_enable();
-    LOCK_PROFILE_REL;
-    _raw_spin_unlock(&lock->raw);
+    _spin_unlock(lock);
     local_irq_enable();
 }
 
 void _spin_unlock_irqrestore(spinlock_t *lock, unsigned long flags)
 {
-    preempt_enable();
-    LOCK_PROFILE_REL;
-    _raw_spin_unlock(&lock->raw);
+    _spin_unlock(lock);
     local_irq_restore(flags);
 }
 
 int _spin_is_locked(spinlock_t *lock)
 {
     check_lock(&lock->debug);
-    return _raw_spin_is_locked(&lock->raw);
+    return __spin_is_locked(lock);
 }
 
 int _spin_trylock(spinlock_t *lock)
 {
     check_lock(&lock->debug);
-    if ( !_raw_spin_trylock(&lock->raw) )
+    if ( !__spin_trylock(lock) )
         return 0;
 #ifdef LOCK_PROFILE
     if (lock->profile)
@@ -213,21 +272,29 @@ int _spin_trylock(spinlock_t *lock)
 
 void _spin_barrier(spinlock_t *lock)
 {
+    spinlock_tickets_t sample;
 #ifdef LOCK_PROFILE
     s_time_t block = NOW();
-    u64      loop = 0;
+#endif
 
     check_barrier(&lock->debug);
-    do { smp_mb(); loop++;} while ( _raw_spin_is_locked(&lock->raw) );
-    if ((loop > 1) && lock->profile)
+    smp_mb();
+    sample = observe_lock(&lock->tickets);
+    if ( lock->queued ? sample.locked : sample.head != sample.tail )
     {
-        lock->profile->time_block += NOW() - block;
-        lock->profile->block_cnt++;
-    }
-#else
-    check_barrier(&lock->debug);
-    do { smp_mb(); } while ( _raw_spin_is_locked(&lock->raw) );
+        if ( lock->queued )
+            queued_spin_barrier(&lock->tickets);
+        else
+            while ( observe_head(&lock->tickets) == sample.head )
+                cpu_relax();
+#ifdef LOCK_PROFILE
+        if ( lock->profile )
+        {
+            lock->profile->time_block += NOW() - block;
+            lock->profile->block_cnt++;
+        }
 #endif
+    }
     smp_mb();
 }
 
@@ -256,8 +323,18 @@ int _spin_trylock_recursive(spinlock_t *lock)
 
 void _spin_lock_recursive(spinlock_t *lock)
 {
-    while ( !spin_trylock_recursive(lock) )
-        cpu_relax();
+    unsigned int cpu = smp_processor_id();
+
+    /* Queue up like any other locker rather than retrying trylock. */
+    if ( likely(lock->recurse_cpu != cpu) )
+    {
+        spin_lock(lock);
+        lock->recurse_cpu = cpu;
+    }
+
+    /* We support only fairly shallow recursion, else the counter overflows. */
+    ASSERT(lock->recurse_cnt < 0xfu);
+    lock->recurse_cnt++;
 }
 
 void _spin_unlock_recursive(spinlock_t *lock)
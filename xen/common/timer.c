@@ -44,6 +44,11 @@ static DEFINE_RCU_READ_LOCK(timer_cpu_read_lock);
 
 DEFINE_PER_CPU(s_time_t, timer_deadline);
 
+/* Timer interrupts taken on each CPU, and a snapshot for rate reporting. */
+static DEFINE_PER_CPU(unsigned long, timer_irqs);
+static DEFINE_PER_CPU(unsigned long, timer_irqs_last);
+static s_time_t timer_irqs_stamp;
+
 /****************************************************************************
  * HEAP OPERATIONS.
  */
@@ -437,6 +442,8 @@ static void timer_softirq_action(void)
     ts = &this_cpu(timers);
     heap = ts->heap;
 
+    this_cpu(timer_irqs)++;
+
     /* If we overflowed the heap, try to allocate a larger heap. */
     if ( unlikely(ts->list != NULL) )
     {
@@ -522,6 +529,9 @@ static void dump_timerq(unsigned char key)
     struct timers *ts;
     unsigned long  flags;
     s_time_t       now = NOW();
+    /* In ms, as irqs * SECONDS(1) could overflow. */
+    uint64_t       elapsed = (now - timer_irqs_stamp) / MILLISECS(1);
+    unsigned long  irqs;
     int            i, j;
 
     printk("Dumping timer queues:\n");
@@ -530,7 +540,12 @@ static void dump_timerq(unsigned char key)
     {
         ts = &per_cpu(timers, i);
 
-        printk("CPU%02d:\n", i);
+        /* Timer interrupt rate since the previous invocation of this key. */
+        irqs = per_cpu(timer_irqs, i) - per_cpu(timer_irqs_last, i);
+        per_cpu(timer_irqs_last, i) += irqs;
+
+        printk("CPU%02d: %lu timer irqs/s\n", i,
+               elapsed ? (unsigned long)(irqs * 1000ULL / elapsed) : 0);
         spin_lock_irqsave(&ts->lock, flags);
         for ( j = 1; j <= GET_HEAP_SIZE(ts->heap); j++ )
             dump_timer(ts->heap[j], now);
@@ -538,12 +553,14 @@ static void dump_timerq(unsigned char key)
             dump_timer(t, now);
         spin_unlock_irqrestore(&ts->lock, flags);
     }
+
+    timer_irqs_stamp = now;
 }
 
 static struct keyhandler dump_timerq_keyhandler = {
     .diagnostic = 1,
     .u.fn = dump_timerq,
-    .desc = "dump timer queues"
+    .desc = "dump timer queues and timer interrupt rates"
 };
 
 static void migrate_timers_from_cpu(unsigned int old_cpu)
@@ -23,6 +23,7 @@
 #include <xen/radix-tree.h>
 #include <xen/list.h>
 #include <xen/init.h>
+#include <xen/cpu.h>
 
 #define TMEM_SPEC_VERSION 1
 
@@ -42,7 +43,7 @@ static int global_pgp_count_max = 0;
 static int global_pcd_count_max = 0;
 static int global_page_count_max = 0;
 static int global_rtree_node_count_max = 0;
-static long global_eph_count_max = 0;
+static int global_eph_count_max = 0;
 static unsigned long failed_copies;
 static unsigned long pcd_tot_tze_size = 0;
 static unsigned long pcd_tot_csize = 0;
@@ -60,8 +61,8 @@ struct client {
     struct tmem_pool *pools[MAX_POOLS_PER_DOMAIN];
     struct domain *domain;
     struct xmem_pool *persistent_pool;
-    struct list_head ephemeral_page_list;
-    long eph_count, eph_count_max;
+    atomic_t eph_count;
+    int eph_count_max;
     domid_t cli_id;
     uint32_t weight;
     uint32_t cap;
@@ -79,6 +80,10 @@ struct client {
     uint64_t compressed_sum_size;
     uint64_t total_cycles;
     unsigned long succ_pers_puts, succ_eph_gets, succ_pers_gets;
+    unsigned long puts, gets;
+    /* puts and gets at the last listing, for the rates */
+    unsigned long stat_puts, stat_gets;
+    s_time_t stat_time;
     /* shared pool authentication */
     uint64_t shared_auth_uuid[MAX_GLOBAL_SHARED_POOLS][2];
 };
@@ -99,8 +104,9 @@ struct tmem_pool {
     struct client *client;
     uint64_t uuid[2]; /* 0 for private, non-zero for shared */
     uint32_t pool_id;
-    rwlock_t pool_rwlock;
-    struct rb_root obj_rb_root[OBJ_HASH_BUCKETS]; /* protected by pool_rwlock */
+    /* each hash bucket of objects is protected by its own lock */
+    rwlock_t obj_rwlocks[OBJ_HASH_BUCKETS];
+    struct rb_root obj_rb_root[OBJ_HASH_BUCKETS];
     struct list_head share_list; /* valid if shared */
     int shared_count; /* valid if shared */
     /* for save/restore/migration */
@@ -109,8 +115,8 @@ struct tmem_pool {
     /* statistics collection */
     atomic_t pgp_count;
     int pgp_count_max;
-    long obj_count;  /* atomicity depends on pool_rwlock held for write */
-    long obj_count_max;  
+    atomic_t obj_count;
+    int obj_count_max;
     unsigned long objnode_count, objnode_count_max;
     uint64_t sum_life_cycles;
     uint64_t sum_evicted_cycles;
@@ -130,7 +136,7 @@ struct oid {
 
 struct tmem_object_root {
     struct oid oid;
-    struct rb_node rb_tree_node; /* protected by pool->pool_rwlock */
+    struct rb_node rb_tree_node; /* protected by the obj_rwlocks[] bucket */
     unsigned long objnode_count; /* atomicity depends on obj_spinlock */
     long pgp_count; /* atomicity depends on obj_spinlock */
     struct radix_tree_root tree_root; /* tree of pages within object */
@@ -146,15 +152,12 @@ struct tmem_object_node {
 
 struct tmem_page_descriptor {
     union {
-        struct list_head global_eph_pages;
+        struct list_head lru_pages; /* ephemeral: eph_lru[lru_cpu] */
         struct list_head client_inv_pages;
     };
     union {
         struct {
-            union {
-                struct list_head client_eph_pages;
-                struct list_head pool_pers_pages;
-            };
+            struct list_head pool_pers_pages;
             struct tmem_object_root *obj;
         } us;
         struct oid inv_oid;  /* used for invalid list only */
@@ -162,9 +165,10 @@ struct tmem_page_descriptor {
     pagesize_t size; /* 0 == PAGE_SIZE (pfp), -1 == data invalid,
                     else compressed data (cdata) */
     uint32_t index;
-    /* must hold pcd_tree_rwlocks[firstbyte] to use pcd pointer/siblings */
-    uint16_t firstbyte; /* NON_SHAREABLE->pfp  otherwise->pcd */
+    /* must hold pcd_tree_rwlocks[pcd_bucket] to use pcd pointer/siblings */
+    uint16_t pcd_bucket; /* NON_SHAREABLE->pfp  otherwise->pcd */
     bool_t eviction_attempted;  /* CHANGE TO lifetimes? (settable) */
+    uint16_t lru_cpu;
     struct list_head pcd_siblings;
     union {
         struct page_info *pfp;  /* page frame pointer */
@@ -187,15 +191,32 @@ struct tmem_page_content_descriptor {
     };
     struct list_head pgp_list;
     struct rb_node pcd_rb_tree_node;
+    uint64_t hash; /* of the data, orders pcd_tree_roots[] before content */
     uint32_t pgp_ref_count;
     pagesize_t size; /* if compression_enabled -> 0<size<PAGE_SIZE (*cdata)
                      * else if tze, 0<=size<PAGE_SIZE, rounded up to mult of 8
                      * else PAGE_SIZE -> *pfp */
 };
-struct rb_root pcd_tree_roots[256]; /* choose based on first byte of page */
-rwlock_t pcd_tree_rwlocks[256]; /* poor man's concurrency for now */
+#define PCD_HASH_BUCKETS 1024 /* must be power of two */
+#define PCD_HASH_BUCKETS_MASK (PCD_HASH_BUCKETS-1)
 
-static LIST_HEAD(global_ephemeral_page_list); /* all pages in ephemeral pools */
+/* Page content descriptors, by hash of their content. */
+struct rb_root pcd_tree_roots[PCD_HASH_BUCKETS];
+rwlock_t pcd_tree_rwlocks[PCD_HASH_BUCKETS];
+
+/*
+ * Pages in ephemeral pools sit on the LRU list of the CPU which put them,
+ * so that puts and gets don't all serialise on one lock.  Eviction starts
+ * with the list whose head is oldest, which approximates a global LRU.
+ * The lists are not per-CPU data, as their locks must stay valid after a
+ * CPU went offline: its pages then move to another list.
+ */
+struct tmem_lru {
+    spinlock_t lock;
+    struct list_head pages;
+} __cacheline_aligned;
+
+static struct tmem_lru *eph_lru;
 
 static LIST_HEAD(global_client_list);
 
@@ -212,14 +233,13 @@ PAGE_LIST_HEAD(tmem_page_list);
 unsigned long tmem_page_list_pages = 0;
 
 DEFINE_RWLOCK(tmem_rwlock);
-static DEFINE_SPINLOCK(eph_lists_spinlock); /* protects global AND clients */
 static DEFINE_SPINLOCK(pers_lists_spinlock);
 
 #define ASSERT_SPINLOCK(_l) ASSERT(spin_is_locked(_l))
 #define ASSERT_WRITELOCK(_l) ASSERT(rw_is_write_locked(_l))
 
 /* global counters (should use long_atomic_t access) */
-static long global_eph_count = 0; /* atomicity depends on eph_lists_spinlock */
+static atomic_t global_eph_count = ATOMIC_INIT(0);
 static atomic_t global_obj_count = ATOMIC_INIT(0);
 static atomic_t global_pgp_count = ATOMIC_INIT(0);
 static atomic_t global_pcd_count = ATOMIC_INIT(0);
@@ -374,12 +394,12 @@ static void tmem_persistent_pool_page_put(void *page_va)
 
 static int pcd_copy_to_client(xen_pfn_t cmfn, struct tmem_page_descriptor *pgp)
 {
-    uint8_t firstbyte = pgp->firstbyte;
+    uint16_t pcd_bucket = pgp->pcd_bucket;
     struct tmem_page_content_descriptor *pcd;
     int ret;
 
     ASSERT(tmem_dedup_enabled());
-    read_lock(&pcd_tree_rwlocks[firstbyte]);
+    read_lock(&pcd_tree_rwlocks[pcd_bucket]);
     pcd = pgp->pcd;
     if ( pgp->size < PAGE_SIZE && pgp->size != 0 &&
          pcd->size < PAGE_SIZE && pcd->size != 0 )
@@ -389,7 +409,7 @@ static int pcd_copy_to_client(xen_pfn_t cmfn, struct tmem_page_descriptor *pgp)
         ret = tmem_copy_tze_to_client(cmfn, pcd->tze, pcd->size);
     else
         ret = tmem_copy_to_client(cmfn, pcd->pfp, tmem_cli_buf_null);
-    read_unlock(&pcd_tree_rwlocks[firstbyte]);
+    read_unlock(&pcd_tree_rwlocks[pcd_bucket]);
     return ret;
 }
 
@@ -399,7 +419,7 @@ static void pcd_disassociate(struct tmem_page_descriptor *pgp, struct tmem_pool
 {
     struct tmem_page_content_descriptor *pcd = pgp->pcd;
     struct page_info *pfp = pgp->pcd->pfp;
-    uint16_t firstbyte = pgp->firstbyte;
+    uint16_t pcd_bucket = pgp->pcd_bucket;
     char *pcd_tze = pgp->pcd->tze;
     pagesize_t pcd_size = pcd->size;
     pagesize_t pgp_size = pgp->size;
@@ -407,20 +427,20 @@ static void pcd_disassociate(struct tmem_page_descriptor *pgp, struct tmem_pool
     pagesize_t pcd_csize = pgp->pcd->size;
 
     ASSERT(tmem_dedup_enabled());
-    ASSERT(firstbyte != NOT_SHAREABLE);
-    ASSERT(firstbyte < 256);
+    ASSERT(pcd_bucket != NOT_SHAREABLE);
+    ASSERT(pcd_bucket < PCD_HASH_BUCKETS);
 
     if ( have_pcd_rwlock )
-        ASSERT_WRITELOCK(&pcd_tree_rwlocks[firstbyte]);
+        ASSERT_WRITELOCK(&pcd_tree_rwlocks[pcd_bucket]);
     else
-        write_lock(&pcd_tree_rwlocks[firstbyte]);
+        write_lock(&pcd_tree_rwlocks[pcd_bucket]);
     list_del_init(&pgp->pcd_siblings);
     pgp->pcd = NULL;
-    pgp->firstbyte = NOT_SHAREABLE;
+    pgp->pcd_bucket = NOT_SHAREABLE;
     pgp->size = -1;
     if ( --pcd->pgp_ref_count )
     {
-        write_unlock(&pcd_tree_rwlocks[firstbyte]);
+        write_unlock(&pcd_tree_rwlocks[pcd_bucket]);
         return;
     }
 
@@ -428,7 +448,7 @@ static void pcd_disassociate(struct tmem_page_descriptor *pgp, struct tmem_pool
     ASSERT(list_empty(&pcd->pgp_list));
     pcd->pfp = NULL;
     /* remove pcd from rbtree */
-    rb_erase(&pcd->pcd_rb_tree_node,&pcd_tree_roots[firstbyte]);
+    rb_erase(&pcd->pcd_rb_tree_node,&pcd_tree_roots[pcd_bucket]);
     /* reinit the struct for safety for now */
     RB_CLEAR_NODE(&pcd->pcd_rb_tree_node);
     /* now free up the pcd memory */
@@ -454,7 +474,7 @@ static void pcd_disassociate(struct tmem_page_descriptor *pgp, struct tmem_pool
             pcd_tot_csize -= PAGE_SIZE;
         tmem_free_page(pool,pfp);
     }
-    write_unlock(&pcd_tree_rwlocks[firstbyte]);
+    write_unlock(&pcd_tree_rwlocks[pcd_bucket]);
 }
 
 
@@ -465,7 +485,8 @@ static int pcd_associate(struct tmem_page_descriptor *pgp, char *cdata, pagesize
     struct tmem_page_content_descriptor *pcd;
     int cmp;
     pagesize_t pfp_size = 0;
-    uint8_t firstbyte = (cdata == NULL) ? tmem_get_first_byte(pgp->pfp) : *cdata;
+    uint64_t hash;
+    uint16_t pcd_bucket;
     int ret = 0;
 
     if ( !tmem_dedup_enabled() )
@@ -485,18 +506,29 @@ static int pcd_associate(struct tmem_page_descriptor *pgp, char *cdata, pagesize
         }
         ASSERT(pfp_size <= PAGE_SIZE);
         ASSERT(!(pfp_size & (sizeof(uint64_t)-1)));
+        /* bytes past pfp_size are zero, so leave them out of the hash */
+        hash = tmem_page_hash(pgp->pfp, pfp_size);
     }
-    write_lock(&pcd_tree_rwlocks[firstbyte]);
+    else
+        hash = tmem_hash_data(cdata, csize);
+    pcd_bucket = hash & PCD_HASH_BUCKETS_MASK;
+    write_lock(&pcd_tree_rwlocks[pcd_bucket]);
 
-    /* look for page match */
-    root = &pcd_tree_roots[firstbyte];
+    /*
+     * Look for page match.  The tree is ordered by hash first, so the
+     * contents only get compared against the (rare) entries whose hash is
+     * the same.
+     */
+    root = &pcd_tree_roots[pcd_bucket];
     new = &(root->rb_node);
     while ( *new )
     {
         pcd = container_of(*new, struct tmem_page_content_descriptor, pcd_rb_tree_node);
         parent = *new;
         /* compare new entry and rbtree entry, set cmp accordingly */
-        if ( cdata != NULL )
+        if ( hash != pcd->hash )
+            cmp = hash < pcd->hash ? -1 : 1;
+        else if ( cdata != NULL )
         {
             if ( pcd->size < PAGE_SIZE )
                 /* both new entry and rbtree entry are compressed */
@@ -553,6 +585,7 @@ static int pcd_associate(struct tmem_page_descriptor *pgp, char *cdata, pagesize
     atomic_inc_and_max(global_pcd_count);
     RB_CLEAR_NODE(&pcd->pcd_rb_tree_node);  /* is this necessary */
     INIT_LIST_HEAD(&pcd->pgp_list);  /* is this necessary */
+    pcd->hash = hash;
     pcd->pgp_ref_count = 0;
     if ( cdata != NULL )
     {
@@ -583,12 +616,12 @@ static int pcd_associate(struct tmem_page_descriptor *pgp, char *cdata, pagesize
 match:
     pcd->pgp_ref_count++;
     list_add(&pgp->pcd_siblings,&pcd->pgp_list);
-    pgp->firstbyte = firstbyte;
+    pgp->pcd_bucket = pcd_bucket;
     pgp->eviction_attempted = 0;
     pgp->pcd = pcd;
 
 unlock:
-    write_unlock(&pcd_tree_rwlocks[firstbyte]);
+    write_unlock(&pcd_tree_rwlocks[pcd_bucket]);
     return ret;
 }
 
@@ -606,12 +639,13 @@ static struct tmem_page_descriptor *pgp_alloc(struct tmem_object_root *obj)
     if ( (pgp = tmem_malloc(sizeof(struct tmem_page_descriptor), pool)) == NULL )
         return NULL;
     pgp->us.obj = obj;
-    INIT_LIST_HEAD(&pgp->global_eph_pages);
-    INIT_LIST_HEAD(&pgp->us.client_eph_pages);
+    INIT_LIST_HEAD(&pgp->lru_pages);
+    INIT_LIST_HEAD(&pgp->us.pool_pers_pages);
+    pgp->lru_cpu = smp_processor_id();
     pgp->pfp = NULL;
     if ( tmem_dedup_enabled() )
     {
-        pgp->firstbyte = NOT_SHAREABLE;
+        pgp->pcd_bucket = NOT_SHAREABLE;
         pgp->eviction_attempted = 0;
         INIT_LIST_HEAD(&pgp->pcd_siblings);
     }
@@ -637,7 +671,7 @@ static void pgp_free_data(struct tmem_page_descriptor *pgp, struct tmem_pool *po
 
     if ( pgp->pfp == NULL )
         return;
-    if ( tmem_dedup_enabled() && pgp->firstbyte != NOT_SHAREABLE )
+    if ( tmem_dedup_enabled() && pgp->pcd_bucket != NOT_SHAREABLE )
         pcd_disassociate(pgp,pool,0); /* pgp->size lost */
     else if ( pgp_size )
         tmem_free(pgp->cdata, pool);
@@ -670,8 +704,7 @@ static void pgp_free(struct tmem_page_descriptor *pgp)
     pool = pgp->us.obj->pool;
     if ( !is_persistent(pool) )
     {
-        ASSERT(list_empty(&pgp->global_eph_pages));
-        ASSERT(list_empty(&pgp->us.client_eph_pages));
+        ASSERT(list_empty(&pgp->lru_pages));
     }
     pgp_free_data(pgp, pool);
     atomic_dec_and_assert(global_pgp_count);
@@ -686,6 +719,52 @@ static void pgp_free(struct tmem_page_descriptor *pgp)
     __pgp_free(pgp, pool);
 }
 
+/*
+ * Lock the LRU list pgp is on.  Pages only change lists when a CPU goes
+ * offline, which happens under both locks, so recheck after locking.
+ */
+static struct tmem_lru *pgp_lru_lock(struct tmem_page_descriptor *pgp)
+{
+    struct tmem_lru *lru;
+
+    for ( ; ; )
+    {
+        lru = &eph_lru[pgp->lru_cpu];
+        spin_lock(&lru->lock);
+        if ( likely(lru == &eph_lru[pgp->lru_cpu]) )
+            return lru;
+        spin_unlock(&lru->lock);
+    }
+}
+
+/* put pgp at the tail (most recently used end) of this CPU's LRU list */
+static void pgp_lru_add(struct tmem_page_descriptor *pgp, struct client *client)
+{
+    unsigned int cpu = smp_processor_id();
+    struct tmem_lru *lru = &eph_lru[cpu];
+
+    spin_lock(&lru->lock);
+    pgp->lru_cpu = cpu;
+    list_add_tail(&pgp->lru_pages, &lru->pages);
+    spin_unlock(&lru->lock);
+    atomic_inc_and_max(global_eph_count);
+    atomic_inc_and_max(client->eph_count);
+}
+
+static void pgp_lru_del(struct tmem_page_descriptor *pgp, struct client *client)
+{
+    struct tmem_lru *lru = pgp_lru_lock(pgp);
+    bool_t listed = !list_empty(&pgp->lru_pages);
+
+    list_del_init(&pgp->lru_pages);
+    spin_unlock(&lru->lock);
+    if ( listed )
+    {
+        atomic_dec_and_assert(global_eph_count);
+        atomic_dec_and_assert(client->eph_count);
+    }
+}
+
 /* remove pgp from global/pool/client lists and free it */
 static void pgp_delist_free(struct tmem_page_descriptor *pgp)
 {
@@ -700,18 +779,7 @@ static void pgp_delist_free(struct tmem_page_descriptor *pgp)
 
     /* Delist pgp */
     if ( !is_persistent(pgp->us.obj->pool) )
-    {
-        spin_lock(&eph_lists_spinlock);
-        if ( !list_empty(&pgp->us.client_eph_pages) )
-            client->eph_count--;
-        ASSERT(client->eph_count >= 0);
-        list_del_init(&pgp->us.client_eph_pages);
-        if ( !list_empty(&pgp->global_eph_pages) )
-            global_eph_count--;
-        ASSERT(global_eph_count >= 0);
-        list_del_init(&pgp->global_eph_pages);
-        spin_unlock(&eph_lists_spinlock);
-    }
+        pgp_lru_del(pgp, client);
     else
     {
         if ( client->live_migrating )
@@ -850,13 +918,20 @@ static unsigned oid_hash(struct oid *oidp)
 }
 
 /* searches for object==oid in pool, returns locked object if found */
+/* the lock protecting the hash bucket of objects oidp belongs to */
+static inline rwlock_t *obj_rwlock(struct tmem_pool *pool, struct oid *oidp)
+{
+    return &pool->obj_rwlocks[oid_hash(oidp)];
+}
+
 static struct tmem_object_root * obj_find(struct tmem_pool *pool, struct oid *oidp)
 {
     struct rb_node *node;
     struct tmem_object_root *obj;
+    rwlock_t *lock = obj_rwlock(pool, oidp);
 
 restart_find:
-    read_lock(&pool->pool_rwlock);
+    read_lock(lock);
     node = pool->obj_rb_root[oid_hash(oidp)].rb_node;
     while ( node )
     {
@@ -866,10 +941,10 @@ restart_find:
             case 0: /* equal */
                 if ( !spin_trylock(&obj->obj_spinlock) )
                 {
-                    read_unlock(&pool->pool_rwlock);
+                    read_unlock(lock);
                     goto restart_find;
                 }
-                read_unlock(&pool->pool_rwlock);
+                read_unlock(lock);
                 return obj;
             case -1:
                 node = node->rb_left;
@@ -878,7 +953,7 @@ restart_find:
                 node = node->rb_right;
         }
     }
-    read_unlock(&pool->pool_rwlock);
+    read_unlock(lock);
     return NULL;
 }
 
@@ -894,13 +969,12 @@ static void obj_free(struct tmem_object_root *obj)
     pool = obj->pool;
     ASSERT(pool != NULL);
     ASSERT(pool->client != NULL);
-    ASSERT_WRITELOCK(&pool->pool_rwlock);
+    ASSERT_WRITELOCK(obj_rwlock(pool, &obj->oid));
     if ( obj->tree_root.rnode != NULL ) /* may be a "stump" with no leaves */
         radix_tree_destroy(&obj->tree_root, pgp_destroy);
     ASSERT((long)obj->objnode_count == 0);
     ASSERT(obj->tree_root.rnode == NULL);
-    pool->obj_count--;
-    ASSERT(pool->obj_count >= 0);
+    atomic_dec_and_assert(pool->obj_count);
     obj->pool = NULL;
     old_oid = obj->oid;
     oid_set_invalid(&obj->oid);
@@ -949,9 +1023,7 @@ static struct tmem_object_root * obj_alloc(struct tmem_pool *pool, struct oid *o
     ASSERT(pool != NULL);
     if ( (obj = tmem_malloc(sizeof(struct tmem_object_root), pool)) == NULL )
         return NULL;
-    pool->obj_count++;
-    if (pool->obj_count > pool->obj_count_max)
-        pool->obj_count_max = pool->obj_count;
+    atomic_inc_and_max(pool->obj_count);
     atomic_inc_and_max(global_obj_count);
     radix_tree_init(&obj->tree_root);
     radix_tree_set_alloc_callbacks(&obj->tree_root, rtn_alloc, rtn_free, obj);
@@ -967,7 +1039,7 @@ static struct tmem_object_root * obj_alloc(struct tmem_pool *pool, struct oid *o
 /* free an object after destroying any pgps in it */
 static void obj_destroy(struct tmem_object_root *obj)
 {
-    ASSERT_WRITELOCK(&obj->pool->pool_rwlock);
+    ASSERT_WRITELOCK(obj_rwlock(obj->pool, &obj->oid));
     radix_tree_destroy(&obj->tree_root, pgp_destroy);
     obj_free(obj);
 }
@@ -979,10 +1051,10 @@ static void pool_destroy_objs(struct tmem_pool *pool, domid_t cli_id)
     struct tmem_object_root *obj;
     int i;
 
-    write_lock(&pool->pool_rwlock);
     pool->is_dying = 1;
     for (i = 0; i < OBJ_HASH_BUCKETS; i++)
     {
+        write_lock(&pool->obj_rwlocks[i]);
         node = rb_first(&pool->obj_rb_root[i]);
         while ( node != NULL )
         {
@@ -994,8 +1066,8 @@ static void pool_destroy_objs(struct tmem_pool *pool, domid_t cli_id)
             else
                 spin_unlock(&obj->obj_spinlock);
         }
+        write_unlock(&pool->obj_rwlocks[i]);
     }
-    write_unlock(&pool->pool_rwlock);
 }
 
 
@@ -1009,9 +1081,11 @@ static struct tmem_pool * pool_alloc(void)
     if ( (pool = xzalloc(struct tmem_pool)) == NULL )
         return NULL;
     for (i = 0; i < OBJ_HASH_BUCKETS; i++)
+    {
         pool->obj_rb_root[i] = RB_ROOT;
+        rwlock_init(&pool->obj_rwlocks[i]);
+    }
     INIT_LIST_HEAD(&pool->persistent_page_list);
-    rwlock_init(&pool->pool_rwlock);
     return pool;
 }
 
@@ -1062,10 +1136,8 @@ static void shared_pool_reassign(struct tmem_pool *pool)
         if (new_client->pools[poolid] == pool)
             break;
     ASSERT(poolid != MAX_POOLS_PER_DOMAIN);
-    new_client->eph_count += _atomic_read(pool->pgp_count);
-    old_client->eph_count -= _atomic_read(pool->pgp_count);
-    list_splice_init(&old_client->ephemeral_page_list,
-                     &new_client->ephemeral_page_list);
+    atomic_add(_atomic_read(pool->pgp_count), &new_client->eph_count);
+    atomic_sub(_atomic_read(pool->pgp_count), &old_client->eph_count);
     tmem_client_info("reassigned shared pool from %s=%d to %s=%d pool_id=%d\n",
         tmem_cli_id_str, old_client->cli_id, tmem_cli_id_str, new_client->cli_id, poolid);
     pool->pool_id = poolid;
@@ -1178,8 +1250,8 @@ static struct client *client_create(domid_t cli_id)
     for ( i = 0; i < MAX_GLOBAL_SHARED_POOLS; i++)
         client->shared_auth_uuid[i][0] =
             client->shared_auth_uuid[i][1] = -1L;
+    client->stat_time = NOW();
     list_add_tail(&client->client_list, &global_client_list);
-    INIT_LIST_HEAD(&client->ephemeral_page_list);
     INIT_LIST_HEAD(&client->persistent_invalidated_list);
     tmem_client_info("ok\n");
     return client;
@@ -1215,23 +1287,25 @@ static void client_flush(struct client *client)
 static bool_t client_over_quota(struct client *client)
 {
     int total = _atomic_read(client_weight_total);
+    int eph_count = _atomic_read(client->eph_count);
 
     ASSERT(client != NULL);
-    if ( (total == 0) || (client->weight == 0) || 
-          (client->eph_count == 0) )
+    if ( (total == 0) || (client->weight == 0) || (eph_count == 0) )
         return 0;
-    return ( ((global_eph_count*100L) / client->eph_count ) >
+    return ( ((_atomic_read(global_eph_count)*100L) / eph_count ) >
              ((total*100L) / client->weight) );
 }
 
 /************ MEMORY REVOCATION ROUTINES *******************************/
 
-static bool_t tmem_try_to_evict_pgp(struct tmem_page_descriptor *pgp, bool_t *hold_pool_rwlock)
+static bool_t tmem_try_to_evict_pgp(struct tmem_page_descriptor *pgp,
+                                    struct tmem_lru *lru,
+                                    rwlock_t **obj_lock)
 {
     struct tmem_object_root *obj = pgp->us.obj;
     struct tmem_pool *pool = obj->pool;
-    struct client *client = pool->client;
-    uint16_t firstbyte = pgp->firstbyte;
+    uint16_t pcd_bucket = pgp->pcd_bucket;
+    rwlock_t *lock;
 
     if ( pool->is_dying )
         return 0;
@@ -1239,78 +1313,103 @@ static bool_t tmem_try_to_evict_pgp(struct tmem_page_descriptor *pgp, bool_t *ho
     {
         if ( tmem_dedup_enabled() )
         {
-            firstbyte = pgp->firstbyte;
-            if ( firstbyte ==  NOT_SHAREABLE )
+            pcd_bucket = pgp->pcd_bucket;
+            if ( pcd_bucket ==  NOT_SHAREABLE )
                 goto obj_unlock;
-            ASSERT(firstbyte < 256);
-            if ( !write_trylock(&pcd_tree_rwlocks[firstbyte]) )
+            ASSERT(pcd_bucket < PCD_HASH_BUCKETS);
+            if ( !write_trylock(&pcd_tree_rwlocks[pcd_bucket]) )
                 goto obj_unlock;
             if ( pgp->pcd->pgp_ref_count > 1 && !pgp->eviction_attempted )
             {
                 pgp->eviction_attempted++;
-                list_del(&pgp->global_eph_pages);
-                list_add_tail(&pgp->global_eph_pages,&global_ephemeral_page_list);
-                list_del(&pgp->us.client_eph_pages);
-                list_add_tail(&pgp->us.client_eph_pages,&client->ephemeral_page_list);
+                list_move_tail(&pgp->lru_pages, &lru->pages);
                 goto pcd_unlock;
             }
         }
         if ( obj->pgp_count > 1 )
             return 1;
-        if ( write_trylock(&pool->pool_rwlock) )
+        lock = obj_rwlock(pool, &obj->oid);
+        if ( write_trylock(lock) )
         {
-            *hold_pool_rwlock = 1;
+            *obj_lock = lock;
             return 1;
         }
 pcd_unlock:
         if ( tmem_dedup_enabled() )
-            write_unlock(&pcd_tree_rwlocks[firstbyte]);
+            write_unlock(&pcd_tree_rwlocks[pcd_bucket]);
 obj_unlock:
         spin_unlock(&obj->obj_spinlock);
     }
     return 0;
 }
 
+/* The CPU whose least recently used page is the oldest, if any. */
+static unsigned int eph_lru_oldest(void)
+{
+    struct tmem_page_descriptor *pgp;
+    unsigned int cpu, oldest = nr_cpu_ids;
+    uint64_t stamp = 0;
+
+    for_each_online_cpu ( cpu )
+    {
+        /* unlocked peek: the result only needs to be roughly right */
+        if ( list_empty(&eph_lru[cpu].pages) )
+            continue;
+        spin_lock(&eph_lru[cpu].lock);
+        if ( !list_empty(&eph_lru[cpu].pages) )
+        {
+            pgp = list_entry(eph_lru[cpu].pages.next,
+                             struct tmem_page_descriptor, lru_pages);
+            if ( oldest == nr_cpu_ids || pgp->timestamp < stamp )
+            {
+                oldest = cpu;
+                stamp = pgp->timestamp;
+            }
+        }
+        spin_unlock(&eph_lru[cpu].lock);
+    }
+    return oldest;
+}
+
 static int tmem_evict(void)
 {
     struct client *client = current->domain->tmem_client;
     struct tmem_page_descriptor *pgp = NULL, *pgp_del;
     struct tmem_object_root *obj;
     struct tmem_pool *pool;
+    struct tmem_lru *lru;
+    unsigned int first, cpu;
     int ret = 0;
-    bool_t hold_pool_rwlock = 0;
+    rwlock_t *obj_lock = NULL;
 
     evict_attempts++;
-    spin_lock(&eph_lists_spinlock);
-    if ( (client != NULL) && client_over_quota(client) &&
-         !list_empty(&client->ephemeral_page_list) )
-    {
-        list_for_each_entry(pgp, &client->ephemeral_page_list, us.client_eph_pages)
-            if ( tmem_try_to_evict_pgp(pgp, &hold_pool_rwlock) )
-                goto found;
-    }
-    else if ( !list_empty(&global_ephemeral_page_list) )
-    {
-        list_for_each_entry(pgp, &global_ephemeral_page_list, global_eph_pages)
-            if ( tmem_try_to_evict_pgp(pgp, &hold_pool_rwlock) )
-            {
-                client = pgp->us.obj->pool->client;
+    /* an over-quota client only evicts its own pages */
+    if ( (client != NULL) && !client_over_quota(client) )
+        client = NULL;
+    if ( (first = eph_lru_oldest()) >= nr_cpu_ids )
+        goto out;
+    cpu = first;
+    do {
+        lru = &eph_lru[cpu];
+        spin_lock(&lru->lock);
+        list_for_each_entry(pgp, &lru->pages, lru_pages)
+            if ( (client == NULL || pgp->us.obj->pool->client == client) &&
+                 tmem_try_to_evict_pgp(pgp, lru, &obj_lock) )
                 goto found;
-            }
-    }
-     /* global_ephemeral_page_list is empty, so we bail out. */
-    spin_unlock(&eph_lists_spinlock);
+        spin_unlock(&lru->lock);
+        if ( (cpu = cpumask_next(cpu, &cpu_online_map)) >= nr_cpu_ids )
+            cpu = cpumask_first(&cpu_online_map);
+    } while ( cpu != first );
+    /* no page could be evicted, so we bail out. */
     goto out;
 
 found:
     /* Delist */
-    list_del_init(&pgp->us.client_eph_pages);
-    client->eph_count--;
-    list_del_init(&pgp->global_eph_pages);
-    global_eph_count--;
-    ASSERT(global_eph_count >= 0);
-    ASSERT(client->eph_count >= 0);
-    spin_unlock(&eph_lists_spinlock);
+    list_del_init(&pgp->lru_pages);
+    spin_unlock(&lru->lock);
+    client = pgp->us.obj->pool->client;
+    atomic_dec_and_assert(global_eph_count);
+    atomic_dec_and_assert(client->eph_count);
 
     ASSERT(pgp != NULL);
     obj = pgp->us.obj;
@@ -1321,7 +1420,7 @@ found:
     ASSERT_SPINLOCK(&obj->obj_spinlock);
     pgp_del = pgp_delete_from_obj(obj, pgp->index);
     ASSERT(pgp_del == pgp);
-    if ( tmem_dedup_enabled() && pgp->firstbyte != NOT_SHAREABLE )
+    if ( tmem_dedup_enabled() && pgp->pcd_bucket != NOT_SHAREABLE )
     {
         ASSERT(pgp->pcd->pgp_ref_count == 1 || pgp->eviction_attempted);
         pcd_disassociate(pgp,pool,1);
@@ -1331,13 +1430,13 @@ found:
     pgp_free(pgp);
     if ( obj->pgp_count == 0 )
     {
-        ASSERT_WRITELOCK(&pool->pool_rwlock);
+        ASSERT_WRITELOCK(obj_lock);
         obj_free(obj);
     }
     else
         spin_unlock(&obj->obj_spinlock);
-    if ( hold_pool_rwlock )
-        write_unlock(&pool->pool_rwlock);
+    if ( obj_lock != NULL )
+        write_unlock(obj_lock);
     evicted_pgs++;
     ret = 1;
 out:
@@ -1510,9 +1609,11 @@ cleanup:
     pgp_delist_free(pgpfound);
     if ( obj->pgp_count == 0 )
     {
-        write_lock(&pool->pool_rwlock);
+        rwlock_t *lock = obj_rwlock(pool, &obj->oid);
+
+        write_lock(lock);
         obj_free(obj);
-        write_unlock(&pool->pool_rwlock);
+        write_unlock(lock);
     } else {
         spin_unlock(&obj->obj_spinlock);
     }
@@ -1527,6 +1628,7 @@ static int do_tmem_put(struct tmem_pool *pool,
     struct tmem_object_root *obj = NULL;
     struct tmem_page_descriptor *pgp = NULL;
     struct client *client;
+    rwlock_t *lock = obj_rwlock(pool, oidp);
     int ret, newobj = 0;
 
     ASSERT(pool != NULL);
@@ -1558,21 +1660,23 @@ refind:
         if ( (obj = obj_alloc(pool, oidp)) == NULL )
             return -ENOMEM;
 
-        write_lock(&pool->pool_rwlock);
+        write_lock(lock);
         /*
 	 * Parallel callers may already allocated obj and inserted to obj_rb_root
 	 * before us.
 	 */
         if (!obj_rb_insert(&pool->obj_rb_root[oid_hash(oidp)], obj))
         {
+            atomic_dec_and_assert(pool->obj_count);
+            atomic_dec_and_assert(global_obj_count);
             tmem_free(obj, pool);
-            write_unlock(&pool->pool_rwlock);
+            write_unlock(lock);
             goto refind;
         }
 
         spin_lock(&obj->obj_spinlock);
         newobj = 1;
-        write_unlock(&pool->pool_rwlock);
+        write_unlock(lock);
     }
 
     /* When arrive here, we have a spinlocked obj for use */
@@ -1629,18 +1733,7 @@ copy_uncompressed:
 
 insert_page:
     if ( !is_persistent(pool) )
-    {
-        spin_lock(&eph_lists_spinlock);
-        list_add_tail(&pgp->global_eph_pages,
-            &global_ephemeral_page_list);
-        if (++global_eph_count > global_eph_count_max)
-            global_eph_count_max = global_eph_count;
-        list_add_tail(&pgp->us.client_eph_pages,
-            &client->ephemeral_page_list);
-        if (++client->eph_count > client->eph_count_max)
-            client->eph_count_max = client->eph_count;
-        spin_unlock(&eph_lists_spinlock);
-    }
+        pgp_lru_add(pgp, client);
     else
     { /* is_persistent */
         spin_lock(&pers_lists_spinlock);
@@ -1674,9 +1767,9 @@ free_pgp:
 unlock_obj:
     if ( newobj )
     {
-        write_lock(&pool->pool_rwlock);
+        write_lock(lock);
         obj_free(obj);
-        write_unlock(&pool->pool_rwlock);
+        write_unlock(lock);
     }
     else
     {
@@ -1714,7 +1807,7 @@ static int do_tmem_get(struct tmem_pool *pool, struct oid *oidp, uint32_t index,
     }
     ASSERT(pgp->size != -1);
     if ( tmem_dedup_enabled() && !is_persistent(pool) &&
-              pgp->firstbyte != NOT_SHAREABLE )
+              pgp->pcd_bucket != NOT_SHAREABLE )
         rc = pcd_copy_to_client(cmfn, pgp);
     else if ( pgp->size != 0 )
     {
@@ -1732,18 +1825,16 @@ static int do_tmem_get(struct tmem_pool *pool, struct oid *oidp, uint32_t index,
             pgp_delist_free(pgp);
             if ( obj->pgp_count == 0 )
             {
-                write_lock(&pool->pool_rwlock);
+                write_lock(obj_rwlock(pool, oidp));
                 obj_free(obj);
                 obj = NULL;
-                write_unlock(&pool->pool_rwlock);
+                write_unlock(obj_rwlock(pool, oidp));
             }
         } else {
-            spin_lock(&eph_lists_spinlock);
-            list_del(&pgp->global_eph_pages);
-            list_add_tail(&pgp->global_eph_pages,&global_ephemeral_page_list);
-            list_del(&pgp->us.client_eph_pages);
-            list_add_tail(&pgp->us.client_eph_pages,&client->ephemeral_page_list);
-            spin_unlock(&eph_lists_spinlock);
+            struct tmem_lru *lru = pgp_lru_lock(pgp);
+
+            list_move_tail(&pgp->lru_pages, &lru->pages);
+            spin_unlock(&lru->lock);
             obj->last_client = current->domain->domain_id;
         }
     }
@@ -1782,9 +1873,9 @@ static int do_tmem_flush_page(struct tmem_pool *pool, struct oid *oidp, uint32_t
     pgp_delist_free(pgp);
     if ( obj->pgp_count == 0 )
     {
-        write_lock(&pool->pool_rwlock);
+        write_lock(obj_rwlock(pool, oidp));
         obj_free(obj);
-        write_unlock(&pool->pool_rwlock);
+        write_unlock(obj_rwlock(pool, oidp));
     } else {
         spin_unlock(&obj->obj_spinlock);
     }
@@ -1805,10 +1896,10 @@ static int do_tmem_flush_object(struct tmem_pool *pool, struct oid *oidp)
     obj = obj_find(pool,oidp);
     if ( obj == NULL )
         goto out;
-    write_lock(&pool->pool_rwlock);
+    write_lock(obj_rwlock(pool, oidp));
     obj_destroy(obj);
     pool->flush_objs_found++;
-    write_unlock(&pool->pool_rwlock);
+    write_unlock(obj_rwlock(pool, oidp));
 
 out:
     if ( pool->client->frozen )
@@ -2058,6 +2149,9 @@ static int tmemc_list_client(struct client *c, tmem_cli_va_param_t buf,
     int i, n = 0, sum = 0;
     struct tmem_pool *p;
     bool_t s;
+    s_time_t now = NOW();
+    uint64_t ms = (now - c->stat_time) / MILLISECS(1);
+    unsigned long puts = c->puts, gets = c->gets;
 
     n = scnprintf(info,BSIZE,"C=CI:%d,ww:%d,ca:%d,co:%d,fr:%d,"
         "Tc:%"PRIu64",Ge:%ld,Pp:%ld,Gp:%ld%c",
@@ -2065,11 +2159,20 @@ static int tmemc_list_client(struct client *c, tmem_cli_va_param_t buf,
         c->total_cycles, c->succ_eph_gets, c->succ_pers_puts, c->succ_pers_gets,
         use_long ? ',' : '\n');
     if (use_long)
+    {
         n += scnprintf(info+n,BSIZE-n,
-             "Ec:%ld,Em:%ld,cp:%ld,cb:%"PRId64",cn:%ld,cm:%ld\n",
-             c->eph_count, c->eph_count_max,
+             "Ec:%ld,Em:%ld,cp:%ld,cb:%"PRId64",cn:%ld,cm:%ld,"
+             "Pt:%lu,Gt:%lu,Pr:%lu,Gr:%lu\n",
+             (long)_atomic_read(c->eph_count), (long)c->eph_count_max,
              c->compressed_pages, c->compressed_sum_size,
-             c->compress_poor, c->compress_nomem);
+             c->compress_poor, c->compress_nomem, puts, gets,
+             /* rates per second since the last listing */
+             ms ? (unsigned long)((puts - c->stat_puts) * 1000ULL / ms) : 0,
+             ms ? (unsigned long)((gets - c->stat_gets) * 1000ULL / ms) : 0);
+        c->stat_puts = puts;
+        c->stat_gets = gets;
+        c->stat_time = now;
+    }
     if ( !copy_to_guest_offset(buf, off + sum, info, n + 1) )
         sum += n;
     for ( i = 0; i < MAX_POOLS_PER_DOMAIN; i++ )
@@ -2090,7 +2193,7 @@ static int tmemc_list_client(struct client *c, tmem_cli_va_param_t buf,
              "ps:%lu,pt:%lu,pd:%lu,pr:%lu,px:%lu,gs:%lu,gt:%lu,"
              "fs:%lu,ft:%lu,os:%lu,ot:%lu\n",
              _atomic_read(p->pgp_count), p->pgp_count_max,
-             p->obj_count, p->obj_count_max,
+             (long)_atomic_read(p->obj_count), (long)p->obj_count_max,
              p->objnode_count, p->objnode_count_max,
              p->good_puts, p->puts,p->dup_puts_flushed, p->dup_puts_replaced,
              p->no_mem_puts, 
@@ -2129,7 +2232,7 @@ static int tmemc_list_shared(tmem_cli_va_param_t buf, int off, uint32_t len,
              "ps:%lu,pt:%lu,pd:%lu,pr:%lu,px:%lu,gs:%lu,gt:%lu,"
              "fs:%lu,ft:%lu,os:%lu,ot:%lu\n",
              _atomic_read(p->pgp_count), p->pgp_count_max,
-             p->obj_count, p->obj_count_max,
+             (long)_atomic_read(p->obj_count), (long)p->obj_count_max,
              p->objnode_count, p->objnode_count_max,
              p->good_puts, p->puts,p->dup_puts_flushed, p->dup_puts_replaced,
              p->no_mem_puts, 
@@ -2177,7 +2280,7 @@ static int tmemc_list_global(tmem_cli_va_param_t buf, int off, uint32_t len,
         n += scnprintf(info+n,BSIZE-n,
           "Ec:%ld,Em:%ld,Oc:%d,Om:%d,Nc:%d,Nm:%d,Pc:%d,Pm:%d,"
           "Fc:%d,Fm:%d,Sc:%d,Sm:%d,Ep:%lu,Gd:%lu,Zt:%lu,Gz:%lu\n",
-          global_eph_count, global_eph_count_max,
+          (long)_atomic_read(global_eph_count), (long)global_eph_count_max,
           _atomic_read(global_obj_count), global_obj_count_max,
           _atomic_read(global_rtree_node_count), global_rtree_node_count_max,
           _atomic_read(global_pgp_count), global_pgp_count_max,
@@ -2618,16 +2721,60 @@ static int do_tmem_control(struct tmem_op *op)
 
 /************ EXPORTed FUNCTIONS **************************************/
 
+/*
+ * Page operations on an existing pool, under the read lock (or the write
+ * lock, for the first operation of a client).  Pools and clients can't come
+ * or go while it is held, so concurrent page operations only contend on the
+ * locks of the objects, hash buckets and LRU lists they touch.
+ */
+static int do_tmem_page_op(struct client *client, struct tmem_op *op)
+{
+    struct tmem_pool *pool;
+    struct oid *oidp = (struct oid *)&op->u.gen.oid[0];
+    int rc;
+
+    if ( ((uint32_t)op->pool_id >= MAX_POOLS_PER_DOMAIN) ||
+         ((pool = client->pools[op->pool_id]) == NULL) )
+    {
+        tmem_client_err("tmem: operation requested on uncreated pool\n");
+        return -ENODEV;
+    }
+
+    switch ( op->cmd )
+    {
+    case TMEM_PUT_PAGE:
+        client->puts++;
+        if ( tmem_ensure_avail_pages() )
+            rc = do_tmem_put(pool, oidp, op->u.gen.index, op->u.gen.cmfn,
+                             tmem_cli_buf_null);
+        else
+            rc = -ENOMEM;
+        break;
+    case TMEM_GET_PAGE:
+        client->gets++;
+        rc = do_tmem_get(pool, oidp, op->u.gen.index, op->u.gen.cmfn,
+                         tmem_cli_buf_null);
+        break;
+    case TMEM_FLUSH_PAGE:
+        rc = do_tmem_flush_page(pool, oidp, op->u.gen.index);
+        break;
+    case TMEM_FLUSH_OBJECT:
+        rc = do_tmem_flush_object(pool, oidp);
+        break;
+    default:
+        tmem_client_warn("tmem: op %d not implemented\n", op->cmd);
+        rc = -ENOSYS;
+        break;
+    }
+
+    return rc;
+}
+
 long do_tmem_op(tmem_cli_op_t uops)
 {
     struct tmem_op op;
     struct client *client = current->domain->tmem_client;
-    struct tmem_pool *pool = NULL;
-    struct oid *oidp;
     int rc = 0;
-    bool_t succ_get = 0, succ_put = 0;
-    bool_t non_succ_get = 0, non_succ_put = 0;
-    bool_t flush = 0, flush_obj = 0;
 
     if ( !tmem_initialized )
         return -ENODEV;
@@ -2650,7 +2797,20 @@ long do_tmem_op(tmem_cli_op_t uops)
         return -EFAULT;
     }
 
-    /* Acquire wirte lock for all command at first */
+    /* The common case, page operations of an existing client, only read. */
+    if ( client != NULL &&
+         (op.cmd == TMEM_PUT_PAGE || op.cmd == TMEM_GET_PAGE ||
+          op.cmd == TMEM_FLUSH_PAGE || op.cmd == TMEM_FLUSH_OBJECT) )
+    {
+        read_lock(&tmem_rwlock);
+        rc = do_tmem_page_op(client, &op);
+        read_unlock(&tmem_rwlock);
+        if ( rc < 0 )
+            errored_tmem_ops++;
+        return rc;
+    }
+
+    /* Everything else changes clients or pools, so needs the write lock. */
     write_lock(&tmem_rwlock);
 
     if ( op.cmd == TMEM_CONTROL )
@@ -2683,67 +2843,13 @@ long do_tmem_op(tmem_cli_op_t uops)
             }
         }
 
-        if ( op.cmd == TMEM_NEW_POOL || op.cmd == TMEM_DESTROY_POOL )
-        {
-            if ( op.cmd == TMEM_NEW_POOL )
-                rc = do_tmem_new_pool(TMEM_CLI_ID_NULL, 0, op.u.creat.flags,
-                                op.u.creat.uuid[0], op.u.creat.uuid[1]);
-	        else
-                rc = do_tmem_destroy_pool(op.pool_id);
-        }
+        if ( op.cmd == TMEM_NEW_POOL )
+            rc = do_tmem_new_pool(TMEM_CLI_ID_NULL, 0, op.u.creat.flags,
+                            op.u.creat.uuid[0], op.u.creat.uuid[1]);
+        else if ( op.cmd == TMEM_DESTROY_POOL )
+            rc = do_tmem_destroy_pool(op.pool_id);
         else
-        {
-            if ( ((uint32_t)op.pool_id >= MAX_POOLS_PER_DOMAIN) ||
-                 ((pool = client->pools[op.pool_id]) == NULL) )
-            {
-                tmem_client_err("tmem: operation requested on uncreated pool\n");
-                rc = -ENODEV;
-                goto out;
-            }
-            /* Commands only need read lock */
-            write_unlock(&tmem_rwlock);
-            read_lock(&tmem_rwlock);
-
-            oidp = (struct oid *)&op.u.gen.oid[0];
-            switch ( op.cmd )
-            {
-            case TMEM_NEW_POOL:
-            case TMEM_DESTROY_POOL:
-                BUG(); /* Done earlier. */
-                break;
-            case TMEM_PUT_PAGE:
-                if (tmem_ensure_avail_pages())
-                    rc = do_tmem_put(pool, oidp, op.u.gen.index, op.u.gen.cmfn,
-                                tmem_cli_buf_null);
-                else
-                    rc = -ENOMEM;
-                if (rc == 1) succ_put = 1;
-                else non_succ_put = 1;
-                break;
-            case TMEM_GET_PAGE:
-                rc = do_tmem_get(pool, oidp, op.u.gen.index, op.u.gen.cmfn,
-                                tmem_cli_buf_null);
-                if (rc == 1) succ_get = 1;
-                else non_succ_get = 1;
-                break;
-            case TMEM_FLUSH_PAGE:
-                flush = 1;
-                rc = do_tmem_flush_page(pool, oidp, op.u.gen.index);
-                break;
-            case TMEM_FLUSH_OBJECT:
-                rc = do_tmem_flush_object(pool, oidp);
-                flush_obj = 1;
-                break;
-            default:
-                tmem_client_warn("tmem: op %d not implemented\n", op.cmd);
-                rc = -ENOSYS;
-                break;
-            }
-            read_unlock(&tmem_rwlock);
-            if ( rc < 0 )
-                errored_tmem_ops++;
-            return rc;
-        }
+            rc = do_tmem_page_op(client, &op);
     }
 out:
     write_unlock(&tmem_rwlock);
@@ -2817,27 +2923,65 @@ unsigned long tmem_freeable_pages(void)
     return tmem_page_list_pages + _atomic_read(freeable_page_count);
 }
 
+/* hand the pages on the LRU list of an offlined CPU to the current one */
+static int cpu_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu, this_cpu = smp_processor_id();
+    struct tmem_lru *dead = &eph_lru[cpu], *live = &eph_lru[this_cpu];
+    struct tmem_page_descriptor *pgp;
+
+    if ( action != CPU_DEAD || cpu == this_cpu )
+        return NOTIFY_DONE;
+
+    /* lock in CPU order, the only place holding two of these locks */
+    spin_lock(cpu < this_cpu ? &dead->lock : &live->lock);
+    spin_lock(cpu < this_cpu ? &live->lock : &dead->lock);
+    list_for_each_entry(pgp, &dead->pages, lru_pages)
+        pgp->lru_cpu = this_cpu;
+    /* the dead CPU's pages are likely the older ones */
+    list_splice_init(&dead->pages, &live->pages);
+    spin_unlock(&live->lock);
+    spin_unlock(&dead->lock);
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_nfb = {
+    .notifier_call = cpu_callback
+};
+
 /* called at hypervisor startup */
 static int __init init_tmem(void)
 {
-    int i;
+    unsigned int i;
     if ( !tmem_enabled() )
         return 0;
 
     if ( tmem_dedup_enabled() )
-        for (i = 0; i < 256; i++ )
+        for (i = 0; i < PCD_HASH_BUCKETS; i++ )
         {
             pcd_tree_roots[i] = RB_ROOT;
             rwlock_init(&pcd_tree_rwlocks[i]);
         }
 
+    if ( (eph_lru = xzalloc_array(struct tmem_lru, nr_cpu_ids)) == NULL )
+        return 0;
+    for ( i = 0; i < nr_cpu_ids; i++ )
+    {
+        spin_lock_init(&eph_lru[i].lock);
+        INIT_LIST_HEAD(&eph_lru[i].pages);
+    }
+    register_cpu_notifier(&cpu_nfb);
+
     if ( !tmem_mempool_init() )
         return 0;
 
     if ( tmem_init() )
     {
-        printk("tmem: initialized comp=%d dedup=%d tze=%d\n",
-            tmem_compression_enabled(), tmem_dedup_enabled(), tmem_tze_enabled());
+        printk("tmem: initialized comp=%d (%s) dedup=%d tze=%d\n",
+            tmem_compression_enabled(), tmem_compressor(),
+            tmem_dedup_enabled(), tmem_tze_enabled());
         if ( tmem_dedup_enabled()&&tmem_compression_enabled()&&tmem_tze_enabled() )
         {
             tmem_tze_disable();
@@ -9,6 +9,7 @@
 #include <xen/tmem.h>
 #include <xen/tmem_xen.h>
 #include <xen/lzo.h> /* compression code */
+#include <xen/lz4.h>
 #include <xen/paging.h>
 #include <xen/domain_page.h>
 #include <xen/cpu.h>
@@ -18,7 +19,20 @@ bool_t __read_mostly opt_tmem = 0;
 boolean_param("tmem", opt_tmem);
 
 bool_t __read_mostly opt_tmem_compress = 0;
-boolean_param("tmem_compress", opt_tmem_compress);
+bool_t __read_mostly opt_tmem_compress_lz4 = 0;
+
+/* tmem_compress=<boolean> | lzo | lz4 */
+static void __init parse_tmem_compress(const char *s)
+{
+    if ( !strcmp(s, "lz4") || !strcmp(s, "lzo") )
+    {
+        opt_tmem_compress = 1;
+        opt_tmem_compress_lz4 = !strcmp(s, "lz4");
+    }
+    else
+        opt_tmem_compress = !!parse_bool(s);
+}
+custom_param("tmem_compress", parse_tmem_compress);
 
 bool_t __read_mostly opt_tmem_dedup = 0;
 boolean_param("tmem_dedup", opt_tmem_dedup);
@@ -31,10 +45,9 @@ boolean_param("tmem_shared_auth", opt_tmem_shared_auth);
 
 atomic_t freeable_page_count = ATOMIC_INIT(0);
 
-/* these are a concurrency bottleneck, could be percpu and dynamically
- * allocated iff opt_tmem_compress */
-#define LZO_WORKMEM_BYTES LZO1X_1_MEM_COMPRESS
-#define LZO_DSTMEM_PAGES 2
+/* Big enough for either compressor. */
+#define WORKMEM_BYTES max_t(size_t, LZO1X_1_MEM_COMPRESS, LZ4_MEM_COMPRESS)
+#define DSTMEM_PAGES 2
 static DEFINE_PER_CPU_READ_MOSTLY(unsigned char *, workmem);
 static DEFINE_PER_CPU_READ_MOSTLY(unsigned char *, dstmem);
 static DEFINE_PER_CPU_READ_MOSTLY(void *, scratch_page);
@@ -150,8 +163,17 @@ int tmem_compress_from_client(xen_pfn_t cmfn,
     else if ( copy_from_guest(scratch, clibuf, PAGE_SIZE) )
         return -EFAULT;
     smp_mb();
-    ret = lzo1x_1_compress(cli_va ?: scratch, PAGE_SIZE, dmem, out_len, wmem);
-    ASSERT(ret == LZO_E_OK);
+    if ( tmem_compress_lz4() )
+    {
+        ret = lz4_compress(cli_va ?: scratch, PAGE_SIZE, dmem, out_len, wmem);
+        ASSERT(ret == 0);
+    }
+    else
+    {
+        ret = lzo1x_1_compress(cli_va ?: scratch, PAGE_SIZE, dmem, out_len,
+                               wmem);
+        ASSERT(ret == LZO_E_OK);
+    }
     *out_va = dmem;
     if ( cli_va )
         cli_put_page(cli_va, cli_pfp, cli_mfn, 0);
@@ -194,7 +216,7 @@ int tmem_decompress_to_client(xen_pfn_t cmfn, void *tmem_va,
     struct page_info *cli_pfp = NULL;
     void *cli_va = NULL;
     char *scratch = this_cpu(scratch_page);
-    size_t out_len = PAGE_SIZE;
+    size_t out_len = PAGE_SIZE, in_len;
     int ret;
 
     if ( guest_handle_is_null(clibuf) )
@@ -205,9 +227,19 @@ int tmem_decompress_to_client(xen_pfn_t cmfn, void *tmem_va,
     }
     else if ( !scratch )
         return 0;
-    ret = lzo1x_decompress_safe(tmem_va, size, cli_va ?: scratch, &out_len);
-    ASSERT(ret == LZO_E_OK);
-    ASSERT(out_len == PAGE_SIZE);
+    if ( tmem_compress_lz4() )
+    {
+        ret = lz4_decompress(tmem_va, &in_len, cli_va ?: scratch, out_len);
+        ASSERT(ret == 0);
+        ASSERT(in_len == size);
+    }
+    else
+    {
+        ret = lzo1x_decompress_safe(tmem_va, size, cli_va ?: scratch,
+                                    &out_len);
+        ASSERT(ret == LZO_E_OK);
+        ASSERT(out_len == PAGE_SIZE);
+    }
     if ( cli_va )
         cli_put_page(cli_va, cli_pfp, cli_mfn, 1);
     else if ( copy_to_guest(clibuf, scratch, PAGE_SIZE) )
@@ -238,6 +270,62 @@ int tmem_copy_tze_to_client(xen_pfn_t cmfn, void *tmem_va,
     return 1;
 }
 
+/*
+ * 64-bit hash of page contents for the deduplication index: the rounds of
+ * xxHash64 over four independent lanes, so that a page hashes at close to
+ * memory bandwidth.  Not compatible with xxHash itself (no merge rounds).
+ */
+#define HASH_PRIME1 0x9e3779b185ebca87ULL
+#define HASH_PRIME2 0xc2b2ae3d27d4eb4fULL
+#define HASH_PRIME3 0x165667b19e3779f9ULL
+#define HASH_PRIME4 0x85ebca77c2b2ae63ULL
+#define HASH_PRIME5 0x27d4eb2f165667c5ULL
+
+static inline uint64_t hash_rotl(uint64_t x, unsigned int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+    return hash_rotl(acc + input * HASH_PRIME2, 31) * HASH_PRIME1;
+}
+
+uint64_t tmem_hash_data(const void *data, size_t len)
+{
+    const uint8_t *p = data, *end = p + len;
+    uint64_t v[4] = { HASH_PRIME1 + HASH_PRIME2, HASH_PRIME2, 0,
+                      -HASH_PRIME1 };
+    uint64_t h, w;
+    unsigned int i;
+
+    for ( ; p + 32 <= end; p += 32 )
+        for ( i = 0; i < 4; i++ )
+        {
+            memcpy(&w, p + i * 8, sizeof(w));
+            v[i] = hash_round(v[i], w);
+        }
+
+    h = hash_rotl(v[0], 1) + hash_rotl(v[1], 7) +
+        hash_rotl(v[2], 12) + hash_rotl(v[3], 18) + len;
+
+    for ( ; p + 8 <= end; p += 8 )
+    {
+        memcpy(&w, p, sizeof(w));
+        h = hash_rotl(h ^ hash_round(0, w), 27) * HASH_PRIME1 + HASH_PRIME4;
+    }
+    for ( ; p < end; p++ )
+        h = hash_rotl(h ^ (*p * HASH_PRIME5), 11) * HASH_PRIME1;
+
+    h ^= h >> 33;
+    h *= HASH_PRIME2;
+    h ^= h >> 29;
+    h *= HASH_PRIME3;
+    h ^= h >> 32;
+
+    return h;
+}
+
 /******************  XEN-SPECIFIC HOST INITIALIZATION ********************/
 static int dstmem_order, workmem_order;
 
@@ -291,8 +379,8 @@ int __init tmem_init(void)
 {
     unsigned int cpu;
 
-    dstmem_order = get_order_from_pages(LZO_DSTMEM_PAGES);
-    workmem_order = get_order_from_bytes(LZO1X_1_MEM_COMPRESS);
+    dstmem_order = get_order_from_pages(DSTMEM_PAGES);
+    workmem_order = get_order_from_bytes(WORKMEM_BYTES);
 
     for_each_online_cpu ( cpu )
     {
@@ -10,7 +10,7 @@
 
 #include "decompress.h"
 #include <xen/lz4.h>
-#include "lz4/decompress.c"
+#include "lz4/defs.h" /* lz4_decompress() is in lz4.c */
 
 /*
  * Note: Uncompressed chunk size is used in the compressor side
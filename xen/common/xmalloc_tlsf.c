@@ -24,9 +24,15 @@
  */
 
 #include <xen/config.h>
+#include <xen/cpu.h>
+#include <xen/init.h>
 #include <xen/irq.h>
+#include <xen/keyhandler.h>
 #include <xen/mm.h>
+#include <xen/numa.h>
+#include <xen/percpu.h>
 #include <xen/pfn.h>
+#include <xen/time.h>
 #include <asm/time.h>
 
 #define MAX_POOL_NAME_LEN       16
@@ -375,44 +381,21 @@ void xmem_pool_destroy(struct xmem_pool *pool)
     free_xenheap_pages(pool,pool_order);
 }
 
-void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
+/*
+ * Carve a block of SIZE bytes (already rounded) out of POOL's free lists.
+ * Called with the pool lock held; never grows the pool.
+ */
+static void *__xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
 {
-    struct bhdr *b, *b2, *next_b, *region;
+    struct bhdr *b, *b2, *next_b;
     int fl, sl;
     unsigned long tmp_size;
 
-    if ( pool->init_region == NULL )
-    {
-        if ( (region = pool->get_mem(pool->init_size)) == NULL )
-            goto out;
-        ADD_REGION(region, pool->init_size, pool);
-        pool->init_region = region;
-    }
-
-    size = (size < MIN_BLOCK_SIZE) ? MIN_BLOCK_SIZE : ROUNDUP_SIZE(size);
-    /* Rounding up the requested size and calculating fl and sl */
-
-    spin_lock(&pool->lock);
- retry_find:
     MAPPING_SEARCH(&size, &fl, &sl);
 
     /* Searching a free block */
     if ( !(b = FIND_SUITABLE_BLOCK(pool, &fl, &sl)) )
-    {
-        /* Not found */
-        if ( size > (pool->grow_size - 2 * BHDR_OVERHEAD) )
-            goto out_locked;
-        if ( pool->max_size && (pool->init_size +
-                                pool->num_regions * pool->grow_size
-                                > pool->max_size) )
-            goto out_locked;
-        spin_unlock(&pool->lock);
-        if ( (region = pool->get_mem(pool->grow_size)) == NULL )
-            goto out;
-        spin_lock(&pool->lock);
-        ADD_REGION(region, pool->grow_size, pool);
-        goto retry_find;
-    }
+        return NULL;
     EXTRACT_BLOCK_HDR(b, pool, fl, sl);
 
     /*-- found: */
@@ -442,8 +425,47 @@ void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
 
     pool->used_size += (b->size & BLOCK_SIZE_MASK) + BHDR_OVERHEAD;
 
-    spin_unlock(&pool->lock);
     return (void *)b->ptr.buffer;
+}
+
+void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
+{
+    struct bhdr *region;
+    unsigned long search;
+    int fl, sl;
+    void *p;
+
+    if ( pool->init_region == NULL )
+    {
+        if ( (region = pool->get_mem(pool->init_size)) == NULL )
+            goto out;
+        ADD_REGION(region, pool->init_size, pool);
+        pool->init_region = region;
+    }
+
+    size = (size < MIN_BLOCK_SIZE) ? MIN_BLOCK_SIZE : ROUNDUP_SIZE(size);
+    /* Rounding up the requested size and calculating fl and sl */
+    search = size;
+    MAPPING_SEARCH(&search, &fl, &sl);
+
+    spin_lock(&pool->lock);
+    while ( (p = __xmem_pool_alloc(size, pool)) == NULL )
+    {
+        /* Not found */
+        if ( search > (pool->grow_size - 2 * BHDR_OVERHEAD) )
+            goto out_locked;
+        if ( pool->max_size && (pool->init_size +
+                                pool->num_regions * pool->grow_size
+                                > pool->max_size) )
+            goto out_locked;
+        spin_unlock(&pool->lock);
+        if ( (region = pool->get_mem(pool->grow_size)) == NULL )
+            goto out;
+        spin_lock(&pool->lock);
+        ADD_REGION(region, pool->grow_size, pool);
+    }
+    spin_unlock(&pool->lock);
+    return p;
 
     /* Failed alloc */
  out_locked:
@@ -453,17 +475,14 @@ void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
     return NULL;
 }
 
-void xmem_pool_free(void *ptr, struct xmem_pool *pool)
+/* Return a block to POOL's free lists.  Called with the pool lock held. */
+static void __xmem_pool_free(void *ptr, struct xmem_pool *pool)
 {
     struct bhdr *b, *tmp_b;
     int fl = 0, sl = 0;
 
-    if ( unlikely(ptr == NULL) )
-        return;
-
     b = (struct bhdr *)((char *) ptr - BHDR_OVERHEAD);
 
-    spin_lock(&pool->lock);
     b->size |= FREE_BLOCK;
     pool->used_size -= (b->size & BLOCK_SIZE_MASK) + BHDR_OVERHEAD;
     b->ptr.free_ptr = (struct free_ptr) { NULL, NULL};
@@ -492,14 +511,22 @@ void xmem_pool_free(void *ptr, struct xmem_pool *pool)
         pool->put_mem(b);
         pool->num_regions--;
         pool->used_size -= BHDR_OVERHEAD; /* sentinel block header */
-        goto out;
+        return;
     }
 
     INSERT_BLOCK(b, pool, fl, sl);
 
     tmp_b->size |= PREV_FREE;
     tmp_b->prev_hdr = b;
- out:
+}
+
+void xmem_pool_free(void *ptr, struct xmem_pool *pool)
+{
+    if ( unlikely(ptr == NULL) )
+        return;
+
+    spin_lock(&pool->lock);
+    __xmem_pool_free(ptr, pool);
     spin_unlock(&pool->lock);
 }
 
@@ -510,21 +537,87 @@ int xmem_pool_maxalloc(struct xmem_pool *pool)
 
 /*
  * Glue for xmalloc().
+ *
+ * There is one pool per NUMA node, grown with memory from that node, and
+ * allocations are served from the pool of the node the caller runs on (a
+ * node whose pool cannot be created uses node 0's).  The owning node of
+ * each pool page is kept in its PFN_ORDER() field, which is otherwise only
+ * used for whole-page allocations.
  */
 
-static struct xmem_pool *xenpool;
+static struct xmem_pool *xenpool[MAX_NUMNODES];
+
+static unsigned int xmalloc_node(void)
+{
+    unsigned int node = cpu_to_node(smp_processor_id());
+
+    return node < MAX_NUMNODES ? node : 0;
+}
 
 static void *xmalloc_pool_get(unsigned long size)
 {
+    unsigned int node = xmalloc_node();
+    void *p;
+
     ASSERT(size == PAGE_SIZE);
-    return alloc_xenheap_page();
+    p = alloc_xenheap_pages(0, MEMF_node(node));
+    if ( p )
+        PFN_ORDER(virt_to_page(p)) = node;
+    return p;
 }
 
 static void xmalloc_pool_put(void *p)
 {
+    PFN_ORDER(virt_to_page(p)) = 0;
     free_xenheap_page(p);
 }
 
+/* Node whose pool the block at P belongs to. */
+static inline unsigned int block_node(const void *p)
+{
+    return PFN_ORDER(virt_to_page(p));
+}
+
+static inline unsigned long block_size(const void *p)
+{
+    const struct bhdr *b = (const struct bhdr *)((const char *)p -
+                                                 BHDR_OVERHEAD);
+
+    return b->size & BLOCK_SIZE_MASK;
+}
+
+static struct xmem_pool *xmalloc_pool(unsigned int node)
+{
+    struct xmem_pool *pool = xenpool[node];
+    char name[MAX_POOL_NAME_LEN];
+
+    if ( likely(pool != NULL) )
+        return pool;
+
+    snprintf(name, sizeof(name), "xmalloc-node%u", node);
+    pool = xmem_pool_create(name, xmalloc_pool_get, xmalloc_pool_put,
+                            PAGE_SIZE, 0, PAGE_SIZE);
+    if ( pool == NULL )
+    {
+        /*
+         * Fall back to node 0's pool for good.  Pages it gains on this
+         * node are tagged with this node, so xenpool[node] must name the
+         * pool they were added to.
+         */
+        BUG_ON(!node);
+        pool = xmalloc_pool(0);
+        if ( cmpxchgptr(&xenpool[node], NULL, pool) != NULL )
+            pool = xenpool[node];
+        return pool;
+    }
+    if ( cmpxchgptr(&xenpool[node], NULL, pool) != NULL )
+    {
+        xmem_pool_destroy(pool);
+        pool = xenpool[node];
+    }
+    return pool;
+}
+
 static void *xmalloc_whole_pages(unsigned long size, unsigned long align)
 {
     unsigned int i, order;
@@ -550,16 +643,464 @@ static void *xmalloc_whole_pages(unsigned long size, unsigned long align)
     return res;
 }
 
+
+/*
+ * Per-CPU object caches.
+ *
+ * Freed blocks of small sizes are kept in per-CPU magazines and handed out
+ * again without touching the pools, so most xmalloc()/xfree() pairs take no
+ * lock.  A magazine only holds blocks from the local node's pool: blocks
+ * freed on another node are collected separately and given back to their
+ * pool a batch at a time.  An empty magazine is refilled, and a full one
+ * half emptied, with one acquisition of the pool lock.
+ *
+ * xmalloc() uses a cache per size class.  Subsystems can create their own
+ * caches for frequently allocated objects, which gives them separate
+ * statistics ('x' key).
+ */
+
+#define XMEM_MAG_BYTES      4096    /* cached bytes per CPU and cache */
+#define XMEM_MAG_MIN        4
+#define XMEM_MAG_MAX        32
+#define XMEM_REMOTE_BATCH   16
+
+struct xmem_magazine {
+    unsigned int nr, max;
+    unsigned int nr_remote;
+    void *objs[XMEM_MAG_MAX];
+    void *remote[XMEM_REMOTE_BATCH];
+
+    /* Statistics */
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long refills;          /* allocations which missed */
+    unsigned long flushes;          /* frees which overflowed */
+    unsigned long remote_frees;     /* frees of other nodes' blocks */
+} __cacheline_aligned;
+
+struct xmem_cache {
+    struct list_head list;
+    char name[MAX_POOL_NAME_LEN];
+    unsigned long size;             /* block size requested from TLSF */
+    unsigned long align;
+    unsigned int mag_max;
+    struct xmem_magazine *mags;     /* per CPU; NULL for xmalloc classes */
+};
+
+static const unsigned short xmalloc_class_size[] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+#define XMALLOC_CLASSES ARRAY_SIZE(xmalloc_class_size)
+
+static struct xmem_cache xmalloc_classes[XMALLOC_CLASSES];
+static DEFINE_PER_CPU(struct xmem_magazine [XMALLOC_CLASSES], xmalloc_mags);
+
+static LIST_HEAD(cache_list);
+static DEFINE_SPINLOCK(cache_list_lock);
+
+static struct xmem_magazine *cache_mag(struct xmem_cache *c,
+                                       unsigned int cpu)
+{
+    if ( c->mags )
+        return &c->mags[cpu];
+    return &per_cpu(xmalloc_mags, cpu)[c - xmalloc_classes];
+}
+
+static void cache_setup(struct xmem_cache *c, const char *name,
+                        unsigned long size, unsigned long align)
+{
+    strlcpy(c->name, name, sizeof(c->name));
+    c->size = ROUNDUP_SIZE(max_t(unsigned long, size, MIN_BLOCK_SIZE));
+    c->align = align;
+    c->mag_max = max_t(unsigned int, XMEM_MAG_MIN,
+                       min_t(unsigned long, XMEM_MAG_MAX,
+                             XMEM_MAG_BYTES / c->size));
+}
+
 static void tlsf_init(void)
 {
+    char name[MAX_POOL_NAME_LEN];
+    unsigned int i;
+
     INIT_LIST_HEAD(&pool_list_head);
     spin_lock_init(&pool_list_lock);
-    xenpool = xmem_pool_create(
-        "xmalloc", xmalloc_pool_get, xmalloc_pool_put,
-        PAGE_SIZE, 0, PAGE_SIZE);
-    BUG_ON(!xenpool);
+    xmalloc_pool(0);
+
+    for ( i = 0; i < XMALLOC_CLASSES; i++ )
+    {
+        snprintf(name, sizeof(name), "xmalloc-%u", xmalloc_class_size[i]);
+        cache_setup(&xmalloc_classes[i], name, xmalloc_class_size[i],
+                    MEM_ALIGN);
+    }
+}
+
+/* The smallest xmalloc class blocks of SIZE bytes can be allocated from. */
+static struct xmem_cache *xmalloc_class(unsigned long size)
+{
+    unsigned int i;
+
+    for ( i = 0; i < XMALLOC_CLASSES; i++ )
+        if ( size <= xmalloc_class_size[i] )
+            return &xmalloc_classes[i];
+    return NULL;
+}
+
+/*
+ * The largest xmalloc class a block of SIZE bytes can serve.  Blocks above
+ * the largest class are only cached if they may have come from it (TLSF
+ * does not split off remainders smaller than a block header).
+ */
+static struct xmem_cache *xmalloc_block_class(unsigned long size)
+{
+    unsigned int i;
+
+    if ( size < xmalloc_class_size[0] ||
+         size >= xmalloc_class_size[XMALLOC_CLASSES - 1] +
+                 sizeof(struct bhdr) )
+        return NULL;
+    for ( i = 1; i < XMALLOC_CLASSES; i++ )
+        if ( size < xmalloc_class_size[i] )
+            break;
+    return &xmalloc_classes[i - 1];
+}
+
+/* Give blocks back to the pools they came from, one lock hold per pool. */
+static void free_blocks(void **objs, unsigned int nr)
+{
+    struct xmem_pool *pool;
+    unsigned int i, node;
+
+    while ( nr )
+    {
+        node = block_node(objs[0]);
+        pool = xenpool[node];
+        spin_lock(&pool->lock);
+        for ( i = 0; i < nr; )
+        {
+            if ( block_node(objs[i]) != node )
+            {
+                i++;
+                continue;
+            }
+            __xmem_pool_free(objs[i], pool);
+            objs[i] = objs[--nr];
+        }
+        spin_unlock(&pool->lock);
+    }
+}
+
+static void *cache_refill(struct xmem_cache *c, struct xmem_magazine *m)
+{
+    struct xmem_pool *pool = xmalloc_pool(xmalloc_node());
+    void *obj;
+
+    m->refills++;
+
+    spin_lock(&pool->lock);
+    while ( m->nr < m->max / 2 &&
+            (obj = __xmem_pool_alloc(c->size, pool)) != NULL )
+        m->objs[m->nr++] = obj;
+    spin_unlock(&pool->lock);
+
+    if ( m->nr )
+        return m->objs[--m->nr];
+
+    /* The pool needs to grow first. */
+    return xmem_pool_alloc(c->size, pool);
+}
+
+static void *cache_alloc(struct xmem_cache *c)
+{
+    struct xmem_magazine *m = cache_mag(c, smp_processor_id());
+
+    if ( unlikely(!m->max) )
+        m->max = c->mag_max;
+    m->allocs++;
+    if ( likely(m->nr) )
+        return m->objs[--m->nr];
+    return cache_refill(c, m);
+}
+
+static void cache_free(struct xmem_cache *c, void *obj)
+{
+    struct xmem_magazine *m = cache_mag(c, smp_processor_id());
+    unsigned int half;
+
+    if ( unlikely(!m->max) )
+        m->max = c->mag_max;
+    m->frees++;
+
+    if ( unlikely(block_node(obj) != xmalloc_node()) )
+    {
+        m->remote_frees++;
+        m->remote[m->nr_remote++] = obj;
+        if ( m->nr_remote == XMEM_REMOTE_BATCH )
+        {
+            free_blocks(m->remote, m->nr_remote);
+            m->nr_remote = 0;
+        }
+        return;
+    }
+
+    if ( unlikely(m->nr == m->max) )
+    {
+        /* Keep the most recently freed (cache hot) half. */
+        m->flushes++;
+        half = m->max / 2;
+        free_blocks(m->objs, half);
+        memmove(m->objs, m->objs + half, (m->nr - half) * sizeof(void *));
+        m->nr -= half;
+    }
+    m->objs[m->nr++] = obj;
+}
+
+static void cache_drain(struct xmem_cache *c, unsigned int cpu)
+{
+    struct xmem_magazine *m = cache_mag(c, cpu);
+
+    free_blocks(m->objs, m->nr);
+    m->nr = 0;
+    free_blocks(m->remote, m->nr_remote);
+    m->nr_remote = 0;
+}
+
+/* Alignment padding: a fake block header records the padding's size. */
+static void *xmalloc_pad(void *p, unsigned long align)
+{
+    u32 pad = -(long)p & (align - 1);
+
+    if ( pad )
+    {
+        char *q = (char *)p + pad;
+        struct bhdr *b = (struct bhdr *)(q - BHDR_OVERHEAD);
+        ASSERT(q > (char *)p);
+        b->size = pad | 1;
+        p = q;
+    }
+
+    ASSERT(((unsigned long)p & (align - 1)) == 0);
+    return p;
+}
+
+static void *xmalloc_unpad(void *p)
+{
+    struct bhdr *b = (struct bhdr *)((char *) p - BHDR_OVERHEAD);
+
+    if ( b->size & 1 )
+    {
+        p = (char *)p - (b->size & ~1u);
+        b = (struct bhdr *)((char *)p - BHDR_OVERHEAD);
+        ASSERT(!(b->size & 1));
+    }
+    return p;
 }
 
+struct xmem_cache *xmem_cache_create(
+    const char *name, unsigned long size, unsigned long align)
+{
+    struct xmem_cache *c;
+
+    ASSERT((align & (align - 1)) == 0);
+    if ( align < MEM_ALIGN )
+        align = MEM_ALIGN;
+    size += align - MEM_ALIGN;
+    if ( size > PAGE_SIZE - 2 * sizeof(struct bhdr) )
+        return NULL;
+
+    c = xzalloc(struct xmem_cache);
+    if ( c == NULL )
+        return NULL;
+    c->mags = xzalloc_array(struct xmem_magazine, nr_cpu_ids);
+    if ( c->mags == NULL )
+    {
+        xfree(c);
+        return NULL;
+    }
+    cache_setup(c, name, size, align);
+
+    spin_lock(&cache_list_lock);
+    list_add_tail(&c->list, &cache_list);
+    spin_unlock(&cache_list_lock);
+
+    return c;
+}
+
+void xmem_cache_destroy(struct xmem_cache *c)
+{
+    unsigned int cpu;
+
+    if ( c == NULL )
+        return;
+
+    spin_lock(&cache_list_lock);
+    list_del(&c->list);
+    spin_unlock(&cache_list_lock);
+
+    for ( cpu = 0; cpu < nr_cpu_ids; cpu++ )
+        cache_drain(c, cpu);
+    xfree(c->mags);
+    xfree(c);
+}
+
+void *xmem_cache_alloc(struct xmem_cache *c)
+{
+    void *p;
+
+    ASSERT(!in_irq());
+
+    p = cache_alloc(c);
+    return p ? xmalloc_pad(p, c->align) : NULL;
+}
+
+void xmem_cache_free(struct xmem_cache *c, void *p)
+{
+    if ( p == NULL )
+        return;
+
+    ASSERT(!in_irq());
+
+    p = xmalloc_unpad(p);
+    /* Tolerate blocks which came from plain xmalloc(). */
+    if ( unlikely(block_size(p) < c->size) )
+        free_blocks(&p, 1);
+    else
+        cache_free(c, p);
+}
+
+static int cpu_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu, i;
+    struct xmem_cache *c;
+
+    if ( action != CPU_DEAD )
+        return NOTIFY_DONE;
+
+    for ( i = 0; i < XMALLOC_CLASSES; i++ )
+        cache_drain(&xmalloc_classes[i], cpu);
+    spin_lock(&cache_list_lock);
+    list_for_each_entry ( c, &cache_list, list )
+        cache_drain(c, cpu);
+    spin_unlock(&cache_list_lock);
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_nfb = {
+    .notifier_call = cpu_callback
+};
+
+static void dump_cache(struct xmem_cache *c)
+{
+    unsigned long allocs = 0, frees = 0, refills = 0, flushes = 0;
+    unsigned long remote = 0, cached = 0;
+    struct xmem_magazine *m;
+    unsigned int cpu;
+
+    for_each_online_cpu ( cpu )
+    {
+        m = cache_mag(c, cpu);
+        allocs += m->allocs;
+        frees += m->frees;
+        refills += m->refills;
+        flushes += m->flushes;
+        remote += m->remote_frees;
+        cached += m->nr + m->nr_remote;
+    }
+
+    if ( !allocs && !frees )
+        return;
+
+    printk("%-16s %5lu %12lu %12lu %4lu%% %4lu%% %10lu %6lu\n",
+           c->name, c->size, allocs, frees,
+           allocs ? (allocs - refills) * 100 / allocs : 0,
+           frees ? remote * 100 / frees : 0, flushes, cached);
+}
+
+static void dump_xmalloc_caches(unsigned char key)
+{
+    struct xmem_cache *c;
+    unsigned int i;
+
+    printk("'%c' pressed -> dumping xmalloc cache statistics\n", key);
+
+    for ( i = 0; i < MAX_NUMNODES; i++ )
+        if ( xenpool[i] && (!i || xenpool[i] != xenpool[0]) )
+            printk("pool %-16s used %lukB of %lukB\n", xenpool[i]->name,
+                   xmem_pool_get_used_size(xenpool[i]) >> 10,
+                   xmem_pool_get_total_size(xenpool[i]) >> 10);
+
+    printk("%-16s %5s %12s %12s %5s %5s %10s %6s\n", "cache", "size",
+           "allocs", "frees", "hit", "rmt", "flushes", "held");
+    for ( i = 0; i < XMALLOC_CLASSES; i++ )
+        dump_cache(&xmalloc_classes[i]);
+    spin_lock(&cache_list_lock);
+    list_for_each_entry ( c, &cache_list, list )
+        dump_cache(c);
+    spin_unlock(&cache_list_lock);
+}
+
+static struct keyhandler dump_xmalloc_caches_keyhandler = {
+    .diagnostic = 1,
+    .u.fn = dump_xmalloc_caches,
+    .desc = "dump xmalloc cache statistics"
+};
+
+#ifndef NDEBUG
+/*
+ * Time alloc/free pairs through the caches against the pool alone, with a
+ * working set large enough to make the magazines refill and flush.
+ */
+static void __init xmalloc_benchmark(void)
+{
+    static const unsigned int sizes[] = { 32, 128, 512, 2048 };
+    enum { ROUNDS = 64, DEPTH = 64 };
+    struct xmem_pool *pool = xmalloc_pool(xmalloc_node());
+    void *objs[DEPTH];
+    unsigned int i, j, r;
+    s_time_t t, cached, direct;
+
+    for ( i = 0; i < ARRAY_SIZE(sizes); i++ )
+    {
+        t = NOW();
+        for ( r = 0; r < ROUNDS; r++ )
+        {
+            for ( j = 0; j < DEPTH; j++ )
+                objs[j] = _xmalloc(sizes[i], MEM_ALIGN);
+            for ( j = 0; j < DEPTH; j++ )
+                xfree(objs[j]);
+        }
+        cached = NOW() - t;
+
+        t = NOW();
+        for ( r = 0; r < ROUNDS; r++ )
+        {
+            for ( j = 0; j < DEPTH; j++ )
+                objs[j] = xmem_pool_alloc(sizes[i], pool);
+            for ( j = 0; j < DEPTH; j++ )
+                xmem_pool_free(objs[j], pool);
+        }
+        direct = NOW() - t;
+
+        printk(XENLOG_DEBUG "xmalloc: %4u bytes: %lu ns/pair cached, "
+               "%lu ns/pair from pool\n", sizes[i],
+               (unsigned long)(cached / (ROUNDS * DEPTH)),
+               (unsigned long)(direct / (ROUNDS * DEPTH)));
+    }
+}
+#else
+static inline void xmalloc_benchmark(void) {}
+#endif
+
+static int __init xmalloc_cache_init(void)
+{
+    register_cpu_notifier(&cpu_nfb);
+    register_keyhandler('x', &dump_xmalloc_caches_keyhandler);
+    xmalloc_benchmark();
+    return 0;
+}
+__initcall(xmalloc_cache_init);
+
 /*
  * xmalloc()
  */
@@ -571,8 +1112,8 @@ static void tlsf_init(void)
 
 void *_xmalloc(unsigned long size, unsigned long align)
 {
+    struct xmem_cache *c;
     void *p = NULL;
-    u32 pad;
 
     ASSERT(!in_irq());
 
@@ -584,26 +1125,17 @@ void *_xmalloc(unsigned long size, unsigned long align)
         align = MEM_ALIGN;
     size += align - MEM_ALIGN;
 
-    if ( !xenpool )
+    if ( !xenpool[0] )
         tlsf_init();
 
-    if ( size < PAGE_SIZE )
-        p = xmem_pool_alloc(size, xenpool);
+    if ( (c = xmalloc_class(size)) != NULL )
+        p = cache_alloc(c);
+    else if ( size < PAGE_SIZE )
+        p = xmem_pool_alloc(size, xmalloc_pool(xmalloc_node()));
     if ( p == NULL )
         return xmalloc_whole_pages(size - align + MEM_ALIGN, align);
 
-    /* Add alignment padding. */
-    if ( (pad = -(long)p & (align - 1)) != 0 )
-    {
-        char *q = (char *)p + pad;
-        struct bhdr *b = (struct bhdr *)(q - BHDR_OVERHEAD);
-        ASSERT(q > (char *)p);
-        b->size = pad | 1;
-        p = q;
-    }
-
-    ASSERT(((unsigned long)p & (align - 1)) == 0);
-    return p;
+    return xmalloc_pad(p, align);
 }
 
 void *_xzalloc(unsigned long size, unsigned long align)
@@ -615,7 +1147,7 @@ void *_xzalloc(unsigned long size, unsigned long align)
 
 void xfree(void *p)
 {
-    struct bhdr *b;
+    struct xmem_cache *c;
 
     if ( p == NULL || p == ZERO_BLOCK_PTR )
         return;
@@ -641,13 +1173,10 @@ void xfree(void *p)
     }
 
     /* Strip alignment padding. */
-    b = (struct bhdr *)((char *) p - BHDR_OVERHEAD);
-    if ( b->size & 1 )
-    {
-        p = (char *)p - (b->size & ~1u);
-        b = (struct bhdr *)((char *)p - BHDR_OVERHEAD);
-        ASSERT(!(b->size & 1));
-    }
+    p = xmalloc_unpad(p);
 
-    xmem_pool_free(p, xenpool);
+    if ( (c = xmalloc_block_class(block_size(p))) != NULL )
+        cache_free(c, p);
+    else
+        free_blocks(&p, 1);
 }
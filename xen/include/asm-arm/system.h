@@ -36,6 +36,9 @@
 #define xchg(ptr,x) \
         ((__typeof__(*(ptr)))__xchg((unsigned long)(x),(ptr),sizeof(*(ptr))))
 
+/* Add x to *ptr and return the previous value.  Implies a full barrier. */
+#define arch_fetch_and_add(ptr, x) __sync_fetch_and_add(ptr, x)
+
 /*
  * This is used to ensure the compiler did actually allocate the register we
  * asked it for some inline assembly sequences.  Apparently we can't trust
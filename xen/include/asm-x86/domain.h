@@ -37,36 +37,41 @@ struct trap_bounce {
     unsigned long eip;
 };
 
-#define MAPHASH_ENTRIES 8
-#define MAPHASH_HASHFN(pfn) ((pfn) & (MAPHASH_ENTRIES-1))
+#define MAPHASH_ENTRIES 16
+#define MAPHASH_WAYS 2
+#define MAPHASH_SETS (MAPHASH_ENTRIES / MAPHASH_WAYS)
+#define MAPHASH_HASHFN(pfn) (((pfn) & (MAPHASH_SETS-1)) * MAPHASH_WAYS)
 #define MAPHASHENT_NOTINUSE ((u32)~0U)
+/* Hits after which an entry stays pinned in the maphash until decayed. */
+#define MAPHASH_HOT 4
 struct mapcache_vcpu {
-    /* Shadow of mapcache_domain.epoch. */
-    unsigned int shadow_epoch;
+    /*
+     * Each vCPU owns MAPCACHE_VCPU_ENTRIES slots of the map area, which only
+     * it ever touches, so none of this needs a lock: disabling interrupts
+     * is enough.
+     */
+    unsigned int cursor;
+
+    /* Ticks on every lookup; stamps hash entries for LRU replacement. */
+    unsigned int clock;
+
+    /* Which slots are in use, and which are garbage to reap at next wrap? */
+    unsigned long inuse[BITS_TO_LONGS(MAPCACHE_VCPU_ENTRIES)];
+    unsigned long garbage[BITS_TO_LONGS(MAPCACHE_VCPU_ENTRIES)];
 
-    /* Lock-free per-VCPU hash of recently-used mappings. */
+    /* Set-associative per-VCPU hash of recently-used mappings. */
     struct vcpu_maphash_entry {
         unsigned long mfn;
         uint32_t      idx;
         uint32_t      refcnt;
+        uint32_t      stamp;
+        uint32_t      hits;
     } hash[MAPHASH_ENTRIES];
 };
 
 struct mapcache_domain {
-    /* The number of array entries, and a cursor into the array. */
-    unsigned int entries;
-    unsigned int cursor;
-
-    /* Protects map_domain_page(). */
-    spinlock_t lock;
-
-    /* Garbage mappings are flushed from TLBs in batches called 'epochs'. */
-    unsigned int epoch;
-    u32 tlbflush_timestamp;
-
-    /* Which mappings are in use, and which are garbage to reap next epoch? */
-    unsigned long *inuse;
-    unsigned long *garbage;
+    /* Does map_domain_page() go through the mapcache for this domain? */
+    bool_t enabled;
 };
 
 int mapcache_domain_init(struct domain *);
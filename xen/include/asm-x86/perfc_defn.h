@@ -29,6 +29,9 @@ PERFCOUNTER(page_faults,            "page faults")
 PERFCOUNTER(copy_user_faults,       "copy_user faults")
 
 PERFCOUNTER(map_domain_page_count,  "map_domain_page count")
+PERFCOUNTER(map_domain_page_hit,    "map_domain_page maphash hits")
+PERFCOUNTER(map_domain_page_miss,   "map_domain_page maphash misses")
+PERFCOUNTER(mapcache_wrap,          "mapcache wraps")
 PERFCOUNTER(ptwr_emulations,        "writable pt emulations")
 
 PERFCOUNTER(exception_fixed,        "pre-exception fixed")
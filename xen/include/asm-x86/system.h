@@ -117,6 +117,42 @@ static always_inline unsigned long __cmpxchg(
                                    (unsigned long)__n,sizeof(*(ptr)))); \
 })
 
+/*
+ * Atomic fetch-and-add.  Add V to *PTR and return the value *PTR held
+ * beforehand.  Implies a full barrier.
+ */
+static always_inline unsigned long __xadd(
+    volatile void *ptr, unsigned long v, int size)
+{
+    switch ( size )
+    {
+    case 1:
+        asm volatile ( "lock; xaddb %b0,%1"
+                       : "+q" (v), "+m" (*__xg((volatile void *)ptr))
+                       :: "memory" );
+        break;
+    case 2:
+        asm volatile ( "lock; xaddw %w0,%1"
+                       : "+r" (v), "+m" (*__xg((volatile void *)ptr))
+                       :: "memory" );
+        break;
+    case 4:
+        asm volatile ( "lock; xaddl %k0,%1"
+                       : "+r" (v), "+m" (*__xg((volatile void *)ptr))
+                       :: "memory" );
+        break;
+    case 8:
+        asm volatile ( "lock; xaddq %q0,%1"
+                       : "+r" (v), "+m" (*__xg((volatile void *)ptr))
+                       :: "memory" );
+        break;
+    }
+    return v;
+}
+
+#define arch_fetch_and_add(ptr, v) \
+    ((__typeof__(*(ptr)))__xadd((ptr), (unsigned long)(v), sizeof(*(ptr))))
+
 /*
  * Both Intel and AMD agree that, from a programmer's viewpoint:
  *  Loads cannot be reordered relative to other loads.
@@ -74,6 +74,7 @@
 #define EVTCHNOP_init_control    11
 #define EVTCHNOP_expand_array    12
 #define EVTCHNOP_set_priority    13
+#define EVTCHNOP_send_batch      14
 /* ` } */
 
 typedef uint32_t evtchn_port_t;
@@ -308,6 +309,20 @@ struct evtchn_set_priority {
 };
 typedef struct evtchn_set_priority evtchn_set_priority_t;
 
+/*
+ * EVTCHNOP_send_batch: Send an event on each of the <nr_ports> local ports
+ * listed in <ports>, as if by EVTCHNOP_send.  Ports are processed in order
+ * and processing stops at the first port which fails; notifications to the
+ * same remote vCPU are coalesced into a single upcall.
+ */
+#define EVTCHN_SEND_BATCH_MAX 64
+struct evtchn_send_batch {
+    /* IN parameters. */
+    uint32_t nr_ports;
+    evtchn_port_t ports[EVTCHN_SEND_BATCH_MAX];
+};
+typedef struct evtchn_send_batch evtchn_send_batch_t;
+
 /*
  * ` enum neg_errnoval
  * ` HYPERVISOR_event_channel_op_compat(struct evtchn_op *op)
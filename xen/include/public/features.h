@@ -94,6 +94,9 @@
 /* operation as Dom0 is supported */
 #define XENFEAT_dom0                      11
 
+/* GTF_superpage grants can be mapped with GNTMAP_superpage. */
+#define XENFEAT_gnttab_superpage          12
+
 #define XENFEAT_NR_SUBMAPS 1
 
 #endif /* __XEN_PUBLIC_FEATURES_H__ */
@@ -172,6 +172,13 @@ typedef struct grant_entry_v1 grant_entry_v1_t;
  *  GTF_sub_page: Grant access to only a subrange of the page.  @domid
  *                will only be allowed to copy from the grant, and not
  *                map it. [GST]
+ *  GTF_superpage: (v2 full-page grants only) Grant access to the
+ *                 GNTTAB_SUPERPAGE_FRAMES frames starting at @frame, which
+ *                 must be naturally aligned and contiguous in machine
+ *                 memory.  @domid may only map the grant, all at once and
+ *                 with GNTMAP_superpage, and not copy from or to it.  The
+ *                 cache attribute flags must be clear.  Only supported if
+ *                 XENFEAT_gnttab_superpage is set. [GST]
  */
 #define _GTF_readonly       (2)
 #define GTF_readonly        (1U<<_GTF_readonly)
@@ -187,6 +194,11 @@ typedef struct grant_entry_v1 grant_entry_v1_t;
 #define GTF_PAT             (1U<<_GTF_PAT)
 #define _GTF_sub_page       (8)
 #define GTF_sub_page        (1U<<_GTF_sub_page)
+#define _GTF_superpage      (9)
+#define GTF_superpage       (1U<<_GTF_superpage)
+
+#define GNTTAB_SUPERPAGE_ORDER  9
+#define GNTTAB_SUPERPAGE_FRAMES (1U << GNTTAB_SUPERPAGE_ORDER)
 
 /*
  * Subflags for GTF_accept_transfer:
@@ -607,6 +619,15 @@ DEFINE_XEN_GUEST_HANDLE(gnttab_swap_grant_ref_t);
 #define _GNTMAP_can_fail        (5)
 #define GNTMAP_can_fail         (1<<_GNTMAP_can_fail)
 
+ /*
+  * GNTMAP_host_map subflag, for GTF_superpage grants (which need it):
+  *  1 => Map all GNTTAB_SUPERPAGE_FRAMES frames of the grant, contiguously
+  *       from <host_addr>, which must be aligned to the size of the region.
+  *       Device mappings and GNTMAP_contains_pte are not supported.
+  */
+#define _GNTMAP_superpage       (6)
+#define GNTMAP_superpage        (1<<_GNTMAP_superpage)
+
 /*
  * Bits to be placed in guest kernel available PTE bits (architecture
  * dependent; only supported when XENFEAT_gnttab_map_avail_bits is set).
@@ -45,6 +45,15 @@ void send_guest_pirq(struct domain *, const struct pirq *);
 /* Send a notification from a given domain's event-channel port. */
 int evtchn_send(struct domain *d, unsigned int lport);
 
+/*
+ * Batched notification.  Between evtchn_batch_begin() and evtchn_batch_end()
+ * port ops may defer the upcall for a VCPU (evtchn_batch_defer()) and are
+ * asked to deliver it through their flush hook when the batch ends.
+ */
+void evtchn_batch_begin(void);
+void evtchn_batch_end(void);
+bool_t evtchn_batch_defer(struct vcpu *v);
+
 /* Bind a local event-channel port to the specified VCPU. */
 long evtchn_bind_vcpu(unsigned int port, unsigned int vcpu_id);
 
@@ -141,6 +150,7 @@ struct evtchn_port_ops {
     int (*set_priority)(struct domain *d, struct evtchn *evtchn,
                         unsigned int priority);
     void (*print_state)(struct domain *d, const struct evtchn *evtchn);
+    void (*flush)(struct vcpu *v);
 };
 
 static inline void evtchn_port_init(struct domain *d, struct evtchn *evtchn)
@@ -188,6 +198,12 @@ static inline int evtchn_port_set_priority(struct domain *d,
     return d->evtchn_port_ops->set_priority(d, evtchn, priority);
 }
 
+static inline void evtchn_port_flush(struct vcpu *v)
+{
+    if ( v->domain->evtchn_port_ops->flush )
+        v->domain->evtchn_port_ops->flush(v);
+}
+
 static inline void evtchn_port_print_state(struct domain *d,
                                            const struct evtchn *evtchn)
 {
@@ -53,4 +53,8 @@ PERFCOUNTER(vcpu_hot,               "csched: vcpu_hot")
 
 PERFCOUNTER(need_flush_tlb_flush,   "PG_need_flush tlb flushes")
 
+PERFCOUNTER(evtchn_send_batch,      "evtchn: send_batch calls")
+PERFCOUNTER(evtchn_send_batch_ports, "evtchn: send_batch ports")
+PERFCOUNTER(evtchn_fifo_suppressed, "evtchn: fifo notifications suppressed")
+
 /*#endif*/ /* __XEN_PERFC_DEFN_H__ */
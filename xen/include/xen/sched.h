@@ -249,6 +249,9 @@ struct vcpu
 
     struct evtchn_fifo_vcpu *evtchn_fifo;
 
+    /* 2-level ABI: selector bits held back while an event batch is open. */
+    DECLARE_BITMAP(evtchn_2l_pending_sel, BITS_PER_XEN_ULONG);
+
     struct arch_vcpu arch;
 };
 
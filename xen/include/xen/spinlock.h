@@ -80,25 +80,30 @@ struct lock_profile_qhead {
     static struct lock_profile *__lock_profile_##name                         \
     __used_section(".lockprofile.data") =                                     \
     &__lock_profile_data_##name
-#define _SPIN_LOCK_UNLOCKED(x) { _RAW_SPIN_LOCK_UNLOCKED, 0xfffu, 0,          \
-                                 _LOCK_DEBUG, x }
-#define SPIN_LOCK_UNLOCKED _SPIN_LOCK_UNLOCKED(NULL)
-#define DEFINE_SPINLOCK(l)                                                    \
-    spinlock_t l = _SPIN_LOCK_UNLOCKED(NULL);                                 \
+#define _SPIN_LOCK_UNLOCKED(x, q) { .recurse_cpu = 0xfffu, .queued = q,      \
+                                    .debug = _LOCK_DEBUG, .profile = x }
+#define SPIN_LOCK_UNLOCKED _SPIN_LOCK_UNLOCKED(NULL, 0)
+#define QUEUED_SPIN_LOCK_UNLOCKED _SPIN_LOCK_UNLOCKED(NULL, 1)
+#define _DEFINE_SPINLOCK(l, q)                                                \
+    spinlock_t l = _SPIN_LOCK_UNLOCKED(NULL, q);                              \
     static struct lock_profile __lock_profile_data_##l = _LOCK_PROFILE(l);    \
     _LOCK_PROFILE_PTR(l)
+#define DEFINE_SPINLOCK(l) _DEFINE_SPINLOCK(l, 0)
+#define DEFINE_QUEUED_SPINLOCK(l) _DEFINE_SPINLOCK(l, 1)
 
-#define spin_lock_init_prof(s, l)                                             \
+#define _spin_lock_init_prof(s, l, q)                                         \
     do {                                                                      \
         struct lock_profile *prof;                                            \
         prof = xzalloc(struct lock_profile);                                  \
         if (!prof) break;                                                     \
         prof->name = #l;                                                      \
         prof->lock = &(s)->l;                                                 \
-        (s)->l = (spinlock_t)_SPIN_LOCK_UNLOCKED(prof);                       \
+        (s)->l = (spinlock_t)_SPIN_LOCK_UNLOCKED(prof, q);                    \
         prof->next = (s)->profile_head.elem_q;                                \
         (s)->profile_head.elem_q = prof;                                      \
     } while(0)
+#define spin_lock_init_prof(s, l) _spin_lock_init_prof(s, l, 0)
+#define spin_lock_init_prof_queued(s, l) _spin_lock_init_prof(s, l, 1)
 
 void _lock_profile_register_struct(
     int32_t, struct lock_profile_qhead *, int32_t, char *);
@@ -117,20 +122,50 @@ extern void spinlock_profile_reset(unsigned char key);
 
 struct lock_profile_qhead { };
 
-#define SPIN_LOCK_UNLOCKED                                                    \
-    { _RAW_SPIN_LOCK_UNLOCKED, 0xfffu, 0, _LOCK_DEBUG }
+#define _SPIN_LOCK_UNLOCKED(q) { .recurse_cpu = 0xfffu, .queued = q,         \
+                                 .debug = _LOCK_DEBUG }
+#define SPIN_LOCK_UNLOCKED _SPIN_LOCK_UNLOCKED(0)
+#define QUEUED_SPIN_LOCK_UNLOCKED _SPIN_LOCK_UNLOCKED(1)
 #define DEFINE_SPINLOCK(l) spinlock_t l = SPIN_LOCK_UNLOCKED
+#define DEFINE_QUEUED_SPINLOCK(l) spinlock_t l = QUEUED_SPIN_LOCK_UNLOCKED
 
 #define spin_lock_init_prof(s, l) spin_lock_init(&((s)->l))
+#define spin_lock_init_prof_queued(s, l) spin_lock_init_queued(&((s)->l))
 #define lock_profile_register_struct(type, ptr, idx, print)
 #define lock_profile_deregister_struct(type, ptr)
 
 #endif
 
+/*
+ * A spinlock is a single 32-bit word, used in one of two ways:
+ *
+ * - As a ticket lock (the default): lockers take a ticket by incrementing
+ *   tail and are served in order as the holder increments head.
+ *
+ * - As a queued lock (spin_lock_init_queued() and friends, see
+ *   common/qspinlock.h): lockers wait on per-CPU queue nodes instead of the
+ *   lock word, and the lock is preferably passed on to waiters on the same
+ *   NUMA node.  Meant for the few locks which are hammered from all over a
+ *   large host; it costs a little more than a ticket lock when uncontended.
+ */
+typedef union {
+    u32 head_tail;
+    struct {
+        u16 head;
+        u16 tail;
+    };
+    struct {
+        u8 locked;      /* held */
+        u8 released;    /* bumped on every release, for spin_barrier() */
+        u16 queue;      /* last waiter in the queue, if any */
+    };
+} spinlock_tickets_t;
+
 typedef struct spinlock {
-    raw_spinlock_t raw;
+    spinlock_tickets_t tickets;
     u16 recurse_cpu:12;
     u16 recurse_cnt:4;
+    bool_t queued;
     struct lock_debug debug;
 #ifdef LOCK_PROFILE
     struct lock_profile *profile;
@@ -139,6 +174,7 @@ typedef struct spinlock {
 
 
 #define spin_lock_init(l) (*(l) = (spinlock_t)SPIN_LOCK_UNLOCKED)
+#define spin_lock_init_queued(l) (*(l) = (spinlock_t)QUEUED_SPIN_LOCK_UNLOCKED)
 
 typedef struct {
     raw_rwlock_t raw;
@@ -41,6 +41,17 @@ static inline bool_t tmem_compression_enabled(void)
     return opt_tmem_compress;
 }
 
+extern bool_t opt_tmem_compress_lz4;
+static inline bool_t tmem_compress_lz4(void)
+{
+    return opt_tmem_compress_lz4;
+}
+
+static inline const char *tmem_compressor(void)
+{
+    return opt_tmem_compress_lz4 ? "lz4" : "lzo";
+}
+
 extern bool_t opt_tmem_dedup;
 static inline bool_t tmem_dedup_enabled(void)
 {
@@ -176,14 +187,17 @@ static inline struct client *tmem_client_from_cli_id(domid_t cli_id)
     return c;
 }
 
-static inline uint8_t tmem_get_first_byte(struct page_info *pfp)
+uint64_t tmem_hash_data(const void *data, size_t len);
+
+/* Hash of the first len bytes of a page, see tmem_tze_pfp_scan(). */
+static inline uint64_t tmem_page_hash(struct page_info *pfp, pagesize_t len)
 {
-    const uint8_t *p = __map_domain_page(pfp);
-    uint8_t byte = p[0];
+    const void *p = __map_domain_page(pfp);
+    uint64_t hash = tmem_hash_data(p, len);
 
     unmap_domain_page(p);
 
-    return byte;
+    return hash;
 }
 
 static inline int tmem_page_cmp(struct page_info *pfp1, struct page_info *pfp2)
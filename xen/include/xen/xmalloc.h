@@ -48,6 +48,39 @@ static inline void *_xzalloc_array(
     return _xzalloc(size * num, align);
 }
 
+/*
+ * Object caches.
+ *
+ * Per-CPU caches of equally sized objects, for allocations hot enough to
+ * deserve their own statistics (see the 'x' debug key).  Objects come from
+ * the xmalloc pools and may also be released with xfree().
+ */
+
+struct xmem_cache;
+
+/**
+ * xmem_cache_create - create a cache of objects of @size bytes
+ * @name: name for the statistics
+ * @align: alignment of each object
+ *
+ * Objects must fit within a page.
+ */
+struct xmem_cache *xmem_cache_create(
+    const char *name, unsigned long size, unsigned long align);
+
+/**
+ * xmem_cache_destroy - destroy a cache
+ *
+ * All objects must have been freed, and nobody may be using the cache.
+ */
+void xmem_cache_destroy(struct xmem_cache *cache);
+
+void *xmem_cache_alloc(struct xmem_cache *cache);
+void xmem_cache_free(struct xmem_cache *cache, void *obj);
+
+#define xmem_cache_create_type(_name, _type) \
+    xmem_cache_create(_name, sizeof(_type), __alignof__(_type))
+
 /*
  * Pooled allocator interface.
  */